@@ -0,0 +1,6 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+void run_benchmark();
+
+#endif // BENCHMARK_H
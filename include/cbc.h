@@ -0,0 +1,9 @@
+#ifndef CBC_H
+#define CBC_H
+
+#include "encrypter.h"
+
+void cbc_encrypt_file(int, int, off_t, unsigned long long, const CIPHER *, const BYTE *, const ENCRYPT_OPTIONS *);
+void cbc_decrypt_file(int, off_t, int, unsigned long long, const CIPHER *, const BYTE *, const ENCRYPT_OPTIONS *);
+
+#endif // CBC_H
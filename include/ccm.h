@@ -0,0 +1,10 @@
+#ifndef CCM_H
+#define CCM_H
+
+#include "encrypter.h"
+
+void ccm_encrypt_file(int, int, unsigned long long, const CIPHER *, const BYTE *, size_t, const ENCRYPT_OPTIONS *);
+bool ccm_decrypt_file(int, int, unsigned long long, const CIPHER *, const BYTE *, size_t, const BYTE *,
+                      const ENCRYPT_OPTIONS *);
+
+#endif // CCM_H
@@ -0,0 +1,24 @@
+#ifndef CIPHER_H
+#define CIPHER_H
+
+#include <stddef.h>
+#include "aes.h"
+#include "blowfish.h"
+
+typedef struct
+{
+    BYTE algorithm; // AES o BLOWFISH
+    int bits;
+    size_t block_size;
+    AES_CTX aes_ctx;
+    BLOWFISH_KEY blowfish_key;
+} CIPHER;
+
+void cipher_setup(CIPHER *, BYTE, const BYTE *, int);
+void cipher_encrypt_buffer(const CIPHER *, const BYTE *, BYTE *, size_t);
+void cipher_decrypt_buffer(const CIPHER *, const BYTE *, BYTE *, size_t);
+void cipher_cbc_encrypt_buffer(const CIPHER *, BYTE *, const BYTE *, BYTE *, size_t);
+void cipher_cbc_decrypt_buffer(const CIPHER *, BYTE *, const BYTE *, BYTE *, size_t);
+void cipher_ctr_buffer(const CIPHER *, const BYTE *, unsigned long long, const BYTE *, BYTE *, size_t);
+
+#endif // CIPHER_H
@@ -0,0 +1,52 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include "encrypter.h"
+#include "merkle.h"
+
+#define CONTAINER_VERSION 2
+#define CONTAINER_HEADER_SIZE 24 // Cabecera extendida que sigue a la cabecera del archivo
+#define CHUNK_ENTRY_SIZE 60      // Entrada del índice: posición, longitud, IV y hoja cifrada
+#define DEFAULT_CHUNK_SIZE MIB
+#define CONTAINER_FLAG_MERKLE 0x01 // A la cabecera extendida le sigue la raíz cifrada del árbol de hashes
+#define CONTAINER_FLAGS CONTAINER_FLAG_MERKLE // Banderas obligatorias en la versión CONTAINER_VERSION
+
+/**
+ * Cabecera extendida del contenedor por fragmentos
+ */
+typedef struct
+{
+    BYTE version;
+    BYTE flags;
+    unsigned int chunk_size;         // Bytes de texto plano por fragmento, múltiplo de AES_BLOCK_SIZE
+    unsigned long long chunks;       // Número de fragmentos
+    unsigned long long index_offset; // Posición del índice dentro del archivo
+} CONTAINER_HEADER;
+
+/**
+ * Entrada del índice de fragmentos
+ */
+typedef struct
+{
+    unsigned long long offset;   // Posición del fragmento cifrado dentro del archivo
+    unsigned int length;         // Bytes de texto plano del fragmento
+    BYTE iv[AES_BLOCK_SIZE];     // IV o nonce propio del fragmento
+    BYTE leaf[MERKLE_HASH_SIZE]; // Hoja del árbol del fragmento, cifrada con la clave del archivo
+} CHUNK_ENTRY;
+
+void store_le(BYTE *, unsigned long long, int);
+unsigned long long load_le(const BYTE *, int);
+size_t chunk_stored_length(BYTE, unsigned int);
+void container_encrypt_file(int, int, const BYTE *, size_t, unsigned long long, const CIPHER *, size_t,
+                            const ENCRYPT_OPTIONS *);
+const char *parse_container_header(const BYTE *, unsigned long long, unsigned long long, CONTAINER_HEADER *);
+bool decode_chunk_entry(const BYTE *, BYTE, unsigned long long, const CONTAINER_HEADER *, unsigned long long,
+                        unsigned long long, CHUNK_ENTRY *);
+unsigned long long read_container_header(int, size_t, unsigned long long, CONTAINER_HEADER *);
+void read_chunk_entry(int, BYTE, unsigned long long, const CONTAINER_HEADER *, unsigned long long, CHUNK_ENTRY *);
+CHUNK_ENTRY *read_container(int, size_t, BYTE, unsigned long long, CONTAINER_HEADER *);
+bool container_decrypt_chunk(const CIPHER *, BYTE, const CONTAINER_HEADER *, unsigned long long, const CHUNK_ENTRY *,
+                             BYTE *, BYTE *);
+bool container_decrypt_file(int, int, size_t, BYTE, unsigned long long, const CIPHER *, const ENCRYPT_OPTIONS *);
+
+#endif // CONTAINER_H
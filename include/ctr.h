@@ -0,0 +1,8 @@
+#ifndef CTR_H
+#define CTR_H
+
+#include "encrypter.h"
+
+void ctr_crypt_file(int, off_t, int, off_t, unsigned long long, const CIPHER *, const BYTE *, const ENCRYPT_OPTIONS *);
+
+#endif // CTR_H
@@ -0,0 +1,29 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sha256.h"
+
+#define DIGEST_EXTENSION ".sha256"
+#define DIGEST_SLICE_SIZE (256 * 1024) // Bytes que se hashean y encriptan juntos en los archivos mapeados
+
+/**
+ * Hash SHA-256 del texto plano que se calcula mientras se encripta. Los hilos añaden sus
+ * fragmentos en orden, cada uno cuando le llega el turno
+ */
+typedef struct
+{
+    SHA256_CTX ctx;
+    unsigned long long next_chunk; // Siguiente fragmento que se añade al hash
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+} FILE_DIGEST;
+
+void digest_init(FILE_DIGEST *);
+void digest_chunk(FILE_DIGEST *, unsigned long long, const BYTE *, size_t);
+void digest_final(FILE_DIGEST *, BYTE *);
+bool write_digest_file(const char *, FILE_DIGEST *);
+
+#endif // DIGEST_H
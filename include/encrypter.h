@@ -14,19 +14,86 @@
 #include "sha256.h"
 #include "aes.h"
 #include "blowfish.h"
+#include "cipher.h"
+#include "io.h"
+#include "digest.h"
 
 #define AES 0x10
 #define BLOWFISH 0x20
+#define CTR 0x40
+#define CBC 0x80
+#define AEAD 0xC0      // Los dos bits del modo a la vez: modo autenticado, indicado por AEAD_ID
+#define MODE_MASK 0xC0 // Bits del modo: ninguno para ecb, CTR, CBC o AEAD
 #define KEY_128 0x01
 #define KEY_192 0x02
 #define KEY_256 0x04
+#define CHUNKED 0x08
+
+#define HEADER_SIZE 9
+// El bit más alto del tamaño, que ningún archivo alcanza, indica que a la cabecera le
+// siguen los parámetros de PBKDF2. Sin él la clave es el SHA-256 de la frase
+#define KDF_FLAG 0x80 // En el último byte del tamaño
+#define KDF_ITERATIONS_SIZE 4 // Iteraciones de PBKDF2, Little Endian
+#define KDF_SALT_SIZE 16
+#define KDF_CHECK_SIZE 8 // Valor de comprobación de la clave, para rechazar una frase incorrecta
+#define KDF_PARAMS_SIZE (KDF_ITERATIONS_SIZE + KDF_SALT_SIZE + KDF_CHECK_SIZE)
+// El segundo bit más alto del tamaño indica que a los parámetros de PBKDF2 les sigue la
+// raíz cifrada del árbol de hashes del texto cifrado. Sólo lo llevan los archivos ecb, ctr
+// y cbc sin fragmentos: los contenedores guardan su propia raíz y gcm y ccm su etiqueta
+#define ROOT_FLAG 0x40 // En el último byte del tamaño
+#define ROOT_SIZE SHA256_BLOCK_SIZE
+#define MAX_HEADER_SIZE (HEADER_SIZE + KDF_PARAMS_SIZE + ROOT_SIZE)
+#define CTR_NONCE_SIZE AES_BLOCK_SIZE // Un bloque del cifrado: con Blowfish ocupa BLOWFISH_BLOCK_SIZE bytes
+#define CBC_IV_SIZE AES_BLOCK_SIZE
+
+// En los modos autenticados la cabecera va seguida de un byte que indica el modo
+#define AEAD_ID_SIZE 1
+#define AEAD_GCM 0x01
+#define AEAD_CCM 0x02
+
+#define GCM_IV_SIZE AES_GCM_IV_SIZE
+#define GCM_TAG_SIZE AES_GCM_TAG_SIZE
+#define GCM_PREFIX_SIZE(header_size) ((header_size) + AEAD_ID_SIZE + GCM_IV_SIZE) // Cabecera, modo e IV
+#define CCM_NONCE_SIZE 8 // Deja 7 bytes para la longitud del mensaje
+#define CCM_MAC_SIZE 16
+#define CCM_ASSOC_SIZE(header_size) ((header_size) + AEAD_ID_SIZE)                  // Cabecera y modo
+#define CCM_PREFIX_SIZE(header_size) (CCM_ASSOC_SIZE(header_size) + CCM_NONCE_SIZE) // Cabecera, modo y nonce
+
+typedef struct
+{
+    size_t buffer_size; // Tamaño de los buffers de lectura y escritura en bytes
+    bool use_mmap;      // Mapear los archivos en memoria en lugar de usar buffers
+    int threads;        // Hilos que procesan el archivo en modo ctr y gcm y al desencriptar en modo cbc
+    size_t chunk_size;  // Bytes por fragmento del contenedor por fragmentos, 0 para no usarlo
+    FILE_DIGEST *digest; // Hash del texto plano que se calcula al encriptar, o NULL
+    unsigned int kdf_ms; // Tiempo que debe tardar PBKDF2 al encriptar, en milisegundos
+} ENCRYPT_OPTIONS;
+
+typedef struct
+{
+    unsigned long long size; // Tamaño del archivo original
+    BYTE mask;
+    int bits;
+    BYTE algorithm; // AES o BLOWFISH
+    size_t header_size;      // HEADER_SIZE, más KDF_PARAMS_SIZE y ROOT_SIZE si los tiene
+    BYTE flags;              // Bits KDF_FLAG y ROOT_FLAG del último byte del tamaño
+    unsigned int iterations; // Iteraciones de PBKDF2, 0 si la clave es el SHA-256 de la frase
+    BYTE salt[KDF_SALT_SIZE];
+    BYTE check[KDF_CHECK_SIZE]; // Valor de comprobación de la clave derivada
+    BYTE root[ROOT_SIZE];       // Raíz cifrada del árbol de hashes, si tiene ROOT_FLAG
+} FILE_HEADER;
 
 bool is_valid_bit(int);
 bool is_valid_algorithm(char *);
+bool is_valid_mode(char *);
 
 int generate_key_sha256(char *, BYTE *, int);
+const char *parse_header(const BYTE *, FILE_HEADER *);
+const char *parse_kdf_params(const BYTE *, FILE_HEADER *);
+const char *parse_header_params(const BYTE *, FILE_HEADER *);
+void read_header(int, FILE_HEADER *);
 
-void encrypt_file(char *, int, char *, char *);
-void decrypt_file(char *, char *);
+void encrypt_file(char *, char *, int, char *, char *, const ENCRYPT_OPTIONS *);
+void decrypt_file(char *, char *, const ENCRYPT_OPTIONS *);
 
 #endif // ENCRYPTER_H
\ No newline at end of file
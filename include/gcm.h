@@ -0,0 +1,10 @@
+#ifndef GCM_H
+#define GCM_H
+
+#include "encrypter.h"
+
+void gcm_encrypt_file(int, int, off_t, unsigned long long, const CIPHER *, const BYTE *, const ENCRYPT_OPTIONS *);
+bool gcm_decrypt_file(int, off_t, int, unsigned long long, const CIPHER *, const BYTE *, const BYTE *,
+                      const ENCRYPT_OPTIONS *);
+
+#endif // GCM_H
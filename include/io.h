@@ -0,0 +1,28 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdbool.h>
+#include <unistd.h>
+#include "aes.h"
+
+#define MIB (1024 * 1024)
+#define DEFAULT_BUFFER_SIZE (4 * MIB)
+
+ssize_t read_full(int, BYTE *, size_t);
+bool write_full(int, const BYTE *, size_t);
+ssize_t pread_full(int, BYTE *, size_t, off_t);
+bool pwrite_full(int, const BYTE *, size_t, off_t);
+bool fill_random(BYTE *, size_t);
+
+BYTE *allocate_io_buffer(size_t *, size_t);
+
+bool reserve_output_file(int, off_t);
+
+BYTE *map_input_file(int, size_t);
+BYTE *map_output_file(int, size_t);
+void unmap_file(BYTE *, size_t);
+
+void remove_output_on_exit(const char *);
+void keep_output_file();
+
+#endif // IO_H
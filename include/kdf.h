@@ -0,0 +1,19 @@
+#ifndef KDF_H
+#define KDF_H
+
+#include "encrypter.h"
+
+#define KDF_DEFAULT_MS 100              // Tiempo objetivo de PBKDF2 por defecto
+#define KDF_MIN_ITERATIONS 10000        // Mínimo aunque la calibración dé menos
+#define KDF_MAX_ITERATIONS 100000000    // Máximo al encriptar y al leer la cabecera
+#define KDF_CALIBRATION_MIN_SECONDS 0.01 // Duración mínima de la medición
+#define KDF_CHECK_LABEL "file-encrypter key check" // Mensaje del HMAC de comprobación
+
+unsigned int kdf_calibrate(unsigned int);
+bool kdf_setup(FILE_HEADER *, unsigned int);
+void store_kdf_params(BYTE *, const FILE_HEADER *);
+void derive_key(const char *, const FILE_HEADER *, BYTE *);
+void key_check_value(const BYTE *, int, BYTE *);
+bool check_key(const FILE_HEADER *, const BYTE *);
+
+#endif // KDF_H
@@ -0,0 +1,15 @@
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include "encrypter.h"
+
+#define MERKLE_HASH_SIZE SHA256_BLOCK_SIZE
+#define MERKLE_LEAF 0x00 // Prefijo de las hojas, para distinguirlas de los nodos internos
+#define MERKLE_NODE 0x01 // Prefijo de los nodos internos
+#define MERKLE_FILE_LEAF_SIZE MIB // Bytes cifrados por hoja del árbol de un archivo sin fragmentos
+
+void merkle_leaf(const BYTE *, size_t, const BYTE *, size_t, BYTE *);
+void merkle_root(BYTE *, unsigned long long, BYTE *);
+void merkle_file_root(int, const BYTE *, size_t, off_t, unsigned long long, int, BYTE *);
+
+#endif // MERKLE_H
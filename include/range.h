@@ -0,0 +1,9 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include "encrypter.h"
+
+bool parse_range(const char *, unsigned long long *, unsigned long long *);
+void decrypt_range(char *, char *, unsigned long long, unsigned long long, char *, const ENCRYPT_OPTIONS *);
+
+#endif // RANGE_H
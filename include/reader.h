@@ -0,0 +1,23 @@
+#ifndef READER_H
+#define READER_H
+
+#include <sys/types.h>
+#include "aes.h"
+
+#define READER_CHUNK_SIZE (64 * 1024)      // Bytes por fragmento en los archivos sin fragmentos
+#define READER_CACHE_SIZE (16 * 1024 * 1024) // Bytes de fragmentos desencriptados en caché
+
+/**
+ * Lector de acceso aleatorio sobre un archivo encriptado. Sirve lecturas arbitrarias
+ * desencriptando sólo los fragmentos que necesita y guarda los últimos usados en una
+ * caché LRU. El key schedule se calcula una sola vez al abrirlo. Se puede usar desde
+ * varios hilos a la vez
+ */
+typedef struct ENC_READER ENC_READER;
+
+ENC_READER *enc_reader_open(const char *, const char *);
+ssize_t enc_pread(ENC_READER *, void *, size_t, unsigned long long);
+unsigned long long enc_reader_size(const ENC_READER *);
+void enc_reader_close(ENC_READER *);
+
+#endif // READER_H
@@ -0,0 +1,32 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "encrypter.h"
+
+#define STREAM_CHUNK_SIZE_SIZE 4   // Bytes de texto plano por fragmento, Little Endian
+#define STREAM_NONCE_PREFIX_SIZE 7 // Parte aleatoria del IV de cada fragmento
+#define STREAM_PREFIX_SIZE(header_size) ((header_size) + AEAD_ID_SIZE + STREAM_CHUNK_SIZE_SIZE + STREAM_NONCE_PREFIX_SIZE)
+#define STREAM_MAX_CHUNKS 0x100000000ULL // El índice del fragmento ocupa 32 bits del IV
+
+/**
+ * Parámetros de un archivo autenticado por fragmentos, comunes a todos sus fragmentos
+ */
+typedef struct
+{
+    AES_GCM_CTX gcm;
+    BYTE prefix[STREAM_PREFIX_SIZE(MAX_HEADER_SIZE)]; // Cabecera, modo, tamaño de fragmento y prefijo del nonce
+    size_t prefix_size;                               // STREAM_PREFIX_SIZE según el tamaño de la cabecera
+    unsigned long long size;                          // Tamaño del archivo original
+    size_t chunk_size;                                // Bytes de texto plano por fragmento
+    unsigned long long chunks;
+} STREAM_FILE;
+
+size_t stream_chunk_length(const STREAM_FILE *, unsigned long long);
+off_t stream_chunk_offset(const STREAM_FILE *, unsigned long long);
+const char *stream_read_prefix(int, size_t, unsigned long long, const CIPHER *, STREAM_FILE *);
+bool stream_decrypt_chunk(const STREAM_FILE *, unsigned long long, BYTE *);
+void stream_encrypt_file(int, int, const BYTE *, size_t, unsigned long long, const CIPHER *, size_t,
+                         const ENCRYPT_OPTIONS *);
+bool stream_decrypt_file(int, int, size_t, unsigned long long, const CIPHER *, const ENCRYPT_OPTIONS *);
+
+#endif // STREAM_H
@@ -0,0 +1,19 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stddef.h>
+#include "aes.h"
+
+/**
+ * Tarea ejecutada por los hilos sobre un fragmento del archivo
+ *
+ * @param context Datos compartidos por todos los hilos
+ * @param chunk Índice del fragmento a procesar
+ * @param buffer Buffer propio del hilo, o NULL si no se pidió
+ */
+typedef void (*WORKER_TASK)(void *context, unsigned long long chunk, BYTE *buffer);
+
+int default_thread_count();
+void run_workers(int, unsigned long long, size_t, WORKER_TASK, void *);
+
+#endif // WORKERS_H
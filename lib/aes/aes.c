@@ -4,7 +4,7 @@
 * Copyright:
 * Disclaimer: This code is presented "as is" without any guarantees.
 * Details:    This code is the implementation of the AES algorithm and
-              the CTR, CBC, and CCM modes of operation it can be used in.
+              the CTR, CBC, CCM, and GCM modes of operation it can be used in.
                AES is, specified by the NIST in in publication FIPS PUB 197,
               availible at:
                * http://csrc.nist.gov/publications/fips/fips197/fips-197.pdf .
@@ -13,6 +13,8 @@
                * http://csrc.nist.gov/publications/nistpubs/800-38a/sp800-38a.pdf .
               The CCM mode of operation is specified by NIST SP80-38 C, available at:
                * http://csrc.nist.gov/publications/nistpubs/800-38C/SP800-38C_updated-July20_2007.pdf
+              The GCM mode of operation is specified by NIST SP 800-38 D, available at:
+               * http://csrc.nist.gov/publications/nistpubs/800-38D/SP-800-38D.pdf
 *********************************************************************/
 
 /*************************** HEADER FILES ***************************/
@@ -22,10 +24,28 @@
 
 #include <stdio.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define AES_X86
+#include <immintrin.h>
+#endif
+
 /****************************** MACROS ******************************/
 // The least significant byte of the word is rotated to the end.
 #define KE_ROTWORD(x) (((x) << 8) | ((x) >> 24))
 
+// Byte access to the S-Boxes with a single 8-bit index.
+#define SBOX(x) (aes_sbox[((x) >> 4) & 0x0F][(x) & 0x0F])
+#define INV_SBOX(x) (aes_invsbox[((x) >> 4) & 0x0F][(x) & 0x0F])
+
+// Big endian load/store of a state column, the same layout the key schedule uses.
+#define GET_WORD(p) (((WORD)(p)[0] << 24) | ((WORD)(p)[1] << 16) | ((WORD)(p)[2] << 8) | ((WORD)(p)[3]))
+#define PUT_WORD(p,w) { (p)[0] = (BYTE)((w) >> 24); (p)[1] = (BYTE)((w) >> 16); \
+                        (p)[2] = (BYTE)((w) >> 8); (p)[3] = (BYTE)(w); }
+
+// xtime() on the four bytes of a column at once.
+#define XTIME_WORD(w) ((((w) & 0x7f7f7f7f) << 1) ^ ((((w) >> 7) & 0x01010101) * 0x1b))
+#define ROTL_WORD(w,n) (((w) << (n)) | ((w) >> (32 - (n))))
+
 #define TRUE  1
 #define FALSE 0
 
@@ -34,11 +54,26 @@
 #define AES_192_ROUNDS 12
 #define AES_256_ROUNDS 14
 
+typedef void (*AES_BLOCK_FUNC)(const BYTE in[], BYTE out[], const WORD key[], int keysize);
+typedef void (*AES_KEY_SETUP_FUNC)(const BYTE key[], WORD w[], int keysize);
+typedef void (*AES_ECB_FUNC)(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx);
+typedef void (*AES_CHAIN_FUNC)(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[]);
+typedef void (*AES_CCM_FUNC)(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[], BYTE mac[], int decrypt);
+
+// The kernels are written once with the round count as a parameter and forced inline
+// into a wrapper that calls them with a constant for each key size. Every key size then
+// gets its own copy of the loop with the rounds unrolled and no per-block branches.
+#define AES_SPECIALIZED static inline __attribute__((always_inline))
+#define AES_SPECIALIZE_ROUNDS(keysize, kernel, ...) \
+	switch (keysize) { \
+		case 128: kernel(__VA_ARGS__, AES_128_ROUNDS); break; \
+		case 192: kernel(__VA_ARGS__, AES_192_ROUNDS); break; \
+		default:  kernel(__VA_ARGS__, AES_256_ROUNDS); break; \
+	}
+
 /*********************** FUNCTION DECLARATIONS **********************/
-void ccm_prepare_first_ctr_blk(BYTE counter[], const BYTE nonce[], int nonce_len, int payload_len_store_size);
-void ccm_prepare_first_format_blk(BYTE buf[], int assoc_len, int payload_len, int payload_len_store_size, int mac_len, const BYTE nonce[], int nonce_len);
-void ccm_format_assoc_data(BYTE buf[], int *end_of_buf, const BYTE assoc[], int assoc_len);
-void ccm_format_payload_data(BYTE buf[], int *end_of_buf, const BYTE payload[], int payload_len);
+static void aes_ccm_generic(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[], BYTE mac[], int decrypt);
+static void aes_ccm_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[], BYTE mac[], int decrypt);
 
 /**************************** VARIABLES *****************************/
 // This is the specified AES SBox. To look up a substitution value, put the first
@@ -218,6 +253,293 @@ static const BYTE gf_mul[256][6] = {
 	{0xe7,0x19,0x4f,0xa8,0x9a,0x83},{0xe5,0x1a,0x46,0xa3,0x97,0x8d}
 };
 
+// These are the encryption T-tables. Each entry merges SubBytes and MixColumns for one
+// byte of a column: aes_te0[x] holds the column {02,01,01,03}*S[x] as a big endian word
+// and aes_te1..aes_te3 are the same words rotated right by 8, 16 and 24 bits, so the
+// ShiftRows step becomes a choice of which state word each byte is taken from.
+static const WORD aes_te0[256] = {
+	0xc66363a5,0xf87c7c84,0xee777799,0xf67b7b8d,0xfff2f20d,0xd66b6bbd,0xde6f6fb1,0x91c5c554,
+	0x60303050,0x02010103,0xce6767a9,0x562b2b7d,0xe7fefe19,0xb5d7d762,0x4dababe6,0xec76769a,
+	0x8fcaca45,0x1f82829d,0x89c9c940,0xfa7d7d87,0xeffafa15,0xb25959eb,0x8e4747c9,0xfbf0f00b,
+	0x41adadec,0xb3d4d467,0x5fa2a2fd,0x45afafea,0x239c9cbf,0x53a4a4f7,0xe4727296,0x9bc0c05b,
+	0x75b7b7c2,0xe1fdfd1c,0x3d9393ae,0x4c26266a,0x6c36365a,0x7e3f3f41,0xf5f7f702,0x83cccc4f,
+	0x6834345c,0x51a5a5f4,0xd1e5e534,0xf9f1f108,0xe2717193,0xabd8d873,0x62313153,0x2a15153f,
+	0x0804040c,0x95c7c752,0x46232365,0x9dc3c35e,0x30181828,0x379696a1,0x0a05050f,0x2f9a9ab5,
+	0x0e070709,0x24121236,0x1b80809b,0xdfe2e23d,0xcdebeb26,0x4e272769,0x7fb2b2cd,0xea75759f,
+	0x1209091b,0x1d83839e,0x582c2c74,0x341a1a2e,0x361b1b2d,0xdc6e6eb2,0xb45a5aee,0x5ba0a0fb,
+	0xa45252f6,0x763b3b4d,0xb7d6d661,0x7db3b3ce,0x5229297b,0xdde3e33e,0x5e2f2f71,0x13848497,
+	0xa65353f5,0xb9d1d168,0x00000000,0xc1eded2c,0x40202060,0xe3fcfc1f,0x79b1b1c8,0xb65b5bed,
+	0xd46a6abe,0x8dcbcb46,0x67bebed9,0x7239394b,0x944a4ade,0x984c4cd4,0xb05858e8,0x85cfcf4a,
+	0xbbd0d06b,0xc5efef2a,0x4faaaae5,0xedfbfb16,0x864343c5,0x9a4d4dd7,0x66333355,0x11858594,
+	0x8a4545cf,0xe9f9f910,0x04020206,0xfe7f7f81,0xa05050f0,0x783c3c44,0x259f9fba,0x4ba8a8e3,
+	0xa25151f3,0x5da3a3fe,0x804040c0,0x058f8f8a,0x3f9292ad,0x219d9dbc,0x70383848,0xf1f5f504,
+	0x63bcbcdf,0x77b6b6c1,0xafdada75,0x42212163,0x20101030,0xe5ffff1a,0xfdf3f30e,0xbfd2d26d,
+	0x81cdcd4c,0x180c0c14,0x26131335,0xc3ecec2f,0xbe5f5fe1,0x359797a2,0x884444cc,0x2e171739,
+	0x93c4c457,0x55a7a7f2,0xfc7e7e82,0x7a3d3d47,0xc86464ac,0xba5d5de7,0x3219192b,0xe6737395,
+	0xc06060a0,0x19818198,0x9e4f4fd1,0xa3dcdc7f,0x44222266,0x542a2a7e,0x3b9090ab,0x0b888883,
+	0x8c4646ca,0xc7eeee29,0x6bb8b8d3,0x2814143c,0xa7dede79,0xbc5e5ee2,0x160b0b1d,0xaddbdb76,
+	0xdbe0e03b,0x64323256,0x743a3a4e,0x140a0a1e,0x924949db,0x0c06060a,0x4824246c,0xb85c5ce4,
+	0x9fc2c25d,0xbdd3d36e,0x43acacef,0xc46262a6,0x399191a8,0x319595a4,0xd3e4e437,0xf279798b,
+	0xd5e7e732,0x8bc8c843,0x6e373759,0xda6d6db7,0x018d8d8c,0xb1d5d564,0x9c4e4ed2,0x49a9a9e0,
+	0xd86c6cb4,0xac5656fa,0xf3f4f407,0xcfeaea25,0xca6565af,0xf47a7a8e,0x47aeaee9,0x10080818,
+	0x6fbabad5,0xf0787888,0x4a25256f,0x5c2e2e72,0x381c1c24,0x57a6a6f1,0x73b4b4c7,0x97c6c651,
+	0xcbe8e823,0xa1dddd7c,0xe874749c,0x3e1f1f21,0x964b4bdd,0x61bdbddc,0x0d8b8b86,0x0f8a8a85,
+	0xe0707090,0x7c3e3e42,0x71b5b5c4,0xcc6666aa,0x904848d8,0x06030305,0xf7f6f601,0x1c0e0e12,
+	0xc26161a3,0x6a35355f,0xae5757f9,0x69b9b9d0,0x17868691,0x99c1c158,0x3a1d1d27,0x279e9eb9,
+	0xd9e1e138,0xebf8f813,0x2b9898b3,0x22111133,0xd26969bb,0xa9d9d970,0x078e8e89,0x339494a7,
+	0x2d9b9bb6,0x3c1e1e22,0x15878792,0xc9e9e920,0x87cece49,0xaa5555ff,0x50282878,0xa5dfdf7a,
+	0x038c8c8f,0x59a1a1f8,0x09898980,0x1a0d0d17,0x65bfbfda,0xd7e6e631,0x844242c6,0xd06868b8,
+	0x824141c3,0x299999b0,0x5a2d2d77,0x1e0f0f11,0x7bb0b0cb,0xa85454fc,0x6dbbbbd6,0x2c16163a
+};
+
+static const WORD aes_te1[256] = {
+	0xa5c66363,0x84f87c7c,0x99ee7777,0x8df67b7b,0x0dfff2f2,0xbdd66b6b,0xb1de6f6f,0x5491c5c5,
+	0x50603030,0x03020101,0xa9ce6767,0x7d562b2b,0x19e7fefe,0x62b5d7d7,0xe64dabab,0x9aec7676,
+	0x458fcaca,0x9d1f8282,0x4089c9c9,0x87fa7d7d,0x15effafa,0xebb25959,0xc98e4747,0x0bfbf0f0,
+	0xec41adad,0x67b3d4d4,0xfd5fa2a2,0xea45afaf,0xbf239c9c,0xf753a4a4,0x96e47272,0x5b9bc0c0,
+	0xc275b7b7,0x1ce1fdfd,0xae3d9393,0x6a4c2626,0x5a6c3636,0x417e3f3f,0x02f5f7f7,0x4f83cccc,
+	0x5c683434,0xf451a5a5,0x34d1e5e5,0x08f9f1f1,0x93e27171,0x73abd8d8,0x53623131,0x3f2a1515,
+	0x0c080404,0x5295c7c7,0x65462323,0x5e9dc3c3,0x28301818,0xa1379696,0x0f0a0505,0xb52f9a9a,
+	0x090e0707,0x36241212,0x9b1b8080,0x3ddfe2e2,0x26cdebeb,0x694e2727,0xcd7fb2b2,0x9fea7575,
+	0x1b120909,0x9e1d8383,0x74582c2c,0x2e341a1a,0x2d361b1b,0xb2dc6e6e,0xeeb45a5a,0xfb5ba0a0,
+	0xf6a45252,0x4d763b3b,0x61b7d6d6,0xce7db3b3,0x7b522929,0x3edde3e3,0x715e2f2f,0x97138484,
+	0xf5a65353,0x68b9d1d1,0x00000000,0x2cc1eded,0x60402020,0x1fe3fcfc,0xc879b1b1,0xedb65b5b,
+	0xbed46a6a,0x468dcbcb,0xd967bebe,0x4b723939,0xde944a4a,0xd4984c4c,0xe8b05858,0x4a85cfcf,
+	0x6bbbd0d0,0x2ac5efef,0xe54faaaa,0x16edfbfb,0xc5864343,0xd79a4d4d,0x55663333,0x94118585,
+	0xcf8a4545,0x10e9f9f9,0x06040202,0x81fe7f7f,0xf0a05050,0x44783c3c,0xba259f9f,0xe34ba8a8,
+	0xf3a25151,0xfe5da3a3,0xc0804040,0x8a058f8f,0xad3f9292,0xbc219d9d,0x48703838,0x04f1f5f5,
+	0xdf63bcbc,0xc177b6b6,0x75afdada,0x63422121,0x30201010,0x1ae5ffff,0x0efdf3f3,0x6dbfd2d2,
+	0x4c81cdcd,0x14180c0c,0x35261313,0x2fc3ecec,0xe1be5f5f,0xa2359797,0xcc884444,0x392e1717,
+	0x5793c4c4,0xf255a7a7,0x82fc7e7e,0x477a3d3d,0xacc86464,0xe7ba5d5d,0x2b321919,0x95e67373,
+	0xa0c06060,0x98198181,0xd19e4f4f,0x7fa3dcdc,0x66442222,0x7e542a2a,0xab3b9090,0x830b8888,
+	0xca8c4646,0x29c7eeee,0xd36bb8b8,0x3c281414,0x79a7dede,0xe2bc5e5e,0x1d160b0b,0x76addbdb,
+	0x3bdbe0e0,0x56643232,0x4e743a3a,0x1e140a0a,0xdb924949,0x0a0c0606,0x6c482424,0xe4b85c5c,
+	0x5d9fc2c2,0x6ebdd3d3,0xef43acac,0xa6c46262,0xa8399191,0xa4319595,0x37d3e4e4,0x8bf27979,
+	0x32d5e7e7,0x438bc8c8,0x596e3737,0xb7da6d6d,0x8c018d8d,0x64b1d5d5,0xd29c4e4e,0xe049a9a9,
+	0xb4d86c6c,0xfaac5656,0x07f3f4f4,0x25cfeaea,0xafca6565,0x8ef47a7a,0xe947aeae,0x18100808,
+	0xd56fbaba,0x88f07878,0x6f4a2525,0x725c2e2e,0x24381c1c,0xf157a6a6,0xc773b4b4,0x5197c6c6,
+	0x23cbe8e8,0x7ca1dddd,0x9ce87474,0x213e1f1f,0xdd964b4b,0xdc61bdbd,0x860d8b8b,0x850f8a8a,
+	0x90e07070,0x427c3e3e,0xc471b5b5,0xaacc6666,0xd8904848,0x05060303,0x01f7f6f6,0x121c0e0e,
+	0xa3c26161,0x5f6a3535,0xf9ae5757,0xd069b9b9,0x91178686,0x5899c1c1,0x273a1d1d,0xb9279e9e,
+	0x38d9e1e1,0x13ebf8f8,0xb32b9898,0x33221111,0xbbd26969,0x70a9d9d9,0x89078e8e,0xa7339494,
+	0xb62d9b9b,0x223c1e1e,0x92158787,0x20c9e9e9,0x4987cece,0xffaa5555,0x78502828,0x7aa5dfdf,
+	0x8f038c8c,0xf859a1a1,0x80098989,0x171a0d0d,0xda65bfbf,0x31d7e6e6,0xc6844242,0xb8d06868,
+	0xc3824141,0xb0299999,0x775a2d2d,0x111e0f0f,0xcb7bb0b0,0xfca85454,0xd66dbbbb,0x3a2c1616
+};
+
+static const WORD aes_te2[256] = {
+	0x63a5c663,0x7c84f87c,0x7799ee77,0x7b8df67b,0xf20dfff2,0x6bbdd66b,0x6fb1de6f,0xc55491c5,
+	0x30506030,0x01030201,0x67a9ce67,0x2b7d562b,0xfe19e7fe,0xd762b5d7,0xabe64dab,0x769aec76,
+	0xca458fca,0x829d1f82,0xc94089c9,0x7d87fa7d,0xfa15effa,0x59ebb259,0x47c98e47,0xf00bfbf0,
+	0xadec41ad,0xd467b3d4,0xa2fd5fa2,0xafea45af,0x9cbf239c,0xa4f753a4,0x7296e472,0xc05b9bc0,
+	0xb7c275b7,0xfd1ce1fd,0x93ae3d93,0x266a4c26,0x365a6c36,0x3f417e3f,0xf702f5f7,0xcc4f83cc,
+	0x345c6834,0xa5f451a5,0xe534d1e5,0xf108f9f1,0x7193e271,0xd873abd8,0x31536231,0x153f2a15,
+	0x040c0804,0xc75295c7,0x23654623,0xc35e9dc3,0x18283018,0x96a13796,0x050f0a05,0x9ab52f9a,
+	0x07090e07,0x12362412,0x809b1b80,0xe23ddfe2,0xeb26cdeb,0x27694e27,0xb2cd7fb2,0x759fea75,
+	0x091b1209,0x839e1d83,0x2c74582c,0x1a2e341a,0x1b2d361b,0x6eb2dc6e,0x5aeeb45a,0xa0fb5ba0,
+	0x52f6a452,0x3b4d763b,0xd661b7d6,0xb3ce7db3,0x297b5229,0xe33edde3,0x2f715e2f,0x84971384,
+	0x53f5a653,0xd168b9d1,0x00000000,0xed2cc1ed,0x20604020,0xfc1fe3fc,0xb1c879b1,0x5bedb65b,
+	0x6abed46a,0xcb468dcb,0xbed967be,0x394b7239,0x4ade944a,0x4cd4984c,0x58e8b058,0xcf4a85cf,
+	0xd06bbbd0,0xef2ac5ef,0xaae54faa,0xfb16edfb,0x43c58643,0x4dd79a4d,0x33556633,0x85941185,
+	0x45cf8a45,0xf910e9f9,0x02060402,0x7f81fe7f,0x50f0a050,0x3c44783c,0x9fba259f,0xa8e34ba8,
+	0x51f3a251,0xa3fe5da3,0x40c08040,0x8f8a058f,0x92ad3f92,0x9dbc219d,0x38487038,0xf504f1f5,
+	0xbcdf63bc,0xb6c177b6,0xda75afda,0x21634221,0x10302010,0xff1ae5ff,0xf30efdf3,0xd26dbfd2,
+	0xcd4c81cd,0x0c14180c,0x13352613,0xec2fc3ec,0x5fe1be5f,0x97a23597,0x44cc8844,0x17392e17,
+	0xc45793c4,0xa7f255a7,0x7e82fc7e,0x3d477a3d,0x64acc864,0x5de7ba5d,0x192b3219,0x7395e673,
+	0x60a0c060,0x81981981,0x4fd19e4f,0xdc7fa3dc,0x22664422,0x2a7e542a,0x90ab3b90,0x88830b88,
+	0x46ca8c46,0xee29c7ee,0xb8d36bb8,0x143c2814,0xde79a7de,0x5ee2bc5e,0x0b1d160b,0xdb76addb,
+	0xe03bdbe0,0x32566432,0x3a4e743a,0x0a1e140a,0x49db9249,0x060a0c06,0x246c4824,0x5ce4b85c,
+	0xc25d9fc2,0xd36ebdd3,0xacef43ac,0x62a6c462,0x91a83991,0x95a43195,0xe437d3e4,0x798bf279,
+	0xe732d5e7,0xc8438bc8,0x37596e37,0x6db7da6d,0x8d8c018d,0xd564b1d5,0x4ed29c4e,0xa9e049a9,
+	0x6cb4d86c,0x56faac56,0xf407f3f4,0xea25cfea,0x65afca65,0x7a8ef47a,0xaee947ae,0x08181008,
+	0xbad56fba,0x7888f078,0x256f4a25,0x2e725c2e,0x1c24381c,0xa6f157a6,0xb4c773b4,0xc65197c6,
+	0xe823cbe8,0xdd7ca1dd,0x749ce874,0x1f213e1f,0x4bdd964b,0xbddc61bd,0x8b860d8b,0x8a850f8a,
+	0x7090e070,0x3e427c3e,0xb5c471b5,0x66aacc66,0x48d89048,0x03050603,0xf601f7f6,0x0e121c0e,
+	0x61a3c261,0x355f6a35,0x57f9ae57,0xb9d069b9,0x86911786,0xc15899c1,0x1d273a1d,0x9eb9279e,
+	0xe138d9e1,0xf813ebf8,0x98b32b98,0x11332211,0x69bbd269,0xd970a9d9,0x8e89078e,0x94a73394,
+	0x9bb62d9b,0x1e223c1e,0x87921587,0xe920c9e9,0xce4987ce,0x55ffaa55,0x28785028,0xdf7aa5df,
+	0x8c8f038c,0xa1f859a1,0x89800989,0x0d171a0d,0xbfda65bf,0xe631d7e6,0x42c68442,0x68b8d068,
+	0x41c38241,0x99b02999,0x2d775a2d,0x0f111e0f,0xb0cb7bb0,0x54fca854,0xbbd66dbb,0x163a2c16
+};
+
+static const WORD aes_te3[256] = {
+	0x6363a5c6,0x7c7c84f8,0x777799ee,0x7b7b8df6,0xf2f20dff,0x6b6bbdd6,0x6f6fb1de,0xc5c55491,
+	0x30305060,0x01010302,0x6767a9ce,0x2b2b7d56,0xfefe19e7,0xd7d762b5,0xababe64d,0x76769aec,
+	0xcaca458f,0x82829d1f,0xc9c94089,0x7d7d87fa,0xfafa15ef,0x5959ebb2,0x4747c98e,0xf0f00bfb,
+	0xadadec41,0xd4d467b3,0xa2a2fd5f,0xafafea45,0x9c9cbf23,0xa4a4f753,0x727296e4,0xc0c05b9b,
+	0xb7b7c275,0xfdfd1ce1,0x9393ae3d,0x26266a4c,0x36365a6c,0x3f3f417e,0xf7f702f5,0xcccc4f83,
+	0x34345c68,0xa5a5f451,0xe5e534d1,0xf1f108f9,0x717193e2,0xd8d873ab,0x31315362,0x15153f2a,
+	0x04040c08,0xc7c75295,0x23236546,0xc3c35e9d,0x18182830,0x9696a137,0x05050f0a,0x9a9ab52f,
+	0x0707090e,0x12123624,0x80809b1b,0xe2e23ddf,0xebeb26cd,0x2727694e,0xb2b2cd7f,0x75759fea,
+	0x09091b12,0x83839e1d,0x2c2c7458,0x1a1a2e34,0x1b1b2d36,0x6e6eb2dc,0x5a5aeeb4,0xa0a0fb5b,
+	0x5252f6a4,0x3b3b4d76,0xd6d661b7,0xb3b3ce7d,0x29297b52,0xe3e33edd,0x2f2f715e,0x84849713,
+	0x5353f5a6,0xd1d168b9,0x00000000,0xeded2cc1,0x20206040,0xfcfc1fe3,0xb1b1c879,0x5b5bedb6,
+	0x6a6abed4,0xcbcb468d,0xbebed967,0x39394b72,0x4a4ade94,0x4c4cd498,0x5858e8b0,0xcfcf4a85,
+	0xd0d06bbb,0xefef2ac5,0xaaaae54f,0xfbfb16ed,0x4343c586,0x4d4dd79a,0x33335566,0x85859411,
+	0x4545cf8a,0xf9f910e9,0x02020604,0x7f7f81fe,0x5050f0a0,0x3c3c4478,0x9f9fba25,0xa8a8e34b,
+	0x5151f3a2,0xa3a3fe5d,0x4040c080,0x8f8f8a05,0x9292ad3f,0x9d9dbc21,0x38384870,0xf5f504f1,
+	0xbcbcdf63,0xb6b6c177,0xdada75af,0x21216342,0x10103020,0xffff1ae5,0xf3f30efd,0xd2d26dbf,
+	0xcdcd4c81,0x0c0c1418,0x13133526,0xecec2fc3,0x5f5fe1be,0x9797a235,0x4444cc88,0x1717392e,
+	0xc4c45793,0xa7a7f255,0x7e7e82fc,0x3d3d477a,0x6464acc8,0x5d5de7ba,0x19192b32,0x737395e6,
+	0x6060a0c0,0x81819819,0x4f4fd19e,0xdcdc7fa3,0x22226644,0x2a2a7e54,0x9090ab3b,0x8888830b,
+	0x4646ca8c,0xeeee29c7,0xb8b8d36b,0x14143c28,0xdede79a7,0x5e5ee2bc,0x0b0b1d16,0xdbdb76ad,
+	0xe0e03bdb,0x32325664,0x3a3a4e74,0x0a0a1e14,0x4949db92,0x06060a0c,0x24246c48,0x5c5ce4b8,
+	0xc2c25d9f,0xd3d36ebd,0xacacef43,0x6262a6c4,0x9191a839,0x9595a431,0xe4e437d3,0x79798bf2,
+	0xe7e732d5,0xc8c8438b,0x3737596e,0x6d6db7da,0x8d8d8c01,0xd5d564b1,0x4e4ed29c,0xa9a9e049,
+	0x6c6cb4d8,0x5656faac,0xf4f407f3,0xeaea25cf,0x6565afca,0x7a7a8ef4,0xaeaee947,0x08081810,
+	0xbabad56f,0x787888f0,0x25256f4a,0x2e2e725c,0x1c1c2438,0xa6a6f157,0xb4b4c773,0xc6c65197,
+	0xe8e823cb,0xdddd7ca1,0x74749ce8,0x1f1f213e,0x4b4bdd96,0xbdbddc61,0x8b8b860d,0x8a8a850f,
+	0x707090e0,0x3e3e427c,0xb5b5c471,0x6666aacc,0x4848d890,0x03030506,0xf6f601f7,0x0e0e121c,
+	0x6161a3c2,0x35355f6a,0x5757f9ae,0xb9b9d069,0x86869117,0xc1c15899,0x1d1d273a,0x9e9eb927,
+	0xe1e138d9,0xf8f813eb,0x9898b32b,0x11113322,0x6969bbd2,0xd9d970a9,0x8e8e8907,0x9494a733,
+	0x9b9bb62d,0x1e1e223c,0x87879215,0xe9e920c9,0xcece4987,0x5555ffaa,0x28287850,0xdfdf7aa5,
+	0x8c8c8f03,0xa1a1f859,0x89898009,0x0d0d171a,0xbfbfda65,0xe6e631d7,0x4242c684,0x6868b8d0,
+	0x4141c382,0x9999b029,0x2d2d775a,0x0f0f111e,0xb0b0cb7b,0x5454fca8,0xbbbbd66d,0x16163a2c
+};
+
+// Decryption T-tables for the equivalent inverse cipher. aes_td0[x] holds the column
+// {0e,09,0d,0b}*InvS[x], merging InvSubBytes and InvMixColumns, and aes_td1..aes_td3
+// are its rotations, as for the encryption tables.
+static const WORD aes_td0[256] = {
+	0x51f4a750,0x7e416553,0x1a17a4c3,0x3a275e96,0x3bab6bcb,0x1f9d45f1,0xacfa58ab,0x4be30393,
+	0x2030fa55,0xad766df6,0x88cc7691,0xf5024c25,0x4fe5d7fc,0xc52acbd7,0x26354480,0xb562a38f,
+	0xdeb15a49,0x25ba1b67,0x45ea0e98,0x5dfec0e1,0xc32f7502,0x814cf012,0x8d4697a3,0x6bd3f9c6,
+	0x038f5fe7,0x15929c95,0xbf6d7aeb,0x955259da,0xd4be832d,0x587421d3,0x49e06929,0x8ec9c844,
+	0x75c2896a,0xf48e7978,0x99583e6b,0x27b971dd,0xbee14fb6,0xf088ad17,0xc920ac66,0x7dce3ab4,
+	0x63df4a18,0xe51a3182,0x97513360,0x62537f45,0xb16477e0,0xbb6bae84,0xfe81a01c,0xf9082b94,
+	0x70486858,0x8f45fd19,0x94de6c87,0x527bf8b7,0xab73d323,0x724b02e2,0xe31f8f57,0x6655ab2a,
+	0xb2eb2807,0x2fb5c203,0x86c57b9a,0xd33708a5,0x302887f2,0x23bfa5b2,0x02036aba,0xed16825c,
+	0x8acf1c2b,0xa779b492,0xf307f2f0,0x4e69e2a1,0x65daf4cd,0x0605bed5,0xd134621f,0xc4a6fe8a,
+	0x342e539d,0xa2f355a0,0x058ae132,0xa4f6eb75,0x0b83ec39,0x4060efaa,0x5e719f06,0xbd6e1051,
+	0x3e218af9,0x96dd063d,0xdd3e05ae,0x4de6bd46,0x91548db5,0x71c45d05,0x0406d46f,0x605015ff,
+	0x1998fb24,0xd6bde997,0x894043cc,0x67d99e77,0xb0e842bd,0x07898b88,0xe7195b38,0x79c8eedb,
+	0xa17c0a47,0x7c420fe9,0xf8841ec9,0x00000000,0x09808683,0x322bed48,0x1e1170ac,0x6c5a724e,
+	0xfd0efffb,0x0f853856,0x3daed51e,0x362d3927,0x0a0fd964,0x685ca621,0x9b5b54d1,0x24362e3a,
+	0x0c0a67b1,0x9357e70f,0xb4ee96d2,0x1b9b919e,0x80c0c54f,0x61dc20a2,0x5a774b69,0x1c121a16,
+	0xe293ba0a,0xc0a02ae5,0x3c22e043,0x121b171d,0x0e090d0b,0xf28bc7ad,0x2db6a8b9,0x141ea9c8,
+	0x57f11985,0xaf75074c,0xee99ddbb,0xa37f60fd,0xf701269f,0x5c72f5bc,0x44663bc5,0x5bfb7e34,
+	0x8b432976,0xcb23c6dc,0xb6edfc68,0xb8e4f163,0xd731dcca,0x42638510,0x13972240,0x84c61120,
+	0x854a247d,0xd2bb3df8,0xaef93211,0xc729a16d,0x1d9e2f4b,0xdcb230f3,0x0d8652ec,0x77c1e3d0,
+	0x2bb3166c,0xa970b999,0x119448fa,0x47e96422,0xa8fc8cc4,0xa0f03f1a,0x567d2cd8,0x223390ef,
+	0x87494ec7,0xd938d1c1,0x8ccaa2fe,0x98d40b36,0xa6f581cf,0xa57ade28,0xdab78e26,0x3fadbfa4,
+	0x2c3a9de4,0x5078920d,0x6a5fcc9b,0x547e4662,0xf68d13c2,0x90d8b8e8,0x2e39f75e,0x82c3aff5,
+	0x9f5d80be,0x69d0937c,0x6fd52da9,0xcf2512b3,0xc8ac993b,0x10187da7,0xe89c636e,0xdb3bbb7b,
+	0xcd267809,0x6e5918f4,0xec9ab701,0x834f9aa8,0xe6956e65,0xaaffe67e,0x21bccf08,0xef15e8e6,
+	0xbae79bd9,0x4a6f36ce,0xea9f09d4,0x29b07cd6,0x31a4b2af,0x2a3f2331,0xc6a59430,0x35a266c0,
+	0x744ebc37,0xfc82caa6,0xe090d0b0,0x33a7d815,0xf104984a,0x41ecdaf7,0x7fcd500e,0x1791f62f,
+	0x764dd68d,0x43efb04d,0xccaa4d54,0xe49604df,0x9ed1b5e3,0x4c6a881b,0xc12c1fb8,0x4665517f,
+	0x9d5eea04,0x018c355d,0xfa877473,0xfb0b412e,0xb3671d5a,0x92dbd252,0xe9105633,0x6dd64713,
+	0x9ad7618c,0x37a10c7a,0x59f8148e,0xeb133c89,0xcea927ee,0xb761c935,0xe11ce5ed,0x7a47b13c,
+	0x9cd2df59,0x55f2733f,0x1814ce79,0x73c737bf,0x53f7cdea,0x5ffdaa5b,0xdf3d6f14,0x7844db86,
+	0xcaaff381,0xb968c43e,0x3824342c,0xc2a3405f,0x161dc372,0xbce2250c,0x283c498b,0xff0d9541,
+	0x39a80171,0x080cb3de,0xd8b4e49c,0x6456c190,0x7bcb8461,0xd532b670,0x486c5c74,0xd0b85742
+};
+
+static const WORD aes_td1[256] = {
+	0x5051f4a7,0x537e4165,0xc31a17a4,0x963a275e,0xcb3bab6b,0xf11f9d45,0xabacfa58,0x934be303,
+	0x552030fa,0xf6ad766d,0x9188cc76,0x25f5024c,0xfc4fe5d7,0xd7c52acb,0x80263544,0x8fb562a3,
+	0x49deb15a,0x6725ba1b,0x9845ea0e,0xe15dfec0,0x02c32f75,0x12814cf0,0xa38d4697,0xc66bd3f9,
+	0xe7038f5f,0x9515929c,0xebbf6d7a,0xda955259,0x2dd4be83,0xd3587421,0x2949e069,0x448ec9c8,
+	0x6a75c289,0x78f48e79,0x6b99583e,0xdd27b971,0xb6bee14f,0x17f088ad,0x66c920ac,0xb47dce3a,
+	0x1863df4a,0x82e51a31,0x60975133,0x4562537f,0xe0b16477,0x84bb6bae,0x1cfe81a0,0x94f9082b,
+	0x58704868,0x198f45fd,0x8794de6c,0xb7527bf8,0x23ab73d3,0xe2724b02,0x57e31f8f,0x2a6655ab,
+	0x07b2eb28,0x032fb5c2,0x9a86c57b,0xa5d33708,0xf2302887,0xb223bfa5,0xba02036a,0x5ced1682,
+	0x2b8acf1c,0x92a779b4,0xf0f307f2,0xa14e69e2,0xcd65daf4,0xd50605be,0x1fd13462,0x8ac4a6fe,
+	0x9d342e53,0xa0a2f355,0x32058ae1,0x75a4f6eb,0x390b83ec,0xaa4060ef,0x065e719f,0x51bd6e10,
+	0xf93e218a,0x3d96dd06,0xaedd3e05,0x464de6bd,0xb591548d,0x0571c45d,0x6f0406d4,0xff605015,
+	0x241998fb,0x97d6bde9,0xcc894043,0x7767d99e,0xbdb0e842,0x8807898b,0x38e7195b,0xdb79c8ee,
+	0x47a17c0a,0xe97c420f,0xc9f8841e,0x00000000,0x83098086,0x48322bed,0xac1e1170,0x4e6c5a72,
+	0xfbfd0eff,0x560f8538,0x1e3daed5,0x27362d39,0x640a0fd9,0x21685ca6,0xd19b5b54,0x3a24362e,
+	0xb10c0a67,0x0f9357e7,0xd2b4ee96,0x9e1b9b91,0x4f80c0c5,0xa261dc20,0x695a774b,0x161c121a,
+	0x0ae293ba,0xe5c0a02a,0x433c22e0,0x1d121b17,0x0b0e090d,0xadf28bc7,0xb92db6a8,0xc8141ea9,
+	0x8557f119,0x4caf7507,0xbbee99dd,0xfda37f60,0x9ff70126,0xbc5c72f5,0xc544663b,0x345bfb7e,
+	0x768b4329,0xdccb23c6,0x68b6edfc,0x63b8e4f1,0xcad731dc,0x10426385,0x40139722,0x2084c611,
+	0x7d854a24,0xf8d2bb3d,0x11aef932,0x6dc729a1,0x4b1d9e2f,0xf3dcb230,0xec0d8652,0xd077c1e3,
+	0x6c2bb316,0x99a970b9,0xfa119448,0x2247e964,0xc4a8fc8c,0x1aa0f03f,0xd8567d2c,0xef223390,
+	0xc787494e,0xc1d938d1,0xfe8ccaa2,0x3698d40b,0xcfa6f581,0x28a57ade,0x26dab78e,0xa43fadbf,
+	0xe42c3a9d,0x0d507892,0x9b6a5fcc,0x62547e46,0xc2f68d13,0xe890d8b8,0x5e2e39f7,0xf582c3af,
+	0xbe9f5d80,0x7c69d093,0xa96fd52d,0xb3cf2512,0x3bc8ac99,0xa710187d,0x6ee89c63,0x7bdb3bbb,
+	0x09cd2678,0xf46e5918,0x01ec9ab7,0xa8834f9a,0x65e6956e,0x7eaaffe6,0x0821bccf,0xe6ef15e8,
+	0xd9bae79b,0xce4a6f36,0xd4ea9f09,0xd629b07c,0xaf31a4b2,0x312a3f23,0x30c6a594,0xc035a266,
+	0x37744ebc,0xa6fc82ca,0xb0e090d0,0x1533a7d8,0x4af10498,0xf741ecda,0x0e7fcd50,0x2f1791f6,
+	0x8d764dd6,0x4d43efb0,0x54ccaa4d,0xdfe49604,0xe39ed1b5,0x1b4c6a88,0xb8c12c1f,0x7f466551,
+	0x049d5eea,0x5d018c35,0x73fa8774,0x2efb0b41,0x5ab3671d,0x5292dbd2,0x33e91056,0x136dd647,
+	0x8c9ad761,0x7a37a10c,0x8e59f814,0x89eb133c,0xeecea927,0x35b761c9,0xede11ce5,0x3c7a47b1,
+	0x599cd2df,0x3f55f273,0x791814ce,0xbf73c737,0xea53f7cd,0x5b5ffdaa,0x14df3d6f,0x867844db,
+	0x81caaff3,0x3eb968c4,0x2c382434,0x5fc2a340,0x72161dc3,0x0cbce225,0x8b283c49,0x41ff0d95,
+	0x7139a801,0xde080cb3,0x9cd8b4e4,0x906456c1,0x617bcb84,0x70d532b6,0x74486c5c,0x42d0b857
+};
+
+static const WORD aes_td2[256] = {
+	0xa75051f4,0x65537e41,0xa4c31a17,0x5e963a27,0x6bcb3bab,0x45f11f9d,0x58abacfa,0x03934be3,
+	0xfa552030,0x6df6ad76,0x769188cc,0x4c25f502,0xd7fc4fe5,0xcbd7c52a,0x44802635,0xa38fb562,
+	0x5a49deb1,0x1b6725ba,0x0e9845ea,0xc0e15dfe,0x7502c32f,0xf012814c,0x97a38d46,0xf9c66bd3,
+	0x5fe7038f,0x9c951592,0x7aebbf6d,0x59da9552,0x832dd4be,0x21d35874,0x692949e0,0xc8448ec9,
+	0x896a75c2,0x7978f48e,0x3e6b9958,0x71dd27b9,0x4fb6bee1,0xad17f088,0xac66c920,0x3ab47dce,
+	0x4a1863df,0x3182e51a,0x33609751,0x7f456253,0x77e0b164,0xae84bb6b,0xa01cfe81,0x2b94f908,
+	0x68587048,0xfd198f45,0x6c8794de,0xf8b7527b,0xd323ab73,0x02e2724b,0x8f57e31f,0xab2a6655,
+	0x2807b2eb,0xc2032fb5,0x7b9a86c5,0x08a5d337,0x87f23028,0xa5b223bf,0x6aba0203,0x825ced16,
+	0x1c2b8acf,0xb492a779,0xf2f0f307,0xe2a14e69,0xf4cd65da,0xbed50605,0x621fd134,0xfe8ac4a6,
+	0x539d342e,0x55a0a2f3,0xe132058a,0xeb75a4f6,0xec390b83,0xefaa4060,0x9f065e71,0x1051bd6e,
+	0x8af93e21,0x063d96dd,0x05aedd3e,0xbd464de6,0x8db59154,0x5d0571c4,0xd46f0406,0x15ff6050,
+	0xfb241998,0xe997d6bd,0x43cc8940,0x9e7767d9,0x42bdb0e8,0x8b880789,0x5b38e719,0xeedb79c8,
+	0x0a47a17c,0x0fe97c42,0x1ec9f884,0x00000000,0x86830980,0xed48322b,0x70ac1e11,0x724e6c5a,
+	0xfffbfd0e,0x38560f85,0xd51e3dae,0x3927362d,0xd9640a0f,0xa621685c,0x54d19b5b,0x2e3a2436,
+	0x67b10c0a,0xe70f9357,0x96d2b4ee,0x919e1b9b,0xc54f80c0,0x20a261dc,0x4b695a77,0x1a161c12,
+	0xba0ae293,0x2ae5c0a0,0xe0433c22,0x171d121b,0x0d0b0e09,0xc7adf28b,0xa8b92db6,0xa9c8141e,
+	0x198557f1,0x074caf75,0xddbbee99,0x60fda37f,0x269ff701,0xf5bc5c72,0x3bc54466,0x7e345bfb,
+	0x29768b43,0xc6dccb23,0xfc68b6ed,0xf163b8e4,0xdccad731,0x85104263,0x22401397,0x112084c6,
+	0x247d854a,0x3df8d2bb,0x3211aef9,0xa16dc729,0x2f4b1d9e,0x30f3dcb2,0x52ec0d86,0xe3d077c1,
+	0x166c2bb3,0xb999a970,0x48fa1194,0x642247e9,0x8cc4a8fc,0x3f1aa0f0,0x2cd8567d,0x90ef2233,
+	0x4ec78749,0xd1c1d938,0xa2fe8cca,0x0b3698d4,0x81cfa6f5,0xde28a57a,0x8e26dab7,0xbfa43fad,
+	0x9de42c3a,0x920d5078,0xcc9b6a5f,0x4662547e,0x13c2f68d,0xb8e890d8,0xf75e2e39,0xaff582c3,
+	0x80be9f5d,0x937c69d0,0x2da96fd5,0x12b3cf25,0x993bc8ac,0x7da71018,0x636ee89c,0xbb7bdb3b,
+	0x7809cd26,0x18f46e59,0xb701ec9a,0x9aa8834f,0x6e65e695,0xe67eaaff,0xcf0821bc,0xe8e6ef15,
+	0x9bd9bae7,0x36ce4a6f,0x09d4ea9f,0x7cd629b0,0xb2af31a4,0x23312a3f,0x9430c6a5,0x66c035a2,
+	0xbc37744e,0xcaa6fc82,0xd0b0e090,0xd81533a7,0x984af104,0xdaf741ec,0x500e7fcd,0xf62f1791,
+	0xd68d764d,0xb04d43ef,0x4d54ccaa,0x04dfe496,0xb5e39ed1,0x881b4c6a,0x1fb8c12c,0x517f4665,
+	0xea049d5e,0x355d018c,0x7473fa87,0x412efb0b,0x1d5ab367,0xd25292db,0x5633e910,0x47136dd6,
+	0x618c9ad7,0x0c7a37a1,0x148e59f8,0x3c89eb13,0x27eecea9,0xc935b761,0xe5ede11c,0xb13c7a47,
+	0xdf599cd2,0x733f55f2,0xce791814,0x37bf73c7,0xcdea53f7,0xaa5b5ffd,0x6f14df3d,0xdb867844,
+	0xf381caaf,0xc43eb968,0x342c3824,0x405fc2a3,0xc372161d,0x250cbce2,0x498b283c,0x9541ff0d,
+	0x017139a8,0xb3de080c,0xe49cd8b4,0xc1906456,0x84617bcb,0xb670d532,0x5c74486c,0x5742d0b8
+};
+
+static const WORD aes_td3[256] = {
+	0xf4a75051,0x4165537e,0x17a4c31a,0x275e963a,0xab6bcb3b,0x9d45f11f,0xfa58abac,0xe303934b,
+	0x30fa5520,0x766df6ad,0xcc769188,0x024c25f5,0xe5d7fc4f,0x2acbd7c5,0x35448026,0x62a38fb5,
+	0xb15a49de,0xba1b6725,0xea0e9845,0xfec0e15d,0x2f7502c3,0x4cf01281,0x4697a38d,0xd3f9c66b,
+	0x8f5fe703,0x929c9515,0x6d7aebbf,0x5259da95,0xbe832dd4,0x7421d358,0xe0692949,0xc9c8448e,
+	0xc2896a75,0x8e7978f4,0x583e6b99,0xb971dd27,0xe14fb6be,0x88ad17f0,0x20ac66c9,0xce3ab47d,
+	0xdf4a1863,0x1a3182e5,0x51336097,0x537f4562,0x6477e0b1,0x6bae84bb,0x81a01cfe,0x082b94f9,
+	0x48685870,0x45fd198f,0xde6c8794,0x7bf8b752,0x73d323ab,0x4b02e272,0x1f8f57e3,0x55ab2a66,
+	0xeb2807b2,0xb5c2032f,0xc57b9a86,0x3708a5d3,0x2887f230,0xbfa5b223,0x036aba02,0x16825ced,
+	0xcf1c2b8a,0x79b492a7,0x07f2f0f3,0x69e2a14e,0xdaf4cd65,0x05bed506,0x34621fd1,0xa6fe8ac4,
+	0x2e539d34,0xf355a0a2,0x8ae13205,0xf6eb75a4,0x83ec390b,0x60efaa40,0x719f065e,0x6e1051bd,
+	0x218af93e,0xdd063d96,0x3e05aedd,0xe6bd464d,0x548db591,0xc45d0571,0x06d46f04,0x5015ff60,
+	0x98fb2419,0xbde997d6,0x4043cc89,0xd99e7767,0xe842bdb0,0x898b8807,0x195b38e7,0xc8eedb79,
+	0x7c0a47a1,0x420fe97c,0x841ec9f8,0x00000000,0x80868309,0x2bed4832,0x1170ac1e,0x5a724e6c,
+	0x0efffbfd,0x8538560f,0xaed51e3d,0x2d392736,0x0fd9640a,0x5ca62168,0x5b54d19b,0x362e3a24,
+	0x0a67b10c,0x57e70f93,0xee96d2b4,0x9b919e1b,0xc0c54f80,0xdc20a261,0x774b695a,0x121a161c,
+	0x93ba0ae2,0xa02ae5c0,0x22e0433c,0x1b171d12,0x090d0b0e,0x8bc7adf2,0xb6a8b92d,0x1ea9c814,
+	0xf1198557,0x75074caf,0x99ddbbee,0x7f60fda3,0x01269ff7,0x72f5bc5c,0x663bc544,0xfb7e345b,
+	0x4329768b,0x23c6dccb,0xedfc68b6,0xe4f163b8,0x31dccad7,0x63851042,0x97224013,0xc6112084,
+	0x4a247d85,0xbb3df8d2,0xf93211ae,0x29a16dc7,0x9e2f4b1d,0xb230f3dc,0x8652ec0d,0xc1e3d077,
+	0xb3166c2b,0x70b999a9,0x9448fa11,0xe9642247,0xfc8cc4a8,0xf03f1aa0,0x7d2cd856,0x3390ef22,
+	0x494ec787,0x38d1c1d9,0xcaa2fe8c,0xd40b3698,0xf581cfa6,0x7ade28a5,0xb78e26da,0xadbfa43f,
+	0x3a9de42c,0x78920d50,0x5fcc9b6a,0x7e466254,0x8d13c2f6,0xd8b8e890,0x39f75e2e,0xc3aff582,
+	0x5d80be9f,0xd0937c69,0xd52da96f,0x2512b3cf,0xac993bc8,0x187da710,0x9c636ee8,0x3bbb7bdb,
+	0x267809cd,0x5918f46e,0x9ab701ec,0x4f9aa883,0x956e65e6,0xffe67eaa,0xbccf0821,0x15e8e6ef,
+	0xe79bd9ba,0x6f36ce4a,0x9f09d4ea,0xb07cd629,0xa4b2af31,0x3f23312a,0xa59430c6,0xa266c035,
+	0x4ebc3774,0x82caa6fc,0x90d0b0e0,0xa7d81533,0x04984af1,0xecdaf741,0xcd500e7f,0x91f62f17,
+	0x4dd68d76,0xefb04d43,0xaa4d54cc,0x9604dfe4,0xd1b5e39e,0x6a881b4c,0x2c1fb8c1,0x65517f46,
+	0x5eea049d,0x8c355d01,0x877473fa,0x0b412efb,0x671d5ab3,0xdbd25292,0x105633e9,0xd647136d,
+	0xd7618c9a,0xa10c7a37,0xf8148e59,0x133c89eb,0xa927eece,0x61c935b7,0x1ce5ede1,0x47b13c7a,
+	0xd2df599c,0xf2733f55,0x14ce7918,0xc737bf73,0xf7cdea53,0xfdaa5b5f,0x3d6f14df,0x44db8678,
+	0xaff381ca,0x68c43eb9,0x24342c38,0xa3405fc2,0x1dc37216,0xe2250cbc,0x3c498b28,0x0d9541ff,
+	0xa8017139,0x0cb3de08,0xb4e49cd8,0x56c19064,0xcb84617b,0x32b670d5,0x6c5c7448,0xb85742d0
+};
+
 /*********************** FUNCTION DEFINITIONS ***********************/
 // XORs the in and out buffers, storing the result in out. Length is in bytes.
 void xor_buf(const BYTE in[], BYTE out[], size_t len)
@@ -351,185 +673,182 @@ void aes_decrypt_ctr(const BYTE in[], size_t in_len, BYTE out[], const WORD key[
 /*******************
 * AES - CCM
 *******************/
-// out_len = payload_len + assoc_len
-int aes_encrypt_ccm(const BYTE payload[], WORD payload_len, const BYTE assoc[], unsigned short assoc_len,
-                    const BYTE nonce[], unsigned short nonce_len, BYTE out[], WORD *out_len,
-                    WORD mac_len, const BYTE key_str[], int keysize)
+// The formatting of SP 800-38C: B0 carries the flags, the nonce, and the payload length
+// in the q = 15 - nonce_len bytes left, and the counter blocks carry the same flags
+// minus the Adata and MAC length bits. The payload blocks use the counters from 1 on,
+// and counter 0 masks the MAC.
+int aes_ccm_init(AES_CCM_CTX *ctx, const AES_CTX *aes, const BYTE nonce[], int nonce_len, unsigned long long payload_len,
+                 const BYTE assoc[], size_t assoc_len, int mac_len)
 {
-	BYTE temp_iv[AES_BLOCK_SIZE], counter[AES_BLOCK_SIZE], mac[16], *buf;
-	int end_of_buf, payload_len_store_size;
-	WORD key[60];
+	BYTE block[AES_BLOCK_SIZE], header[10];
+	size_t header_len = 0, idx, used;
+	int q = AES_BLOCK_SIZE - 1 - nonce_len;
 
-	if (mac_len != 4 && mac_len != 6 && mac_len != 8 && mac_len != 10 &&
-	   mac_len != 12 && mac_len != 14 && mac_len != 16)
+	if (mac_len < 4 || mac_len > 16 || mac_len % 2 != 0)
 		return(FALSE);
-
 	if (nonce_len < 7 || nonce_len > 13)
 		return(FALSE);
-
-	if (assoc_len > 32768 /* = 2^15 */)
+	if (q < 8 && (payload_len >> (8 * q)) != 0)
 		return(FALSE);
 
-	buf = (BYTE*)malloc(payload_len + assoc_len + 48 /*Round both payload and associated data up a block size and add an extra block.*/);
-	if (! buf)
+	ctx->aes = aes;
+	ctx->payload_len = payload_len;
+	ctx->processed = 0;
+	ctx->mac_len = mac_len;
+
+	// B0
+	block[0] = (assoc_len > 0 ? 0x40 : 0) | (((mac_len - 2) / 2) << 3) | (q - 1);
+	memcpy(&block[1], nonce, nonce_len);
+	for (idx = AES_BLOCK_SIZE - 1; idx > (size_t)nonce_len; idx--) {
+		block[idx] = (BYTE)payload_len;
+		payload_len >>= 8;
+	}
+	aes_encrypt(block, ctx->mac, aes->key, aes->keysize);
+
+	// The associated data is prefixed with its length in 2, 6, or 10 bytes and padded
+	// with zeros to a whole number of blocks.
+	if (assoc_len > 0) {
+		unsigned long long len = assoc_len;
+		int len_bytes = 2;
+
+		if (len >= 0xFF00ULL) {
+			header[header_len++] = 0xFF;
+			header[header_len++] = len > 0xFFFFFFFFULL ? 0xFF : 0xFE;
+			len_bytes = len > 0xFFFFFFFFULL ? 8 : 4;
+		}
+		for (idx = len_bytes; idx > 0; idx--)
+			header[header_len++] = (BYTE)(len >> (8 * (idx - 1)));
+
+		used = 0;
+		for (idx = 0; idx < header_len + assoc_len; idx++) {
+			ctx->mac[used++] ^= idx < header_len ? header[idx] : assoc[idx - header_len];
+			if (used == AES_BLOCK_SIZE) {
+				aes_encrypt(ctx->mac, ctx->mac, aes->key, aes->keysize);
+				used = 0;
+			}
+		}
+		if (used > 0)
+			aes_encrypt(ctx->mac, ctx->mac, aes->key, aes->keysize);
+	}
+
+	memset(ctx->ctr, 0, AES_BLOCK_SIZE);
+	ctx->ctr[0] = q - 1;
+	memcpy(&ctx->ctr[1], nonce, nonce_len);
+	aes_encrypt(ctx->ctr, ctx->s0, aes->key, aes->keysize);
+	ctx->ctr[AES_BLOCK_SIZE - 1] = 1;
+
+	return(TRUE);
+}
+
+static int aes_ccm_update(AES_CCM_CTX *ctx, const BYTE in[], BYTE out[], size_t len, int decrypt)
+{
+	BYTE ks[AES_BLOCK_SIZE], plain[AES_BLOCK_SIZE] = {0};
+	size_t blocks = len / AES_BLOCK_SIZE, tail = len % AES_BLOCK_SIZE, idx;
+
+	// Only the last update may end in a partial block.
+	if (ctx->processed % AES_BLOCK_SIZE != 0 || len > ctx->payload_len - ctx->processed)
 		return(FALSE);
 
-	// Prepare the key for usage.
-	aes_key_setup(key_str, key, keysize);
+	aes_ccm_blocks(in, out, blocks, ctx->aes, ctx->ctr, ctx->mac, decrypt);
+
+	if (tail > 0) {
+		in += blocks * AES_BLOCK_SIZE;
+		out += blocks * AES_BLOCK_SIZE;
+		aes_encrypt(ctx->ctr, ks, ctx->aes->key, ctx->aes->keysize);
+		for (idx = 0; idx < tail; idx++) {
+			plain[idx] = decrypt ? in[idx] ^ ks[idx] : in[idx];
+			out[idx] = in[idx] ^ ks[idx];
+		}
+		xor_buf(plain, ctx->mac, AES_BLOCK_SIZE);
+		aes_encrypt(ctx->mac, ctx->mac, ctx->aes->key, ctx->aes->keysize);
+	}
+
+	ctx->processed += len;
+	return(TRUE);
+}
+
+int aes_ccm_encrypt_update(AES_CCM_CTX *ctx, const BYTE in[], BYTE out[], size_t len)
+{
+	return(aes_ccm_update(ctx, in, out, len, FALSE));
+}
+
+int aes_ccm_decrypt_update(AES_CCM_CTX *ctx, const BYTE in[], BYTE out[], size_t len)
+{
+	return(aes_ccm_update(ctx, in, out, len, TRUE));
+}
 
-	// Format the first block of the formatted data.
-	payload_len_store_size = AES_BLOCK_SIZE - 1 - nonce_len;
-	ccm_prepare_first_format_blk(buf, assoc_len, payload_len, payload_len_store_size, mac_len, nonce, nonce_len);
-	end_of_buf = AES_BLOCK_SIZE;
+int aes_ccm_encrypt_final(AES_CCM_CTX *ctx, BYTE mac[])
+{
+	int idx;
 
-	// Format the Associated Data, aka, assoc[].
-	ccm_format_assoc_data(buf, &end_of_buf, assoc, assoc_len);
+	if (ctx->processed != ctx->payload_len)
+		return(FALSE);
 
-	// Format the Payload, aka payload[].
-	ccm_format_payload_data(buf, &end_of_buf, payload, payload_len);
+	for (idx = 0; idx < ctx->mac_len; idx++)
+		mac[idx] = ctx->mac[idx] ^ ctx->s0[idx];
+	return(TRUE);
+}
 
-	// Create the first counter block.
-	ccm_prepare_first_ctr_blk(counter, nonce, nonce_len, payload_len_store_size);
+int aes_ccm_decrypt_final(AES_CCM_CTX *ctx, const BYTE mac[])
+{
+	BYTE diff = 0;
+	int idx;
 
-	// Perform the CBC operation with an IV of zeros on the formatted buffer to calculate the MAC.
-	memset(temp_iv, 0, AES_BLOCK_SIZE);
-	aes_encrypt_cbc_mac(buf, end_of_buf, mac, key, keysize, temp_iv);
+	if (ctx->processed != ctx->payload_len)
+		return(FALSE);
 
-	// Copy the Payload and MAC to the output buffer.
-	memcpy(out, payload, payload_len);
-	memcpy(&out[payload_len], mac, mac_len);
+	for (idx = 0; idx < ctx->mac_len; idx++)
+		diff |= mac[idx] ^ ctx->mac[idx] ^ ctx->s0[idx];
+	return(diff == 0);
+}
 
-	// Encrypt the Payload with CTR mode with a counter starting at 1.
-	memcpy(temp_iv, counter, AES_BLOCK_SIZE);
-	increment_iv(temp_iv, AES_BLOCK_SIZE - 1 - mac_len);   // Last argument is the byte size of the counting portion of the counter block. /*BUG?*/
-	aes_encrypt_ctr(out, payload_len, out, key, keysize, temp_iv);
+// The one-shot functions run the streaming API over the whole buffer, so they no
+// longer need a formatted copy of the payload.
+int aes_encrypt_ccm(const BYTE payload[], WORD payload_len, const BYTE assoc[], unsigned short assoc_len,
+                    const BYTE nonce[], unsigned short nonce_len, BYTE out[], WORD *out_len,
+                    WORD mac_len, const BYTE key_str[], int keysize)
+{
+	AES_CTX aes;
+	AES_CCM_CTX ctx;
 
-	// Encrypt the MAC with CTR mode with a counter starting at 0.
-	aes_encrypt_ctr(&out[payload_len], mac_len, &out[payload_len], key, keysize, counter);
+	aes_ctx_init(&aes, key_str, keysize);
+	if (!aes_ccm_init(&ctx, &aes, nonce, nonce_len, payload_len, assoc, assoc_len, mac_len))
+		return(FALSE);
 
-	free(buf);
+	aes_ccm_encrypt_update(&ctx, payload, out, payload_len);
+	aes_ccm_encrypt_final(&ctx, &out[payload_len]);
 	*out_len = payload_len + mac_len;
 
 	return(TRUE);
 }
 
-// plaintext_len = ciphertext_len - mac_len
-// Needs a flag for whether the MAC matches.
 int aes_decrypt_ccm(const BYTE ciphertext[], WORD ciphertext_len, const BYTE assoc[], unsigned short assoc_len,
                     const BYTE nonce[], unsigned short nonce_len, BYTE plaintext[], WORD *plaintext_len,
                     WORD mac_len, int *mac_auth, const BYTE key_str[], int keysize)
 {
-	BYTE temp_iv[AES_BLOCK_SIZE], counter[AES_BLOCK_SIZE], mac[16], mac_buf[16], *buf;
-	int end_of_buf, plaintext_len_store_size;
-	WORD key[60];
+	AES_CTX aes;
+	AES_CCM_CTX ctx;
 
-	if (ciphertext_len <= mac_len)
+	if (ciphertext_len < mac_len)
 		return(FALSE);
 
-	buf = (BYTE*)malloc(assoc_len + ciphertext_len /*ciphertext_len = plaintext_len + mac_len*/ + 48);
-	if (! buf)
-		return(FALSE);
-
-	// Prepare the key for usage.
-	aes_key_setup(key_str, key, keysize);
-
-	// Copy the plaintext and MAC to the output buffers.
+	aes_ctx_init(&aes, key_str, keysize);
 	*plaintext_len = ciphertext_len - mac_len;
-	plaintext_len_store_size = AES_BLOCK_SIZE - 1 - nonce_len;
-	memcpy(plaintext, ciphertext, *plaintext_len);
-	memcpy(mac, &ciphertext[*plaintext_len], mac_len);
-
-	// Prepare the first counter block for use in decryption.
-	ccm_prepare_first_ctr_blk(counter, nonce, nonce_len, plaintext_len_store_size);
+	if (!aes_ccm_init(&ctx, &aes, nonce, nonce_len, *plaintext_len, assoc, assoc_len, mac_len))
+		return(FALSE);
 
-	// Decrypt the Payload with CTR mode with a counter starting at 1.
-	memcpy(temp_iv, counter, AES_BLOCK_SIZE);
-	increment_iv(temp_iv, AES_BLOCK_SIZE - 1 - mac_len);   // (AES_BLOCK_SIZE - 1 - mac_len) is the byte size of the counting portion of the counter block.
-	aes_decrypt_ctr(plaintext, *plaintext_len, plaintext, key, keysize, temp_iv);
+	aes_ccm_decrypt_update(&ctx, ciphertext, plaintext, *plaintext_len);
 
 	// Setting mac_auth to NULL disables the authentication check.
 	if (mac_auth != NULL) {
-		// Decrypt the MAC with CTR mode with a counter starting at 0.
-		aes_decrypt_ctr(mac, mac_len, mac, key, keysize, counter);
-
-		// Format the first block of the formatted data.
-		plaintext_len_store_size = AES_BLOCK_SIZE - 1 - nonce_len;
-		ccm_prepare_first_format_blk(buf, assoc_len, *plaintext_len, plaintext_len_store_size, mac_len, nonce, nonce_len);
-		end_of_buf = AES_BLOCK_SIZE;
-
-		// Format the Associated Data into the authentication buffer.
-		ccm_format_assoc_data(buf, &end_of_buf, assoc, assoc_len);
-
-		// Format the Payload into the authentication buffer.
-		ccm_format_payload_data(buf, &end_of_buf, plaintext, *plaintext_len);
-
-		// Perform the CBC operation with an IV of zeros on the formatted buffer to calculate the MAC.
-		memset(temp_iv, 0, AES_BLOCK_SIZE);
-		aes_encrypt_cbc_mac(buf, end_of_buf, mac_buf, key, keysize, temp_iv);
-
-		// Compare the calculated MAC against the MAC embedded in the ciphertext to see if they are the same.
-		if (! memcmp(mac, mac_buf, mac_len)) {
-			*mac_auth = TRUE;
-		}
-		else {
-			*mac_auth = FALSE;
+		*mac_auth = aes_ccm_decrypt_final(&ctx, &ciphertext[*plaintext_len]);
+		if (!*mac_auth)
 			memset(plaintext, 0, *plaintext_len);
-		}
 	}
 
-	free(buf);
-
 	return(TRUE);
 }
 
-// Creates the first counter block. First byte is flags, then the nonce, then the incremented part.
-void ccm_prepare_first_ctr_blk(BYTE counter[], const BYTE nonce[], int nonce_len, int payload_len_store_size)
-{
-	memset(counter, 0, AES_BLOCK_SIZE);
-	counter[0] = (payload_len_store_size - 1) & 0x07;
-	memcpy(&counter[1], nonce, nonce_len);
-}
-
-void ccm_prepare_first_format_blk(BYTE buf[], int assoc_len, int payload_len, int payload_len_store_size, int mac_len, const BYTE nonce[], int nonce_len)
-{
-	// Set the flags for the first byte of the first block.
-	buf[0] = ((((mac_len - 2) / 2) & 0x07) << 3) | ((payload_len_store_size - 1) & 0x07);
-	if (assoc_len > 0)
-		buf[0] += 0x40;
-	// Format the rest of the first block, storing the nonce and the size of the payload.
-	memcpy(&buf[1], nonce, nonce_len);
-	memset(&buf[1 + nonce_len], 0, AES_BLOCK_SIZE - 1 - nonce_len);
-	buf[15] = payload_len & 0x000000FF;
-	buf[14] = (payload_len >> 8) & 0x000000FF;
-}
-
-void ccm_format_assoc_data(BYTE buf[], int *end_of_buf, const BYTE assoc[], int assoc_len)
-{
-	int pad;
-
-	buf[*end_of_buf + 1] = assoc_len & 0x00FF;
-	buf[*end_of_buf] = (assoc_len >> 8) & 0x00FF;
-	*end_of_buf += 2;
-	memcpy(&buf[*end_of_buf], assoc, assoc_len);
-	*end_of_buf += assoc_len;
-	pad = AES_BLOCK_SIZE - (*end_of_buf % AES_BLOCK_SIZE); /*BUG?*/
-	memset(&buf[*end_of_buf], 0, pad);
-	*end_of_buf += pad;
-}
-
-void ccm_format_payload_data(BYTE buf[], int *end_of_buf, const BYTE payload[], int payload_len)
-{
-	int pad;
-
-	memcpy(&buf[*end_of_buf], payload, payload_len);
-	*end_of_buf += payload_len;
-	pad = *end_of_buf % AES_BLOCK_SIZE;
-	if (pad != 0)
-		pad = AES_BLOCK_SIZE - pad;
-	memset(&buf[*end_of_buf], 0, pad);
-	*end_of_buf += pad;
-}
-
 /*******************
 * AES
 *******************/
@@ -552,7 +871,7 @@ WORD SubWord(WORD word)
 // Performs the action of generating the keys that will be used in every round of
 // encryption. "key" is the user-supplied input key, "w" is the output key schedule,
 // "keysize" is the length in bits of "key", must be 128, 192, or 256.
-void aes_key_setup(const BYTE key[], WORD w[], int keysize)
+static void aes_key_setup_reference(const BYTE key[], WORD w[], int keysize)
 {
 	int Nb=4,Nr,Nk,idx;
 	WORD temp,Rcon[]={0x01000000,0x02000000,0x04000000,0x08000000,0x10000000,0x20000000,
@@ -926,7 +1245,7 @@ void InvMixColumns(BYTE state[][4])
 // (En/De)Crypt
 /////////////////
 
-void aes_encrypt(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+static void aes_encrypt_reference(const BYTE in[], BYTE out[], const WORD key[], int keysize)
 {
 	BYTE state[4][4];
 
@@ -999,7 +1318,7 @@ void aes_encrypt(const BYTE in[], BYTE out[], const WORD key[], int keysize)
 	out[15] = state[3][3];
 }
 
-void aes_decrypt(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+static void aes_decrypt_reference(const BYTE in[], BYTE out[], const WORD key[], int keysize)
 {
 	BYTE state[4][4];
 
@@ -1068,6 +1387,2119 @@ void aes_decrypt(const BYTE in[], BYTE out[], const WORD key[], int keysize)
 	out[15] = state[3][3];
 }
 
+/////////////////
+// T-TABLE (En/De)Crypt
+/////////////////
+
+// Returns the number of rounds for a key size in bits.
+static int aes_rounds(int keysize)
+{
+	switch (keysize) {
+		case 128: return(AES_128_ROUNDS);
+		case 192: return(AES_192_ROUNDS);
+		default: return(AES_256_ROUNDS);
+	}
+}
+
+// Performs the MixColumns step on a single column stored as a big endian word.
+static WORD MixColumnWord(WORD w)
+{
+	WORD r1 = ROTL_WORD(w, 8);
+
+	return(XTIME_WORD(w ^ r1) ^ r1 ^ ROTL_WORD(w, 16) ^ ROTL_WORD(w, 24));
+}
+
+// Performs the InvMixColumns step on a single column. InvMixColumns is MixColumns
+// preceded by adding {04}*(a0^a2) to rows 0 and 2 and {04}*(a1^a3) to rows 1 and 3.
+static WORD InvMixColumnWord(WORD w)
+{
+	WORD u = XTIME_WORD(XTIME_WORD(w ^ ROTL_WORD(w, 16)));
+
+	return(MixColumnWord(w ^ u));
+}
+
+// Encrypts one block keeping each column of the state in a 32-bit word. Every round but
+// the last is 16 table lookups and XORs; the last round has no MixColumns and uses the
+// plain S-Box.
+AES_SPECIALIZED void ttable_encrypt(const BYTE in[], BYTE out[], const WORD key[], int rounds)
+{
+	WORD s0, s1, s2, s3, t0, t1, t2, t3;
+	int round;
+
+	s0 = GET_WORD(in) ^ key[0];
+	s1 = GET_WORD(in + 4) ^ key[1];
+	s2 = GET_WORD(in + 8) ^ key[2];
+	s3 = GET_WORD(in + 12) ^ key[3];
+
+	for (round = 1; round < rounds; round++) {
+		key += 4;
+		t0 = aes_te0[s0 >> 24] ^ aes_te1[(s1 >> 16) & 0xff] ^ aes_te2[(s2 >> 8) & 0xff] ^ aes_te3[s3 & 0xff] ^ key[0];
+		t1 = aes_te0[s1 >> 24] ^ aes_te1[(s2 >> 16) & 0xff] ^ aes_te2[(s3 >> 8) & 0xff] ^ aes_te3[s0 & 0xff] ^ key[1];
+		t2 = aes_te0[s2 >> 24] ^ aes_te1[(s3 >> 16) & 0xff] ^ aes_te2[(s0 >> 8) & 0xff] ^ aes_te3[s1 & 0xff] ^ key[2];
+		t3 = aes_te0[s3 >> 24] ^ aes_te1[(s0 >> 16) & 0xff] ^ aes_te2[(s1 >> 8) & 0xff] ^ aes_te3[s2 & 0xff] ^ key[3];
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+
+	key += 4;
+	t0 = ((WORD)SBOX(s0 >> 24) << 24) ^ ((WORD)SBOX(s1 >> 16) << 16) ^ ((WORD)SBOX(s2 >> 8) << 8) ^ SBOX(s3) ^ key[0];
+	t1 = ((WORD)SBOX(s1 >> 24) << 24) ^ ((WORD)SBOX(s2 >> 16) << 16) ^ ((WORD)SBOX(s3 >> 8) << 8) ^ SBOX(s0) ^ key[1];
+	t2 = ((WORD)SBOX(s2 >> 24) << 24) ^ ((WORD)SBOX(s3 >> 16) << 16) ^ ((WORD)SBOX(s0 >> 8) << 8) ^ SBOX(s1) ^ key[2];
+	t3 = ((WORD)SBOX(s3 >> 24) << 24) ^ ((WORD)SBOX(s0 >> 16) << 16) ^ ((WORD)SBOX(s1 >> 8) << 8) ^ SBOX(s2) ^ key[3];
+
+	PUT_WORD(out, t0);
+	PUT_WORD(out + 4, t1);
+	PUT_WORD(out + 8, t2);
+	PUT_WORD(out + 12, t3);
+}
+
+// Builds the decryption schedule of the FIPS-197 equivalent inverse cipher: the round
+// keys in reverse order, with InvMixColumns applied to all but the first and last.
+static void aes_key_setup_dec(const WORD key[], WORD dk[], int rounds)
+{
+	int round, idx;
+
+	for (idx = 0; idx < 4; idx++) {
+		dk[idx] = key[rounds * 4 + idx];
+		dk[rounds * 4 + idx] = key[idx];
+	}
+	for (round = 1; round < rounds; round++)
+		for (idx = 0; idx < 4; idx++)
+			dk[round * 4 + idx] = InvMixColumnWord(key[(rounds - round) * 4 + idx]);
+}
+
+// Decrypts one block with the equivalent inverse cipher, which has the same structure as
+// the encryption: every round but the last is 16 lookups in the aes_td tables, and the
+// last one uses the plain inverse S-Box. "dk" is the schedule from aes_key_setup_dec.
+AES_SPECIALIZED void ttable_decrypt(const BYTE in[], BYTE out[], const WORD dk[], int rounds)
+{
+	WORD s0, s1, s2, s3, t0, t1, t2, t3;
+	int round;
+
+	s0 = GET_WORD(in) ^ dk[0];
+	s1 = GET_WORD(in + 4) ^ dk[1];
+	s2 = GET_WORD(in + 8) ^ dk[2];
+	s3 = GET_WORD(in + 12) ^ dk[3];
+
+	for (round = 1; round < rounds; round++) {
+		dk += 4;
+		t0 = aes_td0[s0 >> 24] ^ aes_td1[(s3 >> 16) & 0xff] ^ aes_td2[(s2 >> 8) & 0xff] ^ aes_td3[s1 & 0xff] ^ dk[0];
+		t1 = aes_td0[s1 >> 24] ^ aes_td1[(s0 >> 16) & 0xff] ^ aes_td2[(s3 >> 8) & 0xff] ^ aes_td3[s2 & 0xff] ^ dk[1];
+		t2 = aes_td0[s2 >> 24] ^ aes_td1[(s1 >> 16) & 0xff] ^ aes_td2[(s0 >> 8) & 0xff] ^ aes_td3[s3 & 0xff] ^ dk[2];
+		t3 = aes_td0[s3 >> 24] ^ aes_td1[(s2 >> 16) & 0xff] ^ aes_td2[(s1 >> 8) & 0xff] ^ aes_td3[s0 & 0xff] ^ dk[3];
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+
+	dk += 4;
+	t0 = ((WORD)INV_SBOX(s0 >> 24) << 24) ^ ((WORD)INV_SBOX(s3 >> 16) << 16) ^ ((WORD)INV_SBOX(s2 >> 8) << 8) ^ INV_SBOX(s1) ^ dk[0];
+	t1 = ((WORD)INV_SBOX(s1 >> 24) << 24) ^ ((WORD)INV_SBOX(s0 >> 16) << 16) ^ ((WORD)INV_SBOX(s3 >> 8) << 8) ^ INV_SBOX(s2) ^ dk[1];
+	t2 = ((WORD)INV_SBOX(s2 >> 24) << 24) ^ ((WORD)INV_SBOX(s1 >> 16) << 16) ^ ((WORD)INV_SBOX(s0 >> 8) << 8) ^ INV_SBOX(s3) ^ dk[2];
+	t3 = ((WORD)INV_SBOX(s3 >> 24) << 24) ^ ((WORD)INV_SBOX(s2 >> 16) << 16) ^ ((WORD)INV_SBOX(s1 >> 8) << 8) ^ INV_SBOX(s0) ^ dk[3];
+
+	PUT_WORD(out, t0);
+	PUT_WORD(out + 4, t1);
+	PUT_WORD(out + 8, t2);
+	PUT_WORD(out + 12, t3);
+}
+
+static void aes_encrypt_ttable(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	AES_SPECIALIZE_ROUNDS(keysize, ttable_encrypt, in, out, key);
+}
+
+// The single block interface only has the encryption schedule, so the decryption
+// schedule is derived on every call. aes_decrypt_ctx and the bulk functions use the one
+// cached in AES_CTX.
+static void aes_decrypt_ttable(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	WORD dk[60];
+
+	aes_key_setup_dec(key, dk, aes_rounds(keysize));
+	AES_SPECIALIZE_ROUNDS(keysize, ttable_decrypt, in, out, dk);
+}
+
+/////////////////
+// MULTI-BLOCK KERNELS
+/////////////////
+
+// The multi-block kernels process a run of independent blocks: ECB, the CTR keystream
+// and CBC decryption. The CTR kernels advance "ctr" by the number of blocks processed
+// and the CBC kernels leave the last ciphertext block in "iv", so consecutive calls
+// continue the same stream.
+
+// Reads and writes the 128-bit big endian CTR counter as two native integers.
+static void ctr_load(const BYTE ctr[], unsigned long long *hi, unsigned long long *lo)
+{
+	int idx;
+
+	*hi = 0;
+	*lo = 0;
+	for (idx = 0; idx < 8; idx++) {
+		*hi = (*hi << 8) | ctr[idx];
+		*lo = (*lo << 8) | ctr[idx + 8];
+	}
+}
+
+static void ctr_store(BYTE ctr[], unsigned long long hi, unsigned long long lo)
+{
+	int idx;
+
+	for (idx = 7; idx >= 0; idx--) {
+		ctr[idx] = (BYTE)hi;
+		ctr[idx + 8] = (BYTE)lo;
+		hi >>= 8;
+		lo >>= 8;
+	}
+}
+
+// One block at a time through aes_encrypt/aes_decrypt, for the reference implementation,
+// which decrypts with the encryption schedule and has no use for the cached one.
+static void aes_ecb_encrypt_generic(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	size_t idx;
+
+	for (idx = 0; idx < blocks; idx++)
+		aes_encrypt(&in[idx * AES_BLOCK_SIZE], &out[idx * AES_BLOCK_SIZE], ctx->key, ctx->keysize);
+}
+
+static void aes_ecb_decrypt_generic(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	size_t idx;
+
+	for (idx = 0; idx < blocks; idx++)
+		aes_decrypt(&in[idx * AES_BLOCK_SIZE], &out[idx * AES_BLOCK_SIZE], ctx->key, ctx->keysize);
+}
+
+static void aes_ctr_generic(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[])
+{
+	BYTE out_buf[AES_BLOCK_SIZE];
+	size_t idx;
+	int byte;
+
+	for (idx = 0; idx < blocks; idx++) {
+		aes_encrypt(ctr, out_buf, ctx->key, ctx->keysize);
+		for (byte = 0; byte < AES_BLOCK_SIZE; byte++)
+			out[idx * AES_BLOCK_SIZE + byte] = in[idx * AES_BLOCK_SIZE + byte] ^ out_buf[byte];
+		increment_iv(ctr, AES_BLOCK_SIZE);
+	}
+}
+
+static void aes_cbc_decrypt_generic(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	BYTE buf_in[AES_BLOCK_SIZE], buf_out[AES_BLOCK_SIZE];
+	size_t idx;
+
+	for (idx = 0; idx < blocks; idx++) {
+		memcpy(buf_in, &in[idx * AES_BLOCK_SIZE], AES_BLOCK_SIZE);
+		aes_decrypt(buf_in, buf_out, ctx->key, ctx->keysize);
+		xor_buf(iv, buf_out, AES_BLOCK_SIZE);
+		memcpy(&out[idx * AES_BLOCK_SIZE], buf_out, AES_BLOCK_SIZE);
+		memcpy(iv, buf_in, AES_BLOCK_SIZE);
+	}
+}
+
+static void aes_cbc_encrypt_generic(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	BYTE buf[AES_BLOCK_SIZE];
+	size_t idx;
+	int byte;
+
+	for (idx = 0; idx < blocks; idx++) {
+		for (byte = 0; byte < AES_BLOCK_SIZE; byte++)
+			buf[byte] = in[idx * AES_BLOCK_SIZE + byte] ^ iv[byte];
+		aes_encrypt(buf, iv, ctx->key, ctx->keysize);
+		memcpy(&out[idx * AES_BLOCK_SIZE], iv, AES_BLOCK_SIZE);
+	}
+}
+
+// The T-table kernels run the specialized round loop directly instead of calling
+// aes_encrypt/aes_decrypt for every block.
+AES_SPECIALIZED void ttable_ecb_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+		ttable_encrypt(in, out, key, rounds);
+}
+
+AES_SPECIALIZED void ttable_ecb_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+		ttable_decrypt(in, out, key, rounds);
+}
+
+// Each block is decrypted before its output is stored, so the buffers may be the same.
+AES_SPECIALIZED void ttable_cbc_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD dk[], BYTE iv[], int rounds)
+{
+	BYTE buf_in[AES_BLOCK_SIZE], buf_out[AES_BLOCK_SIZE];
+
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		memcpy(buf_in, in, AES_BLOCK_SIZE);
+		ttable_decrypt(buf_in, buf_out, dk, rounds);
+		xor_buf(iv, buf_out, AES_BLOCK_SIZE);
+		memcpy(out, buf_out, AES_BLOCK_SIZE);
+		memcpy(iv, buf_in, AES_BLOCK_SIZE);
+	}
+}
+
+AES_SPECIALIZED void ttable_ctr_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE ctr[], int rounds)
+{
+	BYTE out_buf[AES_BLOCK_SIZE];
+	int byte;
+
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		ttable_encrypt(ctr, out_buf, key, rounds);
+		for (byte = 0; byte < AES_BLOCK_SIZE; byte++)
+			out[byte] = in[byte] ^ out_buf[byte];
+		increment_iv(ctr, AES_BLOCK_SIZE);
+	}
+}
+
+// CBC encryption is serial, but the chain still skips the per-block dispatch.
+AES_SPECIALIZED void ttable_cbc_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE iv[], int rounds)
+{
+	BYTE buf[AES_BLOCK_SIZE];
+	int byte;
+
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		for (byte = 0; byte < AES_BLOCK_SIZE; byte++)
+			buf[byte] = in[byte] ^ iv[byte];
+		ttable_encrypt(buf, iv, key, rounds);
+		memcpy(out, iv, AES_BLOCK_SIZE);
+	}
+}
+
+static void ttable_ecb_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, ttable_ecb_encrypt_rounds, in, out, blocks, ctx->key);
+}
+
+static void ttable_ecb_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, ttable_ecb_decrypt_rounds, in, out, blocks, ctx->dec_key);
+}
+
+static void ttable_cbc_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, ttable_cbc_decrypt_rounds, in, out, blocks, ctx->dec_key, iv);
+}
+
+static void ttable_ctr(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, ttable_ctr_rounds, in, out, blocks, ctx->key, ctr);
+}
+
+static void ttable_cbc_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, ttable_cbc_encrypt_rounds, in, out, blocks, ctx->key, iv);
+}
+
+/////////////////
+// SSSE3 VECTOR PERMUTE (En/De)Crypt
+/////////////////
+
+#ifdef AES_X86
+
+// Constant-time software AES for CPUs without AES-NI. The state is one 16-byte vector in
+// memory order and the S-Box is applied with PSHUFB: each of its 16 rows is a 16-entry
+// table indexed by the low nibble, and every row is looked up for every byte, keeping
+// only the results whose high nibble matches. The tables are read from fixed addresses,
+// so neither the timing nor the cache footprint depend on the key or the data.
+
+#define VPERM __attribute__((target("ssse3")))
+
+#define VPERM_BSWAP_MASK      _mm_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12)
+#define VPERM_SHIFT_ROWS      _mm_setr_epi8(0,5,10,15, 4,9,14,3, 8,13,2,7, 12,1,6,11)
+#define VPERM_INV_SHIFT_ROWS  _mm_setr_epi8(0,13,10,7, 4,1,14,11, 8,5,2,15, 12,9,6,3)
+// Rotate the bytes of every column up by one, two and three rows.
+#define VPERM_ROT1            _mm_setr_epi8(1,2,3,0, 5,6,7,4, 9,10,11,8, 13,14,15,12)
+#define VPERM_ROT2            _mm_setr_epi8(2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13)
+#define VPERM_ROT3            _mm_setr_epi8(3,0,1,2, 7,4,5,6, 11,8,9,10, 15,12,13,14)
+
+// Round key "round" of the schedule, whose words are stored big endian.
+VPERM static inline __m128i vperm_round_key(const WORD key[], int round)
+{
+	return(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&key[round * 4]), VPERM_BSWAP_MASK));
+}
+
+// Substitutes the 16 bytes of "x" with a 16x16 S-Box. PSHUFB returns zero for indexes
+// with the top bit set, and a saturating add of 0x70 sets it for every byte whose high
+// nibble is not zero. Subtracting 0x10 per row brings the next row's bytes to zero.
+VPERM static inline __m128i vperm_sub_bytes(__m128i x, const BYTE box[][16])
+{
+	const __m128i select = _mm_set1_epi8(0x70), next = _mm_set1_epi8(0x10);
+	__m128i result = _mm_setzero_si128();
+	int row;
+
+#pragma GCC unroll 16
+	for (row = 0; row < 16; row++) {
+		result = _mm_or_si128(result, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)box[row]),
+		                                               _mm_adds_epu8(x, select)));
+		x = _mm_sub_epi8(x, next);
+	}
+	return(result);
+}
+
+// Four states share each row of the S-Box, which also gives the CPU four independent
+// dependency chains.
+VPERM static inline void vperm_sub_bytes4(__m128i b[], const BYTE box[][16])
+{
+	const __m128i select = _mm_set1_epi8(0x70), next = _mm_set1_epi8(0x10);
+	__m128i x0 = b[0], x1 = b[1], x2 = b[2], x3 = b[3], row_data;
+	__m128i r0, r1, r2, r3;
+	int row;
+
+	r0 = r1 = r2 = r3 = _mm_setzero_si128();
+	for (row = 0; row < 16; row++) {
+		row_data = _mm_loadu_si128((const __m128i *)box[row]);
+		r0 = _mm_or_si128(r0, _mm_shuffle_epi8(row_data, _mm_adds_epu8(x0, select)));
+		r1 = _mm_or_si128(r1, _mm_shuffle_epi8(row_data, _mm_adds_epu8(x1, select)));
+		r2 = _mm_or_si128(r2, _mm_shuffle_epi8(row_data, _mm_adds_epu8(x2, select)));
+		r3 = _mm_or_si128(r3, _mm_shuffle_epi8(row_data, _mm_adds_epu8(x3, select)));
+		x0 = _mm_sub_epi8(x0, next);
+		x1 = _mm_sub_epi8(x1, next);
+		x2 = _mm_sub_epi8(x2, next);
+		x3 = _mm_sub_epi8(x3, next);
+	}
+	b[0] = r0; b[1] = r1; b[2] = r2; b[3] = r3;
+}
+
+VPERM static inline __m128i vperm_xtime(__m128i x)
+{
+	__m128i carry = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+
+	return(_mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(carry, _mm_set1_epi8(0x1b))));
+}
+
+// Same decompositions as MixColumnWord and InvMixColumnWord, on the four columns at once.
+VPERM static inline __m128i vperm_mix_columns(__m128i x)
+{
+	__m128i r1 = _mm_shuffle_epi8(x, VPERM_ROT1);
+	__m128i r23 = _mm_xor_si128(_mm_shuffle_epi8(x, VPERM_ROT2), _mm_shuffle_epi8(x, VPERM_ROT3));
+
+	return(_mm_xor_si128(_mm_xor_si128(vperm_xtime(_mm_xor_si128(x, r1)), r1), r23));
+}
+
+VPERM static inline __m128i vperm_inv_mix_columns(__m128i x)
+{
+	__m128i u = vperm_xtime(vperm_xtime(_mm_xor_si128(x, _mm_shuffle_epi8(x, VPERM_ROT2))));
+
+	return(vperm_mix_columns(_mm_xor_si128(x, u)));
+}
+
+AES_SPECIALIZED VPERM __m128i vperm_encrypt1(__m128i state, const WORD key[], int rounds)
+{
+	int round;
+
+	state = _mm_xor_si128(state, vperm_round_key(key, 0));
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++) {
+		state = _mm_shuffle_epi8(vperm_sub_bytes(state, aes_sbox), VPERM_SHIFT_ROWS);
+		state = _mm_xor_si128(vperm_mix_columns(state), vperm_round_key(key, round));
+	}
+	state = _mm_shuffle_epi8(vperm_sub_bytes(state, aes_sbox), VPERM_SHIFT_ROWS);
+	return(_mm_xor_si128(state, vperm_round_key(key, rounds)));
+}
+
+AES_SPECIALIZED VPERM __m128i vperm_decrypt1(__m128i state, const WORD key[], int rounds)
+{
+	int round;
+
+	state = _mm_xor_si128(state, vperm_round_key(key, rounds));
+#pragma GCC unroll 14
+	for (round = rounds - 1; round > 0; round--) {
+		state = vperm_sub_bytes(_mm_shuffle_epi8(state, VPERM_INV_SHIFT_ROWS), aes_invsbox);
+		state = vperm_inv_mix_columns(_mm_xor_si128(state, vperm_round_key(key, round)));
+	}
+	state = vperm_sub_bytes(_mm_shuffle_epi8(state, VPERM_INV_SHIFT_ROWS), aes_invsbox);
+	return(_mm_xor_si128(state, vperm_round_key(key, 0)));
+}
+
+VPERM static void aes_encrypt_vperm(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	_mm_storeu_si128((__m128i *)out, vperm_encrypt1(_mm_loadu_si128((const __m128i *)in), key, aes_rounds(keysize)));
+}
+
+VPERM static void aes_decrypt_vperm(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	_mm_storeu_si128((__m128i *)out, vperm_decrypt1(_mm_loadu_si128((const __m128i *)in), key, aes_rounds(keysize)));
+}
+
+AES_SPECIALIZED VPERM void vperm_encrypt4(__m128i b[], const WORD key[], int rounds)
+{
+	__m128i rk = vperm_round_key(key, 0);
+	int round, idx;
+
+	for (idx = 0; idx < 4; idx++)
+		b[idx] = _mm_xor_si128(b[idx], rk);
+#pragma GCC unroll 14
+	for (round = 1; round <= rounds; round++) {
+		rk = vperm_round_key(key, round);
+		vperm_sub_bytes4(b, aes_sbox);
+		for (idx = 0; idx < 4; idx++) {
+			b[idx] = _mm_shuffle_epi8(b[idx], VPERM_SHIFT_ROWS);
+			if (round < rounds)
+				b[idx] = vperm_mix_columns(b[idx]);
+			b[idx] = _mm_xor_si128(b[idx], rk);
+		}
+	}
+}
+
+AES_SPECIALIZED VPERM void vperm_decrypt4(__m128i b[], const WORD key[], int rounds)
+{
+	__m128i rk = vperm_round_key(key, rounds);
+	int round, idx;
+
+	for (idx = 0; idx < 4; idx++)
+		b[idx] = _mm_shuffle_epi8(_mm_xor_si128(b[idx], rk), VPERM_INV_SHIFT_ROWS);
+#pragma GCC unroll 14
+	for (round = rounds - 1; round >= 0; round--) {
+		rk = vperm_round_key(key, round);
+		vperm_sub_bytes4(b, aes_invsbox);
+		for (idx = 0; idx < 4; idx++) {
+			b[idx] = _mm_xor_si128(b[idx], rk);
+			if (round > 0)
+				b[idx] = _mm_shuffle_epi8(vperm_inv_mix_columns(b[idx]), VPERM_INV_SHIFT_ROWS);
+		}
+	}
+}
+
+// Multi-block kernels, four blocks per iteration and the rest one at a time.
+AES_SPECIALIZED VPERM void vperm_ecb_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i b[4];
+	int idx;
+
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++)
+			b[idx] = _mm_loadu_si128((const __m128i *)in + idx);
+		vperm_encrypt4(b, key, rounds);
+		for (idx = 0; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, b[idx]);
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+		_mm_storeu_si128((__m128i *)out, vperm_encrypt1(_mm_loadu_si128((const __m128i *)in), key, rounds));
+}
+
+AES_SPECIALIZED VPERM void vperm_ecb_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i b[4];
+	int idx;
+
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++)
+			b[idx] = _mm_loadu_si128((const __m128i *)in + idx);
+		vperm_decrypt4(b, key, rounds);
+		for (idx = 0; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, b[idx]);
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+		_mm_storeu_si128((__m128i *)out, vperm_decrypt1(_mm_loadu_si128((const __m128i *)in), key, rounds));
+}
+
+AES_SPECIALIZED VPERM void vperm_ctr_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE ctr[], int rounds)
+{
+	__m128i b[4];
+	unsigned long long hi, lo;
+	int idx;
+
+	ctr_load(ctr, &hi, &lo);
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++) {
+			b[idx] = _mm_set_epi64x(__builtin_bswap64(lo), __builtin_bswap64(hi));
+			if (++lo == 0)
+				hi++;
+		}
+		vperm_encrypt4(b, key, rounds);
+		for (idx = 0; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, _mm_xor_si128(b[idx], _mm_loadu_si128((const __m128i *)in + idx)));
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		b[0] = vperm_encrypt1(_mm_set_epi64x(__builtin_bswap64(lo), __builtin_bswap64(hi)), key, rounds);
+		if (++lo == 0)
+			hi++;
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(b[0], _mm_loadu_si128((const __m128i *)in)));
+	}
+	ctr_store(ctr, hi, lo);
+}
+
+AES_SPECIALIZED VPERM void vperm_cbc_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE iv[], int rounds)
+{
+	__m128i b[4], c[4];
+	__m128i prev = _mm_loadu_si128((const __m128i *)iv);
+	int idx;
+
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++)
+			b[idx] = c[idx] = _mm_loadu_si128((const __m128i *)in + idx);
+		vperm_decrypt4(b, key, rounds);
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(b[0], prev));
+		for (idx = 1; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, _mm_xor_si128(b[idx], c[idx - 1]));
+		prev = c[3];
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		c[0] = _mm_loadu_si128((const __m128i *)in);
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(vperm_decrypt1(c[0], key, rounds), prev));
+		prev = c[0];
+	}
+	_mm_storeu_si128((__m128i *)iv, prev);
+}
+
+AES_SPECIALIZED VPERM void vperm_cbc_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE iv[], int rounds)
+{
+	__m128i state = _mm_loadu_si128((const __m128i *)iv);
+
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		state = vperm_encrypt1(_mm_xor_si128(state, _mm_loadu_si128((const __m128i *)in)), key, rounds);
+		_mm_storeu_si128((__m128i *)out, state);
+	}
+	_mm_storeu_si128((__m128i *)iv, state);
+}
+
+VPERM static void vperm_ecb_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vperm_ecb_encrypt_rounds, in, out, blocks, ctx->key);
+}
+
+VPERM static void vperm_ecb_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vperm_ecb_decrypt_rounds, in, out, blocks, ctx->key);
+}
+
+VPERM static void vperm_ctr(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vperm_ctr_rounds, in, out, blocks, ctx->key, ctr);
+}
+
+VPERM static void vperm_cbc_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vperm_cbc_decrypt_rounds, in, out, blocks, ctx->key, iv);
+}
+
+VPERM static void vperm_cbc_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vperm_cbc_encrypt_rounds, in, out, blocks, ctx->key, iv);
+}
+
+// SubWord() without table lookups indexed by the key.
+VPERM static WORD vperm_sub_word(WORD word)
+{
+	return((WORD)_mm_cvtsi128_si32(vperm_sub_bytes(_mm_cvtsi32_si128((int)word), aes_sbox)));
+}
+
+// Same expansion as aes_key_setup_reference, with SubWord done in registers.
+VPERM static void aes_key_setup_vperm(const BYTE key[], WORD w[], int keysize)
+{
+	int Nk, idx, total;
+	WORD temp, rcon = 0x01000000;
+
+	switch (keysize) {
+		case 128: Nk = 4; break;
+		case 192: Nk = 6; break;
+		case 256: Nk = 8; break;
+		default: return;
+	}
+	total = 4 * (aes_rounds(keysize) + 1);
+
+	for (idx = 0; idx < Nk; idx++)
+		w[idx] = GET_WORD(&key[4 * idx]);
+
+	for (idx = Nk; idx < total; idx++) {
+		temp = w[idx - 1];
+		if ((idx % Nk) == 0) {
+			temp = vperm_sub_word(KE_ROTWORD(temp)) ^ rcon;
+			rcon = XTIME_WORD(rcon);
+		}
+		else if (Nk > 6 && (idx % Nk) == 4)
+			temp = vperm_sub_word(temp);
+		w[idx] = w[idx - Nk] ^ temp;
+	}
+}
+
+#endif   // AES_X86
+
+/////////////////
+// AES-NI (En/De)Crypt
+/////////////////
+
+#ifdef AES_X86
+
+#define AESNI __attribute__((target("aes,ssse3")))
+
+// The key schedule stores each word big endian in a WORD, while the AES instructions
+// expect the round key bytes in memory order. This shuffle swaps the bytes of each word
+// and converts between both layouts in either direction.
+#define AESNI_BSWAP_MASK _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3)
+
+AESNI static inline __m128i aesni_load_round_key(const WORD key[])
+{
+	return(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)key), AESNI_BSWAP_MASK));
+}
+
+AESNI static inline void aesni_store_round_key(WORD key[], __m128i round_key)
+{
+	_mm_storeu_si128((__m128i *)key, _mm_shuffle_epi8(round_key, AESNI_BSWAP_MASK));
+}
+
+// Adds the three lower words of the previous round key into the upper ones, the
+// running XOR every key expansion step needs.
+AESNI static inline __m128i aesni_key_xor_shift(__m128i key)
+{
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return(_mm_xor_si128(key, _mm_slli_si128(key, 4)));
+}
+
+#define AESNI_EXPAND_128(k,rcon) _mm_xor_si128(aesni_key_xor_shift(k), \
+                                 _mm_shuffle_epi32(_mm_aeskeygenassist_si128((k), (rcon)), 0xff))
+
+AESNI static void aesni_key_setup_128(const BYTE key[], __m128i rk[])
+{
+	rk[0] = _mm_loadu_si128((const __m128i *)key);
+	rk[1] = AESNI_EXPAND_128(rk[0], 0x01);
+	rk[2] = AESNI_EXPAND_128(rk[1], 0x02);
+	rk[3] = AESNI_EXPAND_128(rk[2], 0x04);
+	rk[4] = AESNI_EXPAND_128(rk[3], 0x08);
+	rk[5] = AESNI_EXPAND_128(rk[4], 0x10);
+	rk[6] = AESNI_EXPAND_128(rk[5], 0x20);
+	rk[7] = AESNI_EXPAND_128(rk[6], 0x40);
+	rk[8] = AESNI_EXPAND_128(rk[7], 0x80);
+	rk[9] = AESNI_EXPAND_128(rk[8], 0x1b);
+	rk[10] = AESNI_EXPAND_128(rk[9], 0x36);
+}
+
+// One step of the 192-bit expansion: produces six new words, four in *lo and the
+// remaining two in the low half of *hi.
+#define AESNI_EXPAND_192(lo,hi,rcon) { \
+	__m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(hi, (rcon)), 0x55); \
+	lo = _mm_xor_si128(aesni_key_xor_shift(lo), assist); \
+	hi = _mm_xor_si128(_mm_xor_si128(hi, _mm_slli_si128(hi, 4)), _mm_shuffle_epi32(lo, 0xff)); }
+
+#define AESNI_MERGE_LO(a,b) _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b), 0))
+#define AESNI_MERGE_HI(a,b) _mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b), 1))
+
+AESNI static void aesni_key_setup_192(const BYTE key[], __m128i rk[])
+{
+	__m128i lo = _mm_loadu_si128((const __m128i *)key);
+	__m128i hi = _mm_loadl_epi64((const __m128i *)(key + 16));
+
+	rk[0] = lo;
+	rk[1] = hi;
+	AESNI_EXPAND_192(lo, hi, 0x01);
+	rk[1] = AESNI_MERGE_LO(rk[1], lo);
+	rk[2] = AESNI_MERGE_HI(lo, hi);
+	AESNI_EXPAND_192(lo, hi, 0x02);
+	rk[3] = lo;
+	rk[4] = hi;
+	AESNI_EXPAND_192(lo, hi, 0x04);
+	rk[4] = AESNI_MERGE_LO(rk[4], lo);
+	rk[5] = AESNI_MERGE_HI(lo, hi);
+	AESNI_EXPAND_192(lo, hi, 0x08);
+	rk[6] = lo;
+	rk[7] = hi;
+	AESNI_EXPAND_192(lo, hi, 0x10);
+	rk[7] = AESNI_MERGE_LO(rk[7], lo);
+	rk[8] = AESNI_MERGE_HI(lo, hi);
+	AESNI_EXPAND_192(lo, hi, 0x20);
+	rk[9] = lo;
+	rk[10] = hi;
+	AESNI_EXPAND_192(lo, hi, 0x40);
+	rk[10] = AESNI_MERGE_LO(rk[10], lo);
+	rk[11] = AESNI_MERGE_HI(lo, hi);
+	AESNI_EXPAND_192(lo, hi, 0x80);
+	rk[12] = lo;
+}
+
+// The 256-bit expansion alternates two kinds of steps: even round keys use
+// RotWord/SubWord/Rcon of the last word, odd ones only SubWord.
+#define AESNI_EXPAND_256_A(a,b,rcon) _mm_xor_si128(aesni_key_xor_shift(a), \
+                                     _mm_shuffle_epi32(_mm_aeskeygenassist_si128((b), (rcon)), 0xff))
+#define AESNI_EXPAND_256_B(a,b) _mm_xor_si128(aesni_key_xor_shift(b), \
+                                _mm_shuffle_epi32(_mm_aeskeygenassist_si128((a), 0x00), 0xaa))
+
+AESNI static void aesni_key_setup_256(const BYTE key[], __m128i rk[])
+{
+	rk[0] = _mm_loadu_si128((const __m128i *)key);
+	rk[1] = _mm_loadu_si128((const __m128i *)(key + 16));
+	rk[2] = AESNI_EXPAND_256_A(rk[0], rk[1], 0x01);
+	rk[3] = AESNI_EXPAND_256_B(rk[2], rk[1]);
+	rk[4] = AESNI_EXPAND_256_A(rk[2], rk[3], 0x02);
+	rk[5] = AESNI_EXPAND_256_B(rk[4], rk[3]);
+	rk[6] = AESNI_EXPAND_256_A(rk[4], rk[5], 0x04);
+	rk[7] = AESNI_EXPAND_256_B(rk[6], rk[5]);
+	rk[8] = AESNI_EXPAND_256_A(rk[6], rk[7], 0x08);
+	rk[9] = AESNI_EXPAND_256_B(rk[8], rk[7]);
+	rk[10] = AESNI_EXPAND_256_A(rk[8], rk[9], 0x10);
+	rk[11] = AESNI_EXPAND_256_B(rk[10], rk[9]);
+	rk[12] = AESNI_EXPAND_256_A(rk[10], rk[11], 0x20);
+	rk[13] = AESNI_EXPAND_256_B(rk[12], rk[11]);
+	rk[14] = AESNI_EXPAND_256_A(rk[12], rk[13], 0x40);
+}
+
+// Expands the key with AESKEYGENASSIST and stores it in the same big endian word
+// layout aes_key_setup_reference() produces, so the schedule works with every
+// implementation.
+AESNI static void aes_key_setup_aesni(const BYTE key[], WORD w[], int keysize)
+{
+	__m128i rk[AES_256_ROUNDS + 1];
+	int idx, rounds;
+
+	switch (keysize) {
+		case 128: aesni_key_setup_128(key, rk); rounds = AES_128_ROUNDS; break;
+		case 192: aesni_key_setup_192(key, rk); rounds = AES_192_ROUNDS; break;
+		case 256: aesni_key_setup_256(key, rk); rounds = AES_256_ROUNDS; break;
+		default: return;
+	}
+
+	for (idx = 0; idx <= rounds; idx++)
+		aesni_store_round_key(&w[idx * 4], rk[idx]);
+}
+
+AESNI static void aes_encrypt_aesni(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	__m128i state = _mm_loadu_si128((const __m128i *)in);
+	int round, rounds = aes_rounds(keysize);
+
+	state = _mm_xor_si128(state, aesni_load_round_key(&key[0]));
+	for (round = 1; round < rounds; round++)
+		state = _mm_aesenc_si128(state, aesni_load_round_key(&key[round * 4]));
+	state = _mm_aesenclast_si128(state, aesni_load_round_key(&key[rounds * 4]));
+
+	_mm_storeu_si128((__m128i *)out, state);
+}
+
+// AESDEC implements the equivalent inverse cipher, so the inner round keys have to go
+// through InvMixColumns (AESIMC) first.
+AESNI static void aes_decrypt_aesni(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	__m128i state = _mm_loadu_si128((const __m128i *)in);
+	int round, rounds = aes_rounds(keysize);
+
+	state = _mm_xor_si128(state, aesni_load_round_key(&key[rounds * 4]));
+	for (round = rounds - 1; round > 0; round--)
+		state = _mm_aesdec_si128(state, _mm_aesimc_si128(aesni_load_round_key(&key[round * 4])));
+	state = _mm_aesdeclast_si128(state, aesni_load_round_key(&key[0]));
+
+	_mm_storeu_si128((__m128i *)out, state);
+}
+
+// Loads the whole key schedule once per call, in the layout the instructions expect. The
+// decryption kernels receive the equivalent inverse cipher schedule cached in AES_CTX,
+// which is the one AESDEC takes.
+AESNI static inline void aesni_load_schedule(const WORD key[], int rounds, __m128i rk[])
+{
+	int idx;
+
+	for (idx = 0; idx <= rounds; idx++)
+		rk[idx] = aesni_load_round_key(&key[idx * 4]);
+}
+
+AES_SPECIALIZED AESNI __m128i aesni_encrypt1(__m128i b, const __m128i rk[], int rounds)
+{
+	int round;
+
+	b = _mm_xor_si128(b, rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++)
+		b = _mm_aesenc_si128(b, rk[round]);
+	return(_mm_aesenclast_si128(b, rk[rounds]));
+}
+
+AES_SPECIALIZED AESNI __m128i aesni_decrypt1(__m128i b, const __m128i rk[], int rounds)
+{
+	int round;
+
+	b = _mm_xor_si128(b, rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++)
+		b = _mm_aesdec_si128(b, rk[round]);
+	return(_mm_aesdeclast_si128(b, rk[rounds]));
+}
+
+// Four independent blocks per round keep the AES unit busy while each one waits for the
+// result of its previous round.
+AES_SPECIALIZED AESNI void aesni_encrypt4(__m128i b[], const __m128i rk[], int rounds)
+{
+	int round;
+
+	b[0] = _mm_xor_si128(b[0], rk[0]);
+	b[1] = _mm_xor_si128(b[1], rk[0]);
+	b[2] = _mm_xor_si128(b[2], rk[0]);
+	b[3] = _mm_xor_si128(b[3], rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++) {
+		b[0] = _mm_aesenc_si128(b[0], rk[round]);
+		b[1] = _mm_aesenc_si128(b[1], rk[round]);
+		b[2] = _mm_aesenc_si128(b[2], rk[round]);
+		b[3] = _mm_aesenc_si128(b[3], rk[round]);
+	}
+	b[0] = _mm_aesenclast_si128(b[0], rk[rounds]);
+	b[1] = _mm_aesenclast_si128(b[1], rk[rounds]);
+	b[2] = _mm_aesenclast_si128(b[2], rk[rounds]);
+	b[3] = _mm_aesenclast_si128(b[3], rk[rounds]);
+}
+
+AES_SPECIALIZED AESNI void aesni_decrypt4(__m128i b[], const __m128i rk[], int rounds)
+{
+	int round;
+
+	b[0] = _mm_xor_si128(b[0], rk[0]);
+	b[1] = _mm_xor_si128(b[1], rk[0]);
+	b[2] = _mm_xor_si128(b[2], rk[0]);
+	b[3] = _mm_xor_si128(b[3], rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++) {
+		b[0] = _mm_aesdec_si128(b[0], rk[round]);
+		b[1] = _mm_aesdec_si128(b[1], rk[round]);
+		b[2] = _mm_aesdec_si128(b[2], rk[round]);
+		b[3] = _mm_aesdec_si128(b[3], rk[round]);
+	}
+	b[0] = _mm_aesdeclast_si128(b[0], rk[rounds]);
+	b[1] = _mm_aesdeclast_si128(b[1], rk[rounds]);
+	b[2] = _mm_aesdeclast_si128(b[2], rk[rounds]);
+	b[3] = _mm_aesdeclast_si128(b[3], rk[rounds]);
+}
+
+// Builds the counter block for the 128-bit counter hi:lo.
+AESNI static inline __m128i aesni_ctr_block(unsigned long long hi, unsigned long long lo)
+{
+	return(_mm_set_epi64x(__builtin_bswap64(lo), __builtin_bswap64(hi)));
+}
+
+AES_SPECIALIZED AESNI void aesni_ecb_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i rk[AES_256_ROUNDS + 1], b[4];
+	int idx;
+
+	aesni_load_schedule(key, rounds, rk);
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++)
+			b[idx] = _mm_loadu_si128((const __m128i *)in + idx);
+		aesni_encrypt4(b, rk, rounds);
+		for (idx = 0; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, b[idx]);
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+		_mm_storeu_si128((__m128i *)out, aesni_encrypt1(_mm_loadu_si128((const __m128i *)in), rk, rounds));
+}
+
+AES_SPECIALIZED AESNI void aesni_ecb_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i rk[AES_256_ROUNDS + 1], b[4];
+	int idx;
+
+	aesni_load_schedule(key, rounds, rk);
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++)
+			b[idx] = _mm_loadu_si128((const __m128i *)in + idx);
+		aesni_decrypt4(b, rk, rounds);
+		for (idx = 0; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, b[idx]);
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE)
+		_mm_storeu_si128((__m128i *)out, aesni_decrypt1(_mm_loadu_si128((const __m128i *)in), rk, rounds));
+}
+
+AES_SPECIALIZED AESNI void aesni_ctr_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE ctr[], int rounds)
+{
+	__m128i rk[AES_256_ROUNDS + 1], b[4];
+	unsigned long long hi, lo;
+	int idx;
+
+	aesni_load_schedule(key, rounds, rk);
+	ctr_load(ctr, &hi, &lo);
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++) {
+			b[idx] = aesni_ctr_block(hi, lo);
+			if (++lo == 0)
+				hi++;
+		}
+		aesni_encrypt4(b, rk, rounds);
+		for (idx = 0; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, _mm_xor_si128(b[idx], _mm_loadu_si128((const __m128i *)in + idx)));
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		b[0] = aesni_encrypt1(aesni_ctr_block(hi, lo), rk, rounds);
+		if (++lo == 0)
+			hi++;
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(b[0], _mm_loadu_si128((const __m128i *)in)));
+	}
+	ctr_store(ctr, hi, lo);
+}
+
+AES_SPECIALIZED AESNI void aesni_cbc_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE iv[], int rounds)
+{
+	__m128i rk[AES_256_ROUNDS + 1], b[4], c[4];
+	__m128i prev = _mm_loadu_si128((const __m128i *)iv);
+	int idx;
+
+	aesni_load_schedule(key, rounds, rk);
+	for ( ; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE, out += 4 * AES_BLOCK_SIZE) {
+		for (idx = 0; idx < 4; idx++)
+			b[idx] = c[idx] = _mm_loadu_si128((const __m128i *)in + idx);
+		aesni_decrypt4(b, rk, rounds);
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(b[0], prev));
+		for (idx = 1; idx < 4; idx++)
+			_mm_storeu_si128((__m128i *)out + idx, _mm_xor_si128(b[idx], c[idx - 1]));
+		prev = c[3];
+	}
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		c[0] = _mm_loadu_si128((const __m128i *)in);
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(aesni_decrypt1(c[0], rk, rounds), prev));
+		prev = c[0];
+	}
+	_mm_storeu_si128((__m128i *)iv, prev);
+}
+
+// CBC encryption is sequential, but the schedule is loaded once per call and the
+// chaining value stays in a register.
+AES_SPECIALIZED AESNI void aesni_cbc_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE iv[], int rounds)
+{
+	__m128i rk[AES_256_ROUNDS + 1];
+	__m128i state = _mm_loadu_si128((const __m128i *)iv);
+
+	aesni_load_schedule(key, rounds, rk);
+	for ( ; blocks > 0; blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		state = aesni_encrypt1(_mm_xor_si128(state, _mm_loadu_si128((const __m128i *)in)), rk, rounds);
+		_mm_storeu_si128((__m128i *)out, state);
+	}
+	_mm_storeu_si128((__m128i *)iv, state);
+}
+
+// CCM needs a CBC-MAC over the plaintext and a CTR keystream. The MAC chain is serial,
+// but the keystream does not depend on it, so every iteration runs the MAC of the
+// previous block and the keystream of the current one through the same rounds. While
+// one waits for the result of its last round, the other one is in the AES unit. Working
+// one block behind also lets decryption MAC the plaintext it has just produced.
+AES_SPECIALIZED AESNI void aesni_ccm_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE ctr[], BYTE mac[], int decrypt, int rounds)
+{
+	__m128i rk[AES_256_ROUNDS + 1], tag, ks, text, plain;
+	unsigned long long hi, lo;
+	int round;
+
+	if (blocks == 0)
+		return;
+
+	aesni_load_schedule(key, rounds, rk);
+	ctr_load(ctr, &hi, &lo);
+	tag = _mm_loadu_si128((const __m128i *)mac);
+
+	ks = aesni_encrypt1(aesni_ctr_block(hi, lo), rk, rounds);
+	if (++lo == 0)
+		hi++;
+	text = _mm_loadu_si128((const __m128i *)in);
+	_mm_storeu_si128((__m128i *)out, _mm_xor_si128(text, ks));
+	plain = decrypt ? _mm_xor_si128(text, ks) : text;
+
+	for (blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE; blocks > 0;
+	     blocks--, in += AES_BLOCK_SIZE, out += AES_BLOCK_SIZE) {
+		ks = _mm_xor_si128(aesni_ctr_block(hi, lo), rk[0]);
+		tag = _mm_xor_si128(_mm_xor_si128(tag, plain), rk[0]);
+		if (++lo == 0)
+			hi++;
+#pragma GCC unroll 14
+		for (round = 1; round < rounds; round++) {
+			ks = _mm_aesenc_si128(ks, rk[round]);
+			tag = _mm_aesenc_si128(tag, rk[round]);
+		}
+		ks = _mm_aesenclast_si128(ks, rk[rounds]);
+		tag = _mm_aesenclast_si128(tag, rk[rounds]);
+
+		text = _mm_loadu_si128((const __m128i *)in);
+		_mm_storeu_si128((__m128i *)out, _mm_xor_si128(text, ks));
+		plain = decrypt ? _mm_xor_si128(text, ks) : text;
+	}
+
+	tag = aesni_encrypt1(_mm_xor_si128(tag, plain), rk, rounds);
+	_mm_storeu_si128((__m128i *)mac, tag);
+	ctr_store(ctr, hi, lo);
+}
+
+AESNI static void aesni_ecb_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, aesni_ecb_encrypt_rounds, in, out, blocks, ctx->key);
+}
+
+AESNI static void aesni_ecb_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, aesni_ecb_decrypt_rounds, in, out, blocks, ctx->dec_key);
+}
+
+AESNI static void aesni_ctr(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, aesni_ctr_rounds, in, out, blocks, ctx->key, ctr);
+}
+
+AESNI static void aesni_cbc_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, aesni_cbc_decrypt_rounds, in, out, blocks, ctx->dec_key, iv);
+}
+
+AESNI static void aesni_cbc_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, aesni_cbc_encrypt_rounds, in, out, blocks, ctx->key, iv);
+}
+
+AESNI static void aesni_ccm(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[], BYTE mac[], int decrypt)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, aesni_ccm_rounds, in, out, blocks, ctx->key, ctr, mac, decrypt);
+}
+
+/////////////////
+// VAES MULTI-BLOCK KERNELS
+/////////////////
+
+// VAES runs AESENC/AESDEC on every 128-bit lane of a 256-bit (AVX2) or 512-bit
+// (AVX-512) register. With four registers per iteration the kernels process 8 and 16
+// blocks at a time. Runs shorter than a full iteration go through the AES-NI kernels.
+
+#define VAES256 __attribute__((target("vaes,avx2,aes,ssse3")))
+#define VAES512 __attribute__((target("vaes,avx512f,avx512bw,avx2,aes,ssse3")))
+
+// Reverses the 16 bytes of each lane: turns the counter stored as little endian
+// 64-bit halves [lo, hi] into its big endian counter block.
+#define VAES_CTR_BSWAP_MASK _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15)
+
+AES_SPECIALIZED VAES256 void vaes256_encrypt4(__m256i b[], const __m256i rk[], int rounds)
+{
+	int round;
+
+	b[0] = _mm256_xor_si256(b[0], rk[0]);
+	b[1] = _mm256_xor_si256(b[1], rk[0]);
+	b[2] = _mm256_xor_si256(b[2], rk[0]);
+	b[3] = _mm256_xor_si256(b[3], rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++) {
+		b[0] = _mm256_aesenc_epi128(b[0], rk[round]);
+		b[1] = _mm256_aesenc_epi128(b[1], rk[round]);
+		b[2] = _mm256_aesenc_epi128(b[2], rk[round]);
+		b[3] = _mm256_aesenc_epi128(b[3], rk[round]);
+	}
+	b[0] = _mm256_aesenclast_epi128(b[0], rk[rounds]);
+	b[1] = _mm256_aesenclast_epi128(b[1], rk[rounds]);
+	b[2] = _mm256_aesenclast_epi128(b[2], rk[rounds]);
+	b[3] = _mm256_aesenclast_epi128(b[3], rk[rounds]);
+}
+
+AES_SPECIALIZED VAES256 void vaes256_decrypt4(__m256i b[], const __m256i rk[], int rounds)
+{
+	int round;
+
+	b[0] = _mm256_xor_si256(b[0], rk[0]);
+	b[1] = _mm256_xor_si256(b[1], rk[0]);
+	b[2] = _mm256_xor_si256(b[2], rk[0]);
+	b[3] = _mm256_xor_si256(b[3], rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++) {
+		b[0] = _mm256_aesdec_epi128(b[0], rk[round]);
+		b[1] = _mm256_aesdec_epi128(b[1], rk[round]);
+		b[2] = _mm256_aesdec_epi128(b[2], rk[round]);
+		b[3] = _mm256_aesdec_epi128(b[3], rk[round]);
+	}
+	b[0] = _mm256_aesdeclast_epi128(b[0], rk[rounds]);
+	b[1] = _mm256_aesdeclast_epi128(b[1], rk[rounds]);
+	b[2] = _mm256_aesdeclast_epi128(b[2], rk[rounds]);
+	b[3] = _mm256_aesdeclast_epi128(b[3], rk[rounds]);
+}
+
+VAES256 static inline void vaes256_load4(const BYTE in[], __m256i b[])
+{
+	b[0] = _mm256_loadu_si256((const __m256i *)in + 0);
+	b[1] = _mm256_loadu_si256((const __m256i *)in + 1);
+	b[2] = _mm256_loadu_si256((const __m256i *)in + 2);
+	b[3] = _mm256_loadu_si256((const __m256i *)in + 3);
+}
+
+VAES256 static inline void vaes256_store4(BYTE out[], const __m256i b[])
+{
+	_mm256_storeu_si256((__m256i *)out + 0, b[0]);
+	_mm256_storeu_si256((__m256i *)out + 1, b[1]);
+	_mm256_storeu_si256((__m256i *)out + 2, b[2]);
+	_mm256_storeu_si256((__m256i *)out + 3, b[3]);
+}
+
+VAES256 static inline void vaes256_xor4(__m256i b[], const __m256i x[])
+{
+	b[0] = _mm256_xor_si256(b[0], x[0]);
+	b[1] = _mm256_xor_si256(b[1], x[1]);
+	b[2] = _mm256_xor_si256(b[2], x[2]);
+	b[3] = _mm256_xor_si256(b[3], x[3]);
+}
+
+VAES256 static inline void vaes256_broadcast_schedule(const __m128i rk128[], int rounds, __m256i rk[])
+{
+	int idx;
+
+	for (idx = 0; idx <= rounds; idx++)
+		rk[idx] = _mm256_broadcastsi128_si256(rk128[idx]);
+}
+
+AES_SPECIALIZED VAES256 void vaes256_ecb_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m256i rk[AES_256_ROUNDS + 1], b[4];
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes256_broadcast_schedule(rk128, rounds, rk);
+	for ( ; blocks >= 8; blocks -= 8, in += 8 * AES_BLOCK_SIZE, out += 8 * AES_BLOCK_SIZE) {
+		vaes256_load4(in, b);
+		vaes256_encrypt4(b, rk, rounds);
+		vaes256_store4(out, b);
+	}
+	aesni_ecb_encrypt_rounds(in, out, blocks, key, rounds);
+}
+
+AES_SPECIALIZED VAES256 void vaes256_ecb_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m256i rk[AES_256_ROUNDS + 1], b[4];
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes256_broadcast_schedule(rk128, rounds, rk);
+	for ( ; blocks >= 8; blocks -= 8, in += 8 * AES_BLOCK_SIZE, out += 8 * AES_BLOCK_SIZE) {
+		vaes256_load4(in, b);
+		vaes256_decrypt4(b, rk, rounds);
+		vaes256_store4(out, b);
+	}
+	aesni_ecb_decrypt_rounds(in, out, blocks, key, rounds);
+}
+
+AES_SPECIALIZED VAES256 void vaes256_ctr_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE ctr[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m256i rk[AES_256_ROUNDS + 1], b[4], c[4], counter, step, bswap;
+	unsigned long long hi, lo;
+
+	// The counters are built with 64-bit additions on the low half, which is only
+	// valid while it does not wrap around.
+	ctr_load(ctr, &hi, &lo);
+	if (lo + blocks < lo) {
+		aesni_ctr_rounds(in, out, blocks, key, ctr, rounds);
+		return;
+	}
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes256_broadcast_schedule(rk128, rounds, rk);
+	bswap = _mm256_broadcastsi128_si256(VAES_CTR_BSWAP_MASK);
+	counter = _mm256_set_epi64x(hi, lo + 1, hi, lo);
+	step = _mm256_set_epi64x(0, 2, 0, 2);
+	for ( ; blocks >= 8; blocks -= 8, in += 8 * AES_BLOCK_SIZE, out += 8 * AES_BLOCK_SIZE) {
+		c[0] = counter;
+		c[1] = _mm256_add_epi64(c[0], step);
+		c[2] = _mm256_add_epi64(c[1], step);
+		c[3] = _mm256_add_epi64(c[2], step);
+		counter = _mm256_add_epi64(c[3], step);
+		b[0] = _mm256_shuffle_epi8(c[0], bswap);
+		b[1] = _mm256_shuffle_epi8(c[1], bswap);
+		b[2] = _mm256_shuffle_epi8(c[2], bswap);
+		b[3] = _mm256_shuffle_epi8(c[3], bswap);
+		vaes256_encrypt4(b, rk, rounds);
+		vaes256_load4(in, c);
+		vaes256_xor4(b, c);
+		vaes256_store4(out, b);
+		lo += 8;
+	}
+	ctr_store(ctr, hi, lo);
+	aesni_ctr_rounds(in, out, blocks, key, ctr, rounds);
+}
+
+AES_SPECIALIZED VAES256 void vaes256_cbc_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE iv[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m128i prev = _mm_loadu_si128((const __m128i *)iv);
+	__m256i rk[AES_256_ROUNDS + 1], b[4], p[4];
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes256_broadcast_schedule(rk128, rounds, rk);
+	for ( ; blocks >= 8; blocks -= 8, in += 8 * AES_BLOCK_SIZE, out += 8 * AES_BLOCK_SIZE) {
+		vaes256_load4(in, b);
+		// The previous ciphertext blocks are read before anything is stored, so the
+		// buffers may be the same. The first one comes from the previous iteration.
+		p[0] = _mm256_permute2x128_si256(_mm256_castsi128_si256(prev), b[0], 0x20);
+		p[1] = _mm256_loadu_si256((const __m256i *)(in + 1 * AES_BLOCK_SIZE));
+		p[2] = _mm256_loadu_si256((const __m256i *)(in + 3 * AES_BLOCK_SIZE));
+		p[3] = _mm256_loadu_si256((const __m256i *)(in + 5 * AES_BLOCK_SIZE));
+		prev = _mm256_extracti128_si256(b[3], 1);
+		vaes256_decrypt4(b, rk, rounds);
+		vaes256_xor4(b, p);
+		vaes256_store4(out, b);
+	}
+	_mm_storeu_si128((__m128i *)iv, prev);
+	aesni_cbc_decrypt_rounds(in, out, blocks, key, iv, rounds);
+}
+
+VAES256 static void vaes256_ecb_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes256_ecb_encrypt_rounds, in, out, blocks, ctx->key);
+}
+
+VAES256 static void vaes256_ecb_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes256_ecb_decrypt_rounds, in, out, blocks, ctx->dec_key);
+}
+
+VAES256 static void vaes256_ctr(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes256_ctr_rounds, in, out, blocks, ctx->key, ctr);
+}
+
+VAES256 static void vaes256_cbc_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes256_cbc_decrypt_rounds, in, out, blocks, ctx->dec_key, iv);
+}
+
+AES_SPECIALIZED VAES512 void vaes512_encrypt4(__m512i b[], const __m512i rk[], int rounds)
+{
+	int round;
+
+	b[0] = _mm512_xor_si512(b[0], rk[0]);
+	b[1] = _mm512_xor_si512(b[1], rk[0]);
+	b[2] = _mm512_xor_si512(b[2], rk[0]);
+	b[3] = _mm512_xor_si512(b[3], rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++) {
+		b[0] = _mm512_aesenc_epi128(b[0], rk[round]);
+		b[1] = _mm512_aesenc_epi128(b[1], rk[round]);
+		b[2] = _mm512_aesenc_epi128(b[2], rk[round]);
+		b[3] = _mm512_aesenc_epi128(b[3], rk[round]);
+	}
+	b[0] = _mm512_aesenclast_epi128(b[0], rk[rounds]);
+	b[1] = _mm512_aesenclast_epi128(b[1], rk[rounds]);
+	b[2] = _mm512_aesenclast_epi128(b[2], rk[rounds]);
+	b[3] = _mm512_aesenclast_epi128(b[3], rk[rounds]);
+}
+
+AES_SPECIALIZED VAES512 void vaes512_decrypt4(__m512i b[], const __m512i rk[], int rounds)
+{
+	int round;
+
+	b[0] = _mm512_xor_si512(b[0], rk[0]);
+	b[1] = _mm512_xor_si512(b[1], rk[0]);
+	b[2] = _mm512_xor_si512(b[2], rk[0]);
+	b[3] = _mm512_xor_si512(b[3], rk[0]);
+#pragma GCC unroll 14
+	for (round = 1; round < rounds; round++) {
+		b[0] = _mm512_aesdec_epi128(b[0], rk[round]);
+		b[1] = _mm512_aesdec_epi128(b[1], rk[round]);
+		b[2] = _mm512_aesdec_epi128(b[2], rk[round]);
+		b[3] = _mm512_aesdec_epi128(b[3], rk[round]);
+	}
+	b[0] = _mm512_aesdeclast_epi128(b[0], rk[rounds]);
+	b[1] = _mm512_aesdeclast_epi128(b[1], rk[rounds]);
+	b[2] = _mm512_aesdeclast_epi128(b[2], rk[rounds]);
+	b[3] = _mm512_aesdeclast_epi128(b[3], rk[rounds]);
+}
+
+VAES512 static inline void vaes512_load4(const BYTE in[], __m512i b[])
+{
+	b[0] = _mm512_loadu_si512((const __m512i *)in + 0);
+	b[1] = _mm512_loadu_si512((const __m512i *)in + 1);
+	b[2] = _mm512_loadu_si512((const __m512i *)in + 2);
+	b[3] = _mm512_loadu_si512((const __m512i *)in + 3);
+}
+
+VAES512 static inline void vaes512_store4(BYTE out[], const __m512i b[])
+{
+	_mm512_storeu_si512((__m512i *)out + 0, b[0]);
+	_mm512_storeu_si512((__m512i *)out + 1, b[1]);
+	_mm512_storeu_si512((__m512i *)out + 2, b[2]);
+	_mm512_storeu_si512((__m512i *)out + 3, b[3]);
+}
+
+VAES512 static inline void vaes512_xor4(__m512i b[], const __m512i x[])
+{
+	b[0] = _mm512_xor_si512(b[0], x[0]);
+	b[1] = _mm512_xor_si512(b[1], x[1]);
+	b[2] = _mm512_xor_si512(b[2], x[2]);
+	b[3] = _mm512_xor_si512(b[3], x[3]);
+}
+
+VAES512 static inline void vaes512_broadcast_schedule(const __m128i rk128[], int rounds, __m512i rk[])
+{
+	int idx;
+
+	for (idx = 0; idx <= rounds; idx++)
+		rk[idx] = _mm512_broadcast_i32x4(rk128[idx]);
+}
+
+AES_SPECIALIZED VAES512 void vaes512_ecb_encrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m512i rk[AES_256_ROUNDS + 1], b[4];
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes512_broadcast_schedule(rk128, rounds, rk);
+	for ( ; blocks >= 16; blocks -= 16, in += 16 * AES_BLOCK_SIZE, out += 16 * AES_BLOCK_SIZE) {
+		vaes512_load4(in, b);
+		vaes512_encrypt4(b, rk, rounds);
+		vaes512_store4(out, b);
+	}
+	aesni_ecb_encrypt_rounds(in, out, blocks, key, rounds);
+}
+
+AES_SPECIALIZED VAES512 void vaes512_ecb_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m512i rk[AES_256_ROUNDS + 1], b[4];
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes512_broadcast_schedule(rk128, rounds, rk);
+	for ( ; blocks >= 16; blocks -= 16, in += 16 * AES_BLOCK_SIZE, out += 16 * AES_BLOCK_SIZE) {
+		vaes512_load4(in, b);
+		vaes512_decrypt4(b, rk, rounds);
+		vaes512_store4(out, b);
+	}
+	aesni_ecb_decrypt_rounds(in, out, blocks, key, rounds);
+}
+
+AES_SPECIALIZED VAES512 void vaes512_ctr_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE ctr[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m512i rk[AES_256_ROUNDS + 1], b[4], c[4], counter, step, bswap;
+	unsigned long long hi, lo;
+
+	ctr_load(ctr, &hi, &lo);
+	if (lo + blocks < lo) {
+		aesni_ctr_rounds(in, out, blocks, key, ctr, rounds);
+		return;
+	}
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes512_broadcast_schedule(rk128, rounds, rk);
+	bswap = _mm512_broadcast_i32x4(VAES_CTR_BSWAP_MASK);
+	counter = _mm512_set_epi64(hi, lo + 3, hi, lo + 2, hi, lo + 1, hi, lo);
+	step = _mm512_set_epi64(0, 4, 0, 4, 0, 4, 0, 4);
+	for ( ; blocks >= 16; blocks -= 16, in += 16 * AES_BLOCK_SIZE, out += 16 * AES_BLOCK_SIZE) {
+		c[0] = counter;
+		c[1] = _mm512_add_epi64(c[0], step);
+		c[2] = _mm512_add_epi64(c[1], step);
+		c[3] = _mm512_add_epi64(c[2], step);
+		counter = _mm512_add_epi64(c[3], step);
+		b[0] = _mm512_shuffle_epi8(c[0], bswap);
+		b[1] = _mm512_shuffle_epi8(c[1], bswap);
+		b[2] = _mm512_shuffle_epi8(c[2], bswap);
+		b[3] = _mm512_shuffle_epi8(c[3], bswap);
+		vaes512_encrypt4(b, rk, rounds);
+		vaes512_load4(in, c);
+		vaes512_xor4(b, c);
+		vaes512_store4(out, b);
+		lo += 16;
+	}
+	ctr_store(ctr, hi, lo);
+	aesni_ctr_rounds(in, out, blocks, key, ctr, rounds);
+}
+
+AES_SPECIALIZED VAES512 void vaes512_cbc_decrypt_rounds(const BYTE in[], BYTE out[], size_t blocks, const WORD key[], BYTE iv[], int rounds)
+{
+	__m128i rk128[AES_256_ROUNDS + 1];
+	__m128i prev = _mm_loadu_si128((const __m128i *)iv);
+	__m512i rk[AES_256_ROUNDS + 1], b[4], p[4];
+
+	aesni_load_schedule(key, rounds, rk128);
+	vaes512_broadcast_schedule(rk128, rounds, rk);
+	for ( ; blocks >= 16; blocks -= 16, in += 16 * AES_BLOCK_SIZE, out += 16 * AES_BLOCK_SIZE) {
+		vaes512_load4(in, b);
+		// Shift the previous ciphertext block in front of the first three of b[0].
+		p[0] = _mm512_alignr_epi64(b[0], _mm512_broadcast_i32x4(prev), 6);
+		p[1] = _mm512_loadu_si512((const __m512i *)(in + 3 * AES_BLOCK_SIZE));
+		p[2] = _mm512_loadu_si512((const __m512i *)(in + 7 * AES_BLOCK_SIZE));
+		p[3] = _mm512_loadu_si512((const __m512i *)(in + 11 * AES_BLOCK_SIZE));
+		prev = _mm512_extracti32x4_epi32(b[3], 3);
+		vaes512_decrypt4(b, rk, rounds);
+		vaes512_xor4(b, p);
+		vaes512_store4(out, b);
+	}
+	_mm_storeu_si128((__m128i *)iv, prev);
+	aesni_cbc_decrypt_rounds(in, out, blocks, key, iv, rounds);
+}
+
+VAES512 static void vaes512_ecb_encrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes512_ecb_encrypt_rounds, in, out, blocks, ctx->key);
+}
+
+VAES512 static void vaes512_ecb_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes512_ecb_decrypt_rounds, in, out, blocks, ctx->dec_key);
+}
+
+VAES512 static void vaes512_ctr(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes512_ctr_rounds, in, out, blocks, ctx->key, ctr);
+}
+
+VAES512 static void vaes512_cbc_decrypt(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	AES_SPECIALIZE_ROUNDS(ctx->keysize, vaes512_cbc_decrypt_rounds, in, out, blocks, ctx->dec_key, iv);
+}
+
+#endif   // AES_X86
+
+/////////////////
+// IMPLEMENTATION SELECTION
+/////////////////
+
+static const char *aes_impl_names[] = {"reference", "ttable", "aesni", "vaes-avx2", "vaes-avx512", "ssse3"};
+static const int aes_impl_widths[] = {1, 1, 4, 8, 16, 4};
+
+static int aes_impl = AES_IMPL_TTABLE;
+static AES_KEY_SETUP_FUNC aes_key_setup_impl = aes_key_setup_reference;
+static AES_BLOCK_FUNC aes_encrypt_impl = aes_encrypt_ttable;
+static AES_BLOCK_FUNC aes_decrypt_impl = aes_decrypt_ttable;
+static AES_ECB_FUNC aes_ecb_encrypt_impl = ttable_ecb_encrypt;
+static AES_ECB_FUNC aes_ecb_decrypt_impl = ttable_ecb_decrypt;
+static AES_CHAIN_FUNC aes_ctr_impl = ttable_ctr;
+static AES_CHAIN_FUNC aes_cbc_decrypt_impl = ttable_cbc_decrypt;
+static AES_CHAIN_FUNC aes_cbc_encrypt_impl = ttable_cbc_encrypt;
+static AES_CCM_FUNC aes_ccm_impl = aes_ccm_generic;
+
+// Returns True if the CPU can run the given implementation.
+static int aes_impl_supported(int impl)
+{
+	switch (impl) {
+		case AES_IMPL_REFERENCE:
+		case AES_IMPL_TTABLE:
+			return(TRUE);
+#ifdef AES_X86
+		case AES_IMPL_SSSE3:
+			__builtin_cpu_init();
+			return(__builtin_cpu_supports("ssse3"));
+		case AES_IMPL_AESNI:
+			__builtin_cpu_init();
+			return(__builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3"));
+		case AES_IMPL_VAES_AVX2:
+			return(aes_impl_supported(AES_IMPL_AESNI) && __builtin_cpu_supports("vaes") &&
+			       __builtin_cpu_supports("avx2"));
+		case AES_IMPL_VAES_AVX512:
+			return(aes_impl_supported(AES_IMPL_VAES_AVX2) && __builtin_cpu_supports("avx512f") &&
+			       __builtin_cpu_supports("avx512bw"));
+#endif
+		default:
+			return(FALSE);
+	}
+}
+
+int aes_set_impl(int impl)
+{
+	if (!aes_impl_supported(impl))
+		return(FALSE);
+
+	switch (impl) {
+		case AES_IMPL_REFERENCE:
+			aes_key_setup_impl = aes_key_setup_reference;
+			aes_encrypt_impl = aes_encrypt_reference;
+			aes_decrypt_impl = aes_decrypt_reference;
+			break;
+		case AES_IMPL_TTABLE:
+			aes_key_setup_impl = aes_key_setup_reference;
+			aes_encrypt_impl = aes_encrypt_ttable;
+			aes_decrypt_impl = aes_decrypt_ttable;
+			break;
+#ifdef AES_X86
+		case AES_IMPL_SSSE3:
+			aes_key_setup_impl = aes_key_setup_vperm;
+			aes_encrypt_impl = aes_encrypt_vperm;
+			aes_decrypt_impl = aes_decrypt_vperm;
+			break;
+		case AES_IMPL_AESNI:
+		case AES_IMPL_VAES_AVX2:
+		case AES_IMPL_VAES_AVX512:
+			aes_key_setup_impl = aes_key_setup_aesni;
+			aes_encrypt_impl = aes_encrypt_aesni;
+			aes_decrypt_impl = aes_decrypt_aesni;
+			break;
+#endif
+	}
+
+	switch (impl) {
+#ifdef AES_X86
+		case AES_IMPL_AESNI:
+			aes_ecb_encrypt_impl = aesni_ecb_encrypt;
+			aes_ecb_decrypt_impl = aesni_ecb_decrypt;
+			aes_ctr_impl = aesni_ctr;
+			aes_cbc_decrypt_impl = aesni_cbc_decrypt;
+			aes_cbc_encrypt_impl = aesni_cbc_encrypt;
+			aes_ccm_impl = aesni_ccm;
+			break;
+		case AES_IMPL_VAES_AVX2:
+			aes_ecb_encrypt_impl = vaes256_ecb_encrypt;
+			aes_ecb_decrypt_impl = vaes256_ecb_decrypt;
+			aes_ctr_impl = vaes256_ctr;
+			aes_cbc_decrypt_impl = vaes256_cbc_decrypt;
+			aes_cbc_encrypt_impl = aesni_cbc_encrypt;
+			aes_ccm_impl = aesni_ccm;
+			break;
+		case AES_IMPL_VAES_AVX512:
+			aes_ecb_encrypt_impl = vaes512_ecb_encrypt;
+			aes_ecb_decrypt_impl = vaes512_ecb_decrypt;
+			aes_ctr_impl = vaes512_ctr;
+			aes_cbc_decrypt_impl = vaes512_cbc_decrypt;
+			aes_cbc_encrypt_impl = aesni_cbc_encrypt;
+			aes_ccm_impl = aesni_ccm;
+			break;
+		case AES_IMPL_SSSE3:
+			aes_ecb_encrypt_impl = vperm_ecb_encrypt;
+			aes_ecb_decrypt_impl = vperm_ecb_decrypt;
+			aes_ctr_impl = vperm_ctr;
+			aes_cbc_decrypt_impl = vperm_cbc_decrypt;
+			aes_cbc_encrypt_impl = vperm_cbc_encrypt;
+			aes_ccm_impl = aes_ccm_generic;
+			break;
+#endif
+		case AES_IMPL_TTABLE:
+			aes_ecb_encrypt_impl = ttable_ecb_encrypt;
+			aes_ecb_decrypt_impl = ttable_ecb_decrypt;
+			aes_ctr_impl = ttable_ctr;
+			aes_cbc_decrypt_impl = ttable_cbc_decrypt;
+			aes_cbc_encrypt_impl = ttable_cbc_encrypt;
+			aes_ccm_impl = aes_ccm_generic;
+			break;
+		default:
+			aes_ecb_encrypt_impl = aes_ecb_encrypt_generic;
+			aes_ecb_decrypt_impl = aes_ecb_decrypt_generic;
+			aes_ctr_impl = aes_ctr_generic;
+			aes_cbc_decrypt_impl = aes_cbc_decrypt_generic;
+			aes_cbc_encrypt_impl = aes_cbc_encrypt_generic;
+			aes_ccm_impl = aes_ccm_generic;
+			break;
+	}
+
+	aes_impl = impl;
+	return(TRUE);
+}
+
+// Picks the fastest implementation the CPU supports when the program starts. Without
+// AES-NI the constant-time SSSE3 code is preferred over the T-tables.
+__attribute__((constructor)) static void aes_select_impl()
+{
+	if (!aes_set_impl(AES_IMPL_VAES_AVX512) && !aes_set_impl(AES_IMPL_VAES_AVX2) &&
+	    !aes_set_impl(AES_IMPL_AESNI) && !aes_set_impl(AES_IMPL_SSSE3))
+		aes_set_impl(AES_IMPL_TTABLE);
+}
+
+int aes_get_impl()
+{
+	return(aes_impl);
+}
+
+const char *aes_impl_name(int impl)
+{
+	if (impl < 0 || impl >= (int)(sizeof(aes_impl_names) / sizeof(aes_impl_names[0])))
+		return(NULL);
+	return(aes_impl_names[impl]);
+}
+
+int aes_impl_width(int impl)
+{
+	if (impl < 0 || impl >= (int)(sizeof(aes_impl_widths) / sizeof(aes_impl_widths[0])))
+		return(0);
+	return(aes_impl_widths[impl]);
+}
+
+void aes_key_setup(const BYTE key[], WORD w[], int keysize)
+{
+	aes_key_setup_impl(key, w, keysize);
+}
+
+void aes_encrypt(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	aes_encrypt_impl(in, out, key, keysize);
+}
+
+void aes_decrypt(const BYTE in[], BYTE out[], const WORD key[], int keysize)
+{
+	aes_decrypt_impl(in, out, key, keysize);
+}
+
+/////////////////
+// BULK API
+/////////////////
+
+void aes_ctx_init(AES_CTX *ctx, const BYTE key[], int keysize)
+{
+	aes_key_setup(key, ctx->key, keysize);
+	ctx->keysize = keysize;
+	ctx->rounds = aes_rounds(keysize);
+	aes_key_setup_dec(ctx->key, ctx->dec_key, ctx->rounds);
+}
+
+// A single block through the ECB kernel, which takes the schedules cached in the context.
+void aes_encrypt_ctx(const BYTE in[], BYTE out[], const AES_CTX *ctx)
+{
+	aes_ecb_encrypt_impl(in, out, 1, ctx);
+}
+
+void aes_decrypt_ctx(const BYTE in[], BYTE out[], const AES_CTX *ctx)
+{
+	aes_ecb_decrypt_impl(in, out, 1, ctx);
+}
+
+void aes_ecb_encrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	aes_ecb_encrypt_impl(in, out, blocks, ctx);
+}
+
+void aes_ecb_decrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx)
+{
+	aes_ecb_decrypt_impl(in, out, blocks, ctx);
+}
+
+void aes_cbc_encrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	aes_cbc_encrypt_impl(in, out, blocks, ctx, iv);
+}
+
+void aes_cbc_decrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[])
+{
+	aes_cbc_decrypt_impl(in, out, blocks, ctx, iv);
+}
+
+void aes_ctr_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[])
+{
+	aes_ctr_impl(in, out, blocks, ctx, ctr);
+}
+
+// Without an interleaved kernel the MAC and the keystream are computed in two passes
+// over runs that stay in the L1 cache, each one with the multi-block kernels of the
+// selected implementation. The MAC reads the plaintext before CTR overwrites it when
+// encrypting in place, and after CTR produced it when decrypting.
+#define AES_CCM_RUN_BLOCKS 256
+
+static void aes_ccm_generic(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[], BYTE mac[], int decrypt)
+{
+	BYTE scratch[AES_CCM_RUN_BLOCKS * AES_BLOCK_SIZE];
+	size_t run;
+
+	for ( ; blocks > 0; blocks -= run, in += run * AES_BLOCK_SIZE, out += run * AES_BLOCK_SIZE) {
+		run = blocks < AES_CCM_RUN_BLOCKS ? blocks : AES_CCM_RUN_BLOCKS;
+		if (decrypt) {
+			aes_ctr_impl(in, out, run, ctx, ctr);
+			aes_cbc_encrypt_impl(out, scratch, run, ctx, mac);
+		}
+		else {
+			aes_cbc_encrypt_impl(in, scratch, run, ctx, mac);
+			aes_ctr_impl(in, out, run, ctx, ctr);
+		}
+	}
+}
+
+static void aes_ccm_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[], BYTE mac[], int decrypt)
+{
+	aes_ccm_impl(in, out, blocks, ctx, ctr, mac, decrypt);
+}
+
+/////////////////
+// AES - GCM
+/////////////////
+
+// GHASH works in GF(2^128) with the bits of each byte reversed: the first bit of the
+// block is the coefficient of x^0. A block is kept as two 64-bit halves loaded big
+// endian, so x^0 is the top bit of hi and a multiplication by x is a right shift.
+#define GHASH_R 0xe100000000000000ULL
+
+static int aes_ghash_pclmul = FALSE;       // Selected by aes_ghash_use_pclmul()
+static int aes_ghash_has_pclmul = FALSE;   // The CPU supports it, the keys always get the powers
+
+static unsigned long long ghash_load(const BYTE p[])
+{
+	unsigned long long v = 0;
+	int idx;
+
+	for (idx = 0; idx < 8; idx++)
+		v = (v << 8) | p[idx];
+	return(v);
+}
+
+static void ghash_store(BYTE p[], unsigned long long v)
+{
+	int idx;
+
+	for (idx = 7; idx >= 0; idx--) {
+		p[idx] = (BYTE)v;
+		v >>= 8;
+	}
+}
+
+// Bit by bit multiplication from SP 800-38D, only used for the table setup and to
+// combine partial hashes, never per data block.
+static void ghash_mul_bitwise(BYTE x[], const BYTE y[])
+{
+	unsigned long long zh = 0, zl = 0, vh, vl, carry;
+	int idx;
+
+	vh = ghash_load(y);
+	vl = ghash_load(y + 8);
+	for (idx = 0; idx < 128; idx++) {
+		if ((x[idx / 8] >> (7 - idx % 8)) & 1) {
+			zh ^= vh;
+			zl ^= vl;
+		}
+		carry = vl & 1;
+		vl = (vl >> 1) | (vh << 63);
+		vh = (vh >> 1) ^ (carry * GHASH_R);
+	}
+	ghash_store(x, zh);
+	ghash_store(x + 8, zl);
+}
+
+// Reduction of the four bits shifted out at each step of the table multiplication.
+static const unsigned long long ghash_last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+// Shoup's 4-bit method: table[n] holds n*H for every nibble n, and the block is
+// consumed a nibble at a time starting at the high end of the polynomial.
+static void ghash_table_setup(AES_GHASH_KEY *key, const BYTE h[])
+{
+	unsigned long long vh, vl, carry;
+	int idx, idx2;
+
+	vh = ghash_load(h);
+	vl = ghash_load(h + 8);
+	key->table[0][0] = key->table[0][1] = 0;
+	key->table[8][0] = vh;
+	key->table[8][1] = vl;
+	for (idx = 4; idx > 0; idx >>= 1) {
+		carry = vl & 1;
+		vl = (vl >> 1) | (vh << 63);
+		vh = (vh >> 1) ^ (carry * GHASH_R);
+		key->table[idx][0] = vh;
+		key->table[idx][1] = vl;
+	}
+	for (idx = 2; idx <= 8; idx *= 2)
+		for (idx2 = 1; idx2 < idx; idx2++) {
+			key->table[idx + idx2][0] = key->table[idx][0] ^ key->table[idx2][0];
+			key->table[idx + idx2][1] = key->table[idx][1] ^ key->table[idx2][1];
+		}
+}
+
+static void ghash_mul_table(const AES_GHASH_KEY *key, BYTE x[])
+{
+	unsigned long long zh, zl, rem;
+	int idx, nibble;
+
+	nibble = x[15] & 0x0f;
+	zh = key->table[nibble][0];
+	zl = key->table[nibble][1];
+	for (idx = 15; idx >= 0; idx--) {
+		if (idx != 15) {
+			nibble = x[idx] & 0x0f;
+			rem = zl & 0x0f;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (ghash_last4[rem] << 48);
+			zh ^= key->table[nibble][0];
+			zl ^= key->table[nibble][1];
+		}
+		nibble = x[idx] >> 4;
+		rem = zl & 0x0f;
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4) ^ (ghash_last4[rem] << 48);
+		zh ^= key->table[nibble][0];
+		zl ^= key->table[nibble][1];
+	}
+	ghash_store(x, zh);
+	ghash_store(x + 8, zl);
+}
+
+static void ghash_table_update(const AES_GHASH_KEY *key, BYTE x[], const BYTE in[], size_t blocks)
+{
+	int idx;
+
+	for (; blocks > 0; blocks--, in += AES_BLOCK_SIZE) {
+		for (idx = 0; idx < AES_BLOCK_SIZE; idx++)
+			x[idx] ^= in[idx];
+		ghash_mul_table(key, x);
+	}
+}
+
+#ifdef AES_X86
+
+#define PCLMUL __attribute__((target("pclmul,ssse3")))
+
+// The carry-less multiplier works on the natural bit order, so the blocks are byte
+// reversed on load and the product is shifted left by one bit before the reduction.
+#define PCLMUL_BSWAP_MASK _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15)
+
+// Accumulates the unreduced 256-bit product a*b into lo, mid, and hi.
+PCLMUL static inline void pclmul_mul_acc(__m128i a, __m128i b, __m128i *lo, __m128i *mid, __m128i *hi)
+{
+	*lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+	*hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+// Reduces a 256-bit product modulo x^128 + x^7 + x^2 + x + 1. Several products can be
+// summed before a single reduction, which is what makes the 4-block loop cheap.
+PCLMUL static inline __m128i pclmul_reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+	__m128i t1, t2, t3;
+
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	// Shift the 256-bit product left by one bit.
+	t1 = _mm_srli_epi32(lo, 31);
+	t2 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t3 = _mm_srli_si128(t1, 12);
+	t2 = _mm_slli_si128(t2, 4);
+	t1 = _mm_slli_si128(t1, 4);
+	lo = _mm_or_si128(lo, t1);
+	hi = _mm_or_si128(hi, t2);
+	hi = _mm_or_si128(hi, t3);
+
+	// First phase of the reduction.
+	t1 = _mm_slli_epi32(lo, 31);
+	t2 = _mm_slli_epi32(lo, 30);
+	t3 = _mm_slli_epi32(lo, 25);
+	t1 = _mm_xor_si128(t1, t2);
+	t1 = _mm_xor_si128(t1, t3);
+	t2 = _mm_srli_si128(t1, 4);
+	t1 = _mm_slli_si128(t1, 12);
+	lo = _mm_xor_si128(lo, t1);
+
+	// Second phase.
+	t1 = _mm_srli_epi32(lo, 1);
+	t3 = _mm_srli_epi32(lo, 2);
+	t1 = _mm_xor_si128(t1, t3);
+	t3 = _mm_srli_epi32(lo, 7);
+	t1 = _mm_xor_si128(t1, t3);
+	t1 = _mm_xor_si128(t1, t2);
+	lo = _mm_xor_si128(lo, t1);
+
+	return(_mm_xor_si128(hi, lo));
+}
+
+PCLMUL static __m128i pclmul_mul(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_setzero_si128(), mid = _mm_setzero_si128(), hi = _mm_setzero_si128();
+
+	pclmul_mul_acc(a, b, &lo, &mid, &hi);
+	return(pclmul_reduce(lo, mid, hi));
+}
+
+// Stores H, H^2, H^3, and H^4 byte reversed for the aggregated loop.
+PCLMUL static void pclmul_ghash_setup(AES_GHASH_KEY *key, const BYTE h[])
+{
+	__m128i h1, hn;
+	int idx;
+
+	h1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), PCLMUL_BSWAP_MASK);
+	hn = h1;
+	_mm_storeu_si128((__m128i *)key->powers[0], h1);
+	for (idx = 1; idx < 4; idx++) {
+		hn = pclmul_mul(hn, h1);
+		_mm_storeu_si128((__m128i *)key->powers[idx], hn);
+	}
+}
+
+// Four blocks per reduction: Y = (Y + X1)*H^4 + X2*H^3 + X3*H^2 + X4*H.
+PCLMUL static void pclmul_ghash_update(const AES_GHASH_KEY *key, BYTE x[], const BYTE in[], size_t blocks)
+{
+	const __m128i bswap = PCLMUL_BSWAP_MASK;
+	__m128i y, h1, h2, h3, h4, lo, mid, hi;
+
+	y = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)x), bswap);
+	h1 = _mm_loadu_si128((const __m128i *)key->powers[0]);
+	h2 = _mm_loadu_si128((const __m128i *)key->powers[1]);
+	h3 = _mm_loadu_si128((const __m128i *)key->powers[2]);
+	h4 = _mm_loadu_si128((const __m128i *)key->powers[3]);
+
+	for (; blocks >= 4; blocks -= 4, in += 4 * AES_BLOCK_SIZE) {
+		lo = mid = hi = _mm_setzero_si128();
+		pclmul_mul_acc(_mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), bswap)),
+		               h4, &lo, &mid, &hi);
+		pclmul_mul_acc(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16)), bswap), h3, &lo, &mid, &hi);
+		pclmul_mul_acc(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 32)), bswap), h2, &lo, &mid, &hi);
+		pclmul_mul_acc(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 48)), bswap), h1, &lo, &mid, &hi);
+		y = pclmul_reduce(lo, mid, hi);
+	}
+	for (; blocks > 0; blocks--, in += AES_BLOCK_SIZE) {
+		y = _mm_xor_si128(y, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), bswap));
+		y = pclmul_mul(y, h1);
+	}
+
+	_mm_storeu_si128((__m128i *)x, _mm_shuffle_epi8(y, bswap));
+}
+
+#endif   // AES_X86
+
+static void ghash_key_setup(AES_GHASH_KEY *key, const BYTE h[])
+{
+	memcpy(key->h, h, AES_BLOCK_SIZE);
+	ghash_table_setup(key, h);
+#ifdef AES_X86
+	if (aes_ghash_has_pclmul)
+		pclmul_ghash_setup(key, h);
+#endif
+}
+
+void aes_ghash_init(AES_GHASH_KEY *key, const AES_CTX *ctx)
+{
+	BYTE zero[AES_BLOCK_SIZE] = {0}, h[AES_BLOCK_SIZE];
+
+	aes_ecb_encrypt_impl(zero, h, 1, ctx);
+	ghash_key_setup(key, h);
+}
+
+void aes_ghash_update(const AES_GHASH_KEY *key, BYTE x[], const BYTE in[], size_t len)
+{
+	BYTE last[AES_BLOCK_SIZE] = {0};
+	size_t blocks = len / AES_BLOCK_SIZE;
+
+#ifdef AES_X86
+	if (aes_ghash_pclmul) {
+		pclmul_ghash_update(key, x, in, blocks);
+		if (len % AES_BLOCK_SIZE) {
+			memcpy(last, in + blocks * AES_BLOCK_SIZE, len % AES_BLOCK_SIZE);
+			pclmul_ghash_update(key, x, last, 1);
+		}
+		return;
+	}
+#endif
+	ghash_table_update(key, x, in, blocks);
+	if (len % AES_BLOCK_SIZE) {
+		memcpy(last, in + blocks * AES_BLOCK_SIZE, len % AES_BLOCK_SIZE);
+		ghash_table_update(key, x, last, 1);
+	}
+}
+
+void aes_ghash_shift(const AES_GHASH_KEY *key, BYTE x[], unsigned long long blocks)
+{
+	BYTE power[AES_BLOCK_SIZE];
+
+	// Square and multiply on H^(2^i).
+	memcpy(power, key->h, AES_BLOCK_SIZE);
+	for (; blocks > 0; blocks >>= 1) {
+		if (blocks & 1)
+			ghash_mul_bitwise(x, power);
+		if (blocks > 1) {
+			BYTE square[AES_BLOCK_SIZE];
+			memcpy(square, power, AES_BLOCK_SIZE);
+			ghash_mul_bitwise(power, square);
+		}
+	}
+}
+
+void aes_ghash_power(AES_GHASH_KEY *power, const AES_GHASH_KEY *key, unsigned long long blocks)
+{
+	BYTE h[AES_BLOCK_SIZE] = {0x80};   // The polynomial 1
+
+	aes_ghash_shift(key, h, blocks);
+	ghash_key_setup(power, h);
+}
+
+int aes_ghash_use_pclmul(int enable)
+{
+	if (enable && !aes_ghash_has_pclmul)
+		return(FALSE);
+	aes_ghash_pclmul = enable;
+	return(TRUE);
+}
+
+int aes_ghash_uses_pclmul()
+{
+	return(aes_ghash_pclmul);
+}
+
+__attribute__((constructor)) static void aes_select_ghash()
+{
+#ifdef AES_X86
+	__builtin_cpu_init();
+	aes_ghash_has_pclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+#endif
+	aes_ghash_pclmul = aes_ghash_has_pclmul;
+}
+
+void aes_gcm_init(AES_GCM_CTX *ctx, const BYTE key[], int keysize)
+{
+	aes_ctx_init(&ctx->aes, key, keysize);
+	aes_ghash_init(&ctx->ghash, &ctx->aes);
+}
+
+// J0 = IV || 0^31 || 1. The payload uses the counters that follow it.
+static void gcm_prepare_counter(BYTE counter[], const BYTE iv[], int value)
+{
+	memcpy(counter, iv, AES_GCM_IV_SIZE);
+	counter[12] = 0;
+	counter[13] = 0;
+	counter[14] = 0;
+	counter[15] = (BYTE)value;
+}
+
+// Only the low 32 bits of the counter are incremented. They start at 2 and the length
+// is capped, so the 128-bit increment of the CTR kernels never carries out of them.
+static void gcm_ctr(const BYTE in[], size_t len, BYTE out[], const BYTE iv[], const AES_CTX *ctx)
+{
+	BYTE counter[AES_BLOCK_SIZE], keystream[AES_BLOCK_SIZE];
+	size_t blocks = len / AES_BLOCK_SIZE, idx;
+
+	gcm_prepare_counter(counter, iv, 2);
+	aes_ctr_impl(in, out, blocks, ctx, counter);
+	if (len % AES_BLOCK_SIZE) {
+		aes_ecb_encrypt_impl(counter, keystream, 1, ctx);
+		for (idx = blocks * AES_BLOCK_SIZE; idx < len; idx++)
+			out[idx] = in[idx] ^ keystream[idx - blocks * AES_BLOCK_SIZE];
+	}
+}
+
+void aes_gcm_tag(const AES_GCM_CTX *ctx, BYTE x[], unsigned long long aad_len, unsigned long long text_len,
+                 const BYTE iv[], BYTE tag[])
+{
+	BYTE lengths[AES_BLOCK_SIZE], counter[AES_BLOCK_SIZE], mask[AES_BLOCK_SIZE];
+	int idx;
+
+	ghash_store(lengths, aad_len * 8);
+	ghash_store(lengths + 8, text_len * 8);
+	aes_ghash_update(&ctx->ghash, x, lengths, AES_BLOCK_SIZE);
+
+	gcm_prepare_counter(counter, iv, 1);
+	aes_ecb_encrypt_impl(counter, mask, 1, &ctx->aes);
+	for (idx = 0; idx < AES_BLOCK_SIZE; idx++)
+		tag[idx] = x[idx] ^ mask[idx];
+}
+
+int aes_encrypt_gcm(const BYTE in[], size_t in_len, BYTE out[], const BYTE aad[], size_t aad_len,
+                    const BYTE iv[], BYTE tag[], const AES_GCM_CTX *ctx)
+{
+	BYTE x[AES_BLOCK_SIZE] = {0};
+
+	if (in_len > AES_GCM_MAX_LEN)
+		return(FALSE);
+
+	gcm_ctr(in, in_len, out, iv, &ctx->aes);
+	aes_ghash_update(&ctx->ghash, x, aad, aad_len);
+	aes_ghash_update(&ctx->ghash, x, out, in_len);
+	aes_gcm_tag(ctx, x, aad_len, in_len, iv, tag);
+
+	return(TRUE);
+}
+
+int aes_decrypt_gcm(const BYTE in[], size_t in_len, BYTE out[], const BYTE aad[], size_t aad_len,
+                    const BYTE iv[], const BYTE tag[], const AES_GCM_CTX *ctx)
+{
+	BYTE x[AES_BLOCK_SIZE] = {0}, expected[AES_BLOCK_SIZE], diff = 0;
+	int idx;
+
+	if (in_len > AES_GCM_MAX_LEN)
+		return(FALSE);
+
+	// The ciphertext is authenticated before anything is decrypted.
+	aes_ghash_update(&ctx->ghash, x, aad, aad_len);
+	aes_ghash_update(&ctx->ghash, x, in, in_len);
+	aes_gcm_tag(ctx, x, aad_len, in_len, iv, expected);
+	for (idx = 0; idx < AES_BLOCK_SIZE; idx++)
+		diff |= expected[idx] ^ tag[idx];
+	if (diff != 0) {
+		memset(out, 0, in_len);
+		return(FALSE);
+	}
+
+	gcm_ctr(in, in_len, out, iv, &ctx->aes);
+	return(TRUE);
+}
+
 /*******************
 ** AES DEBUGGING FUNCTIONS
 *******************/
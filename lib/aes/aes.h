@@ -15,10 +15,54 @@
 /****************************** MACROS ******************************/
 #define AES_BLOCK_SIZE 16               // AES operates on 16 bytes at a time
 
+// Implementations of the block functions, see aes_set_impl().
+#define AES_IMPL_REFERENCE 0            // Byte-matrix round functions, follows FIPS-197 step by step
+#define AES_IMPL_TTABLE    1            // 32-bit column words with fused T-table rounds
+#define AES_IMPL_AESNI     2            // AES-NI instructions, 4 blocks per iteration
+#define AES_IMPL_VAES_AVX2 3            // VAES on 256-bit registers, 8 blocks per iteration
+#define AES_IMPL_VAES_AVX512 4          // VAES on 512-bit registers, 16 blocks per iteration
+#define AES_IMPL_SSSE3     5            // Constant-time SSSE3 byte shuffles without AES-NI, 4 blocks per iteration
+
+#define AES_GCM_IV_SIZE 12              // GCM only takes 96-bit IVs
+#define AES_GCM_TAG_SIZE 16
+#define AES_GCM_MAX_LEN 68719476704ULL  // (2^32 - 2) blocks, the limit of the 32-bit counter
+
 /**************************** DATA TYPES ****************************/
 typedef unsigned char BYTE;            // 8-bit byte
 typedef unsigned int WORD;             // 32-bit word, change to "long" for 16-bit machines
 
+// Key schedules and round count, filled once per key by aes_ctx_init() and shared by the
+// bulk functions.
+typedef struct {
+	WORD key[60];                      // Key schedule, as produced by aes_key_setup()
+	WORD dec_key[60];                  // Schedule of the FIPS-197 equivalent inverse cipher
+	int keysize;                       // Bit length of the key, 128, 192, or 256
+	int rounds;                        // 10, 12, or 14
+} AES_CTX;
+
+// Hash subkey H = E(K, 0^128) and the values precomputed from it by aes_ghash_init().
+typedef struct {
+	BYTE h[AES_BLOCK_SIZE];                // H itself
+	unsigned long long table[16][2];       // n*H for every 4-bit n, for the table code
+	BYTE powers[4][AES_BLOCK_SIZE];        // H^1 to H^4 byte reversed, for the PCLMULQDQ code
+} AES_GHASH_KEY;
+
+typedef struct {
+	AES_CTX aes;
+	AES_GHASH_KEY ghash;
+} AES_GCM_CTX;
+
+// State of a CCM message between aes_ccm_init() and the final call.
+typedef struct {
+	const AES_CTX *aes;                    // Key, must outlive the CCM context
+	BYTE mac[AES_BLOCK_SIZE];              // Running CBC-MAC
+	BYTE ctr[AES_BLOCK_SIZE];              // Counter of the next payload block
+	BYTE s0[AES_BLOCK_SIZE];               // Keystream of counter 0, masks the MAC
+	unsigned long long payload_len;        // Declared in the first block
+	unsigned long long processed;          // Payload bytes so far
+	int mac_len;
+} AES_CCM_CTX;
+
 /*********************** FUNCTION DECLARATIONS **********************/
 ///////////////////
 // AES
@@ -38,6 +82,37 @@ void aes_decrypt(const BYTE in[],             // 16 bytes of ciphertext
                  const WORD key[],            // From the key setup
                  int keysize);                // Bit length of the key, 128, 192, or 256
 
+// Selects the implementation used by aes_encrypt/aes_decrypt and every mode built on
+// them. All implementations share the key schedule and produce identical output. At
+// startup the widest one the CPU supports is selected.
+// Returns False if the implementation is unknown or not available on this machine.
+int aes_set_impl(int impl);
+int aes_get_impl();
+const char *aes_impl_name(int impl);  // NULL for an unknown implementation
+int aes_impl_width(int impl);         // Blocks processed per iteration of the multi-block kernels
+
+///////////////////
+// AES - Bulk
+///////////////////
+// Whole runs of blocks in one call. Each call goes straight to the multi-block kernel
+// of the selected implementation, specialized for the round count of the key. The input
+// and output buffers may be the same. The CBC and CTR functions update iv/ctr so that
+// consecutive calls continue the same stream.
+void aes_ctx_init(AES_CTX *ctx,               // Context to fill
+                  const BYTE key[],           // The key, must be 128, 192, or 256 bits
+                  int keysize);               // Bit length of the key, 128, 192, or 256
+
+// Single blocks with the schedules of the context. Unlike aes_decrypt, aes_decrypt_ctx
+// does not derive the decryption schedule on every call.
+void aes_encrypt_ctx(const BYTE in[], BYTE out[], const AES_CTX *ctx);
+void aes_decrypt_ctx(const BYTE in[], BYTE out[], const AES_CTX *ctx);
+
+void aes_ecb_encrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx);
+void aes_ecb_decrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx);
+void aes_cbc_encrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[]);
+void aes_cbc_decrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE iv[]);
+void aes_ctr_blocks(const BYTE in[], BYTE out[], size_t blocks, const AES_CTX *ctx, BYTE ctr[]);  // 128-bit big endian counter
+
 ///////////////////
 // AES - CBC
 ///////////////////
@@ -48,6 +123,13 @@ int aes_encrypt_cbc(const BYTE in[],          // Plaintext
                     int keysize,              // Bit length of the key, 128, 192, or 256
                     const BYTE iv[]);         // IV, must be AES_BLOCK_SIZE bytes long
 
+int aes_decrypt_cbc(const BYTE in[],          // Ciphertext
+                    size_t in_len,            // Must be a multiple of AES_BLOCK_SIZE
+                    BYTE out[],               // Plaintext, same length as ciphertext
+                    const WORD key[],         // From the key setup
+                    int keysize,              // Bit length of the key, 128, 192, or 256
+                    const BYTE iv[]);         // IV, must be AES_BLOCK_SIZE bytes long
+
 // Only output the CBC-MAC of the input.
 int aes_encrypt_cbc_mac(const BYTE in[],      // plaintext
                         size_t in_len,        // Must be a multiple of AES_BLOCK_SIZE
@@ -79,6 +161,33 @@ void aes_decrypt_ctr(const BYTE in[],         // Ciphertext
 ///////////////////
 // AES - CCM
 ///////////////////
+// Streaming CCM in constant memory. The payload length goes into the first block, so
+// it has to be known up front, and it must fit in the 15 - nonce_len bytes left by the
+// nonce. Updates may be of any size, but only the last one may end in a partial block.
+// With AES-NI the CBC-MAC and the CTR keystream run interleaved in one kernel.
+// Returns True if the input parameters do not violate any constraint.
+int aes_ccm_init(AES_CCM_CTX *ctx,
+                 const AES_CTX *aes,                     // From aes_ctx_init()
+                 const BYTE nonce[],
+                 int nonce_len,                          // 7 to 13 bytes
+                 unsigned long long payload_len,
+                 const BYTE assoc[],                     // Associated data, authenticated but not encrypted
+                 size_t assoc_len,
+                 int mac_len);                           // 4, 6, 8, 10, 12, 14, or 16
+
+// The input and output buffers may be the same. Return False once the payload length
+// would be exceeded or after an update that ended in a partial block.
+int aes_ccm_encrypt_update(AES_CCM_CTX *ctx, const BYTE in[], BYTE out[], size_t len);
+int aes_ccm_decrypt_update(AES_CCM_CTX *ctx, const BYTE in[], BYTE out[], size_t len);
+
+// Outputs the mac_len byte MAC. Returns False if less payload than declared was given.
+int aes_ccm_encrypt_final(AES_CCM_CTX *ctx, BYTE mac[]);
+
+// Returns True only if the whole declared payload was given and the MAC matches. The
+// plaintext has already been output by then, so on failure it must be discarded.
+int aes_ccm_decrypt_final(AES_CCM_CTX *ctx, const BYTE mac[]);
+
+// One-shot versions over a buffer in memory, built on the functions above.
 // Returns True if the input parameters do not violate any constraint.
 int aes_encrypt_ccm(const BYTE plaintext[],              // IN  - Plaintext.
                     WORD plaintext_len,                  // IN  - Plaintext length.
@@ -112,12 +221,57 @@ int aes_decrypt_ccm(const BYTE ciphertext[],             // IN  - Ciphertext, th
                     int keysize);                        // IN  - The length of the key in BITS. Valid values are 128, 192, 256.
 
 ///////////////////
-// Test functions
+// AES - GCM
 ///////////////////
-int aes_test();
-int aes_ecb_test();
-int aes_cbc_test();
-int aes_ctr_test();
-int aes_ccm_test();
+// GHASH uses PCLMULQDQ when the CPU has it, 4 blocks per reduction, and a 4-bit table
+// otherwise. The running hash x starts as 16 zero bytes.
+void aes_gcm_init(AES_GCM_CTX *ctx,           // Context to fill
+                  const BYTE key[],           // The key, must be 128, 192, or 256 bits
+                  int keysize);               // Bit length of the key, 128, 192, or 256
+
+void aes_ghash_init(AES_GHASH_KEY *key, const AES_CTX *ctx);
+
+// Absorbs len bytes into x. A partial last block is padded with zeros, so only the
+// last call of a message may have a length that is not a multiple of AES_BLOCK_SIZE.
+void aes_ghash_update(const AES_GHASH_KEY *key, BYTE x[], const BYTE in[], size_t len);
+
+// Multiplies x by H^blocks. GHASH(A || B) = shift(GHASH(A), blocks of B) + GHASH(B), so
+// hashes of consecutive parts of a message computed separately can be combined.
+void aes_ghash_shift(const AES_GHASH_KEY *key, BYTE x[], unsigned long long blocks);
+
+// Fills power with the key for H^blocks. Hashing a zero block with it multiplies x by
+// H^blocks at the cost of a single block, for when the same shift is applied many times.
+void aes_ghash_power(AES_GHASH_KEY *power, const AES_GHASH_KEY *key, unsigned long long blocks);
+
+// Selects the PCLMULQDQ code or the table code. Returns False if PCLMULQDQ is not
+// available on this machine.
+int aes_ghash_use_pclmul(int enable);
+int aes_ghash_uses_pclmul();
+
+// Finishes a hash of aad_len bytes of associated data followed by text_len bytes of
+// ciphertext, each part zero padded, and outputs the AES_GCM_TAG_SIZE byte tag.
+void aes_gcm_tag(const AES_GCM_CTX *ctx, BYTE x[], unsigned long long aad_len, unsigned long long text_len,
+                 const BYTE iv[], BYTE tag[]);
+
+// Returns False if in_len is over AES_GCM_MAX_LEN.
+int aes_encrypt_gcm(const BYTE in[],          // Plaintext
+                    size_t in_len,            // Any byte length
+                    BYTE out[],               // Ciphertext, same length as plaintext
+                    const BYTE aad[],         // Associated data, authenticated but not encrypted
+                    size_t aad_len,
+                    const BYTE iv[],          // IV, must be AES_GCM_IV_SIZE bytes long
+                    BYTE tag[],               // Output tag, AES_GCM_TAG_SIZE bytes
+                    const AES_GCM_CTX *ctx);
+
+// Returns True only if the tag matches. The tag is checked before decrypting, and on
+// failure the plaintext is zeroed out.
+int aes_decrypt_gcm(const BYTE in[],          // Ciphertext
+                    size_t in_len,            // Any byte length
+                    BYTE out[],               // Plaintext, same length as ciphertext
+                    const BYTE aad[],         // Associated data given to the encryption
+                    size_t aad_len,
+                    const BYTE iv[],          // IV, must be AES_GCM_IV_SIZE bytes long
+                    const BYTE tag[],         // Tag produced by the encryption
+                    const AES_GCM_CTX *ctx);
 
 #endif   // AES_H
@@ -14,6 +14,11 @@
 #include <memory.h>
 #include "blowfish.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define BLOWFISH_X86
+#include <immintrin.h>
+#endif
+
 /****************************** MACROS ******************************/
 #define F(x,t) t = keystruct->s[0][(x) >> 24]; \
                t += keystruct->s[1][((x) >> 16) & 0xff]; \
@@ -22,6 +27,14 @@
 #define swap(r,l,t) t = l; l = r; r = t;
 #define ITERATION(l,r,t,pval) l ^= keystruct->p[pval]; F(l,t); r^= t; swap(r,l,t);
 
+// Four independent blocks per round. Each half-round is written out for every block, so
+// the S-box loads of one block are in flight while the others are computed. Instead of
+// swapping the halves, consecutive rounds alternate between the l and r words.
+#define HALF_ROUND4(a,b,pval) \
+   a##0 ^= pval; a##1 ^= pval; a##2 ^= pval; a##3 ^= pval; \
+   F(a##0,t0); F(a##1,t1); F(a##2,t2); F(a##3,t3); \
+   b##0 ^= t0; b##1 ^= t1; b##2 ^= t2; b##3 ^= t3;
+
 /**************************** VARIABLES *****************************/
 static const WORD p_perm[18] = {
    0x243F6A88,0x85A308D3,0x13198A2E,0x03707344,0xA4093822,0x299F31D0,0x082EFA98,
@@ -236,9 +249,300 @@ void blowfish_decrypt(const BYTE in[], BYTE out[], const BLOWFISH_KEY *keystruct
    out[7] = r;
 }
 
-void blowfish_key_setup(const BYTE user_key[], BLOWFISH_KEY *keystruct, size_t len)
+// Runs four blocks, given as (l,r) word pairs, through the 16 rounds. p is the P-array
+// in the order it is applied: keystruct->p for encryption, reversed for decryption.
+static void blowfish_rounds4(WORD l[4], WORD r[4], const WORD p[18], const BLOWFISH_KEY *keystruct)
+{
+   WORD l0 = l[0], l1 = l[1], l2 = l[2], l3 = l[3];
+   WORD r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];
+   WORD t0, t1, t2, t3;
+   int idx;
+
+   for (idx = 0; idx < 16; idx += 2) {
+      HALF_ROUND4(l,r,p[idx]);
+      HALF_ROUND4(r,l,p[idx + 1]);
+   }
+
+   // The last round has no swap, so the halves come out exchanged.
+   l[0] = r0 ^ p[17]; l[1] = r1 ^ p[17]; l[2] = r2 ^ p[17]; l[3] = r3 ^ p[17];
+   r[0] = l0 ^ p[16]; r[1] = l1 ^ p[16]; r[2] = l2 ^ p[16]; r[3] = l3 ^ p[16];
+}
+
+static WORD load_word(const BYTE in[])
+{
+   return(((WORD)in[0] << 24) | ((WORD)in[1] << 16) | ((WORD)in[2] << 8) | in[3]);
+}
+
+static void store_word(BYTE out[], WORD w)
+{
+   out[0] = w >> 24;
+   out[1] = w >> 16;
+   out[2] = w >> 8;
+   out[3] = w;
+}
+
+/////////////////
+// AVX2
+/////////////////
+#ifdef BLOWFISH_X86
+#define AVX2 __attribute__((target("avx2")))
+
+// Eight blocks in the lanes of two vectors, one with the l words and one with the r
+// words. The four S-box lookups of F are vpgatherdd loads, one per S-box for all lanes.
+AVX2 static __m256i avx2_f(__m256i x, const BLOWFISH_KEY *keystruct)
+{
+   const __m256i mask = _mm256_set1_epi32(0xff);
+   __m256i t;
+
+   t = _mm256_i32gather_epi32((const int *)keystruct->s[0], _mm256_srli_epi32(x, 24), 4);
+   t = _mm256_add_epi32(t, _mm256_i32gather_epi32((const int *)keystruct->s[1],
+                                                  _mm256_and_si256(_mm256_srli_epi32(x, 16), mask), 4));
+   t = _mm256_xor_si256(t, _mm256_i32gather_epi32((const int *)keystruct->s[2],
+                                                  _mm256_and_si256(_mm256_srli_epi32(x, 8), mask), 4));
+   t = _mm256_add_epi32(t, _mm256_i32gather_epi32((const int *)keystruct->s[3], _mm256_and_si256(x, mask), 4));
+   return(t);
+}
+
+AVX2 static void avx2_rounds8(__m256i *l, __m256i *r, const WORD p[18], const BLOWFISH_KEY *keystruct)
+{
+   __m256i a = *l, b = *r;
+   int idx;
+
+   for (idx = 0; idx < 16; idx += 2) {
+      a = _mm256_xor_si256(a, _mm256_set1_epi32(p[idx]));
+      b = _mm256_xor_si256(b, avx2_f(a, keystruct));
+      b = _mm256_xor_si256(b, _mm256_set1_epi32(p[idx + 1]));
+      a = _mm256_xor_si256(a, avx2_f(b, keystruct));
+   }
+
+   // The last round has no swap, so the halves come out exchanged.
+   *l = _mm256_xor_si256(b, _mm256_set1_epi32(p[17]));
+   *r = _mm256_xor_si256(a, _mm256_set1_epi32(p[16]));
+}
+
+// Loads eight big endian blocks and splits them into l and r lanes.
+AVX2 static void avx2_load8(const BYTE in[], __m256i *l, __m256i *r)
+{
+   const __m256i bswap = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+                                          3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+   const __m256i split = _mm256_setr_epi32(0,2,4,6,1,3,5,7);
+   __m256i lo = _mm256_loadu_si256((const __m256i *)in);
+   __m256i hi = _mm256_loadu_si256((const __m256i *)&in[32]);
+
+   lo = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(lo, bswap), split);
+   hi = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(hi, bswap), split);
+   *l = _mm256_permute2x128_si256(lo, hi, 0x20);
+   *r = _mm256_permute2x128_si256(lo, hi, 0x31);
+}
+
+// Inverse of avx2_load8. When in is not NULL the blocks are XORed with it, as in CTR.
+AVX2 static void avx2_store8(BYTE out[], const BYTE in[], __m256i l, __m256i r)
+{
+   const __m256i bswap = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+                                          3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+   const __m256i merge = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
+   __m256i lo = _mm256_permute2x128_si256(l, r, 0x20);
+   __m256i hi = _mm256_permute2x128_si256(l, r, 0x31);
+
+   lo = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(lo, merge), bswap);
+   hi = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(hi, merge), bswap);
+   if (in != NULL) {
+      lo = _mm256_xor_si256(lo, _mm256_loadu_si256((const __m256i *)in));
+      hi = _mm256_xor_si256(hi, _mm256_loadu_si256((const __m256i *)&in[32]));
+   }
+   _mm256_storeu_si256((__m256i *)out, lo);
+   _mm256_storeu_si256((__m256i *)&out[32], hi);
+}
+
+// Both return the number of blocks processed, a multiple of 8.
+AVX2 static size_t avx2_ecb_blocks(const BYTE in[], BYTE out[], size_t blocks, const WORD p[18],
+                                   const BLOWFISH_KEY *keystruct)
+{
+   __m256i l, r;
+   size_t blk;
+
+   for (blk = 0; blk + 8 <= blocks; blk += 8) {
+      avx2_load8(&in[blk * BLOWFISH_BLOCK_SIZE], &l, &r);
+      avx2_rounds8(&l, &r, p, keystruct);
+      avx2_store8(&out[blk * BLOWFISH_BLOCK_SIZE], NULL, l, r);
+   }
+   return(blk);
+}
+
+AVX2 static size_t avx2_ctr_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct,
+                                   unsigned long long *counter)
+{
+   const __m256i step = _mm256_setr_epi64x(0, 1, 2, 3);
+   const __m256i split = _mm256_setr_epi32(1,3,5,7,0,2,4,6);
+   __m256i l, r, c0, c1;
+   size_t blk;
+
+   for (blk = 0; blk + 8 <= blocks; blk += 8) {
+      // Counters as 64-bit lanes, then split into their high (l) and low (r) words.
+      c0 = _mm256_add_epi64(_mm256_set1_epi64x(*counter), step);
+      c1 = _mm256_add_epi64(_mm256_set1_epi64x(*counter + 4), step);
+      c0 = _mm256_permutevar8x32_epi32(c0, split);
+      c1 = _mm256_permutevar8x32_epi32(c1, split);
+      l = _mm256_permute2x128_si256(c0, c1, 0x20);
+      r = _mm256_permute2x128_si256(c0, c1, 0x31);
+      avx2_rounds8(&l, &r, keystruct->p, keystruct);
+      avx2_store8(&out[blk * BLOWFISH_BLOCK_SIZE], &in[blk * BLOWFISH_BLOCK_SIZE], l, r);
+      *counter += 8;
+   }
+   return(blk);
+}
+#endif
+
+/////////////////
+// Bulk
+/////////////////
+static const char *blowfish_impl_names[] = {"scalar", "interleaved", "avx2-gather"};
+static const int blowfish_impl_widths[] = {1, 4, 8};
+static int blowfish_impl = BLOWFISH_IMPL_INTERLEAVED;
+
+// Returns 1 if the CPU can run the given implementation.
+static int blowfish_impl_supported(int impl)
+{
+   switch (impl) {
+      case BLOWFISH_IMPL_SCALAR:
+      case BLOWFISH_IMPL_INTERLEAVED:
+         return(1);
+#ifdef BLOWFISH_X86
+      case BLOWFISH_IMPL_AVX2:
+         __builtin_cpu_init();
+         return(__builtin_cpu_supports("avx2"));
+#endif
+      default:
+         return(0);
+   }
+}
+
+int blowfish_set_impl(int impl)
+{
+   if (!blowfish_impl_supported(impl))
+      return(0);
+   blowfish_impl = impl;
+   return(1);
+}
+
+int blowfish_get_impl()
+{
+   return(blowfish_impl);
+}
+
+const char *blowfish_impl_name(int impl)
+{
+   if (impl < 0 || impl >= (int)(sizeof(blowfish_impl_names) / sizeof(blowfish_impl_names[0])))
+      return(NULL);
+   return(blowfish_impl_names[impl]);
+}
+
+int blowfish_impl_width(int impl)
+{
+   if (impl < 0 || impl >= (int)(sizeof(blowfish_impl_widths) / sizeof(blowfish_impl_widths[0])))
+      return(0);
+   return(blowfish_impl_widths[impl]);
+}
+
+__attribute__((constructor)) static void blowfish_select_impl()
+{
+   blowfish_set_impl(BLOWFISH_IMPL_AVX2);
+}
+
+// ECB over a run of blocks: groups of eight with AVX2, then groups of four, then the
+// single-block functions for the tail.
+static void blowfish_ecb_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct,
+                                int decrypt)
+{
+   WORD l[4], r[4], p[18];
+   size_t blk = 0;
+   int idx;
+
+   for (idx = 0; idx < 18; ++idx)
+      p[idx] = decrypt ? keystruct->p[17 - idx] : keystruct->p[idx];
+
+#ifdef BLOWFISH_X86
+   if (blowfish_impl == BLOWFISH_IMPL_AVX2)
+      blk = avx2_ecb_blocks(in, out, blocks, p, keystruct);
+#endif
+
+   for (; blowfish_impl != BLOWFISH_IMPL_SCALAR && blk + 4 <= blocks; blk += 4) {
+      for (idx = 0; idx < 4; ++idx) {
+         l[idx] = load_word(&in[(blk + idx) * BLOWFISH_BLOCK_SIZE]);
+         r[idx] = load_word(&in[(blk + idx) * BLOWFISH_BLOCK_SIZE + 4]);
+      }
+      blowfish_rounds4(l, r, p, keystruct);
+      for (idx = 0; idx < 4; ++idx) {
+         store_word(&out[(blk + idx) * BLOWFISH_BLOCK_SIZE], l[idx]);
+         store_word(&out[(blk + idx) * BLOWFISH_BLOCK_SIZE + 4], r[idx]);
+      }
+   }
+
+   for (; blk < blocks; ++blk) {
+      if (decrypt)
+         blowfish_decrypt(&in[blk * BLOWFISH_BLOCK_SIZE], &out[blk * BLOWFISH_BLOCK_SIZE], keystruct);
+      else
+         blowfish_encrypt(&in[blk * BLOWFISH_BLOCK_SIZE], &out[blk * BLOWFISH_BLOCK_SIZE], keystruct);
+   }
+}
+
+void blowfish_ecb_encrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct)
+{
+   blowfish_ecb_blocks(in, out, blocks, keystruct, 0);
+}
+
+void blowfish_ecb_decrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct)
+{
+   blowfish_ecb_blocks(in, out, blocks, keystruct, 1);
+}
+
+void blowfish_ctr_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct,
+                         BYTE ctr[])
+{
+   unsigned long long counter = ((unsigned long long)load_word(ctr) << 32) | load_word(&ctr[4]);
+   WORD l[4], r[4];
+   BYTE block[BLOWFISH_BLOCK_SIZE];
+   size_t blk = 0, n;
+   int idx;
+
+#ifdef BLOWFISH_X86
+   if (blowfish_impl == BLOWFISH_IMPL_AVX2)
+      blk = avx2_ctr_blocks(in, out, blocks, keystruct, &counter);
+#endif
+
+   for (; blk < blocks; blk += n) {
+      if (blowfish_impl == BLOWFISH_IMPL_SCALAR) {
+         n = 1;
+         store_word(block, (WORD)(counter >> 32));
+         store_word(&block[4], (WORD)counter);
+         blowfish_encrypt(block, block, keystruct);
+         l[0] = load_word(block);
+         r[0] = load_word(&block[4]);
+      }
+      else {
+         n = blocks - blk < 4 ? blocks - blk : 4;
+         for (idx = 0; idx < 4; ++idx) {
+            l[idx] = (WORD)((counter + idx) >> 32);
+            r[idx] = (WORD)(counter + idx);
+         }
+         blowfish_rounds4(l, r, keystruct->p, keystruct);
+      }
+      for (idx = 0; idx < (int)n; ++idx) {
+         const BYTE *src = &in[(blk + idx) * BLOWFISH_BLOCK_SIZE];
+         BYTE *dst = &out[(blk + idx) * BLOWFISH_BLOCK_SIZE];
+         store_word(dst, load_word(src) ^ l[idx]);
+         store_word(&dst[4], load_word(&src[4]) ^ r[idx]);
+      }
+      counter += n;
+   }
+
+   store_word(ctr, (WORD)(counter >> 32));
+   store_word(&ctr[4], (WORD)counter);
+}
+
+// Copies the constant P-array and S-boxes and combines the key with the P-array.
+static void blowfish_key_init(const BYTE user_key[], BLOWFISH_KEY *keystruct, size_t len)
 {
-   BYTE block[8];
    int idx,idx2;
 
    // Copy over the constant init array vals (so the originals aren't destroyed).
@@ -249,6 +553,15 @@ void blowfish_key_setup(const BYTE user_key[], BLOWFISH_KEY *keystruct, size_t l
    for (idx = 0, idx2 = 0; idx < 18; ++idx, idx2 += 4)
       keystruct->p[idx] ^= (user_key[idx2 % len] << 24) | (user_key[(idx2+1) % len] << 16)
                            | (user_key[(idx2+2) % len] << 8) | (user_key[(idx2+3) % len]);
+}
+
+void blowfish_key_setup(const BYTE user_key[], BLOWFISH_KEY *keystruct, size_t len)
+{
+   BYTE block[8];
+   int idx,idx2;
+
+   blowfish_key_init(user_key, keystruct, len);
+
    // Re-calculate the P box.
    memset(block, 0, 8);
    for (idx = 0; idx < 18; idx += 2) {
@@ -267,3 +580,140 @@ void blowfish_key_setup(const BYTE user_key[], BLOWFISH_KEY *keystruct, size_t l
       }
    }
 }
+
+/////////////////
+// Batched key setup
+/////////////////
+// The key schedule is 521 encryptions where each one depends on the previous one, so a
+// single key setup cannot overlap its S-box loads. The chains of different keys are
+// independent, so they are run side by side like the blocks of the bulk functions,
+// each lane reading the P-array and S-boxes of its own key.
+#define F_KEY(k,x,t) t = (k)->s[0][(x) >> 24]; \
+                     t += (k)->s[1][((x) >> 16) & 0xff]; \
+                     t ^= (k)->s[2][((x) >> 8) & 0xff]; \
+                     t += (k)->s[3][(x) & 0xff];
+#define HALF_ROUND_KEYS4(a,b,pval) \
+   a##0 ^= k0->p[pval]; a##1 ^= k1->p[pval]; a##2 ^= k2->p[pval]; a##3 ^= k3->p[pval]; \
+   F_KEY(k0,a##0,t0); F_KEY(k1,a##1,t1); F_KEY(k2,a##2,t2); F_KEY(k3,a##3,t3); \
+   b##0 ^= t0; b##1 ^= t1; b##2 ^= t2; b##3 ^= t3;
+
+// Encrypts block l[i],r[i] with key k[i] for each of the four lanes, in place.
+static void blowfish_encrypt_keys4(WORD l[4], WORD r[4], BLOWFISH_KEY *k[4])
+{
+   const BLOWFISH_KEY *k0 = k[0], *k1 = k[1], *k2 = k[2], *k3 = k[3];
+   WORD l0 = l[0], l1 = l[1], l2 = l[2], l3 = l[3];
+   WORD r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3];
+   WORD t0, t1, t2, t3;
+   int idx;
+
+   for (idx = 0; idx < 16; idx += 2) {
+      HALF_ROUND_KEYS4(l,r,idx);
+      HALF_ROUND_KEYS4(r,l,idx + 1);
+   }
+
+   l[0] = r0 ^ k0->p[17]; l[1] = r1 ^ k1->p[17]; l[2] = r2 ^ k2->p[17]; l[3] = r3 ^ k3->p[17];
+   r[0] = l0 ^ k0->p[16]; r[1] = l1 ^ k1->p[16]; r[2] = l2 ^ k2->p[16]; r[3] = l3 ^ k3->p[16];
+}
+
+// Finishes the key setup of four keys already prepared by blowfish_key_init.
+static void blowfish_key_schedule4(BLOWFISH_KEY *k[4])
+{
+   WORD l[4] = {0}, r[4] = {0};
+   int idx, idx2, lane;
+
+   for (idx = 0; idx < 18; idx += 2) {
+      blowfish_encrypt_keys4(l, r, k);
+      for (lane = 0; lane < 4; ++lane) {
+         k[lane]->p[idx] = l[lane];
+         k[lane]->p[idx + 1] = r[lane];
+      }
+   }
+   for (idx = 0; idx < 4; ++idx) {
+      for (idx2 = 0; idx2 < 256; idx2 += 2) {
+         blowfish_encrypt_keys4(l, r, k);
+         for (lane = 0; lane < 4; ++lane) {
+            k[lane]->s[idx][idx2] = l[lane];
+            k[lane]->s[idx][idx2 + 1] = r[lane];
+         }
+      }
+   }
+}
+
+#ifdef BLOWFISH_X86
+// Eight keys in the lanes of the vectors. Every lane gathers from its own BLOWFISH_KEY,
+// given as a word offset from the first key of the batch. AVX2 has no scatter, so the
+// new P-array and S-box entries are written back one lane at a time.
+AVX2 static __m256i avx2_f_keys(__m256i x, const int *base, __m256i s)
+{
+   const __m256i mask = _mm256_set1_epi32(0xff);
+   const __m256i box = _mm256_set1_epi32(256);
+   __m256i t;
+
+   t = _mm256_i32gather_epi32(base, _mm256_add_epi32(s, _mm256_srli_epi32(x, 24)), 4);
+   s = _mm256_add_epi32(s, box);
+   t = _mm256_add_epi32(t, _mm256_i32gather_epi32(base, _mm256_add_epi32(s, _mm256_and_si256(_mm256_srli_epi32(x, 16), mask)), 4));
+   s = _mm256_add_epi32(s, box);
+   t = _mm256_xor_si256(t, _mm256_i32gather_epi32(base, _mm256_add_epi32(s, _mm256_and_si256(_mm256_srli_epi32(x, 8), mask)), 4));
+   s = _mm256_add_epi32(s, box);
+   t = _mm256_add_epi32(t, _mm256_i32gather_epi32(base, _mm256_add_epi32(s, _mm256_and_si256(x, mask)), 4));
+   return(t);
+}
+
+AVX2 static void avx2_key_schedule8(BLOWFISH_KEY keys[])
+{
+   const int *base = (const int *)keys;
+   const int stride = sizeof(BLOWFISH_KEY) / sizeof(WORD);
+   const __m256i p = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7), _mm256_set1_epi32(stride));
+   const __m256i s = _mm256_add_epi32(p, _mm256_set1_epi32(18));
+   __m256i l = _mm256_setzero_si256(), r = _mm256_setzero_si256();
+   WORD out_l[8], out_r[8];
+   int idx, round, lane;
+
+   for (idx = 0; idx < 18 + 1024; idx += 2) {
+      for (round = 0; round < 16; round += 2) {
+         l = _mm256_xor_si256(l, _mm256_i32gather_epi32(base, _mm256_add_epi32(p, _mm256_set1_epi32(round)), 4));
+         r = _mm256_xor_si256(r, avx2_f_keys(l, base, s));
+         r = _mm256_xor_si256(r, _mm256_i32gather_epi32(base, _mm256_add_epi32(p, _mm256_set1_epi32(round + 1)), 4));
+         l = _mm256_xor_si256(l, avx2_f_keys(r, base, s));
+      }
+      __m256i t = _mm256_xor_si256(r, _mm256_i32gather_epi32(base, _mm256_add_epi32(p, _mm256_set1_epi32(17)), 4));
+      r = _mm256_xor_si256(l, _mm256_i32gather_epi32(base, _mm256_add_epi32(p, _mm256_set1_epi32(16)), 4));
+      l = t;
+
+      // p and s are contiguous in BLOWFISH_KEY, so idx walks the P-array and then the S-boxes.
+      _mm256_storeu_si256((__m256i *)out_l, l);
+      _mm256_storeu_si256((__m256i *)out_r, r);
+      for (lane = 0; lane < 8; ++lane) {
+         WORD *words = (WORD *)&keys[lane];
+         words[idx] = out_l[lane];
+         words[idx + 1] = out_r[lane];
+      }
+   }
+}
+#endif
+
+void blowfish_key_setup_batch(const BYTE *const user_keys[], const size_t lens[], BLOWFISH_KEY keystructs[],
+                              size_t count)
+{
+   BLOWFISH_KEY *lanes[4];
+   size_t key = 0, idx;
+
+   for (idx = 0; idx < count; ++idx)
+      blowfish_key_init(user_keys[idx], &keystructs[idx], lens[idx]);
+
+#ifdef BLOWFISH_X86
+   if (blowfish_impl == BLOWFISH_IMPL_AVX2) {
+      for (; key + 8 <= count; key += 8)
+         avx2_key_schedule8(&keystructs[key]);
+   }
+#endif
+
+   for (; blowfish_impl != BLOWFISH_IMPL_SCALAR && key + 4 <= count; key += 4) {
+      for (idx = 0; idx < 4; ++idx)
+         lanes[idx] = &keystructs[key + idx];
+      blowfish_key_schedule4(lanes);
+   }
+
+   for (; key < count; ++key)
+      blowfish_key_setup(user_keys[key], &keystructs[key], lens[key]);
+}
@@ -15,6 +15,11 @@
 /****************************** MACROS ******************************/
 #define BLOWFISH_BLOCK_SIZE 8           // Blowfish operates on 8 bytes at a time
 
+// Implementations of the multi-block functions, see blowfish_set_impl().
+#define BLOWFISH_IMPL_SCALAR      0     // One block at a time with blowfish_encrypt/blowfish_decrypt
+#define BLOWFISH_IMPL_INTERLEAVED 1     // Four blocks interleaved per round
+#define BLOWFISH_IMPL_AVX2        2     // Eight blocks in AVX2 lanes, S-box lookups with vpgatherdd
+
 /**************************** DATA TYPES ****************************/
 typedef unsigned char BYTE;             // 8-bit byte
 typedef unsigned int  WORD;             // 32-bit word, change to "long" for 16-bit machines
@@ -26,7 +31,31 @@ typedef struct {
 
 /*********************** FUNCTION DECLARATIONS **********************/
 void blowfish_key_setup(const BYTE user_key[], BLOWFISH_KEY *keystruct, size_t len);
+
+// Expands count keys at once. The 521 dependent encryptions of each key schedule are
+// interleaved with those of other keys, four at a time or eight in AVX2 lanes depending
+// on the selected implementation. The result is the same as calling blowfish_key_setup
+// on each key.
+void blowfish_key_setup_batch(const BYTE *const user_keys[], const size_t lens[], BLOWFISH_KEY keystructs[],
+                              size_t count);
 void blowfish_encrypt(const BYTE in[], BYTE out[], const BLOWFISH_KEY *keystruct);
 void blowfish_decrypt(const BYTE in[], BYTE out[], const BLOWFISH_KEY *keystruct);
 
+// Selects the implementation used by the multi-block functions. All implementations
+// produce identical output. At startup AVX2 is selected if the CPU supports it, and the
+// interleaved one otherwise.
+// Returns 0 if the implementation is unknown or not available on this machine.
+int blowfish_set_impl(int impl);
+int blowfish_get_impl();
+const char *blowfish_impl_name(int impl);  // NULL for an unknown implementation
+int blowfish_impl_width(int impl);         // Blocks processed per iteration
+
+// Whole runs of blocks in one call, processing several independent blocks per round so
+// the S-box loads overlap. The input and output buffers may be the same. The CTR
+// function uses ctr as a 64-bit big endian counter and updates it so that consecutive
+// calls continue the same stream.
+void blowfish_ecb_encrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct);
+void blowfish_ecb_decrypt_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct);
+void blowfish_ctr_blocks(const BYTE in[], BYTE out[], size_t blocks, const BLOWFISH_KEY *keystruct, BYTE ctr[]);
+
 #endif   // BLOWFISH_H
@@ -17,6 +17,12 @@
 #include <memory.h>
 #include "sha256.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 /****************************** MACROS ******************************/
 #define ROTLEFT(a,b) (((a) << (b)) | ((a) >> (32-(b))))
 #define ROTRIGHT(a,b) (((a) >> (b)) | ((a) << (32-(b))))
@@ -41,45 +47,144 @@ static const WORD k[64] = {
 };
 
 /*********************** FUNCTION DEFINITIONS ***********************/
-void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
+// Portable compression function over a run of consecutive 64-byte blocks.
+static void sha256_blocks_generic(WORD state[8], const BYTE data[], size_t blocks)
 {
 	WORD a, b, c, d, e, f, g, h, i, j, t1, t2, m[64];
 
-	for (i = 0, j = 0; i < 16; ++i, j += 4)
-		m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
-	for ( ; i < 64; ++i)
-		m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
-
-	a = ctx->state[0];
-	b = ctx->state[1];
-	c = ctx->state[2];
-	d = ctx->state[3];
-	e = ctx->state[4];
-	f = ctx->state[5];
-	g = ctx->state[6];
-	h = ctx->state[7];
-
-	for (i = 0; i < 64; ++i) {
-		t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
-		t2 = EP0(a) + MAJ(a,b,c);
-		h = g;
-		g = f;
-		f = e;
-		e = d + t1;
-		d = c;
-		c = b;
-		b = a;
-		a = t1 + t2;
-	}
-
-	ctx->state[0] += a;
-	ctx->state[1] += b;
-	ctx->state[2] += c;
-	ctx->state[3] += d;
-	ctx->state[4] += e;
-	ctx->state[5] += f;
-	ctx->state[6] += g;
-	ctx->state[7] += h;
+	for ( ; blocks > 0; --blocks, data += 64) {
+		for (i = 0, j = 0; i < 16; ++i, j += 4)
+			m[i] = (data[j] << 24) | (data[j + 1] << 16) | (data[j + 2] << 8) | (data[j + 3]);
+		for ( ; i < 64; ++i)
+			m[i] = SIG1(m[i - 2]) + m[i - 7] + SIG0(m[i - 15]) + m[i - 16];
+
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+		f = state[5];
+		g = state[6];
+		h = state[7];
+
+		for (i = 0; i < 64; ++i) {
+			t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
+			t2 = EP0(a) + MAJ(a,b,c);
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef SHA256_X86
+#define SHANI __attribute__((target("sha,sse4.1,ssse3")))
+
+// Compression function with the SHA extensions. sha256rnds2 runs two rounds on the state
+// split as ABEF/CDGH, and sha256msg1/sha256msg2 compute the message schedule four words
+// at a time.
+SHANI static void sha256_blocks_shani(WORD state[8], const BYTE data[], size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp, w[4];
+	int i;
+
+	// Reorder the state words into the ABEF/CDGH layout of sha256rnds2.
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);   // CDAB
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B); // EFGH
+	state0 = _mm_alignr_epi8(tmp, state1, 8);                                     // ABEF
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                  // CDGH
+
+	for ( ; blocks > 0; --blocks, data += 64) {
+		abef = state0;
+		cdgh = state1;
+
+		// Fully unrolled, so w[] stays in registers.
+#pragma GCC unroll 16
+		for (i = 0; i < 16; ++i) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)&data[i * 16]), bswap);
+			}
+			else {
+				// W[t..t+3] from W[t-16..t-13], W[t-15..t-12], W[t-7..t-4] and W[t-4..t-1].
+				tmp = _mm_alignr_epi8(w[(i - 1) & 3], w[(i - 2) & 3], 4);
+				tmp = _mm_add_epi32(_mm_sha256msg1_epu32(w[i & 3], w[(i - 3) & 3]), tmp);
+				w[i & 3] = _mm_sha256msg2_epu32(tmp, w[(i - 1) & 3]);
+			}
+
+			msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&k[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);         // FEBA
+	state1 = _mm_shuffle_epi32(state1, 0xB1);      // DCHG
+	state0 = _mm_blend_epi16(tmp, state1, 0xF0);   // DCBA
+	state1 = _mm_alignr_epi8(state1, tmp, 8);      // HGFE
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+#endif
+
+typedef void (*SHA256_BLOCKS_FUNC)(WORD state[8], const BYTE data[], size_t blocks);
+
+static SHA256_BLOCKS_FUNC sha256_blocks_impl = sha256_blocks_generic;
+
+int sha256_use_shani(int enable)
+{
+	if (!enable) {
+		sha256_blocks_impl = sha256_blocks_generic;
+		return(1);
+	}
+#ifdef SHA256_X86
+	unsigned int eax, ebx, ecx, edx;
+	__builtin_cpu_init();
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_SHA) &&
+	    __builtin_cpu_supports("sse4.1")) {
+		sha256_blocks_impl = sha256_blocks_shani;
+		return(1);
+	}
+#endif
+	return(0);
+}
+
+int sha256_uses_shani()
+{
+#ifdef SHA256_X86
+	return(sha256_blocks_impl == sha256_blocks_shani);
+#else
+	return(0);
+#endif
+}
+
+// With the SHA extensions one stream per lane is already faster than eight AVX2 lanes.
+__attribute__((constructor)) static void sha256_select_impl()
+{
+	if (!sha256_use_shani(1))
+		sha256_multi_use_avx2(1);
+}
+
+void sha256_transform(SHA256_CTX *ctx, const BYTE data[])
+{
+	sha256_blocks_impl(ctx->state, data, 1);
 }
 
 void sha256_init(SHA256_CTX *ctx)
@@ -98,17 +203,33 @@ void sha256_init(SHA256_CTX *ctx)
 
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len)
 {
-	WORD i;
+	size_t fill, blocks;
 
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	// Complete the block left over from the previous call.
+	if (ctx->datalen > 0) {
+		fill = 64 - ctx->datalen < len ? 64 - ctx->datalen : len;
+		memcpy(&ctx->data[ctx->datalen], data, fill);
+		ctx->datalen += fill;
+		data += fill;
+		len -= fill;
+		if (ctx->datalen < 64)
+			return;
+		sha256_transform(ctx, ctx->data);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
 	}
+
+	// Whole blocks are hashed straight from the caller's buffer, without copying.
+	blocks = len / 64;
+	if (blocks > 0) {
+		sha256_blocks_impl(ctx->state, data, blocks);
+		ctx->bitlen += (unsigned long long)blocks * 512;
+		data += blocks * 64;
+		len -= blocks * 64;
+	}
+
+	memcpy(ctx->data, data, len);
+	ctx->datalen = len;
 }
 
 void sha256_final(SHA256_CTX *ctx, BYTE hash[])
@@ -156,3 +277,450 @@ void sha256_final(SHA256_CTX *ctx, BYTE hash[])
 		hash[i + 28] = (ctx->state[7] >> (24 - i * 8)) & 0x000000ff;
 	}
 }
+
+/////////////////
+// Multi-buffer
+/////////////////
+// Runs blocks of several independent messages at once. Lanes whose state is NULL are idle.
+typedef void (*SHA256_MULTI_FUNC)(WORD *const state[SHA256_LANES], const BYTE *const data[SHA256_LANES],
+                                  size_t blocks);
+
+// One lane after the other with the single-stream compression function.
+static void sha256_multi_serial(WORD *const state[SHA256_LANES], const BYTE *const data[SHA256_LANES],
+                                size_t blocks)
+{
+	int lane;
+
+	for (lane = 0; lane < SHA256_LANES; ++lane) {
+		if (state[lane] != NULL)
+			sha256_blocks_impl(state[lane], data[lane], blocks);
+	}
+}
+
+#ifdef SHA256_X86
+#define AVX2 __attribute__((target("avx2")))
+#define ROTR8(x,n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+
+// Transposes eight rows of eight words, so that row i of the output holds word i of
+// every input row.
+AVX2 static void sha256_transpose8(__m256i r[8])
+{
+	__m256i t0, t1, t2, t3, t4, t5, t6, t7, u0, u1, u2, u3, u4, u5, u6, u7;
+
+	t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+	t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+	t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+	t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+	t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+	t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+	t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+	t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+	u0 = _mm256_unpacklo_epi64(t0, t2);
+	u1 = _mm256_unpackhi_epi64(t0, t2);
+	u2 = _mm256_unpacklo_epi64(t1, t3);
+	u3 = _mm256_unpackhi_epi64(t1, t3);
+	u4 = _mm256_unpacklo_epi64(t4, t6);
+	u5 = _mm256_unpackhi_epi64(t4, t6);
+	u6 = _mm256_unpacklo_epi64(t5, t7);
+	u7 = _mm256_unpackhi_epi64(t5, t7);
+	r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+	r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+	r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+	r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+	r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+	r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+	r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+	r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// Eight messages in the lanes of the vectors: every 32-bit lane runs the same rounds as
+// sha256_blocks_generic on its own state and message words.
+AVX2 static void sha256_multi_avx2(WORD *const state[SHA256_LANES], const BYTE *const data[SHA256_LANES],
+                                   size_t blocks)
+{
+	const __m256i bswap = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+	                                       3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+	const BYTE *ptr[SHA256_LANES];
+	WORD idle[8] = {0}, *lanes[SHA256_LANES];
+	__m256i s[8], m[16], r[8];
+	__m256i a, b, c, d, e, f, g, h, t1, t2;
+	size_t off;
+	int lane, active = 0, i;
+
+	for (lane = 0; lane < SHA256_LANES; ++lane) {
+		if (state[lane] != NULL)
+			active = lane;
+	}
+	// Idle lanes hash the data of an active lane into a scratch state.
+	for (lane = 0; lane < SHA256_LANES; ++lane) {
+		lanes[lane] = state[lane] != NULL ? state[lane] : idle;
+		ptr[lane] = state[lane] != NULL ? data[lane] : data[active];
+		r[lane] = _mm256_loadu_si256((const __m256i *)lanes[lane]);
+	}
+	sha256_transpose8(r);
+	for (i = 0; i < 8; ++i)
+		s[i] = r[i];
+
+	for (off = 0; blocks > 0; --blocks, off += 64) {
+		for (i = 0; i < 16; i += 8) {
+			for (lane = 0; lane < SHA256_LANES; ++lane)
+				r[lane] = _mm256_loadu_si256((const __m256i *)&ptr[lane][off + i * 4]);
+			sha256_transpose8(r);
+			for (lane = 0; lane < 8; ++lane)
+				m[i + lane] = _mm256_shuffle_epi8(r[lane], bswap);
+		}
+
+		a = s[0]; b = s[1]; c = s[2]; d = s[3];
+		e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+		for (i = 0; i < 64; ++i) {
+			__m256i w;
+			if (i < 16) {
+				w = m[i];
+			}
+			else {
+				// The schedule only needs the last 16 words, kept in a ring.
+				__m256i w2 = m[(i - 2) & 15], w15 = m[(i - 15) & 15];
+				__m256i sig1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w2, 17), ROTR8(w2, 19)),
+				                                _mm256_srli_epi32(w2, 10));
+				__m256i sig0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w15, 7), ROTR8(w15, 18)),
+				                                _mm256_srli_epi32(w15, 3));
+				w = _mm256_add_epi32(_mm256_add_epi32(sig1, m[(i - 7) & 15]),
+				                     _mm256_add_epi32(sig0, m[i & 15]));
+				m[i & 15] = w;
+			}
+
+			t1 = _mm256_add_epi32(h, _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25)));
+			t1 = _mm256_add_epi32(t1, _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)));
+			t1 = _mm256_add_epi32(t1, _mm256_add_epi32(_mm256_set1_epi32(k[i]), w));
+			t2 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+			t2 = _mm256_add_epi32(t2, _mm256_xor_si256(_mm256_and_si256(a, _mm256_xor_si256(b, c)),
+			                                           _mm256_and_si256(b, c)));
+			h = g;
+			g = f;
+			f = e;
+			e = _mm256_add_epi32(d, t1);
+			d = c;
+			c = b;
+			b = a;
+			a = _mm256_add_epi32(t1, t2);
+		}
+
+		s[0] = _mm256_add_epi32(s[0], a); s[1] = _mm256_add_epi32(s[1], b);
+		s[2] = _mm256_add_epi32(s[2], c); s[3] = _mm256_add_epi32(s[3], d);
+		s[4] = _mm256_add_epi32(s[4], e); s[5] = _mm256_add_epi32(s[5], f);
+		s[6] = _mm256_add_epi32(s[6], g); s[7] = _mm256_add_epi32(s[7], h);
+	}
+
+	// The transpose is its own inverse.
+	for (i = 0; i < 8; ++i)
+		r[i] = s[i];
+	sha256_transpose8(r);
+	for (lane = 0; lane < SHA256_LANES; ++lane)
+		_mm256_storeu_si256((__m256i *)lanes[lane], r[lane]);
+}
+#endif
+
+static SHA256_MULTI_FUNC sha256_multi_impl = sha256_multi_serial;
+
+int sha256_multi_use_avx2(int enable)
+{
+	if (!enable) {
+		sha256_multi_impl = sha256_multi_serial;
+		return(1);
+	}
+#ifdef SHA256_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		sha256_multi_impl = sha256_multi_avx2;
+		return(1);
+	}
+#endif
+	return(0);
+}
+
+int sha256_multi_uses_avx2()
+{
+#ifdef SHA256_X86
+	return(sha256_multi_impl == sha256_multi_avx2);
+#else
+	return(0);
+#endif
+}
+
+void sha256_update_multi(SHA256_CTX *const ctx[SHA256_LANES], const BYTE *const data[SHA256_LANES], size_t len)
+{
+	WORD *state[SHA256_LANES];
+	const BYTE *ptr[SHA256_LANES];
+	size_t off[SHA256_LANES], blocks = 0, fill;
+	int lane, first = 1;
+
+	// Complete the pending partial blocks. The contexts may be at different offsets, so
+	// the number of whole blocks left differs by at most one between lanes.
+	for (lane = 0; lane < SHA256_LANES; ++lane) {
+		state[lane] = NULL;
+		if (ctx[lane] == NULL)
+			continue;
+		off[lane] = 0;
+		if (ctx[lane]->datalen > 0) {
+			fill = 64 - ctx[lane]->datalen < len ? 64 - ctx[lane]->datalen : len;
+			sha256_update(ctx[lane], data[lane], fill);
+			off[lane] = fill;
+		}
+		if (first || (len - off[lane]) / 64 < blocks)
+			blocks = (len - off[lane]) / 64;
+		first = 0;
+	}
+
+	if (blocks > 0) {
+		for (lane = 0; lane < SHA256_LANES; ++lane) {
+			if (ctx[lane] == NULL)
+				continue;
+			state[lane] = ctx[lane]->state;
+			ptr[lane] = &data[lane][off[lane]];
+			ctx[lane]->bitlen += (unsigned long long)blocks * 512;
+			off[lane] += blocks * 64;
+		}
+		sha256_multi_impl(state, ptr, blocks);
+	}
+
+	for (lane = 0; lane < SHA256_LANES; ++lane) {
+		if (ctx[lane] != NULL)
+			sha256_update(ctx[lane], &data[lane][off[lane]], len - off[lane]);
+	}
+}
+
+// Per-lane progress of sha256_multi: the whole blocks of the message, then the padded
+// last one or two blocks from tail.
+typedef struct {
+	size_t msg;                 // Index of the message in the lane
+	const BYTE *ptr;            // Next block to hash
+	size_t blocks;              // Blocks left in the current segment
+	int in_tail;
+	size_t tail_blocks;
+	BYTE tail[128];
+	WORD state[8];
+} SHA256_LANE;
+
+static void sha256_lane_start(SHA256_LANE *lane, size_t msg, const BYTE data[], size_t len)
+{
+	unsigned long long bitlen = (unsigned long long)len * 8;
+	size_t rest = len % 64;
+	int i;
+
+	lane->msg = msg;
+	lane->ptr = data;
+	lane->blocks = len / 64;
+	lane->in_tail = 0;
+	lane->tail_blocks = rest < 56 ? 1 : 2;
+	memset(lane->tail, 0, sizeof(lane->tail));
+	memcpy(lane->tail, &data[len - rest], rest);
+	lane->tail[rest] = 0x80;
+	for (i = 0; i < 8; ++i)
+		lane->tail[lane->tail_blocks * 64 - 1 - i] = bitlen >> (i * 8);
+
+	lane->state[0] = 0x6a09e667;
+	lane->state[1] = 0xbb67ae85;
+	lane->state[2] = 0x3c6ef372;
+	lane->state[3] = 0xa54ff53a;
+	lane->state[4] = 0x510e527f;
+	lane->state[5] = 0x9b05688c;
+	lane->state[6] = 0x1f83d9ab;
+	lane->state[7] = 0x5be0cd19;
+}
+
+void sha256_multi(const BYTE *const data[], const size_t lens[], BYTE hashes[][SHA256_BLOCK_SIZE], size_t count)
+{
+	SHA256_LANE lanes[SHA256_LANES];
+	WORD *state[SHA256_LANES];
+	const BYTE *ptr[SHA256_LANES];
+	size_t next = 0, blocks;
+	int lane, active, i;
+
+	for (lane = 0; lane < SHA256_LANES; ++lane) {
+		state[lane] = NULL;
+		if (next < count) {
+			sha256_lane_start(&lanes[lane], next, data[next], lens[next]);
+			state[lane] = lanes[lane].state;
+			++next;
+		}
+	}
+
+	for (;;) {
+		// Switch lanes that finished a segment to their tail, or to the next message.
+		for (lane = 0; lane < SHA256_LANES; ++lane) {
+			while (state[lane] != NULL && lanes[lane].blocks == 0) {
+				if (!lanes[lane].in_tail) {
+					lanes[lane].in_tail = 1;
+					lanes[lane].ptr = lanes[lane].tail;
+					lanes[lane].blocks = lanes[lane].tail_blocks;
+					continue;
+				}
+				for (i = 0; i < 4; ++i) {
+					int w;
+					for (w = 0; w < 8; ++w)
+						hashes[lanes[lane].msg][i + w * 4] = (lanes[lane].state[w] >> (24 - i * 8)) & 0x000000ff;
+				}
+				state[lane] = NULL;
+				if (next < count) {
+					sha256_lane_start(&lanes[lane], next, data[next], lens[next]);
+					state[lane] = lanes[lane].state;
+					++next;
+				}
+			}
+		}
+
+		blocks = 0;
+		active = 0;
+		for (lane = 0; lane < SHA256_LANES; ++lane) {
+			if (state[lane] == NULL)
+				continue;
+			if (!active || lanes[lane].blocks < blocks)
+				blocks = lanes[lane].blocks;
+			active = 1;
+		}
+		if (!active)
+			break;
+
+		for (lane = 0; lane < SHA256_LANES; ++lane)
+			ptr[lane] = state[lane] != NULL ? lanes[lane].ptr : NULL;
+		sha256_multi_impl(state, ptr, blocks);
+		for (lane = 0; lane < SHA256_LANES; ++lane) {
+			if (state[lane] != NULL) {
+				lanes[lane].ptr += blocks * 64;
+				lanes[lane].blocks -= blocks;
+			}
+		}
+	}
+}
+
+/////////////////
+// HMAC and PBKDF2
+/////////////////
+static void sha256_store_state(const WORD state[8], BYTE hash[])
+{
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		hash[i * 4]     = state[i] >> 24;
+		hash[i * 4 + 1] = state[i] >> 16;
+		hash[i * 4 + 2] = state[i] >> 8;
+		hash[i * 4 + 3] = state[i];
+	}
+}
+
+void hmac_sha256_init(HMAC_SHA256_KEY *key, const BYTE secret[], size_t len)
+{
+	BYTE block[64] = {0};
+	SHA256_CTX ctx;
+	int i;
+
+	// Keys longer than a block are hashed first.
+	if (len > 64) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, secret, len);
+		sha256_final(&ctx, block);
+	}
+	else
+		memcpy(block, secret, len);
+
+	for (i = 0; i < 64; ++i)
+		block[i] ^= 0x36;
+	sha256_init(&ctx);
+	sha256_transform(&ctx, block);
+	memcpy(key->inner, ctx.state, sizeof(key->inner));
+
+	for (i = 0; i < 64; ++i)
+		block[i] ^= 0x36 ^ 0x5c;
+	sha256_init(&ctx);
+	sha256_transform(&ctx, block);
+	memcpy(key->outer, ctx.state, sizeof(key->outer));
+
+	memset(block, 0, sizeof(block));
+	memset(&ctx, 0, sizeof(ctx));
+}
+
+void hmac_sha256(const HMAC_SHA256_KEY *key, const BYTE data[], size_t len, BYTE mac[])
+{
+	SHA256_CTX ctx;
+
+	// Both hashes resume after the pad block, which is already in the cached states.
+	memcpy(ctx.state, key->inner, sizeof(ctx.state));
+	ctx.datalen = 0;
+	ctx.bitlen = 512;
+	sha256_update(&ctx, data, len);
+	sha256_final(&ctx, mac);
+
+	memcpy(ctx.state, key->outer, sizeof(ctx.state));
+	ctx.datalen = 0;
+	ctx.bitlen = 512;
+	sha256_update(&ctx, mac, SHA256_BLOCK_SIZE);
+	sha256_final(&ctx, mac);
+}
+
+// Every iteration after the first hashes a 32-byte message behind a cached pad block, so
+// both hashes fit in one padded block and cost one compression each. The padding and
+// length are written once and only the first 32 bytes change between iterations.
+static void pbkdf2_sha256_block(const HMAC_SHA256_KEY *key, const BYTE salt[], size_t salt_len,
+				unsigned int index, unsigned long iterations, BYTE out[])
+{
+	BYTE counter[4] = {index >> 24, index >> 16, index >> 8, index};
+	BYTE block[64] = {0};
+	WORD state[8];
+	SHA256_CTX ctx;
+	unsigned long i;
+	int j;
+
+	memcpy(ctx.state, key->inner, sizeof(ctx.state));
+	ctx.datalen = 0;
+	ctx.bitlen = 512;
+	sha256_update(&ctx, salt, salt_len);
+	sha256_update(&ctx, counter, 4);
+	sha256_final(&ctx, block);
+	memcpy(ctx.state, key->outer, sizeof(ctx.state));
+	ctx.datalen = 0;
+	ctx.bitlen = 512;
+	sha256_update(&ctx, block, SHA256_BLOCK_SIZE);
+	sha256_final(&ctx, block);
+	memcpy(out, block, SHA256_BLOCK_SIZE);
+
+	// 64 + 32 bytes: 768 bits.
+	block[SHA256_BLOCK_SIZE] = 0x80;
+	block[62] = 0x03;
+	block[63] = 0x00;
+	for (i = 1; i < iterations; ++i) {
+		memcpy(state, key->inner, sizeof(state));
+		sha256_blocks_impl(state, block, 1);
+		sha256_store_state(state, block);
+		memcpy(state, key->outer, sizeof(state));
+		sha256_blocks_impl(state, block, 1);
+		sha256_store_state(state, block);
+		for (j = 0; j < SHA256_BLOCK_SIZE; ++j)
+			out[j] ^= block[j];
+	}
+
+	memset(block, 0, sizeof(block));
+	memset(state, 0, sizeof(state));
+	memset(&ctx, 0, sizeof(ctx));
+}
+
+void pbkdf2_sha256(const BYTE password[], size_t password_len, const BYTE salt[], size_t salt_len,
+		   unsigned long iterations, BYTE out[], size_t out_len)
+{
+	HMAC_SHA256_KEY key;
+	BYTE block[SHA256_BLOCK_SIZE];
+	unsigned int index;
+	size_t len;
+
+	hmac_sha256_init(&key, password, password_len);
+	for (index = 1; out_len > 0; ++index) {
+		len = out_len < SHA256_BLOCK_SIZE ? out_len : SHA256_BLOCK_SIZE;
+		pbkdf2_sha256_block(&key, salt, salt_len, index, iterations, block);
+		memcpy(out, block, len);
+		out += len;
+		out_len -= len;
+	}
+
+	memset(block, 0, sizeof(block));
+	memset(&key, 0, sizeof(key));
+}
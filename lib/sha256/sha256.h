@@ -14,6 +14,7 @@
 
 /****************************** MACROS ******************************/
 #define SHA256_BLOCK_SIZE 32            // SHA256 outputs a 32 byte digest
+#define SHA256_LANES 8                  // Messages hashed at once by the multi-buffer functions
 
 /**************************** DATA TYPES ****************************/
 typedef unsigned char BYTE;             // 8-bit byte
@@ -26,9 +27,41 @@ typedef struct {
 	WORD state[8];
 } SHA256_CTX;
 
+typedef struct {
+	WORD inner[8];                  // State after the key XOR ipad block
+	WORD outer[8];                  // State after the key XOR opad block
+} HMAC_SHA256_KEY;
+
 /*********************** FUNCTION DECLARATIONS **********************/
 void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len);
 void sha256_final(SHA256_CTX *ctx, BYTE hash[]);
 
+// Selects the compression function used by sha256_update. At startup the SHA extensions
+// (sha256rnds2) are used if the CPU has them, and the portable code otherwise.
+// Returns 0 if the SHA extensions are not available on this machine.
+int sha256_use_shani(int enable);
+int sha256_uses_shani();
+
+// Multi-buffer hashing: the blocks of up to SHA256_LANES independent messages are hashed
+// at once, one per AVX2 lane. Only worth it without the SHA extensions, so at startup AVX2
+// is selected only when the CPU lacks them; otherwise the lanes are hashed one after the
+// other. The results are the same as with sha256_update.
+// Returns 0 if AVX2 is not available on this machine.
+int sha256_multi_use_avx2(int enable);
+int sha256_multi_uses_avx2();
+
+// Advances each context by len bytes of its own data. NULL contexts are skipped.
+void sha256_update_multi(SHA256_CTX *const ctx[SHA256_LANES], const BYTE *const data[SHA256_LANES], size_t len);
+// Hashes count messages of any length. Lanes that finish early take the next message.
+void sha256_multi(const BYTE *const data[], const size_t lens[], BYTE hashes[][SHA256_BLOCK_SIZE], size_t count);
+
+// HMAC-SHA256 with the states after the two pad blocks computed once per key, so every
+// MAC with the same key skips two compressions.
+void hmac_sha256_init(HMAC_SHA256_KEY *key, const BYTE secret[], size_t len);
+void hmac_sha256(const HMAC_SHA256_KEY *key, const BYTE data[], size_t len, BYTE mac[]);
+// PBKDF2 (RFC 8018) with HMAC-SHA256. Each iteration costs two compressions.
+void pbkdf2_sha256(const BYTE password[], size_t password_len, const BYTE salt[], size_t salt_len,
+		   unsigned long iterations, BYTE out[], size_t out_len);
+
 #endif   // SHA256_H
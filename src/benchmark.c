@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <time.h>
+#include "encrypter.h"
+#include "benchmark.h"
+
+#define BENCHMARK_BUFFER_SIZE MIB
+#define BENCHMARK_MIN_SECONDS 0.25
+#define BENCHMARK_KEY_BATCH 1000
+
+/**
+ * Devuelve el tiempo actual en segundos de un reloj monotónico
+ */
+static double benchmark_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Ejecuta una operación de AES sobre el buffer repetidamente hasta superar el tiempo mínimo
+ *
+ * @param operation 0: ECB encriptación, 1: ECB desencriptación, 2: CTR, 3: CBC encriptación,
+ *                  4: CBC desencriptación, 5: GCM encriptación
+ * @param buffer Buffer de BENCHMARK_BUFFER_SIZE bytes
+ * @param gcm Contexto de GCM con la clave expandida
+ *
+ * @return Rendimiento en MB/s
+ */
+static double benchmark_aes_operation(int operation, BYTE *buffer, const AES_GCM_CTX *gcm)
+{
+    const AES_CTX *ctx = &gcm->aes;
+    BYTE iv[AES_BLOCK_SIZE] = {0};
+    BYTE tag[AES_GCM_TAG_SIZE];
+    size_t blocks = BENCHMARK_BUFFER_SIZE / AES_BLOCK_SIZE;
+    size_t processed = 0;
+    double start = benchmark_now();
+    double elapsed;
+
+    do
+    {
+        switch (operation)
+        {
+        case 0:
+            aes_ecb_encrypt_blocks(buffer, buffer, blocks, ctx);
+            break;
+        case 1:
+            aes_ecb_decrypt_blocks(buffer, buffer, blocks, ctx);
+            break;
+        case 2:
+            aes_ctr_blocks(buffer, buffer, blocks, ctx, iv);
+            break;
+        case 3:
+            aes_cbc_encrypt_blocks(buffer, buffer, blocks, ctx, iv);
+            break;
+        case 4:
+            aes_cbc_decrypt_blocks(buffer, buffer, blocks, ctx, iv);
+            break;
+        default:
+            aes_encrypt_gcm(buffer, BENCHMARK_BUFFER_SIZE, buffer, NULL, 0, iv, tag, gcm);
+            break;
+        }
+        processed += BENCHMARK_BUFFER_SIZE;
+        elapsed = benchmark_now() - start;
+    } while (elapsed < BENCHMARK_MIN_SECONDS);
+
+    return processed / elapsed / 1e6;
+}
+
+/**
+ * Calcula SHA-256 sobre el buffer repetidamente hasta superar el tiempo mínimo
+ *
+ * @param buffer Buffer de BENCHMARK_BUFFER_SIZE bytes
+ *
+ * @return Rendimiento en MB/s
+ */
+static double benchmark_sha256(const BYTE *buffer)
+{
+    SHA256_CTX ctx;
+    size_t processed = 0;
+    double start = benchmark_now();
+    double elapsed;
+
+    sha256_init(&ctx);
+    do
+    {
+        sha256_update(&ctx, buffer, BENCHMARK_BUFFER_SIZE);
+        processed += BENCHMARK_BUFFER_SIZE;
+        elapsed = benchmark_now() - start;
+    } while (elapsed < BENCHMARK_MIN_SECONDS);
+
+    return processed / elapsed / 1e6;
+}
+
+/**
+ * Calcula SHA-256 de mensajes independientes de msg_size bytes que cubren el buffer, con
+ * sha256_multi, repetidamente hasta superar el tiempo mínimo
+ *
+ * @param buffer Buffer de BENCHMARK_BUFFER_SIZE bytes
+ * @param msg_size Tamaño de cada mensaje, divisor de BENCHMARK_BUFFER_SIZE
+ *
+ * @return Rendimiento en MB/s
+ */
+static double benchmark_sha256_multi(const BYTE *buffer, size_t msg_size)
+{
+    size_t count = BENCHMARK_BUFFER_SIZE / msg_size;
+    const BYTE **messages = (const BYTE **)malloc(count * sizeof(BYTE *));
+    size_t *lens = (size_t *)malloc(count * sizeof(size_t));
+    BYTE(*hashes)[SHA256_BLOCK_SIZE] = malloc(count * SHA256_BLOCK_SIZE);
+    size_t processed = 0;
+    double start, elapsed;
+
+    if (messages == NULL || lens == NULL || hashes == NULL)
+    {
+        print_error("Error al reservar el buffer del benchmark\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        messages[i] = buffer + i * msg_size;
+        lens[i] = msg_size;
+    }
+
+    start = benchmark_now();
+    do
+    {
+        sha256_multi(messages, lens, hashes, count);
+        processed += BENCHMARK_BUFFER_SIZE;
+        elapsed = benchmark_now() - start;
+    } while (elapsed < BENCHMARK_MIN_SECONDS);
+
+    free(messages);
+    free(lens);
+    free(hashes);
+    return processed / elapsed / 1e6;
+}
+
+/**
+ * Ejecuta una operación de Blowfish sobre el buffer repetidamente hasta superar el tiempo
+ * mínimo, con la implementación seleccionada
+ *
+ * @param operation 0: ECB encriptación, 1: ECB desencriptación, 2: CTR
+ * @param buffer Buffer de datos
+ * @param size Tamaño del buffer en bytes, múltiplo de BLOWFISH_BLOCK_SIZE
+ * @param key Clave de Blowfish expandida
+ *
+ * @return Rendimiento en MB/s
+ */
+static double benchmark_blowfish_operation(int operation, BYTE *buffer, size_t size, const BLOWFISH_KEY *key)
+{
+    BYTE ctr[BLOWFISH_BLOCK_SIZE] = {0};
+    size_t blocks = size / BLOWFISH_BLOCK_SIZE;
+    size_t processed = 0;
+    double start = benchmark_now();
+    double elapsed;
+
+    do
+    {
+        switch (operation)
+        {
+        case 0:
+            blowfish_ecb_encrypt_blocks(buffer, buffer, blocks, key);
+            break;
+        case 1:
+            blowfish_ecb_decrypt_blocks(buffer, buffer, blocks, key);
+            break;
+        default:
+            blowfish_ctr_blocks(buffer, buffer, blocks, key, ctr);
+            break;
+        }
+        processed += size;
+        elapsed = benchmark_now() - start;
+    } while (elapsed < BENCHMARK_MIN_SECONDS);
+
+    return processed / elapsed / 1e6;
+}
+
+/**
+ * Expande repetidamente BENCHMARK_KEY_BATCH claves de longitudes distintas, una a una con
+ * blowfish_key_setup o todas juntas con blowfish_key_setup_batch, hasta superar el tiempo
+ * mínimo
+ *
+ * @param batched true para usar blowfish_key_setup_batch
+ * @param keys Claves de BENCHMARK_KEY_BATCH * 56 bytes
+ * @param lens Longitud de cada clave
+ * @param schedules Key schedules resultantes, BENCHMARK_KEY_BATCH
+ *
+ * @return Claves expandidas por segundo
+ */
+static double benchmark_blowfish_key_setup(bool batched, const BYTE *const keys[], const size_t lens[],
+                                           BLOWFISH_KEY *schedules)
+{
+    size_t processed = 0;
+    double start = benchmark_now();
+    double elapsed;
+
+    do
+    {
+        if (batched)
+        {
+            blowfish_key_setup_batch(keys, lens, schedules, BENCHMARK_KEY_BATCH);
+        }
+        else
+        {
+            for (int i = 0; i < BENCHMARK_KEY_BATCH; i++)
+            {
+                blowfish_key_setup(keys[i], &schedules[i], lens[i]);
+            }
+        }
+        processed += BENCHMARK_KEY_BATCH;
+        elapsed = benchmark_now() - start;
+    } while (elapsed < BENCHMARK_MIN_SECONDS);
+
+    return processed / elapsed;
+}
+
+/**
+ * Mide cada implementación de Blowfish disponible sobre buffers de 1 KB, que caben en la
+ * caché L1 junto a las S-boxes, de 64 KB y de 1 GB, que se lee de memoria principal. Al
+ * final mide el key setup de claves sueltas y por lotes
+ *
+ * @param key Clave de 32 bytes
+ */
+static void benchmark_blowfish(const BYTE *key)
+{
+    size_t sizes[] = {1024, 64 * 1024, 1024 * MIB};
+    const char *size_names[] = {"1 KB", "64 KB", "1 GB"};
+    int original_impl = blowfish_get_impl();
+    BLOWFISH_KEY blowfish_key;
+
+    blowfish_key_setup(key, &blowfish_key, 32);
+    printf("\n%-12s %8s %6s %10s %10s %10s\n", "Blowfish", "bloques", "datos", "ECB enc", "ECB dec", "CTR");
+    for (int impl = 0; blowfish_impl_name(impl) != NULL; impl++)
+    {
+        if (!blowfish_set_impl(impl))
+        {
+            printf("%-12s no disponible\n", blowfish_impl_name(impl));
+            continue;
+        }
+
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            BYTE *buffer = (BYTE *)calloc(sizes[i], 1);
+            printf("%-12s %8d %6s", blowfish_impl_name(impl), blowfish_impl_width(impl), size_names[i]);
+            if (buffer == NULL)
+            {
+                printf(" no disponible\n");
+                continue;
+            }
+            // Con 1 GB cada medida tarda varios segundos, así que sólo se miden los modos
+            // que se usan al restaurar archivos
+            for (int operation = 0; operation < 3; operation++)
+            {
+                if (operation == 0 && sizes[i] > BENCHMARK_BUFFER_SIZE)
+                {
+                    printf(" %10s", "-");
+                    continue;
+                }
+                printf(" %10.1f", benchmark_blowfish_operation(operation, buffer, sizes[i], &blowfish_key));
+                fflush(stdout);
+            }
+            printf("\n");
+            free(buffer);
+        }
+    }
+    printf("(MB/s)\n");
+
+    // Claves de 4 a 56 bytes, como las de archivos con frases distintas
+    static BYTE key_bytes[BENCHMARK_KEY_BATCH][56];
+    const BYTE *keys[BENCHMARK_KEY_BATCH];
+    size_t lens[BENCHMARK_KEY_BATCH];
+    BLOWFISH_KEY *schedules = (BLOWFISH_KEY *)malloc(BENCHMARK_KEY_BATCH * sizeof(BLOWFISH_KEY));
+    if (schedules == NULL)
+    {
+        print_error("Error al reservar el buffer del benchmark\n");
+        exit(1);
+    }
+    for (int i = 0; i < BENCHMARK_KEY_BATCH; i++)
+    {
+        memset(key_bytes[i], i, sizeof(key_bytes[i]));
+        keys[i] = key_bytes[i];
+        lens[i] = 4 + i % 53;
+    }
+
+    printf("\n%-12s %8s %12s %12s\n", "Blowfish", "bloques", "key setup", "por lotes");
+    for (int impl = 0; blowfish_impl_name(impl) != NULL; impl++)
+    {
+        if (!blowfish_set_impl(impl))
+        {
+            printf("%-12s no disponible\n", blowfish_impl_name(impl));
+            continue;
+        }
+        printf("%-12s %8d %12.0f", blowfish_impl_name(impl), blowfish_impl_width(impl),
+               benchmark_blowfish_key_setup(false, keys, lens, schedules));
+        printf(" %12.0f\n", benchmark_blowfish_key_setup(true, keys, lens, schedules));
+    }
+    printf("(claves/s, lotes de %d claves)\n", BENCHMARK_KEY_BATCH);
+    free(schedules);
+    blowfish_set_impl(original_impl);
+}
+
+/**
+ * Calcula GHASH sobre el buffer repetidamente hasta superar el tiempo mínimo
+ *
+ * @param buffer Buffer de BENCHMARK_BUFFER_SIZE bytes
+ * @param key Clave de GHASH
+ *
+ * @return Rendimiento en MB/s
+ */
+static double benchmark_ghash(const BYTE *buffer, const AES_GHASH_KEY *key)
+{
+    BYTE x[AES_BLOCK_SIZE] = {0};
+    size_t processed = 0;
+    double start = benchmark_now();
+    double elapsed;
+
+    do
+    {
+        aes_ghash_update(key, x, buffer, BENCHMARK_BUFFER_SIZE);
+        processed += BENCHMARK_BUFFER_SIZE;
+        elapsed = benchmark_now() - start;
+    } while (elapsed < BENCHMARK_MIN_SECONDS);
+
+    return processed / elapsed / 1e6;
+}
+
+/**
+ * Mide el rendimiento de cada implementación de AES disponible en esta máquina, indicando
+ * cuántos bloques procesa por iteración, e imprime una tabla con los resultados en MB/s.
+ * Después mide GHASH con PCLMULQDQ y con la tabla de 4 bits, SHA-256 con y sin las
+ * extensiones SHA y por lotes, y cada implementación de Blowfish
+ */
+void run_benchmark()
+{
+    BYTE key[32] = {0};
+    AES_GCM_CTX gcm;
+    int original_impl = aes_get_impl();
+    int original_pclmul = aes_ghash_uses_pclmul();
+    BYTE *buffer = (BYTE *)calloc(BENCHMARK_BUFFER_SIZE, 1);
+
+    if (buffer == NULL)
+    {
+        print_error("Error al reservar el buffer del benchmark\n");
+        exit(1);
+    }
+
+    printf("%-12s %8s %6s %10s %10s %10s %10s %10s %10s\n", "AES", "bloques", "bits", "ECB enc", "ECB dec", "CTR",
+           "CBC enc", "CBC dec", "GCM enc");
+    for (int impl = 0; aes_impl_name(impl) != NULL; impl++)
+    {
+        if (!aes_set_impl(impl))
+        {
+            printf("%-12s no disponible\n", aes_impl_name(impl));
+            continue;
+        }
+
+        for (int bits = 128; bits <= 256; bits += 64)
+        {
+            aes_gcm_init(&gcm, key, bits);
+            printf("%-12s %8d %6d", aes_impl_name(impl), aes_impl_width(impl), bits);
+            for (int operation = 0; operation < 6; operation++)
+            {
+                printf(" %10.1f", benchmark_aes_operation(operation, buffer, &gcm));
+            }
+            printf("\n");
+        }
+    }
+    printf("(MB/s)\n");
+
+    aes_set_impl(original_impl);
+    aes_gcm_init(&gcm, key, 128);
+    for (int pclmul = 1; pclmul >= 0; pclmul--)
+    {
+        const char *name = pclmul ? "pclmul" : "tabla 4 bits";
+        if (!aes_ghash_use_pclmul(pclmul))
+        {
+            printf("GHASH %-12s no disponible\n", name);
+            continue;
+        }
+        printf("GHASH %-12s %10.1f MB/s\n", name, benchmark_ghash(buffer, &gcm.ghash));
+    }
+    aes_ghash_use_pclmul(original_pclmul);
+
+    int original_shani = sha256_uses_shani();
+    for (int shani = 1; shani >= 0; shani--)
+    {
+        const char *name = shani ? "sha-ni" : "portable";
+        if (!sha256_use_shani(shani))
+        {
+            printf("SHA-256 %-10s no disponible\n", name);
+            continue;
+        }
+        printf("SHA-256 %-10s %10.1f MB/s\n", name, benchmark_sha256(buffer));
+    }
+
+    // Varios mensajes a la vez: en serie con la función de compresión por defecto, o en los
+    // carriles de AVX2
+    sha256_use_shani(original_shani);
+    int original_multi = sha256_multi_uses_avx2();
+    printf("\n%-20s %10s %10s %10s\n", "SHA-256 por lotes", "64 B", "1 KB", "64 KB");
+    for (int avx2 = 1; avx2 >= 0; avx2--)
+    {
+        const char *name = avx2 ? "8 carriles avx2" : (sha256_uses_shani() ? "serie sha-ni" : "serie portable");
+        if (!sha256_multi_use_avx2(avx2))
+        {
+            printf("%-20s no disponible\n", name);
+            continue;
+        }
+        printf("%-20s", name);
+        for (size_t msg_size = 64; msg_size <= 64 * 1024; msg_size *= 16)
+        {
+            printf(" %10.1f", benchmark_sha256_multi(buffer, msg_size));
+        }
+        printf("\n");
+    }
+    printf("(MB/s)\n");
+    sha256_multi_use_avx2(original_multi);
+
+    benchmark_blowfish(key);
+    free(buffer);
+}
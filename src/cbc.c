@@ -0,0 +1,265 @@
+#include "cbc.h"
+#include "workers.h"
+
+/**
+ * Datos compartidos por los hilos que desencriptan un archivo en modo CBC
+ */
+typedef struct
+{
+    const CIPHER *cipher;
+    const BYTE *iv;
+    unsigned long long size;       // Tamaño del archivo original
+    unsigned long long padded_len; // Bytes cifrados, múltiplo del tamaño de bloque
+    size_t chunk_size;             // Bytes por fragmento, múltiplo del tamaño de bloque
+    int in_fd;
+    off_t in_offset; // Posición de los datos cifrados dentro del archivo de entrada
+    int out_fd;
+    const BYTE *in_map; // Datos cifrados mapeados, o NULL si se usan buffers
+    BYTE *out_map;      // Archivo de salida mapeado, o NULL si se usan buffers
+} CBC_JOB;
+
+/**
+ * Tamaño de los fragmentos: el tamaño del buffer redondeado a bloques de AES
+ *
+ * @param options Opciones de encriptación
+ */
+static size_t cbc_chunk_size(const ENCRYPT_OPTIONS *options)
+{
+    size_t chunk_size = options->buffer_size - options->buffer_size % AES_BLOCK_SIZE;
+    return chunk_size < AES_BLOCK_SIZE ? AES_BLOCK_SIZE : chunk_size;
+}
+
+/**
+ * Encripta en modo CBC un archivo mapeando en memoria la entrada y la salida. Si se
+ * calcula el hash del texto plano, el archivo se recorre en partes de DIGEST_SLICE_SIZE
+ * bytes que se hashean y encriptan mientras están en la caché
+ *
+ * @return true si se encriptó el archivo, false si alguno de los archivos no se puede
+ * mapear y se deben usar buffers
+ */
+static bool cbc_encrypt_mapped(int in_fd, int out_fd, off_t out_offset, unsigned long long size, const CIPHER *cipher,
+                               BYTE *iv, FILE_DIGEST *digest)
+{
+    size_t tail = size % AES_BLOCK_SIZE;
+    size_t full_len = size - tail;
+    size_t padded_len = full_len + (tail > 0 ? AES_BLOCK_SIZE : 0);
+
+    BYTE *in = map_input_file(in_fd, size);
+    if (in == NULL)
+    {
+        return false;
+    }
+
+    BYTE *out = map_output_file(out_fd, out_offset + padded_len);
+    if (out == NULL)
+    {
+        unmap_file(in, size);
+        return false;
+    }
+
+    size_t slice = digest != NULL ? DIGEST_SLICE_SIZE : full_len;
+    for (size_t offset = 0; offset < full_len; offset += slice)
+    {
+        size_t len = full_len - offset < slice ? full_len - offset : slice;
+        digest_chunk(digest, offset / DIGEST_SLICE_SIZE, in + offset, len);
+        cipher_cbc_encrypt_buffer(cipher, iv, in + offset, out + out_offset + offset, len);
+    }
+
+    // El último bloque incompleto se rellena con ceros
+    if (tail > 0)
+    {
+        BYTE last_block[AES_BLOCK_SIZE] = {0};
+        memcpy(last_block, in + full_len, tail);
+        digest_chunk(digest, (full_len + DIGEST_SLICE_SIZE - 1) / DIGEST_SLICE_SIZE, last_block, tail);
+        cipher_cbc_encrypt_buffer(cipher, iv, last_block, out + out_offset + full_len, AES_BLOCK_SIZE);
+    }
+
+    unmap_file(in, size);
+    unmap_file(out, out_offset + padded_len);
+    return true;
+}
+
+/**
+ * Encripta en modo CBC un archivo completo. Cada bloque depende del bloque cifrado
+ * anterior, así que la encriptación es secuencial: el IV encadena los buffers y el
+ * último bloque se rellena con ceros
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado, abierto para lectura y escritura y
+ *               posicionado después de la cabecera
+ * @param out_offset Tamaño de la cabecera ya escrita en el archivo encriptado
+ * @param size Tamaño del archivo a encriptar
+ * @param cipher Cifrado AES inicializado
+ * @param iv Vector de inicialización, de AES_BLOCK_SIZE bytes
+ * @param options Opciones de encriptación
+ */
+void cbc_encrypt_file(int in_fd, int out_fd, off_t out_offset, unsigned long long size, const CIPHER *cipher,
+                      const BYTE *iv, const ENCRYPT_OPTIONS *options)
+{
+    BYTE chain[AES_BLOCK_SIZE];
+    memcpy(chain, iv, AES_BLOCK_SIZE);
+
+    if (options->use_mmap && cbc_encrypt_mapped(in_fd, out_fd, out_offset, size, cipher, chain, options->digest))
+    {
+        return;
+    }
+
+    size_t buffer_size = cbc_chunk_size(options);
+    BYTE *buffer = (BYTE *)malloc(buffer_size);
+    if (buffer == NULL)
+    {
+        print_error("Error al reservar el buffer de E/S");
+        exit(1);
+    }
+
+    ssize_t bytes_read;
+    unsigned long long chunk = 0;
+    while ((bytes_read = read_full(in_fd, buffer, buffer_size)) > 0)
+    {
+        digest_chunk(options->digest, chunk++, buffer, bytes_read);
+        size_t padding = (AES_BLOCK_SIZE - bytes_read % AES_BLOCK_SIZE) % AES_BLOCK_SIZE;
+        memset(buffer + bytes_read, 0, padding);
+        size_t len = bytes_read + padding;
+
+        cipher_cbc_encrypt_buffer(cipher, chain, buffer, buffer, len);
+        if (!write_full(out_fd, buffer, len))
+        {
+            print_error("Error al escribir el archivo encriptado");
+            exit(1);
+        }
+    }
+
+    if (bytes_read < 0)
+    {
+        print_error("Error al leer el archivo a encriptar");
+        exit(1);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Desencripta un fragmento del archivo. El IV del fragmento es el último bloque cifrado
+ * del fragmento anterior, que se lee directamente del archivo, así que los fragmentos se
+ * pueden desencriptar en cualquier orden
+ *
+ * @param context Trabajo CBC
+ * @param chunk Índice del fragmento
+ * @param buffer Buffer del hilo, sólo se usa cuando los archivos no están mapeados
+ */
+static void cbc_decrypt_task(void *context, unsigned long long chunk, BYTE *buffer)
+{
+    const CBC_JOB *job = (const CBC_JOB *)context;
+    unsigned long long offset = chunk * job->chunk_size;
+    size_t len = job->padded_len - offset < job->chunk_size ? (size_t)(job->padded_len - offset) : job->chunk_size;
+    // Del último bloque sólo se escriben los bytes del archivo original
+    size_t out_len = job->size - offset < len ? (size_t)(job->size - offset) : len;
+    BYTE iv[AES_BLOCK_SIZE];
+
+    if (job->in_map != NULL)
+    {
+        const BYTE *in = job->in_map + offset;
+        BYTE *out = job->out_map + offset;
+        size_t direct = out_len - out_len % AES_BLOCK_SIZE;
+
+        memcpy(iv, offset == 0 ? job->iv : in - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        cipher_cbc_decrypt_buffer(job->cipher, iv, in, out, direct);
+        if (out_len > direct)
+        {
+            BYTE last_block[AES_BLOCK_SIZE];
+            cipher_cbc_decrypt_buffer(job->cipher, iv, in + direct, last_block, AES_BLOCK_SIZE);
+            memcpy(out + direct, last_block, out_len - direct);
+        }
+        return;
+    }
+
+    if (offset == 0)
+    {
+        memcpy(iv, job->iv, AES_BLOCK_SIZE);
+    }
+    else if (pread_full(job->in_fd, iv, AES_BLOCK_SIZE, job->in_offset + offset - AES_BLOCK_SIZE) != AES_BLOCK_SIZE)
+    {
+        print_error("Error al leer el archivo a desencriptar\n");
+        exit(1);
+    }
+
+    if (pread_full(job->in_fd, buffer, len, job->in_offset + offset) != (ssize_t)len)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    cipher_cbc_decrypt_buffer(job->cipher, iv, buffer, buffer, len);
+
+    if (!pwrite_full(job->out_fd, buffer, out_len, offset))
+    {
+        print_error("Error al escribir el archivo desencriptado\n");
+        exit(1);
+    }
+}
+
+/**
+ * Desencripta en modo CBC un archivo, repartiendo fragmentos del tamaño del buffer entre
+ * options->threads hilos. Con options->use_mmap los hilos trabajan directamente sobre los
+ * archivos mapeados; si no se pueden mapear, cada hilo lee y escribe su fragmento en su
+ * posición con su propio buffer
+ *
+ * @param in_fd Descriptor del archivo encriptado, que debe contener todos los bloques
+ * @param in_offset Posición de los datos cifrados en el archivo encriptado
+ * @param out_fd Descriptor del archivo desencriptado, abierto para lectura y escritura
+ * @param size Tamaño del archivo original indicado en la cabecera
+ * @param cipher Cifrado AES inicializado
+ * @param iv Vector de inicialización, de AES_BLOCK_SIZE bytes
+ * @param options Opciones de desencriptación
+ */
+void cbc_decrypt_file(int in_fd, off_t in_offset, int out_fd, unsigned long long size, const CIPHER *cipher,
+                      const BYTE *iv, const ENCRYPT_OPTIONS *options)
+{
+    size_t chunk_size = cbc_chunk_size(options);
+    unsigned long long padded_len = (size + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+
+    CBC_JOB job = {
+        .cipher = cipher,
+        .iv = iv,
+        .size = size,
+        .padded_len = padded_len,
+        .chunk_size = chunk_size,
+        .in_fd = in_fd,
+        .in_offset = in_offset,
+        .out_fd = out_fd,
+        .in_map = NULL,
+        .out_map = NULL,
+    };
+    unsigned long long chunks = (padded_len + chunk_size - 1) / chunk_size;
+
+    BYTE *in_map = NULL;
+    BYTE *out_map = NULL;
+    if (options->use_mmap && size > 0)
+    {
+        in_map = map_input_file(in_fd, in_offset + padded_len);
+        out_map = in_map != NULL ? map_output_file(out_fd, size) : NULL;
+    }
+
+    if (out_map != NULL)
+    {
+        job.in_map = in_map + in_offset;
+        job.out_map = out_map;
+        run_workers(options->threads, chunks, 0, cbc_decrypt_task, &job);
+        unmap_file(in_map, in_offset + padded_len);
+        unmap_file(out_map, size);
+        return;
+    }
+
+    if (in_map != NULL)
+    {
+        unmap_file(in_map, in_offset + padded_len);
+    }
+
+    if (!reserve_output_file(out_fd, size))
+    {
+        print_error("Error al reservar espacio para el archivo desencriptado\n");
+        exit(1);
+    }
+
+    run_workers(options->threads, chunks, chunk_size, cbc_decrypt_task, &job);
+}
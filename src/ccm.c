@@ -0,0 +1,124 @@
+#include "ccm.h"
+
+/**
+ * Procesa size bytes de un descriptor a otro con la API incremental de CCM, con un
+ * buffer del tamaño de options->buffer_size, de modo que la memoria usada no depende del
+ * tamaño del archivo. El buffer es múltiplo del tamaño de bloque, así que sólo la última
+ * actualización puede terminar en un bloque incompleto
+ *
+ * @param in_fd Descriptor de entrada, posicionado al inicio de los datos
+ * @param out_fd Descriptor de salida, posicionado donde se escriben los datos
+ * @param size Número de bytes a procesar
+ * @param ctx Contexto CCM inicializado con aes_ccm_init
+ * @param decrypt true para desencriptar, false para encriptar
+ * @param options Opciones de encriptación
+ */
+static void ccm_process(int in_fd, int out_fd, unsigned long long size, AES_CCM_CTX *ctx, bool decrypt,
+                        const ENCRYPT_OPTIONS *options)
+{
+    size_t buffer_size = options->buffer_size;
+    BYTE *buffer = allocate_io_buffer(&buffer_size, AES_BLOCK_SIZE);
+    if (buffer == NULL)
+    {
+        print_error("Error al reservar el buffer de E/S\n");
+        exit(1);
+    }
+
+    unsigned long long chunk = 0;
+    for (unsigned long long remaining = size; remaining > 0;)
+    {
+        size_t len = remaining < buffer_size ? (size_t)remaining : buffer_size;
+        if (read_full(in_fd, buffer, len) != (ssize_t)len)
+        {
+            print_error("Error al leer el archivo o archivo truncado\n");
+            exit(1);
+        }
+
+        if (decrypt)
+        {
+            aes_ccm_decrypt_update(ctx, buffer, buffer, len);
+        }
+        else
+        {
+            digest_chunk(options->digest, chunk++, buffer, len);
+            aes_ccm_encrypt_update(ctx, buffer, buffer, len);
+        }
+
+        if (!write_full(out_fd, buffer, len))
+        {
+            print_error("Error al escribir el archivo\n");
+            exit(1);
+        }
+        remaining -= len;
+    }
+
+    free(buffer);
+}
+
+/**
+ * Encripta en modo CCM size bytes de un archivo y escribe el MAC después del texto
+ * cifrado. La cabecera y el modo se autentican como datos asociados. CBC-MAC es
+ * secuencial, así que el archivo se procesa en un solo hilo
+ *
+ * @param in_fd Descriptor del archivo a encriptar, posicionado al inicio
+ * @param out_fd Descriptor del archivo encriptado, posicionado después del nonce
+ * @param size Número de bytes a encriptar
+ * @param cipher Cifrado AES inicializado
+ * @param prefix Cabecera seguida del modo y el nonce
+ * @param prefix_size Bytes de prefix, CCM_PREFIX_SIZE según el tamaño de la cabecera
+ * @param options Opciones de encriptación
+ */
+void ccm_encrypt_file(int in_fd, int out_fd, unsigned long long size, const CIPHER *cipher, const BYTE *prefix,
+                      size_t prefix_size, const ENCRYPT_OPTIONS *options)
+{
+    AES_CCM_CTX ctx;
+    BYTE mac[CCM_MAC_SIZE];
+
+    if (!aes_ccm_init(&ctx, &cipher->aes_ctx, prefix + prefix_size - CCM_NONCE_SIZE, CCM_NONCE_SIZE, size, prefix,
+                      prefix_size - CCM_NONCE_SIZE, CCM_MAC_SIZE))
+    {
+        print_error("El archivo es demasiado grande para el modo ccm\n");
+        exit(1);
+    }
+
+    ccm_process(in_fd, out_fd, size, &ctx, false, options);
+
+    aes_ccm_encrypt_final(&ctx, mac);
+    if (!write_full(out_fd, mac, CCM_MAC_SIZE))
+    {
+        print_error("Error al escribir el archivo\n");
+        exit(1);
+    }
+}
+
+/**
+ * Desencripta en modo CCM size bytes de un archivo y verifica el MAC. El MAC se calcula
+ * sobre el texto plano, que se escribe antes de conocer el resultado: si el MAC no
+ * coincide, quien llama debe descartar el archivo de salida
+ *
+ * @param in_fd Descriptor del archivo encriptado, posicionado después del nonce
+ * @param out_fd Descriptor del archivo desencriptado
+ * @param size Número de bytes a desencriptar
+ * @param cipher Cifrado AES inicializado
+ * @param prefix Cabecera seguida del modo y el nonce
+ * @param prefix_size Bytes de prefix, CCM_PREFIX_SIZE según el tamaño de la cabecera
+ * @param mac MAC guardado en el archivo, de CCM_MAC_SIZE bytes
+ * @param options Opciones de desencriptación
+ *
+ * @return true si el MAC coincide, false si el archivo fue modificado o la clave no es
+ *         la correcta
+ */
+bool ccm_decrypt_file(int in_fd, int out_fd, unsigned long long size, const CIPHER *cipher, const BYTE *prefix,
+                      size_t prefix_size, const BYTE *mac, const ENCRYPT_OPTIONS *options)
+{
+    AES_CCM_CTX ctx;
+
+    if (!aes_ccm_init(&ctx, &cipher->aes_ctx, prefix + prefix_size - CCM_NONCE_SIZE, CCM_NONCE_SIZE, size, prefix,
+                      prefix_size - CCM_NONCE_SIZE, CCM_MAC_SIZE))
+    {
+        return false;
+    }
+
+    ccm_process(in_fd, out_fd, size, &ctx, true, options);
+    return aes_ccm_decrypt_final(&ctx, mac);
+}
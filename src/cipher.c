@@ -0,0 +1,168 @@
+#include "encrypter.h"
+
+/**
+ * Prepara el cifrado a partir de la clave, calculando el key schedule correspondiente
+ *
+ * @param cipher Cifrado a inicializar
+ * @param algorithm Algoritmo de encriptación (AES o BLOWFISH)
+ * @param key Clave de encriptación
+ * @param bits Número de bits de la clave
+ */
+void cipher_setup(CIPHER *cipher, BYTE algorithm, const BYTE *key, int bits)
+{
+    cipher->algorithm = algorithm;
+    cipher->bits = bits;
+
+    if (algorithm == AES)
+    {
+        cipher->block_size = AES_BLOCK_SIZE;
+        aes_ctx_init(&cipher->aes_ctx, key, bits);
+    }
+    else
+    {
+        cipher->block_size = BLOWFISH_BLOCK_SIZE;
+        blowfish_key_setup(key, &cipher->blowfish_key, bits / 8);
+    }
+}
+
+/**
+ * Encripta un buffer completo. AES procesa varios bloques por iteración con los
+ * kernels de la implementación seleccionada y Blowfish intercala cuatro bloques por
+ * ronda. El buffer de entrada y el de salida pueden ser el mismo
+ *
+ * @param cipher Cifrado inicializado con cipher_setup
+ * @param in Buffer de entrada
+ * @param out Buffer de salida
+ * @param len Número de bytes, debe ser múltiplo del tamaño de bloque
+ */
+void cipher_encrypt_buffer(const CIPHER *cipher, const BYTE *in, BYTE *out, size_t len)
+{
+    if (cipher->algorithm == AES)
+    {
+        aes_ecb_encrypt_blocks(in, out, len / AES_BLOCK_SIZE, &cipher->aes_ctx);
+    }
+    else
+    {
+        blowfish_ecb_encrypt_blocks(in, out, len / BLOWFISH_BLOCK_SIZE, &cipher->blowfish_key);
+    }
+}
+
+/**
+ * Desencripta un buffer completo. AES procesa varios bloques por iteración con los
+ * kernels de la implementación seleccionada y Blowfish intercala cuatro bloques por
+ * ronda. El buffer de entrada y el de salida pueden ser el mismo
+ *
+ * @param cipher Cifrado inicializado con cipher_setup
+ * @param in Buffer de entrada
+ * @param out Buffer de salida
+ * @param len Número de bytes, debe ser múltiplo del tamaño de bloque
+ */
+void cipher_decrypt_buffer(const CIPHER *cipher, const BYTE *in, BYTE *out, size_t len)
+{
+    if (cipher->algorithm == AES)
+    {
+        aes_ecb_decrypt_blocks(in, out, len / AES_BLOCK_SIZE, &cipher->aes_ctx);
+    }
+    else
+    {
+        blowfish_ecb_decrypt_blocks(in, out, len / BLOWFISH_BLOCK_SIZE, &cipher->blowfish_key);
+    }
+}
+
+/**
+ * Calcula el contador del bloque indicado sumando su índice al nonce como un entero big
+ * endian del tamaño del bloque, de modo que cualquier parte del archivo se puede procesar
+ * sin recorrer las anteriores
+ *
+ * @param nonce Contador inicial, de block_size bytes
+ * @param block Índice del bloque
+ * @param ctr Contador resultante, de block_size bytes
+ * @param block_size Tamaño de bloque del cifrado
+ */
+static void ctr_at_block(const BYTE *nonce, unsigned long long block, BYTE *ctr, size_t block_size)
+{
+    unsigned int carry = 0;
+
+    for (int i = block_size - 1; i >= 0; i--)
+    {
+        unsigned int sum = nonce[i] + (block & 0xFF) + carry;
+        ctr[i] = (BYTE)sum;
+        carry = sum >> 8;
+        block >>= 8;
+    }
+}
+
+/**
+ * Encripta o desencripta en modo CTR una parte de un archivo. El contador se calcula a
+ * partir de la posición, así que cada parte se puede procesar de forma independiente.
+ * El buffer de entrada y el de salida pueden ser el mismo
+ *
+ * @param cipher Cifrado inicializado con cipher_setup
+ * @param nonce Contador del primer bloque del archivo, del tamaño de bloque del cifrado
+ * @param offset Posición de la parte dentro del archivo, múltiplo del tamaño de bloque
+ * @param in Buffer de entrada
+ * @param out Buffer de salida
+ * @param len Número de bytes, puede no ser múltiplo del tamaño de bloque
+ */
+void cipher_ctr_buffer(const CIPHER *cipher, const BYTE *nonce, unsigned long long offset, const BYTE *in, BYTE *out,
+                       size_t len)
+{
+    BYTE ctr[AES_BLOCK_SIZE];
+    BYTE keystream[AES_BLOCK_SIZE];
+    size_t block_size = cipher->block_size;
+    size_t blocks = len / block_size;
+    size_t full_len = blocks * block_size;
+
+    ctr_at_block(nonce, offset / block_size, ctr, block_size);
+    if (cipher->algorithm == AES)
+    {
+        aes_ctr_blocks(in, out, blocks, &cipher->aes_ctx, ctr);
+    }
+    else
+    {
+        blowfish_ctr_blocks(in, out, blocks, &cipher->blowfish_key, ctr);
+    }
+
+    // Del último bloque incompleto sólo se usan los primeros bytes del keystream
+    if (len > full_len)
+    {
+        cipher_encrypt_buffer(cipher, ctr, keystream, block_size);
+        for (size_t i = full_len; i < len; i++)
+        {
+            out[i] = in[i] ^ keystream[i - full_len];
+        }
+    }
+}
+
+/**
+ * Encripta en modo CBC un buffer completo con los kernels de AES. Actualiza el IV con el
+ * último bloque cifrado para que la siguiente llamada continúe la cadena. El buffer de
+ * entrada y el de salida pueden ser el mismo
+ *
+ * @param cipher Cifrado AES inicializado con cipher_setup
+ * @param iv Vector de inicialización, de AES_BLOCK_SIZE bytes
+ * @param in Buffer de entrada
+ * @param out Buffer de salida
+ * @param len Número de bytes, debe ser múltiplo del tamaño de bloque
+ */
+void cipher_cbc_encrypt_buffer(const CIPHER *cipher, BYTE *iv, const BYTE *in, BYTE *out, size_t len)
+{
+    aes_cbc_encrypt_blocks(in, out, len / AES_BLOCK_SIZE, &cipher->aes_ctx, iv);
+}
+
+/**
+ * Desencripta en modo CBC un buffer completo. Cada bloque sólo depende del bloque cifrado
+ * anterior, así que los bloques se desencriptan en paralelo con los kernels de AES.
+ * Actualiza el IV con el último bloque cifrado. El buffer de entrada y el de salida
+ * pueden ser el mismo
+ *
+ * @param cipher Cifrado AES inicializado con cipher_setup
+ * @param iv Bloque cifrado anterior al buffer, o el vector de inicialización
+ * @param in Buffer de entrada
+ * @param out Buffer de salida
+ * @param len Número de bytes, debe ser múltiplo del tamaño de bloque
+ */
+void cipher_cbc_decrypt_buffer(const CIPHER *cipher, BYTE *iv, const BYTE *in, BYTE *out, size_t len)
+{
+    aes_cbc_decrypt_blocks(in, out, len / AES_BLOCK_SIZE, &cipher->aes_ctx, iv);
+}
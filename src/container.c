@@ -0,0 +1,632 @@
+#include "container.h"
+#include "workers.h"
+
+/**
+ * Datos compartidos por los hilos que procesan un contenedor por fragmentos
+ */
+typedef struct
+{
+    const CIPHER *cipher;
+    BYTE mask;               // Máscara de la cabecera, indica el modo de cada fragmento
+    unsigned long long size; // Tamaño del archivo original
+    size_t chunk_size;
+    int in_fd;
+    int out_fd;
+    const CONTAINER_HEADER *header;
+    CHUNK_ENTRY *index;
+    BYTE *leaves;            // Hoja del árbol de cada fragmento
+    FILE_DIGEST *digest;     // Hash del texto plano completo al encriptar, o NULL
+    bool failed;             // Algún fragmento no coincide con la hoja de su entrada
+} CONTAINER_JOB;
+
+/**
+ * Escribe un entero en formato Little Endian
+ *
+ * @param buffer Destino
+ * @param value Valor a escribir
+ * @param bytes Número de bytes, 4 u 8
+ */
+void store_le(BYTE *buffer, unsigned long long value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+    {
+        buffer[i] = (value >> 8 * i) & 0xFF;
+    }
+}
+
+/**
+ * Lee un entero en formato Little Endian
+ *
+ * @param buffer Origen
+ * @param bytes Número de bytes, 4 u 8
+ *
+ * @return Valor leído
+ */
+unsigned long long load_le(const BYTE *buffer, int bytes)
+{
+    unsigned long long value = 0;
+    for (int i = bytes - 1; i >= 0; i--)
+    {
+        value = (value << 8) | buffer[i];
+    }
+    return value;
+}
+
+/**
+ * Devuelve cuántos bytes ocupa cifrado un fragmento: en modo CTR los mismos que el texto
+ * plano y en modo CBC el texto plano rellenado hasta completar el último bloque
+ *
+ * @param mask Máscara de la cabecera
+ * @param length Bytes de texto plano del fragmento
+ */
+size_t chunk_stored_length(BYTE mask, unsigned int length)
+{
+    if ((mask & MODE_MASK) == CBC)
+    {
+        return (length + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+    }
+    return length;
+}
+
+/**
+ * Cifra o descifra un hash del árbol con la clave del archivo, para que el archivo no
+ * revele hashes del texto plano que se puedan comparar con archivos conocidos
+ *
+ * @param cipher Cifrado AES inicializado
+ * @param hash Hash, de MERKLE_HASH_SIZE bytes, que se transforma en su lugar
+ * @param encrypt true para cifrarlo, false para descifrarlo
+ */
+static void container_crypt_hash(const CIPHER *cipher, BYTE *hash, bool encrypt)
+{
+    if (encrypt)
+    {
+        cipher_encrypt_buffer(cipher, hash, hash, MERKLE_HASH_SIZE);
+    }
+    else
+    {
+        cipher_decrypt_buffer(cipher, hash, hash, MERKLE_HASH_SIZE);
+    }
+}
+
+/**
+ * Calcula la hoja del árbol de un fragmento. Además del texto plano cubre la posición del
+ * fragmento, si es el último y su IV, así que una entrada del índice no se puede mover a
+ * otra posición ni se pueden quitar fragmentos del final sin que lo note quien verifica
+ * un fragmento suelto. El IV, que es aleatorio, hace además que dos fragmentos iguales
+ * tengan hojas distintas
+ *
+ * @param entry Entrada del índice del fragmento
+ * @param chunk Índice del fragmento
+ * @param last true si es el último fragmento del archivo
+ * @param data Texto plano del fragmento, entry->length bytes
+ * @param leaf Hoja resultante, de MERKLE_HASH_SIZE bytes
+ */
+static void container_leaf(const CHUNK_ENTRY *entry, unsigned long long chunk, bool last, const BYTE *data, BYTE *leaf)
+{
+    BYTE context[8 + 1 + AES_BLOCK_SIZE];
+
+    store_le(context, chunk, 8);
+    context[8] = last;
+    memcpy(context + 9, entry->iv, AES_BLOCK_SIZE);
+    merkle_leaf(context, sizeof(context), data, entry->length, leaf);
+}
+
+/**
+ * Encripta un fragmento en el buffer, que debe tener espacio para el relleno de CBC
+ */
+static void container_encrypt_chunk(const CIPHER *cipher, BYTE mask, const CHUNK_ENTRY *entry, BYTE *buffer)
+{
+    size_t stored = chunk_stored_length(mask, entry->length);
+
+    if ((mask & MODE_MASK) == CBC)
+    {
+        BYTE iv[AES_BLOCK_SIZE];
+        memcpy(iv, entry->iv, AES_BLOCK_SIZE);
+        memset(buffer + entry->length, 0, stored - entry->length);
+        cipher_cbc_encrypt_buffer(cipher, iv, buffer, buffer, stored);
+    }
+    else
+    {
+        cipher_ctr_buffer(cipher, entry->iv, 0, buffer, buffer, entry->length);
+    }
+}
+
+/**
+ * Desencripta un fragmento en su lugar y lo verifica con la hoja guardada en su entrada
+ * del índice. El buffer contiene los bytes cifrados del fragmento y al terminar sus
+ * primeros entry->length bytes son el texto plano
+ *
+ * @param cipher Cifrado AES inicializado
+ * @param mask Máscara de la cabecera
+ * @param header Cabecera extendida
+ * @param chunk Índice del fragmento
+ * @param entry Entrada del índice del fragmento
+ * @param buffer Bytes cifrados del fragmento, chunk_stored_length() bytes
+ * @param leaf Hoja calculada a partir del texto plano, de MERKLE_HASH_SIZE bytes, o NULL
+ *
+ * @return true si la hoja coincide con la del índice, false si el fragmento o su entrada
+ *         fueron modificados o la clave no es la correcta
+ */
+bool container_decrypt_chunk(const CIPHER *cipher, BYTE mask, const CONTAINER_HEADER *header, unsigned long long chunk,
+                             const CHUNK_ENTRY *entry, BYTE *buffer, BYTE *leaf)
+{
+    BYTE computed[MERKLE_HASH_SIZE];
+
+    if ((mask & MODE_MASK) == CBC)
+    {
+        BYTE iv[AES_BLOCK_SIZE];
+        memcpy(iv, entry->iv, AES_BLOCK_SIZE);
+        cipher_cbc_decrypt_buffer(cipher, iv, buffer, buffer, chunk_stored_length(mask, entry->length));
+    }
+    else
+    {
+        cipher_ctr_buffer(cipher, entry->iv, 0, buffer, buffer, entry->length);
+    }
+
+    container_leaf(entry, chunk, chunk == header->chunks - 1, buffer, computed);
+    if (leaf != NULL)
+    {
+        memcpy(leaf, computed, MERKLE_HASH_SIZE);
+    }
+    container_crypt_hash(cipher, computed, true);
+    return memcmp(computed, entry->leaf, MERKLE_HASH_SIZE) == 0;
+}
+
+/**
+ * Encripta un fragmento del archivo con un IV aleatorio propio y lo escribe en su posición
+ *
+ * @param context Trabajo del contenedor
+ * @param chunk Índice del fragmento
+ * @param buffer Buffer del hilo
+ */
+static void container_encrypt_task(void *context, unsigned long long chunk, BYTE *buffer)
+{
+    CONTAINER_JOB *job = (CONTAINER_JOB *)context;
+    CHUNK_ENTRY *entry = &job->index[chunk];
+    unsigned long long offset = chunk * job->chunk_size;
+
+    if (!fill_random(entry->iv, AES_BLOCK_SIZE))
+    {
+        print_error("Error al generar el IV");
+        exit(1);
+    }
+
+    if (pread_full(job->in_fd, buffer, entry->length, offset) != (ssize_t)entry->length)
+    {
+        print_error("Error al leer el archivo a encriptar");
+        exit(1);
+    }
+
+    BYTE *leaf = job->leaves + chunk * MERKLE_HASH_SIZE;
+    container_leaf(entry, chunk, chunk == job->header->chunks - 1, buffer, leaf);
+    memcpy(entry->leaf, leaf, MERKLE_HASH_SIZE);
+    container_crypt_hash(job->cipher, entry->leaf, true);
+
+    digest_chunk(job->digest, chunk, buffer, entry->length);
+    container_encrypt_chunk(job->cipher, job->mask, entry, buffer);
+
+    if (!pwrite_full(job->out_fd, buffer, chunk_stored_length(job->mask, entry->length), entry->offset))
+    {
+        print_error("Error al escribir el archivo encriptado");
+        exit(1);
+    }
+}
+
+/**
+ * Reserva los hashes de las hojas del árbol, uno por fragmento
+ *
+ * @param chunks Número de fragmentos
+ *
+ * @return Hashes de las hojas, que se deben liberar con free
+ */
+static BYTE *container_alloc_leaves(unsigned long long chunks)
+{
+    BYTE *leaves = (BYTE *)malloc((chunks > 0 ? chunks : 1) * MERKLE_HASH_SIZE);
+    if (leaves == NULL)
+    {
+        print_error("Error al reservar el árbol de hashes\n");
+        exit(1);
+    }
+    return leaves;
+}
+
+/**
+ * Encripta un archivo en el contenedor por fragmentos. A la cabecera le sigue la cabecera
+ * extendida y la raíz cifrada del árbol de hashes del texto plano, luego los fragmentos
+ * cifrados de forma independiente, cada uno con su propio IV, y al final el índice de
+ * fragmentos, en el que cada entrada guarda además la hoja cifrada de su fragmento. Los
+ * fragmentos se reparten entre options->threads hilos, y cada hilo calcula las hojas de
+ * sus fragmentos mientras los encripta
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado
+ * @param header Cabecera del archivo, con CHUNKED y el modo en la máscara
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo a encriptar
+ * @param cipher Cifrado AES inicializado
+ * @param chunk_size Bytes de texto plano por fragmento, múltiplo de AES_BLOCK_SIZE
+ * @param options Opciones de encriptación
+ */
+void container_encrypt_file(int in_fd, int out_fd, const BYTE *header, size_t header_size, unsigned long long size,
+                            const CIPHER *cipher, size_t chunk_size, const ENCRYPT_OPTIONS *options)
+{
+    BYTE mask = header[8];
+    unsigned long long chunks = (size + chunk_size - 1) / chunk_size;
+    unsigned long long offset = header_size + CONTAINER_HEADER_SIZE + MERKLE_HASH_SIZE;
+
+    CHUNK_ENTRY *index = (CHUNK_ENTRY *)calloc(chunks > 0 ? chunks : 1, sizeof(CHUNK_ENTRY));
+    if (index == NULL)
+    {
+        print_error("Error al reservar el índice de fragmentos");
+        exit(1);
+    }
+
+    // Las posiciones dependen sólo del tamaño del archivo, así que se calculan antes de
+    // encriptar y cada hilo escribe su fragmento directamente en su lugar
+    for (unsigned long long i = 0; i < chunks; i++)
+    {
+        index[i].length = size - i * chunk_size < chunk_size ? (unsigned int)(size - i * chunk_size) : chunk_size;
+        index[i].offset = offset;
+        offset += chunk_stored_length(mask, index[i].length);
+    }
+
+    CONTAINER_HEADER container = {
+        .version = CONTAINER_VERSION,
+        .flags = CONTAINER_FLAGS,
+        .chunk_size = chunk_size,
+        .chunks = chunks,
+        .index_offset = offset,
+    };
+    BYTE extended[CONTAINER_HEADER_SIZE] = {0};
+    extended[0] = container.version;
+    extended[1] = container.flags;
+    store_le(extended + 4, container.chunk_size, 4);
+    store_le(extended + 8, container.chunks, 8);
+    store_le(extended + 16, container.index_offset, 8);
+
+    if (!pwrite_full(out_fd, header, header_size, 0) ||
+        !pwrite_full(out_fd, extended, CONTAINER_HEADER_SIZE, header_size))
+    {
+        print_error("Error al escribir la cabecera");
+        exit(1);
+    }
+
+    CONTAINER_JOB job = {
+        .cipher = cipher,
+        .mask = mask,
+        .size = size,
+        .chunk_size = chunk_size,
+        .in_fd = in_fd,
+        .out_fd = out_fd,
+        .header = &container,
+        .index = index,
+        .leaves = container_alloc_leaves(chunks),
+        .digest = options->digest,
+    };
+    if (!reserve_output_file(out_fd, offset + chunks * CHUNK_ENTRY_SIZE))
+    {
+        print_error("Error al reservar espacio para el archivo encriptado\n");
+        exit(1);
+    }
+    run_workers(options->threads, chunks, chunk_size, container_encrypt_task, &job);
+
+    BYTE root[MERKLE_HASH_SIZE];
+    merkle_root(job.leaves, chunks, root);
+    container_crypt_hash(cipher, root, true);
+    if (!pwrite_full(out_fd, root, MERKLE_HASH_SIZE, header_size + CONTAINER_HEADER_SIZE))
+    {
+        print_error("Error al escribir la cabecera");
+        exit(1);
+    }
+
+    BYTE *trailer = (BYTE *)malloc(chunks * CHUNK_ENTRY_SIZE + 1);
+    if (trailer == NULL)
+    {
+        print_error("Error al reservar el índice de fragmentos");
+        exit(1);
+    }
+
+    for (unsigned long long i = 0; i < chunks; i++)
+    {
+        BYTE *entry = trailer + i * CHUNK_ENTRY_SIZE;
+        store_le(entry, index[i].offset, 8);
+        store_le(entry + 8, index[i].length, 4);
+        memcpy(entry + 12, index[i].iv, AES_BLOCK_SIZE);
+        memcpy(entry + 12 + AES_BLOCK_SIZE, index[i].leaf, MERKLE_HASH_SIZE);
+    }
+
+    if (!pwrite_full(out_fd, trailer, chunks * CHUNK_ENTRY_SIZE, offset))
+    {
+        print_error("Error al escribir el índice de fragmentos");
+        exit(1);
+    }
+
+    free(trailer);
+    free(index);
+    free(job.leaves);
+}
+
+/**
+ * Decodifica y valida una entrada del índice: todos los fragmentos tienen chunk_size
+ * bytes salvo el último, y sus bytes cifrados deben estar dentro del archivo
+ *
+ * @param raw Entrada codificada, de CHUNK_ENTRY_SIZE bytes
+ * @param mask Máscara de la cabecera
+ * @param size Tamaño del archivo original
+ * @param header Cabecera extendida
+ * @param file_size Tamaño del archivo encriptado
+ * @param chunk Índice del fragmento
+ * @param entry Entrada decodificada
+ *
+ * @return true si la entrada es válida, false en caso contrario
+ */
+bool decode_chunk_entry(const BYTE *raw, BYTE mask, unsigned long long size, const CONTAINER_HEADER *header,
+                        unsigned long long file_size, unsigned long long chunk, CHUNK_ENTRY *entry)
+{
+    unsigned long long expected = size - chunk * header->chunk_size;
+    if (expected > header->chunk_size)
+    {
+        expected = header->chunk_size;
+    }
+
+    entry->offset = load_le(raw, 8);
+    entry->length = load_le(raw + 8, 4);
+    memcpy(entry->iv, raw + 12, AES_BLOCK_SIZE);
+    memcpy(entry->leaf, raw + 12 + AES_BLOCK_SIZE, MERKLE_HASH_SIZE);
+
+    return entry->length == expected && entry->offset <= file_size &&
+           file_size - entry->offset >= chunk_stored_length(mask, entry->length);
+}
+
+/**
+ * Decodifica y valida la cabecera extendida de un contenedor
+ *
+ * @param raw Cabecera extendida tal como está en el archivo
+ * @param size Tamaño del archivo original indicado en la cabecera
+ * @param file_size Tamaño del archivo encriptado
+ * @param header Cabecera extendida decodificada
+ *
+ * @return NULL si la cabecera es válida, o el mensaje de error en caso contrario
+ */
+const char *parse_container_header(const BYTE *raw, unsigned long long size, unsigned long long file_size,
+                                   CONTAINER_HEADER *header)
+{
+    header->version = raw[0];
+    header->flags = raw[1];
+    header->chunk_size = load_le(raw + 4, 4);
+    header->chunks = load_le(raw + 8, 8);
+    header->index_offset = load_le(raw + 16, 8);
+
+    // Todos los contenedores de esta versión guardan la raíz y las hojas, así que una bandera borrada o
+    // un byte reservado distinto de cero sólo pueden venir de un archivo modificado
+    if (header->version != CONTAINER_VERSION)
+    {
+        return "Versión del contenedor no soportada\n";
+    }
+    if (header->flags != CONTAINER_FLAGS || raw[2] != 0 || raw[3] != 0)
+    {
+        return "Archivo encriptado truncado o corrupto\n";
+    }
+
+    // Cada hilo reserva un búfer de chunk_size bytes, así que se aplica el mismo límite que al
+    // encriptar en lugar de confiar en el tamaño que indique el archivo
+    if (header->chunk_size == 0 || header->chunk_size > 1024 * MIB)
+    {
+        return "Cabecera no especifica el tamaño de fragmento correctamente\n";
+    }
+
+    if (header->chunk_size % AES_BLOCK_SIZE != 0 ||
+        header->chunks != (size + header->chunk_size - 1) / header->chunk_size ||
+        header->index_offset > file_size || (file_size - header->index_offset) / CHUNK_ENTRY_SIZE < header->chunks)
+    {
+        return "Archivo encriptado truncado o corrupto\n";
+    }
+
+    return NULL;
+}
+
+/**
+ * Lee y valida la cabecera extendida de un contenedor
+ *
+ * @param fd Descriptor del archivo encriptado
+ * @param header_size Bytes de la cabecera del archivo, a los que sigue la extendida
+ * @param size Tamaño del archivo original indicado en la cabecera
+ * @param header Cabecera extendida leída
+ *
+ * @return Tamaño del archivo encriptado
+ */
+unsigned long long read_container_header(int fd, size_t header_size, unsigned long long size, CONTAINER_HEADER *header)
+{
+    BYTE extended[CONTAINER_HEADER_SIZE];
+    struct stat file_stats;
+
+    if (pread_full(fd, extended, CONTAINER_HEADER_SIZE, header_size) != CONTAINER_HEADER_SIZE ||
+        fstat(fd, &file_stats) < 0)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    const char *error = parse_container_header(extended, size, file_stats.st_size, header);
+    if (error != NULL)
+    {
+        print_error((char *)error);
+        exit(1);
+    }
+
+    return file_stats.st_size;
+}
+
+/**
+ * Lee del índice sólo la entrada de un fragmento, sin cargar el índice completo
+ *
+ * @param fd Descriptor del archivo encriptado
+ * @param mask Máscara de la cabecera
+ * @param size Tamaño del archivo original indicado en la cabecera
+ * @param header Cabecera extendida leída con read_container_header
+ * @param chunk Índice del fragmento, menor que header->chunks
+ * @param entry Entrada leída
+ */
+void read_chunk_entry(int fd, BYTE mask, unsigned long long size, const CONTAINER_HEADER *header, unsigned long long chunk,
+                      CHUNK_ENTRY *entry)
+{
+    BYTE raw[CHUNK_ENTRY_SIZE];
+    struct stat file_stats;
+
+    if (pread_full(fd, raw, CHUNK_ENTRY_SIZE, header->index_offset + chunk * CHUNK_ENTRY_SIZE) != CHUNK_ENTRY_SIZE ||
+        fstat(fd, &file_stats) < 0)
+    {
+        print_error("Error al leer el índice de fragmentos\n");
+        exit(1);
+    }
+
+    if (!decode_chunk_entry(raw, mask, size, header, file_stats.st_size, chunk, entry))
+    {
+        print_error("Índice de fragmentos corrupto\n");
+        exit(1);
+    }
+}
+
+/**
+ * Lee y valida la cabecera extendida y el índice de fragmentos completo de un contenedor
+ *
+ * @param fd Descriptor del archivo encriptado
+ * @param header_size Bytes de la cabecera del archivo
+ * @param mask Máscara de la cabecera
+ * @param size Tamaño del archivo original indicado en la cabecera
+ * @param header Cabecera extendida leída
+ *
+ * @return Índice de fragmentos, que se debe liberar con free
+ */
+CHUNK_ENTRY *read_container(int fd, size_t header_size, BYTE mask, unsigned long long size, CONTAINER_HEADER *header)
+{
+    unsigned long long file_size = read_container_header(fd, header_size, size, header);
+    size_t trailer_size = header->chunks * CHUNK_ENTRY_SIZE;
+    BYTE *trailer = (BYTE *)malloc(trailer_size + 1);
+    CHUNK_ENTRY *index = (CHUNK_ENTRY *)malloc((header->chunks > 0 ? header->chunks : 1) * sizeof(CHUNK_ENTRY));
+    if (trailer == NULL || index == NULL)
+    {
+        print_error("Error al reservar el índice de fragmentos\n");
+        exit(1);
+    }
+
+    if (pread_full(fd, trailer, trailer_size, header->index_offset) != (ssize_t)trailer_size)
+    {
+        print_error("Error al leer el índice de fragmentos\n");
+        exit(1);
+    }
+
+    for (unsigned long long i = 0; i < header->chunks; i++)
+    {
+        if (!decode_chunk_entry(trailer + i * CHUNK_ENTRY_SIZE, mask, size, header, file_size, i, &index[i]))
+        {
+            print_error("Índice de fragmentos corrupto\n");
+            exit(1);
+        }
+    }
+
+    free(trailer);
+    return index;
+}
+
+/**
+ * Desencripta un fragmento y escribe su texto plano en su posición del archivo original
+ *
+ * @param context Trabajo del contenedor
+ * @param chunk Índice del fragmento
+ * @param buffer Buffer del hilo
+ */
+static void container_decrypt_task(void *context, unsigned long long chunk, BYTE *buffer)
+{
+    CONTAINER_JOB *job = (CONTAINER_JOB *)context;
+    const CHUNK_ENTRY *entry = &job->index[chunk];
+    size_t stored = chunk_stored_length(job->mask, entry->length);
+
+    if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    if (pread_full(job->in_fd, buffer, stored, entry->offset) != (ssize_t)stored)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    if (!container_decrypt_chunk(job->cipher, job->mask, job->header, chunk, entry, buffer,
+                                 job->leaves + chunk * MERKLE_HASH_SIZE))
+    {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (!pwrite_full(job->out_fd, buffer, entry->length, chunk * job->chunk_size))
+    {
+        print_error("Error al escribir el archivo desencriptado\n");
+        exit(1);
+    }
+}
+
+/**
+ * Desencripta un contenedor por fragmentos, repartiendo los fragmentos entre
+ * options->threads hilos. Cada hilo verifica los fragmentos que desencripta con las hojas
+ * del índice y al final se compara la raíz recalculada con la guardada, que cubre además
+ * el número de fragmentos; quien llama debe borrar el archivo de salida si algo no
+ * coincide
+ *
+ * @param in_fd Descriptor del archivo encriptado
+ * @param out_fd Descriptor del archivo desencriptado
+ * @param header_size Bytes de la cabecera del archivo
+ * @param mask Máscara de la cabecera
+ * @param size Tamaño del archivo original indicado en la cabecera
+ * @param cipher Cifrado AES inicializado
+ * @param options Opciones de desencriptación
+ *
+ * @return true si las hojas y la raíz coinciden, false si el archivo fue modificado o la
+ *         clave no es la correcta
+ */
+bool container_decrypt_file(int in_fd, int out_fd, size_t header_size, BYTE mask, unsigned long long size,
+                            const CIPHER *cipher, const ENCRYPT_OPTIONS *options)
+{
+    CONTAINER_HEADER header;
+    CHUNK_ENTRY *index = read_container(in_fd, header_size, mask, size, &header);
+    BYTE stored_root[MERKLE_HASH_SIZE];
+    BYTE root[MERKLE_HASH_SIZE];
+
+    if (pread_full(in_fd, stored_root, MERKLE_HASH_SIZE, header_size + CONTAINER_HEADER_SIZE) != MERKLE_HASH_SIZE)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    CONTAINER_JOB job = {
+        .cipher = cipher,
+        .mask = mask,
+        .size = size,
+        .chunk_size = header.chunk_size,
+        .in_fd = in_fd,
+        .out_fd = out_fd,
+        .header = &header,
+        .index = index,
+        .leaves = container_alloc_leaves(header.chunks),
+    };
+    if (!reserve_output_file(out_fd, size))
+    {
+        print_error("Error al reservar espacio para el archivo desencriptado\n");
+        exit(1);
+    }
+    run_workers(options->threads, header.chunks, header.chunk_size, container_decrypt_task, &job);
+
+    // Si algún fragmento falló, sus hilos no calcularon todas las hojas
+    bool intact = !job.failed;
+    if (intact)
+    {
+        merkle_root(job.leaves, header.chunks, root);
+        container_crypt_hash(cipher, stored_root, false);
+        intact = memcmp(root, stored_root, MERKLE_HASH_SIZE) == 0;
+    }
+
+    free(index);
+    free(job.leaves);
+    return intact;
+}
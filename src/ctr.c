@@ -0,0 +1,131 @@
+#include "ctr.h"
+#include "workers.h"
+
+/**
+ * Datos compartidos por los hilos que procesan un archivo en modo CTR
+ */
+typedef struct
+{
+    const CIPHER *cipher;
+    const BYTE *nonce;
+    unsigned long long size; // Bytes a procesar
+    size_t chunk_size;       // Bytes por fragmento, múltiplo del tamaño de bloque
+    int in_fd;
+    off_t in_offset; // Posición de los datos dentro del archivo de entrada
+    int out_fd;
+    off_t out_offset; // Posición de los datos dentro del archivo de salida
+    const BYTE *in_map; // Datos de entrada mapeados, o NULL si se usan buffers
+    BYTE *out_map;      // Datos de salida mapeados, o NULL si se usan buffers
+    FILE_DIGEST *digest; // Hash del texto plano al encriptar, o NULL
+} CTR_JOB;
+
+/**
+ * Procesa un fragmento del archivo. Cada fragmento calcula su propio contador a partir de
+ * su posición, así que los hilos no necesitan coordinarse
+ *
+ * @param context Trabajo CTR
+ * @param chunk Índice del fragmento
+ * @param buffer Buffer del hilo, sólo se usa cuando los archivos no están mapeados
+ */
+static void ctr_task(void *context, unsigned long long chunk, BYTE *buffer)
+{
+    const CTR_JOB *job = (const CTR_JOB *)context;
+    unsigned long long offset = chunk * job->chunk_size;
+    size_t len = job->size - offset < job->chunk_size ? (size_t)(job->size - offset) : job->chunk_size;
+
+    if (job->in_map != NULL)
+    {
+        digest_chunk(job->digest, chunk, job->in_map + offset, len);
+        cipher_ctr_buffer(job->cipher, job->nonce, offset, job->in_map + offset, job->out_map + offset, len);
+        return;
+    }
+
+    if (pread_full(job->in_fd, buffer, len, job->in_offset + offset) != (ssize_t)len)
+    {
+        print_error("Error al leer el archivo o archivo truncado\n");
+        exit(1);
+    }
+
+    digest_chunk(job->digest, chunk, buffer, len);
+    cipher_ctr_buffer(job->cipher, job->nonce, offset, buffer, buffer, len);
+
+    if (!pwrite_full(job->out_fd, buffer, len, job->out_offset + offset))
+    {
+        print_error("Error al escribir el archivo\n");
+        exit(1);
+    }
+}
+
+/**
+ * Encripta o desencripta en modo CTR size bytes de un archivo en otro, repartiendo
+ * fragmentos del tamaño del buffer entre options->threads hilos. Con options->use_mmap
+ * los hilos trabajan directamente sobre los archivos mapeados; si no se pueden mapear,
+ * cada hilo lee y escribe su fragmento en su posición con su propio buffer. Con
+ * options->digest cada hilo añade al hash el texto plano de su fragmento antes de
+ * encriptarlo
+ *
+ * @param in_fd Descriptor del archivo de entrada
+ * @param in_offset Posición de los datos en el archivo de entrada
+ * @param out_fd Descriptor del archivo de salida, abierto para lectura y escritura. Los
+ *               primeros out_offset bytes ya deben estar escritos
+ * @param out_offset Posición de los datos en el archivo de salida
+ * @param size Número de bytes a procesar
+ * @param cipher Cifrado inicializado
+ * @param nonce Contador del primer bloque, del tamaño de bloque del cifrado
+ * @param options Opciones de encriptación
+ */
+void ctr_crypt_file(int in_fd, off_t in_offset, int out_fd, off_t out_offset, unsigned long long size,
+                    const CIPHER *cipher, const BYTE *nonce, const ENCRYPT_OPTIONS *options)
+{
+    size_t chunk_size = options->buffer_size - options->buffer_size % AES_BLOCK_SIZE;
+    if (chunk_size < AES_BLOCK_SIZE)
+    {
+        chunk_size = AES_BLOCK_SIZE;
+    }
+
+    CTR_JOB job = {
+        .cipher = cipher,
+        .nonce = nonce,
+        .size = size,
+        .chunk_size = chunk_size,
+        .in_fd = in_fd,
+        .in_offset = in_offset,
+        .out_fd = out_fd,
+        .out_offset = out_offset,
+        .in_map = NULL,
+        .out_map = NULL,
+        .digest = options->digest,
+    };
+    unsigned long long chunks = (size + chunk_size - 1) / chunk_size;
+
+    BYTE *in_map = NULL;
+    BYTE *out_map = NULL;
+    if (options->use_mmap && size > 0)
+    {
+        in_map = map_input_file(in_fd, in_offset + size);
+        out_map = in_map != NULL ? map_output_file(out_fd, out_offset + size) : NULL;
+    }
+
+    if (out_map != NULL)
+    {
+        job.in_map = in_map + in_offset;
+        job.out_map = out_map + out_offset;
+        run_workers(options->threads, chunks, 0, ctr_task, &job);
+        unmap_file(in_map, in_offset + size);
+        unmap_file(out_map, out_offset + size);
+        return;
+    }
+
+    if (in_map != NULL)
+    {
+        unmap_file(in_map, in_offset + size);
+    }
+
+    if (!reserve_output_file(out_fd, out_offset + size))
+    {
+        print_error("Error al reservar espacio para el archivo\n");
+        exit(1);
+    }
+
+    run_workers(options->threads, chunks, chunk_size, ctr_task, &job);
+}
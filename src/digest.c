@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "digest.h"
+
+/**
+ * Inicializa el hash de un archivo
+ *
+ * @param digest Hash a inicializar
+ */
+void digest_init(FILE_DIGEST *digest)
+{
+    sha256_init(&digest->ctx);
+    digest->next_chunk = 0;
+    pthread_mutex_init(&digest->lock, NULL);
+    pthread_cond_init(&digest->turn, NULL);
+}
+
+/**
+ * Añade un fragmento del texto plano al hash. SHA-256 es secuencial, así que cada hilo
+ * espera a que se hayan añadido todos los fragmentos anteriores; como los hilos toman los
+ * fragmentos en orden, la espera es corta y sólo el hash se serializa, no la encriptación.
+ * Se debe llamar justo antes de encriptar el fragmento, cuando sus bytes todavía están en
+ * la caché. Si digest es NULL no hace nada
+ *
+ * @param digest Hash del archivo, o NULL
+ * @param chunk Índice del fragmento; cada fragmento se añade una sola vez
+ * @param data Texto plano del fragmento
+ * @param len Número de bytes
+ */
+void digest_chunk(FILE_DIGEST *digest, unsigned long long chunk, const BYTE *data, size_t len)
+{
+    if (digest == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&digest->lock);
+    while (digest->next_chunk != chunk)
+    {
+        pthread_cond_wait(&digest->turn, &digest->lock);
+    }
+    pthread_mutex_unlock(&digest->lock);
+
+    // Mientras sea su turno ningún otro hilo toca el contexto
+    sha256_update(&digest->ctx, data, len);
+
+    pthread_mutex_lock(&digest->lock);
+    digest->next_chunk++;
+    pthread_cond_broadcast(&digest->turn);
+    pthread_mutex_unlock(&digest->lock);
+}
+
+/**
+ * Termina el hash de un archivo
+ *
+ * @param digest Hash del archivo
+ * @param hash Hash resultante, de SHA256_BLOCK_SIZE bytes
+ */
+void digest_final(FILE_DIGEST *digest, BYTE *hash)
+{
+    sha256_final(&digest->ctx, hash);
+    pthread_mutex_destroy(&digest->lock);
+    pthread_cond_destroy(&digest->turn);
+}
+
+/**
+ * Termina el hash de un archivo y lo guarda junto al archivo en el formato de sha256sum,
+ * en un archivo con el mismo nombre y la extensión DIGEST_EXTENSION, de modo que
+ * `sha256sum -c` puede verificar el archivo desencriptado
+ *
+ * @param file_name Nombre del archivo original
+ * @param digest Hash del archivo, con todos sus bytes añadidos
+ *
+ * @return true si se escribió el archivo, false en caso contrario
+ */
+bool write_digest_file(const char *file_name, FILE_DIGEST *digest)
+{
+    BYTE hash[SHA256_BLOCK_SIZE];
+    char *digest_name = (char *)malloc(strlen(file_name) + strlen(DIGEST_EXTENSION) + 1);
+    if (digest_name == NULL)
+    {
+        return false;
+    }
+    strcpy(digest_name, file_name);
+    strcat(digest_name, DIGEST_EXTENSION);
+
+    digest_final(digest, hash);
+
+    FILE *file = fopen(digest_name, "w");
+    if (file == NULL)
+    {
+        free(digest_name);
+        return false;
+    }
+
+    for (int i = 0; i < SHA256_BLOCK_SIZE; i++)
+    {
+        fprintf(file, "%02x", hash[i]);
+    }
+    fprintf(file, "  %s\n", file_name);
+
+    bool written = fclose(file) == 0;
+    if (written)
+    {
+        printf("Hash SHA-256 de %s guardado en %s\n", file_name, digest_name);
+    }
+    free(digest_name);
+    return written;
+}
@@ -1,4 +1,11 @@
 #include "encrypter.h"
+#include "ctr.h"
+#include "cbc.h"
+#include "gcm.h"
+#include "ccm.h"
+#include "stream.h"
+#include "container.h"
+#include "kdf.h"
 
 /**
  * Número de bits disponibles para encriptación
@@ -14,6 +21,13 @@ int available_bits[] = {128, 192, 256};
  */
 char *available_algorithms[] = {"aes", "blowfish"};
 
+/**
+ * Modos de encriptación disponibles
+ *
+ * ecb, ctr, cbc, gcm, ccm
+ */
+char *available_modes[] = {"ecb", "ctr", "cbc", "gcm", "ccm"};
+
 /**
  * Verifica si el número de bits es válido. Los valores válidos son 128, 192 y 256
  *
@@ -56,6 +70,27 @@ bool is_valid_algorithm(char *algorithm)
     return false;
 }
 
+/**
+ * Verifica si el modo de encriptación es válido. Los valores válidos son ecb, ctr, cbc, gcm y ccm
+ *
+ * @param mode Modo de encriptación
+ *
+ * @return true si el modo es válido, false en caso contrario
+ */
+bool is_valid_mode(char *mode)
+{
+    int length = sizeof(available_modes) / sizeof(available_modes[0]);
+    for (int i = 0; i < length; i++)
+    {
+        if (strcmp(mode, available_modes[i]) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**
  * Genera una clave de encriptación a partir de una frase
  *
@@ -76,15 +111,362 @@ int generate_key_sha256(char *phrase, BYTE *key, int n_bits)
     }
 }
 
+/**
+ * Encripta un archivo mapeando en memoria tanto el archivo original como el encriptado,
+ * de modo que el cifrado recorre directamente las páginas mapeadas sin copias intermedias.
+ * Si se calcula el hash del texto plano, el archivo se recorre en partes de
+ * DIGEST_SLICE_SIZE bytes que se hashean y encriptan mientras están en la caché
+ *
+ * @param original_file_fd Descriptor del archivo a encriptar
+ * @param new_file_fd Descriptor del archivo encriptado, abierto para lectura y escritura
+ * @param file_size Tamaño del archivo a encriptar
+ * @param header Cabecera a escribir al inicio del archivo encriptado
+ * @param header_size Bytes de la cabecera
+ * @param cipher Cifrado inicializado
+ * @param digest Hash del texto plano, o NULL
+ *
+ * @return true si se encriptó el archivo, false si alguno de los archivos no se puede
+ * mapear y se debe usar la encriptación con buffers
+ */
+static bool encrypt_file_mapped(int original_file_fd, int new_file_fd, off_t file_size, const BYTE *header,
+                                size_t header_size, const CIPHER *cipher, FILE_DIGEST *digest)
+{
+    size_t tail = file_size % cipher->block_size;
+    size_t full_len = file_size - tail;
+    size_t padded_len = full_len + (tail > 0 ? cipher->block_size : 0);
+
+    BYTE *in = map_input_file(original_file_fd, file_size);
+    if (in == NULL)
+    {
+        return false;
+    }
+
+    BYTE *out = map_output_file(new_file_fd, header_size + padded_len);
+    if (out == NULL)
+    {
+        unmap_file(in, file_size);
+        return false;
+    }
+
+    memcpy(out, header, header_size);
+    size_t slice = digest != NULL ? DIGEST_SLICE_SIZE : full_len;
+    for (size_t offset = 0; offset < full_len; offset += slice)
+    {
+        size_t len = full_len - offset < slice ? full_len - offset : slice;
+        digest_chunk(digest, offset / DIGEST_SLICE_SIZE, in + offset, len);
+        cipher_encrypt_buffer(cipher, in + offset, out + header_size + offset, len);
+    }
+
+    // El último bloque incompleto se rellena con ceros
+    if (tail > 0)
+    {
+        BYTE last_block[AES_BLOCK_SIZE] = {0};
+        memcpy(last_block, in + full_len, tail);
+        digest_chunk(digest, (full_len + DIGEST_SLICE_SIZE - 1) / DIGEST_SLICE_SIZE, last_block, tail);
+        cipher_encrypt_buffer(cipher, last_block, out + header_size + full_len, cipher->block_size);
+    }
+
+    unmap_file(in, file_size);
+    unmap_file(out, header_size + padded_len);
+    return true;
+}
+
+/**
+ * Desencripta un archivo mapeando en memoria tanto el archivo encriptado como el desencriptado
+ *
+ * @param original_file_fd Descriptor del archivo encriptado
+ * @param new_file_fd Descriptor del archivo desencriptado, abierto para lectura y escritura
+ * @param header_size Bytes de la cabecera
+ * @param original_file_size Tamaño del archivo original indicado en la cabecera
+ * @param cipher Cifrado inicializado
+ *
+ * @return true si se desencriptó el archivo, false si alguno de los archivos no se puede
+ * mapear y se debe usar la desencriptación con buffers
+ */
+static bool decrypt_file_mapped(int original_file_fd, int new_file_fd, size_t header_size, unsigned long long original_file_size,
+                                const CIPHER *cipher)
+{
+    struct stat file_stats;
+    if (fstat(original_file_fd, &file_stats) < 0)
+    {
+        return false;
+    }
+
+    size_t encrypted_size = file_stats.st_size;
+    size_t tail = original_file_size % cipher->block_size;
+    size_t full_len = original_file_size - tail;
+    size_t padded_len = full_len + (tail > 0 ? cipher->block_size : 0);
+
+    if (encrypted_size < header_size + padded_len)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    BYTE *in = map_input_file(original_file_fd, encrypted_size);
+    if (in == NULL)
+    {
+        return false;
+    }
+
+    BYTE *out = map_output_file(new_file_fd, original_file_size);
+    if (out == NULL)
+    {
+        unmap_file(in, encrypted_size);
+        return false;
+    }
+
+    cipher_decrypt_buffer(cipher, in + header_size, out, full_len);
+
+    // Del último bloque sólo se copian los bytes del archivo original
+    if (tail > 0)
+    {
+        BYTE last_block[AES_BLOCK_SIZE];
+        cipher_decrypt_buffer(cipher, in + header_size + full_len, last_block, cipher->block_size);
+        memcpy(out + full_len, last_block, tail);
+    }
+
+    unmap_file(in, encrypted_size);
+    unmap_file(out, original_file_size);
+    return true;
+}
+
+/**
+ * Encripta en modo CTR. El archivo no se rellena: a la cabecera le sigue un nonce
+ * aleatorio y luego el texto cifrado, del mismo tamaño que el archivo original
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado
+ * @param header Cabecera del archivo
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo a encriptar
+ * @param cipher Cifrado inicializado
+ * @param options Opciones de encriptación
+ */
+static void encrypt_ctr_mode(int in_fd, int out_fd, const BYTE *header, size_t header_size, unsigned long long size,
+                             const CIPHER *cipher, const ENCRYPT_OPTIONS *options)
+{
+    BYTE nonce[CTR_NONCE_SIZE];
+    size_t nonce_size = cipher->block_size;
+    if (!fill_random(nonce, nonce_size))
+    {
+        print_error("Error al generar el nonce");
+        exit(1);
+    }
+
+    if (!write_full(out_fd, header, header_size) || !write_full(out_fd, nonce, nonce_size))
+    {
+        print_error("Error al escribir la cabecera");
+        exit(1);
+    }
+
+    ctr_crypt_file(in_fd, 0, out_fd, header_size + nonce_size, size, cipher, nonce, options);
+}
+
+/**
+ * Encripta en modo GCM. A la cabecera le siguen el modo y un IV aleatorio de 96 bits,
+ * luego el texto cifrado sin relleno y al final la etiqueta, que autentica también lo
+ * anterior
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado
+ * @param header Cabecera del archivo
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo a encriptar
+ * @param cipher Cifrado AES inicializado
+ * @param options Opciones de encriptación
+ */
+static void encrypt_gcm_mode(int in_fd, int out_fd, const BYTE *header, size_t header_size, unsigned long long size,
+                             const CIPHER *cipher, const ENCRYPT_OPTIONS *options)
+{
+    BYTE prefix[GCM_PREFIX_SIZE(MAX_HEADER_SIZE)];
+    size_t prefix_size = GCM_PREFIX_SIZE(header_size);
+    memcpy(prefix, header, header_size);
+    prefix[header_size] = AEAD_GCM;
+    if (!fill_random(prefix + header_size + AEAD_ID_SIZE, GCM_IV_SIZE))
+    {
+        print_error("Error al generar el IV");
+        exit(1);
+    }
+
+    if (!write_full(out_fd, prefix, prefix_size))
+    {
+        print_error("Error al escribir la cabecera");
+        exit(1);
+    }
+
+    gcm_encrypt_file(in_fd, out_fd, prefix_size, size, cipher, prefix, options);
+}
+
+/**
+ * Encripta en modo CCM. A la cabecera le siguen el modo y un nonce aleatorio, luego el
+ * texto cifrado sin relleno y al final el MAC
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado
+ * @param header Cabecera del archivo
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo a encriptar
+ * @param cipher Cifrado AES inicializado
+ * @param options Opciones de encriptación
+ */
+static void encrypt_ccm_mode(int in_fd, int out_fd, const BYTE *header, size_t header_size, unsigned long long size,
+                             const CIPHER *cipher, const ENCRYPT_OPTIONS *options)
+{
+    BYTE prefix[CCM_PREFIX_SIZE(MAX_HEADER_SIZE)];
+    size_t prefix_size = CCM_PREFIX_SIZE(header_size);
+    memcpy(prefix, header, header_size);
+    prefix[header_size] = AEAD_CCM;
+    if (!fill_random(prefix + CCM_ASSOC_SIZE(header_size), CCM_NONCE_SIZE))
+    {
+        print_error("Error al generar el nonce");
+        exit(1);
+    }
+
+    if (!write_full(out_fd, prefix, prefix_size))
+    {
+        print_error("Error al escribir la cabecera");
+        exit(1);
+    }
+
+    ccm_encrypt_file(in_fd, out_fd, size, cipher, prefix, prefix_size, options);
+}
+
+/**
+ * Encripta en modo CBC. A la cabecera le sigue un IV aleatorio y luego los bloques
+ * cifrados, rellenando el último con ceros como en ECB
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado
+ * @param header Cabecera del archivo
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo a encriptar
+ * @param cipher Cifrado AES inicializado
+ * @param options Opciones de encriptación
+ */
+static void encrypt_cbc_mode(int in_fd, int out_fd, const BYTE *header, size_t header_size, unsigned long long size,
+                             const CIPHER *cipher, const ENCRYPT_OPTIONS *options)
+{
+    BYTE iv[CBC_IV_SIZE];
+    if (!fill_random(iv, CBC_IV_SIZE))
+    {
+        print_error("Error al generar el IV");
+        exit(1);
+    }
+
+    if (!write_full(out_fd, header, header_size) || !write_full(out_fd, iv, CBC_IV_SIZE))
+    {
+        print_error("Error al escribir la cabecera");
+        exit(1);
+    }
+
+    cbc_encrypt_file(in_fd, out_fd, header_size + CBC_IV_SIZE, size, cipher, iv, options);
+}
+
+/**
+ * Encripta en modo ECB, el formato original: a la cabecera le siguen los bloques
+ * cifrados y el último se rellena con ceros. Con --mmap se intenta mapear los archivos
+ * y, si no es posible, se usan buffers
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado, abierto para lectura y escritura
+ * @param header Cabecera del archivo
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo a encriptar
+ * @param cipher Cifrado inicializado
+ * @param options Opciones de encriptación
+ */
+static void encrypt_ecb_mode(int in_fd, int out_fd, const BYTE *header, size_t header_size, unsigned long long size,
+                             const CIPHER *cipher, const ENCRYPT_OPTIONS *options)
+{
+    if (options->use_mmap && encrypt_file_mapped(in_fd, out_fd, size, header, header_size, cipher, options->digest))
+    {
+        return;
+    }
+
+    if (!write_full(out_fd, header, header_size))
+    {
+        print_error("Error al escribir la cabecera");
+        exit(1);
+    }
+
+    size_t buffer_size = options->buffer_size;
+    BYTE *buffer = allocate_io_buffer(&buffer_size, cipher->block_size);
+    if (buffer == NULL)
+    {
+        print_error("Error al reservar el buffer de E/S");
+        exit(1);
+    }
+
+    // Se leen bloques grandes del archivo y se encripta el buffer completo de una vez.
+    // Sólo el último buffer puede quedar incompleto, en cuyo caso se rellena con ceros
+    // hasta completar el último bloque.
+    ssize_t bytes_read;
+    unsigned long long chunk = 0;
+    while ((bytes_read = read_full(in_fd, buffer, buffer_size)) > 0)
+    {
+        digest_chunk(options->digest, chunk++, buffer, bytes_read);
+        size_t padding = (cipher->block_size - bytes_read % cipher->block_size) % cipher->block_size;
+        memset(buffer + bytes_read, 0, padding);
+        size_t len = bytes_read + padding;
+
+        cipher_encrypt_buffer(cipher, buffer, buffer, len);
+        if (!write_full(out_fd, buffer, len))
+        {
+            print_error("Error al escribir el archivo encriptado");
+            exit(1);
+        }
+    }
+
+    if (bytes_read < 0)
+    {
+        print_error("Error al leer el archivo a encriptar");
+        exit(1);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Calcula la raíz del árbol de hashes de un archivo ecb, ctr o cbc sin fragmentos y la
+ * cifra con la clave del archivo. El árbol cubre todo lo que sigue a la cabecera, desde
+ * el nonce o el IV, y cada hoja incluye la cabecera sin la raíz, así que también se nota
+ * un cambio en el tamaño, la máscara o los parámetros de PBKDF2
+ *
+ * @param fd Descriptor del archivo encriptado, abierto para lectura
+ * @param header_size Bytes de la cabecera, con la raíz al final
+ * @param cipher Cifrado inicializado
+ * @param threads Hilos que calculan las hojas
+ * @param root Raíz cifrada resultante, de ROOT_SIZE bytes
+ */
+static void file_root(int fd, size_t header_size, const CIPHER *cipher, int threads, BYTE *root)
+{
+    BYTE header[MAX_HEADER_SIZE];
+    size_t header_len = header_size - ROOT_SIZE;
+    struct stat file_stats;
+
+    if (pread_full(fd, header, header_len, 0) != (ssize_t)header_len || fstat(fd, &file_stats) < 0 ||
+        (unsigned long long)file_stats.st_size < header_size)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    merkle_file_root(fd, header, header_len, header_size, file_stats.st_size - header_size, threads, root);
+    cipher_encrypt_buffer(cipher, root, root, ROOT_SIZE);
+}
+
 /**
  * Encripta un archivo
  *
  * @param algorithm Algoritmo de encriptación
+ * @param mode Modo de encriptación
  * @param bits Número de bits de la clave
  * @param passphrase Frase de encriptación
  * @param file_name Nombre del archivo a encriptar
+ * @param options Opciones de encriptación
  */
-void encrypt_file(char *algorithm, int bits, char *passphrase, char *file_name)
+void encrypt_file(char *algorithm, char *mode, int bits, char *passphrase, char *file_name, const ENCRYPT_OPTIONS *options)
 {
     int original_file_fd = open(file_name, O_RDONLY, S_IRUSR);
 
@@ -103,13 +485,13 @@ void encrypt_file(char *algorithm, int bits, char *passphrase, char *file_name)
 
     off_t file_size = file_stats.st_size;
 
-    BYTE size_bytes[8] = {0};
+    BYTE header[MAX_HEADER_SIZE] = {0};
 
     // Convertir el tamaño del archivo a bytes para escribirlo en la cabecera en formato Little Endian
     for (int i = 0; i < 8; i++)
     {
         BYTE byte = (file_size >> 8 * (i)) & 0xFF;
-        size_bytes[i] = byte;
+        header[i] = byte;
     }
 
     BYTE mask = 0x00;
@@ -128,152 +510,164 @@ void encrypt_file(char *algorithm, int bits, char *passphrase, char *file_name)
         mask |= KEY_256;
     }
 
-    char extension[] = ".enc";
-    char *new_file_name = (char *)malloc(strlen(file_name) + strlen(extension));
-    strcpy(new_file_name, file_name);
-    strcat(new_file_name, extension);
+    BYTE algorithm_mask = strcmp(algorithm, "aes") == 0 ? AES : BLOWFISH;
+    mask |= algorithm_mask;
 
-    int new_file_fd = open(new_file_name, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+    bool use_ctr = strcmp(mode, "ctr") == 0;
+    bool use_cbc = strcmp(mode, "cbc") == 0;
+    bool use_gcm = strcmp(mode, "gcm") == 0;
+    bool use_ccm = strcmp(mode, "ccm") == 0;
+    if (use_ctr)
+    {
+        mask |= CTR;
+    }
+    else if (use_cbc)
+    {
+        mask |= CBC;
+    }
+    else if (use_gcm || use_ccm)
+    {
+        mask |= AEAD;
+    }
 
-    if (new_file_fd < 0)
+    if (use_gcm && (unsigned long long)file_size > AES_GCM_MAX_LEN)
     {
-        print_error("Error al crear el archivo encriptado");
+        print_error("El archivo es demasiado grande para el modo gcm");
         exit(1);
     }
 
-    ssize_t write_size = sizeof(BYTE) * 8;
-    ssize_t bytes_written = write(new_file_fd, size_bytes, write_size);
-    if (bytes_written != write_size)
+    if (options->chunk_size > 0)
     {
-        print_error("Error al escribir la cabecera");
+        mask |= CHUNKED;
+    }
+    header[8] = mask;
+
+    // Los archivos nuevos derivan la clave con PBKDF2: el bit KDF_FLAG del tamaño indica
+    // que a la cabecera le siguen las iteraciones y la sal
+    FILE_HEADER file_header = {.bits = bits};
+    if (!kdf_setup(&file_header, options->kdf_ms))
+    {
+        print_error("Error al generar la sal");
         exit(1);
     }
 
     BYTE *encrypt_key;
     encrypt_key = (BYTE *)malloc(sizeof(BYTE) * bits);
-    generate_key_sha256(passphrase, encrypt_key, bits);
+    derive_key(passphrase, &file_header, encrypt_key);
+    key_check_value(encrypt_key, bits, file_header.check);
 
-    if (strcmp(algorithm, "aes") == 0)
+    header[7] |= KDF_FLAG;
+    store_kdf_params(header + HEADER_SIZE, &file_header);
+    size_t header_size = file_header.header_size;
+
+    // Los archivos ecb, ctr y cbc sin fragmentos reservan la raíz al final de la cabecera y
+    // la escriben cuando el texto cifrado está completo
+    bool use_root = options->chunk_size == 0 && !use_gcm && !use_ccm;
+    if (use_root)
     {
-        mask |= AES;
-        ssize_t bytes_mask_written = write(new_file_fd, &mask, sizeof(BYTE));
-        if (bytes_mask_written != sizeof(BYTE))
-        {
-            print_error("Error al escribir la cabecera");
-            exit(1);
-        }
+        header[7] |= ROOT_FLAG;
+        header_size += ROOT_SIZE;
+    }
 
-        WORD key_schedule[60];
-        BYTE aes_buffer[AES_BLOCK_SIZE];
-        BYTE read_buffer[AES_BLOCK_SIZE] = {0};
+    char extension[] = ".enc";
+    char *new_file_name = (char *)malloc(strlen(file_name) + strlen(extension) + 1);
+    strcpy(new_file_name, file_name);
+    strcat(new_file_name, extension);
 
-        aes_key_setup(encrypt_key, key_schedule, bits);
+    int new_file_fd = open(new_file_name, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
 
-        while (read(original_file_fd, read_buffer, AES_BLOCK_SIZE) > 0)
-        {
-            aes_encrypt(read_buffer, aes_buffer, key_schedule, bits);
-            if (write(new_file_fd, aes_buffer, AES_BLOCK_SIZE) == -1)
-            {
-                print_error("Error al escribir el archivo encriptado");
-                exit(1);
-            }
-            memset(read_buffer, 0, sizeof(read_buffer));
-        }
+    if (new_file_fd < 0)
+    {
+        print_error("Error al crear el archivo encriptado");
+        exit(1);
+    }
+    remove_output_on_exit(new_file_name);
+
+    CIPHER cipher;
+    cipher_setup(&cipher, algorithm_mask, encrypt_key, bits);
+
+    // En modo gcm cada fragmento lleva su propia etiqueta; en ctr y cbc se usa el
+    // contenedor por fragmentos con su índice
+    if (options->chunk_size > 0 && use_gcm)
+    {
+        stream_encrypt_file(original_file_fd, new_file_fd, header, header_size, file_size, &cipher, options->chunk_size,
+                            options);
+    }
+    else if (options->chunk_size > 0)
+    {
+        container_encrypt_file(original_file_fd, new_file_fd, header, header_size, file_size, &cipher, options->chunk_size,
+                               options);
+    }
+    else if (use_ctr)
+    {
+        encrypt_ctr_mode(original_file_fd, new_file_fd, header, header_size, file_size, &cipher, options);
+    }
+    else if (use_gcm)
+    {
+        encrypt_gcm_mode(original_file_fd, new_file_fd, header, header_size, file_size, &cipher, options);
+    }
+    else if (use_ccm)
+    {
+        encrypt_ccm_mode(original_file_fd, new_file_fd, header, header_size, file_size, &cipher, options);
+    }
+    else if (use_cbc)
+    {
+        encrypt_cbc_mode(original_file_fd, new_file_fd, header, header_size, file_size, &cipher, options);
     }
     else
     {
-        mask |= BLOWFISH;
-        ssize_t bytes_mask_written = write(new_file_fd, &mask, sizeof(BYTE));
-        if (bytes_mask_written != sizeof(BYTE))
+        encrypt_ecb_mode(original_file_fd, new_file_fd, header, header_size, file_size, &cipher, options);
+    }
+
+    if (use_root)
+    {
+        BYTE root[ROOT_SIZE];
+        file_root(new_file_fd, header_size, &cipher, options->threads, root);
+        if (!pwrite_full(new_file_fd, root, ROOT_SIZE, header_size - ROOT_SIZE))
         {
             print_error("Error al escribir la cabecera");
             exit(1);
         }
-
-        BLOWFISH_KEY key;
-        BYTE enc_buf[BLOWFISH_BLOCK_SIZE];
-        BYTE read_buffer[BLOWFISH_BLOCK_SIZE] = {0};
-
-        blowfish_key_setup(encrypt_key, &key, bits / 8);
-
-        while (read(original_file_fd, read_buffer, BLOWFISH_BLOCK_SIZE) > 0)
-        {
-            blowfish_encrypt(read_buffer, enc_buf, &key);
-            if (write(new_file_fd, enc_buf, BLOWFISH_BLOCK_SIZE) == -1)
-            {
-                print_error("Error al escribir el archivo encriptado");
-                exit(1);
-            }
-            memset(read_buffer, 0, sizeof(read_buffer));
-        }
     }
+    keep_output_file();
 
     printf("Archivo %s encriptado exitosamente en %s\n", file_name, new_file_name);
 
+    close(original_file_fd);
+    close(new_file_fd);
     free(new_file_name);
     free(encrypt_key);
 }
 
 /**
- * Desencripta un archivo
+ * Decodifica y valida los HEADER_SIZE bytes de la cabecera de un archivo encriptado. Si
+ * tiene el bit KDF_FLAG, los parámetros de PBKDF2 se decodifican con parse_kdf_params
  *
- * @param passphrase Frase de encriptación
- * @param file_name Nombre del archivo a desencriptar
+ * @param raw Cabecera tal como está en el archivo
+ * @param file_header Cabecera decodificada
+ *
+ * @return NULL si la cabecera es válida, o el mensaje de error en caso contrario
  */
-void decrypt_file(char *passphrase, char *file_name)
+const char *parse_header(const BYTE *raw, FILE_HEADER *file_header)
 {
-
-    int original_file_fd = open(file_name, O_RDONLY, S_IRUSR);
-
-    if (original_file_fd < 0)
-    {
-        print_error("Error al leer el archivo a desencriptar\n");
-        exit(1);
-    }
-
-    char *extension = strstr(file_name, ".enc");
-
-    if (extension == NULL)
-    {
-        print_error("Nombre de archivo no valido: archivo sin extensión .enc\n");
-        exit(1);
-    }
-
     unsigned long long original_file_size = 0;
-    BYTE size_bytes[8] = {0};
-
-    // Leer el tamaño del archivo en bytes
-    BYTE byte = 0x00;
-    for (int i = 0; i < 8; i++)
-    {
-        if (read(original_file_fd, &byte, sizeof(BYTE)) == -1)
-        {
-            print_error("Error al leer el tamaño del archivo\n");
-            exit(1);
-        }
-        size_bytes[i] = byte;
-    }
 
     // Convertir el tamaño del archivo a entero de 64 bits.
     // Primero se lee el byte más significativo, se almacena en el byte
     // menos significativo de la variable original_file_size y se desplaza
     // 8 bits a la izquierda.
     // Se repite el proceso hasta leer el byte menos significativo.
+    // Los bits KDF_FLAG y ROOT_FLAG del byte más significativo no forman parte del tamaño.
     int i;
     for (i = 7; i > 0; i--)
     {
-        original_file_size = original_file_size | size_bytes[i];
+        original_file_size = original_file_size | (i == 7 ? raw[i] & ~(KDF_FLAG | ROOT_FLAG) : raw[i]);
         original_file_size = original_file_size << 8;
     }
 
-    original_file_size = original_file_size | size_bytes[i];
+    original_file_size = original_file_size | raw[i];
 
-    BYTE mask = 0x00;
-    if (read(original_file_fd, &mask, sizeof(BYTE)) == -1)
-    {
-        print_error("Error al leer la cabecera\n");
-        exit(1);
-    }
+    BYTE mask = raw[8];
 
     int bits = 0;
     if ((mask & KEY_128) == KEY_128)
@@ -290,80 +684,436 @@ void decrypt_file(char *passphrase, char *file_name)
     }
     else
     {
-        print_error("Cabecera no especifica número de bits de clave correctamente\n");
-        exit(1);
+        return "Cabecera no especifica número de bits de clave correctamente\n";
     }
 
-    char *algorithm;
+    BYTE algorithm_mask;
 
     if ((mask & AES) == AES)
     {
-        char str[] = "aes";
-        algorithm = str;
+        algorithm_mask = AES;
+    }
+    else if ((mask & BLOWFISH) == BLOWFISH && ((mask & MODE_MASK) == CBC || (mask & MODE_MASK) == AEAD))
+    {
+        return "Cabecera no válida: los modos cbc, gcm y ccm sólo están disponibles con aes\n";
+    }
+    else if ((mask & BLOWFISH) == BLOWFISH && (mask & CHUNKED) == CHUNKED)
+    {
+        return "Cabecera no válida: el modo por fragmentos sólo está disponible con aes\n";
     }
     else if ((mask & BLOWFISH) == BLOWFISH)
     {
-        char str[] = "blowfish";
-        algorithm = str;
+        algorithm_mask = BLOWFISH;
     }
     else
     {
-        print_error("Cabecera no especifica algoritmo de encriptación correctamente\n");
+        return "Cabecera no especifica algoritmo de encriptación correctamente\n";
+    }
+
+    if ((mask & CHUNKED) == CHUNKED && (mask & MODE_MASK) == 0)
+    {
+        return "Cabecera no especifica el modo de los fragmentos correctamente\n";
+    }
+
+    BYTE flags = raw[7] & (KDF_FLAG | ROOT_FLAG);
+    if ((flags & ROOT_FLAG) == ROOT_FLAG && ((mask & CHUNKED) == CHUNKED || (mask & MODE_MASK) == AEAD))
+    {
+        return "Cabecera no válida: la raíz del árbol de hashes sólo va en los archivos ecb, ctr y cbc sin fragmentos\n";
+    }
+
+    file_header->size = original_file_size;
+    file_header->mask = mask;
+    file_header->bits = bits;
+    file_header->algorithm = algorithm_mask;
+    file_header->flags = flags;
+    file_header->header_size = HEADER_SIZE + ((flags & KDF_FLAG) == KDF_FLAG ? KDF_PARAMS_SIZE : 0) +
+                               ((flags & ROOT_FLAG) == ROOT_FLAG ? ROOT_SIZE : 0);
+    file_header->iterations = 0;
+    return NULL;
+}
+
+/**
+ * Decodifica y valida los parámetros de PBKDF2 que siguen a la cabecera cuando tiene el
+ * bit KDF_FLAG
+ *
+ * @param raw Parámetros tal como están en el archivo, KDF_PARAMS_SIZE bytes
+ * @param file_header Cabecera decodificada con parse_header, donde se guardan
+ *
+ * @return NULL si los parámetros son válidos, o el mensaje de error en caso contrario
+ */
+const char *parse_kdf_params(const BYTE *raw, FILE_HEADER *file_header)
+{
+    unsigned long long iterations = load_le(raw, KDF_ITERATIONS_SIZE);
+
+    // Un número de iteraciones desmedido bloquearía la desencriptación
+    if (iterations == 0 || iterations > KDF_MAX_ITERATIONS)
+    {
+        return "Cabecera no especifica las iteraciones de la derivación de la clave correctamente\n";
+    }
+
+    file_header->iterations = iterations;
+    memcpy(file_header->salt, raw + KDF_ITERATIONS_SIZE, KDF_SALT_SIZE);
+    memcpy(file_header->check, raw + KDF_ITERATIONS_SIZE + KDF_SALT_SIZE, KDF_CHECK_SIZE);
+    return NULL;
+}
+
+/**
+ * Decodifica lo que sigue a los HEADER_SIZE bytes de la cabecera según sus bits: los
+ * parámetros de PBKDF2 con KDF_FLAG y, detrás, la raíz cifrada con ROOT_FLAG
+ *
+ * @param raw Bytes que siguen a la cabecera, header_size - HEADER_SIZE bytes
+ * @param file_header Cabecera decodificada con parse_header, donde se guardan
+ *
+ * @return NULL si los parámetros son válidos, o el mensaje de error en caso contrario
+ */
+const char *parse_header_params(const BYTE *raw, FILE_HEADER *file_header)
+{
+    if ((file_header->flags & KDF_FLAG) == KDF_FLAG)
+    {
+        const char *error = parse_kdf_params(raw, file_header);
+        if (error != NULL)
+        {
+            return error;
+        }
+    }
+
+    if ((file_header->flags & ROOT_FLAG) == ROOT_FLAG)
+    {
+        memcpy(file_header->root, raw + file_header->header_size - HEADER_SIZE - ROOT_SIZE, ROOT_SIZE);
+    }
+    return NULL;
+}
+
+/**
+ * Lee y valida la cabecera de un archivo encriptado, con los parámetros de PBKDF2 y la
+ * raíz del árbol de hashes si los tiene. Al terminar, el descriptor queda posicionado
+ * justo después de la cabecera
+ *
+ * @param fd Descriptor del archivo encriptado
+ * @param file_header Cabecera leída
+ */
+void read_header(int fd, FILE_HEADER *file_header)
+{
+    BYTE header[MAX_HEADER_SIZE] = {0};
+
+    if (read_full(fd, header, HEADER_SIZE) != HEADER_SIZE)
+    {
+        print_error("Error al leer la cabecera\n");
         exit(1);
     }
 
-    printf("Usando %s con clave de %d bits\n", algorithm, bits);
+    const char *error = parse_header(header, file_header);
+    if (error == NULL && file_header->header_size > HEADER_SIZE)
+    {
+        size_t params_size = file_header->header_size - HEADER_SIZE;
+        if (read_full(fd, header + HEADER_SIZE, params_size) != (ssize_t)params_size)
+        {
+            print_error("Error al leer la cabecera\n");
+            exit(1);
+        }
+        error = parse_header_params(header + HEADER_SIZE, file_header);
+    }
 
-    ssize_t file_name_size = strlen(file_name) - strlen(extension);
-    char *new_file_name = (char *)malloc(file_name_size);
-    memcpy(new_file_name, file_name, file_name_size);
+    if (error != NULL)
+    {
+        print_error((char *)error);
+        exit(1);
+    }
+}
 
-    int new_file_fd = open(new_file_name, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+/**
+ * Desencripta un archivo en modo CTR, que sigue a la cabecera con el nonce
+ *
+ * @param in_fd Descriptor del archivo encriptado, posicionado después de la cabecera
+ * @param out_fd Descriptor del archivo desencriptado
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo original según la cabecera
+ * @param cipher Cifrado inicializado
+ * @param options Opciones de desencriptación
+ */
+static void decrypt_ctr_mode(int in_fd, int out_fd, size_t header_size, unsigned long long size, const CIPHER *cipher,
+                             const ENCRYPT_OPTIONS *options)
+{
+    BYTE nonce[CTR_NONCE_SIZE];
+    size_t nonce_size = cipher->block_size;
+    struct stat file_stats;
 
-    BYTE *encrypt_key;
-    encrypt_key = (BYTE *)malloc(sizeof(BYTE) * bits);
-    generate_key_sha256(passphrase, encrypt_key, bits);
+    if (read_full(in_fd, nonce, nonce_size) != (ssize_t)nonce_size || fstat(in_fd, &file_stats) < 0 ||
+        (unsigned long long)file_stats.st_size < header_size + nonce_size + size)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    ctr_crypt_file(in_fd, header_size + nonce_size, out_fd, 0, size, cipher, nonce, options);
+}
+
+/**
+ * Desencripta un archivo en modo GCM o CCM, según el byte de modo que sigue a la
+ * cabecera, y verifica su etiqueta. El texto plano ya está escrito cuando se conoce el
+ * resultado, así que quien llama debe borrar el archivo de salida si no es auténtico
+ *
+ * @param in_fd Descriptor del archivo encriptado, posicionado después de la cabecera
+ * @param out_fd Descriptor del archivo desencriptado
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo original según la cabecera
+ * @param cipher Cifrado AES inicializado
+ * @param options Opciones de desencriptación
+ *
+ * @return true si la etiqueta coincide, false si el archivo fue modificado o la clave
+ *         no es la correcta
+ */
+static bool decrypt_aead_mode(int in_fd, int out_fd, size_t header_size, unsigned long long size, const CIPHER *cipher,
+                              const ENCRYPT_OPTIONS *options)
+{
+    BYTE prefix[GCM_PREFIX_SIZE(MAX_HEADER_SIZE) > CCM_PREFIX_SIZE(MAX_HEADER_SIZE) ? GCM_PREFIX_SIZE(MAX_HEADER_SIZE)
+                                                                             : CCM_PREFIX_SIZE(MAX_HEADER_SIZE)];
+    BYTE tag[GCM_TAG_SIZE > CCM_MAC_SIZE ? GCM_TAG_SIZE : CCM_MAC_SIZE];
+    struct stat file_stats;
+
+    if (pread_full(in_fd, prefix, header_size + AEAD_ID_SIZE, 0) != (ssize_t)(header_size + AEAD_ID_SIZE) ||
+        (prefix[header_size] != AEAD_GCM && prefix[header_size] != AEAD_CCM))
+    {
+        print_error("Cabecera no especifica el modo autenticado correctamente\n");
+        exit(1);
+    }
 
-    if (strcmp(algorithm, "aes") == 0)
+    bool gcm = prefix[header_size] == AEAD_GCM;
+    size_t prefix_size = gcm ? GCM_PREFIX_SIZE(header_size) : CCM_PREFIX_SIZE(header_size);
+    size_t tag_size = gcm ? GCM_TAG_SIZE : CCM_MAC_SIZE;
+
+    if (read_full(in_fd, prefix + header_size, prefix_size - header_size) != (ssize_t)(prefix_size - header_size) ||
+        fstat(in_fd, &file_stats) < 0 || (unsigned long long)file_stats.st_size != prefix_size + size + tag_size ||
+        pread_full(in_fd, tag, tag_size, prefix_size + size) != (ssize_t)tag_size)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    if (gcm)
+    {
+        return gcm_decrypt_file(in_fd, prefix_size, out_fd, size, cipher, prefix, tag, options);
+    }
+    return ccm_decrypt_file(in_fd, out_fd, size, cipher, prefix, prefix_size, tag, options);
+}
+
+/**
+ * Desencripta un archivo en modo CBC, que sigue a la cabecera con el IV
+ *
+ * @param in_fd Descriptor del archivo encriptado, posicionado después de la cabecera
+ * @param out_fd Descriptor del archivo desencriptado
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo original según la cabecera
+ * @param cipher Cifrado AES inicializado
+ * @param options Opciones de desencriptación
+ */
+static void decrypt_cbc_mode(int in_fd, int out_fd, size_t header_size, unsigned long long size, const CIPHER *cipher,
+                             const ENCRYPT_OPTIONS *options)
+{
+    BYTE iv[CBC_IV_SIZE];
+    struct stat file_stats;
+    unsigned long long padded_len = (size + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+
+    if (read_full(in_fd, iv, CBC_IV_SIZE) != CBC_IV_SIZE || fstat(in_fd, &file_stats) < 0 ||
+        (unsigned long long)file_stats.st_size < header_size + CBC_IV_SIZE + padded_len)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    cbc_decrypt_file(in_fd, header_size + CBC_IV_SIZE, out_fd, size, cipher, iv, options);
+}
+
+/**
+ * Desencripta un archivo en modo ECB, el formato original. Con --mmap se intenta mapear
+ * los archivos y, si no es posible, se usan buffers
+ *
+ * @param in_fd Descriptor del archivo encriptado, posicionado después de la cabecera
+ * @param out_fd Descriptor del archivo desencriptado, abierto para lectura y escritura
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo original según la cabecera
+ * @param cipher Cifrado inicializado
+ * @param options Opciones de desencriptación
+ */
+static void decrypt_ecb_mode(int in_fd, int out_fd, size_t header_size, unsigned long long size, const CIPHER *cipher,
+                             const ENCRYPT_OPTIONS *options)
+{
+    if (options->use_mmap && decrypt_file_mapped(in_fd, out_fd, header_size, size, cipher))
+    {
+        return;
+    }
+
+    size_t buffer_size = options->buffer_size;
+    BYTE *buffer = allocate_io_buffer(&buffer_size, cipher->block_size);
+    if (buffer == NULL)
     {
-        WORD key_schedule[60];
-        BYTE aes_buffer[AES_BLOCK_SIZE];
-        BYTE read_buffer[AES_BLOCK_SIZE] = {0};
+        print_error("Error al reservar el buffer de E/S\n");
+        exit(1);
+    }
+
+    // Sólo se escriben los bytes del archivo original, descartando el relleno del último bloque
+    unsigned long long remaining = size;
+    ssize_t bytes_read;
+    while ((bytes_read = read_full(in_fd, buffer, buffer_size)) > 0)
+    {
+        if (bytes_read % cipher->block_size != 0)
+        {
+            print_error("Archivo encriptado truncado o corrupto\n");
+            exit(1);
+        }
 
-        aes_key_setup(encrypt_key, key_schedule, bits);
+        cipher_decrypt_buffer(cipher, buffer, buffer, bytes_read);
 
-        while (read(original_file_fd, read_buffer, AES_BLOCK_SIZE) > 0)
+        size_t len = (unsigned long long)bytes_read < remaining ? (size_t)bytes_read : (size_t)remaining;
+        if (!write_full(out_fd, buffer, len))
         {
-            aes_decrypt(read_buffer, aes_buffer, key_schedule, bits);
-            if (write(new_file_fd, aes_buffer, AES_BLOCK_SIZE) == -1)
-            {
-                print_error("Error al escribir el archivo desencriptado");
-                exit(1);
-            }
+            print_error("Error al escribir el archivo desencriptado");
+            exit(1);
         }
+        remaining -= len;
     }
-    else
+
+    if (bytes_read < 0)
+    {
+        print_error("Error al leer el archivo a desencriptar\n");
+        exit(1);
+    }
+
+    // Ya se escribieron exactamente los bytes del archivo original; si faltan, el archivo
+    // encriptado es más corto de lo que indica la cabecera
+    if (remaining > 0)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Desencripta un archivo
+ *
+ * @param passphrase Frase de encriptación
+ * @param file_name Nombre del archivo a desencriptar
+ * @param options Opciones de desencriptación
+ */
+void decrypt_file(char *passphrase, char *file_name, const ENCRYPT_OPTIONS *options)
+{
+
+    int original_file_fd = open(file_name, O_RDONLY, S_IRUSR);
+
+    if (original_file_fd < 0)
+    {
+        print_error("Error al leer el archivo a desencriptar\n");
+        exit(1);
+    }
+
+    char *extension = strstr(file_name, ".enc");
+
+    if (extension == NULL)
+    {
+        print_error("Nombre de archivo no valido: archivo sin extensión .enc\n");
+        exit(1);
+    }
+
+    FILE_HEADER header;
+    read_header(original_file_fd, &header);
+
+    unsigned long long original_file_size = header.size;
+    BYTE mask = header.mask;
+    int bits = header.bits;
+    size_t header_size = header.header_size;
+    BYTE algorithm_mask = header.algorithm;
+    char *algorithm = algorithm_mask == AES ? "aes" : "blowfish";
+
+    printf("Usando %s con clave de %d bits\n", algorithm, bits);
+
+    // La clave se comprueba antes de crear el archivo desencriptado, de modo que una frase
+    // incorrecta no sobrescribe nada
+    BYTE *encrypt_key;
+    encrypt_key = (BYTE *)malloc(sizeof(BYTE) * bits);
+    derive_key(passphrase, &header, encrypt_key);
+    if (!check_key(&header, encrypt_key))
     {
-        BLOWFISH_KEY key;
-        BYTE enc_buf[BLOWFISH_BLOCK_SIZE];
-        BYTE read_buffer[BLOWFISH_BLOCK_SIZE] = {0};
+        print_error("Frase de encriptación incorrecta\n");
+        exit(1);
+    }
 
-        blowfish_key_setup(encrypt_key, &key, bits / 8);
+    CIPHER cipher;
+    cipher_setup(&cipher, algorithm_mask, encrypt_key, bits);
 
-        while (read(original_file_fd, read_buffer, BLOWFISH_BLOCK_SIZE) > 0)
+    // La raíz cubre el texto cifrado, así que se verifica antes de crear el archivo
+    // desencriptado. Los archivos sin ROOT_FLAG, de versiones anteriores, no se verifican
+    if ((header.flags & ROOT_FLAG) == ROOT_FLAG)
+    {
+        BYTE root[ROOT_SIZE];
+        file_root(original_file_fd, header_size, &cipher, options->threads, root);
+        if (memcmp(root, header.root, ROOT_SIZE) != 0)
         {
-            blowfish_decrypt(read_buffer, enc_buf, &key);
-            if (write(new_file_fd, enc_buf, BLOWFISH_BLOCK_SIZE) == -1)
-            {
-                print_error("Error al escribir el archivo desencriptado");
-                exit(1);
-            }
+            print_error("Verificación fallida: el árbol de hashes no coincide, el archivo fue modificado\n");
+            exit(1);
         }
     }
 
+    ssize_t file_name_size = strlen(file_name) - strlen(extension);
+    char *new_file_name = (char *)malloc(file_name_size + 1);
+    memcpy(new_file_name, file_name, file_name_size);
+    new_file_name[file_name_size] = '\0';
+
+    int new_file_fd = open(new_file_name, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+
+    if (new_file_fd < 0)
+    {
+        print_error("Error al crear el archivo desencriptado\n");
+        exit(1);
+    }
+    remove_output_on_exit(new_file_name);
+
+    // Los archivos autenticados y los contenedores con árbol de hashes sólo se verifican
+    // cuando el texto plano ya está escrito, así que si no son auténticos se termina sin
+    // conservar el archivo desencriptado. Los autenticados por fragmentos verifican cada fragmento por
+    // separado, y el resto de contenedores, cada fragmento y la raíz del árbol de hashes
+    bool verified = true;
+    char *failure = "Autenticación fallida: el archivo fue modificado o la frase de encriptación es incorrecta\n";
+    if ((mask & CHUNKED) == CHUNKED && (mask & MODE_MASK) == AEAD)
+    {
+        verified = stream_decrypt_file(original_file_fd, new_file_fd, header_size, original_file_size, &cipher, options);
+    }
+    else if ((mask & CHUNKED) == CHUNKED)
+    {
+        verified = container_decrypt_file(original_file_fd, new_file_fd, header_size, mask, original_file_size, &cipher,
+                                          options);
+        failure = "Verificación fallida: el árbol de hashes no coincide, el archivo fue modificado o la frase de "
+                  "encriptación es incorrecta\n";
+    }
+    else if ((mask & MODE_MASK) == CTR)
+    {
+        decrypt_ctr_mode(original_file_fd, new_file_fd, header_size, original_file_size, &cipher, options);
+    }
+    else if ((mask & MODE_MASK) == AEAD)
+    {
+        verified = decrypt_aead_mode(original_file_fd, new_file_fd, header_size, original_file_size, &cipher, options);
+    }
+    else if ((mask & MODE_MASK) == CBC)
+    {
+        decrypt_cbc_mode(original_file_fd, new_file_fd, header_size, original_file_size, &cipher, options);
+    }
+    else
+    {
+        decrypt_ecb_mode(original_file_fd, new_file_fd, header_size, original_file_size, &cipher, options);
+    }
+
+    if (!verified)
+    {
+        print_error(failure);
+        exit(1);
+    }
+    keep_output_file();
+
     printf("Archivo %s desencriptado exitosamente en %s\n", file_name, new_file_name);
 
+    close(original_file_fd);
+    close(new_file_fd);
     free(new_file_name);
     free(encrypt_key);
-    ftruncate(new_file_fd, original_file_size);
-}
\ No newline at end of file
+}
@@ -0,0 +1,224 @@
+#include "gcm.h"
+#include "workers.h"
+
+/**
+ * Datos compartidos por los hilos que procesan un archivo en modo GCM
+ */
+typedef struct
+{
+    const CIPHER *cipher;
+    const AES_GHASH_KEY *ghash_key;
+    BYTE nonce[AES_BLOCK_SIZE]; // Contador del primer bloque de datos: IV || 2
+    bool encrypt;
+    unsigned long long size; // Bytes a procesar
+    size_t chunk_size;       // Bytes por fragmento, múltiplo del tamaño de bloque
+    int in_fd;
+    off_t in_offset; // Posición de los datos dentro del archivo de entrada
+    int out_fd;
+    off_t out_offset; // Posición de los datos dentro del archivo de salida
+    BYTE (*partials)[AES_BLOCK_SIZE]; // GHASH del texto cifrado de cada fragmento, empezando en cero
+    FILE_DIGEST *digest;              // Hash del texto plano al encriptar, o NULL
+} GCM_JOB;
+
+/**
+ * Procesa un fragmento del archivo: lo encripta o desencripta en modo CTR como ctr_task y
+ * calcula el GHASH de su texto cifrado por separado. Los GHASH parciales se combinan al
+ * final, así que los hilos no necesitan coordinarse
+ *
+ * @param context Trabajo GCM
+ * @param chunk Índice del fragmento
+ * @param buffer Buffer del hilo
+ */
+static void gcm_task(void *context, unsigned long long chunk, BYTE *buffer)
+{
+    const GCM_JOB *job = (const GCM_JOB *)context;
+    unsigned long long offset = chunk * job->chunk_size;
+    size_t len = job->size - offset < job->chunk_size ? (size_t)(job->size - offset) : job->chunk_size;
+    BYTE *partial = job->partials[chunk];
+
+    if (pread_full(job->in_fd, buffer, len, job->in_offset + offset) != (ssize_t)len)
+    {
+        print_error("Error al leer el archivo o archivo truncado\n");
+        exit(1);
+    }
+
+    memset(partial, 0, AES_BLOCK_SIZE);
+    if (job->encrypt)
+    {
+        digest_chunk(job->digest, chunk, buffer, len);
+        cipher_ctr_buffer(job->cipher, job->nonce, offset, buffer, buffer, len);
+        aes_ghash_update(job->ghash_key, partial, buffer, len);
+    }
+    else
+    {
+        aes_ghash_update(job->ghash_key, partial, buffer, len);
+        cipher_ctr_buffer(job->cipher, job->nonce, offset, buffer, buffer, len);
+    }
+
+    if (!pwrite_full(job->out_fd, buffer, len, job->out_offset + offset))
+    {
+        print_error("Error al escribir el archivo\n");
+        exit(1);
+    }
+}
+
+/**
+ * Procesa el archivo en paralelo y calcula la etiqueta. GHASH es lineal: el hash de los
+ * datos completos es el hash acumulado multiplicado por H elevado al número de bloques de
+ * cada fragmento, más el hash parcial del fragmento. Todos los fragmentos menos el último
+ * tienen el mismo tamaño, así que esa potencia de H se calcula una sola vez
+ *
+ * @param job Trabajo GCM, sin cipher, ghash_key ni partials
+ * @param cipher Cifrado AES inicializado
+ * @param aad Datos asociados: la cabecera, el modo y el IV, que ocupan el archivo
+ *            encriptado hasta los datos
+ * @param options Opciones de encriptación
+ * @param tag Etiqueta resultante, de GCM_TAG_SIZE bytes
+ */
+static void gcm_run(GCM_JOB *job, const CIPHER *cipher, const BYTE *aad, const ENCRYPT_OPTIONS *options, BYTE *tag)
+{
+    size_t aad_len = job->encrypt ? job->out_offset : job->in_offset;
+    const BYTE *iv = aad + aad_len - GCM_IV_SIZE;
+    AES_GCM_CTX gcm;
+    AES_GHASH_KEY chunk_power;
+    BYTE zero[AES_BLOCK_SIZE] = {0};
+    BYTE x[AES_BLOCK_SIZE] = {0};
+
+    gcm.aes = cipher->aes_ctx;
+    aes_ghash_init(&gcm.ghash, &gcm.aes);
+
+    job->chunk_size = options->buffer_size - options->buffer_size % AES_BLOCK_SIZE;
+    if (job->chunk_size < AES_BLOCK_SIZE)
+    {
+        job->chunk_size = AES_BLOCK_SIZE;
+    }
+    unsigned long long chunks = (job->size + job->chunk_size - 1) / job->chunk_size;
+
+    job->cipher = cipher;
+    job->ghash_key = &gcm.ghash;
+    job->digest = job->encrypt ? options->digest : NULL;
+    memcpy(job->nonce, iv, GCM_IV_SIZE);
+    memset(job->nonce + GCM_IV_SIZE, 0, AES_BLOCK_SIZE - GCM_IV_SIZE);
+    job->nonce[AES_BLOCK_SIZE - 1] = 2;
+    job->partials = malloc((chunks > 0 ? chunks : 1) * AES_BLOCK_SIZE);
+    if (job->partials == NULL)
+    {
+        print_error("Error al reservar memoria\n");
+        exit(1);
+    }
+
+    run_workers(options->threads, chunks, job->chunk_size, gcm_task, job);
+
+    aes_ghash_update(&gcm.ghash, x, aad, aad_len);
+    aes_ghash_power(&chunk_power, &gcm.ghash, job->chunk_size / AES_BLOCK_SIZE);
+    for (unsigned long long chunk = 0; chunk < chunks; chunk++)
+    {
+        if (chunk + 1 < chunks)
+        {
+            aes_ghash_update(&chunk_power, x, zero, AES_BLOCK_SIZE);
+        }
+        else
+        {
+            unsigned long long last = job->size - chunk * job->chunk_size;
+            aes_ghash_shift(&gcm.ghash, x, (last + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE);
+        }
+
+        for (int i = 0; i < AES_BLOCK_SIZE; i++)
+        {
+            x[i] ^= job->partials[chunk][i];
+        }
+    }
+
+    aes_gcm_tag(&gcm, x, aad_len, job->size, iv, tag);
+    free(job->partials);
+}
+
+/**
+ * Encripta en modo GCM size bytes de un archivo, repartiendo fragmentos del tamaño del
+ * buffer entre options->threads hilos, y escribe la etiqueta después del texto cifrado.
+ * La cabecera, el modo y el IV se autentican como datos asociados
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado. La cabecera, el modo y el IV ya deben
+ *               estar escritos
+ * @param out_offset Posición de los datos en el archivo encriptado
+ * @param size Número de bytes a encriptar, como mucho AES_GCM_MAX_LEN
+ * @param cipher Cifrado AES inicializado
+ * @param aad Cabecera seguida del modo y el IV, out_offset bytes
+ * @param options Opciones de encriptación
+ */
+void gcm_encrypt_file(int in_fd, int out_fd, off_t out_offset, unsigned long long size, const CIPHER *cipher,
+                      const BYTE *aad, const ENCRYPT_OPTIONS *options)
+{
+    BYTE tag[GCM_TAG_SIZE];
+    GCM_JOB job = {
+        .encrypt = true,
+        .size = size,
+        .in_fd = in_fd,
+        .in_offset = 0,
+        .out_fd = out_fd,
+        .out_offset = out_offset,
+    };
+
+    if (!reserve_output_file(out_fd, out_offset + size + GCM_TAG_SIZE))
+    {
+        print_error("Error al reservar espacio para el archivo\n");
+        exit(1);
+    }
+
+    gcm_run(&job, cipher, aad, options, tag);
+
+    if (!pwrite_full(out_fd, tag, GCM_TAG_SIZE, out_offset + size))
+    {
+        print_error("Error al escribir el archivo\n");
+        exit(1);
+    }
+}
+
+/**
+ * Desencripta en modo GCM size bytes de un archivo, repartiendo fragmentos del tamaño del
+ * buffer entre options->threads hilos, y verifica la etiqueta. El archivo completo no
+ * cabe en memoria, así que el texto plano se escribe antes de conocer el resultado: si la
+ * etiqueta no coincide, quien llama debe descartar el archivo de salida
+ *
+ * @param in_fd Descriptor del archivo encriptado
+ * @param in_offset Posición de los datos en el archivo encriptado
+ * @param out_fd Descriptor del archivo desencriptado
+ * @param size Número de bytes a desencriptar
+ * @param cipher Cifrado AES inicializado
+ * @param aad Cabecera seguida del modo y el IV, in_offset bytes
+ * @param tag Etiqueta guardada en el archivo, de GCM_TAG_SIZE bytes
+ * @param options Opciones de desencriptación
+ *
+ * @return true si la etiqueta coincide, false si el archivo fue modificado o la clave
+ *         no es la correcta
+ */
+bool gcm_decrypt_file(int in_fd, off_t in_offset, int out_fd, unsigned long long size, const CIPHER *cipher,
+                      const BYTE *aad, const BYTE *tag, const ENCRYPT_OPTIONS *options)
+{
+    BYTE expected[GCM_TAG_SIZE];
+    BYTE diff = 0;
+    GCM_JOB job = {
+        .encrypt = false,
+        .size = size,
+        .in_fd = in_fd,
+        .in_offset = in_offset,
+        .out_fd = out_fd,
+        .out_offset = 0,
+    };
+
+    if (!reserve_output_file(out_fd, size))
+    {
+        print_error("Error al reservar espacio para el archivo\n");
+        exit(1);
+    }
+
+    gcm_run(&job, cipher, aad, options, expected);
+
+    // Comparación en tiempo constante
+    for (int i = 0; i < GCM_TAG_SIZE; i++)
+    {
+        diff |= expected[i] ^ tag[i];
+    }
+    return diff == 0;
+}
@@ -0,0 +1,329 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include "io.h"
+
+static const char *pending_output = NULL; // Archivo de salida que se borra al terminar con exit
+
+/**
+ * Lee hasta len bytes de un descriptor, reintentando ante lecturas parciales
+ * o interrupciones. Sólo devuelve menos de len bytes al llegar al final del archivo
+ *
+ * @param fd Descriptor de archivo
+ * @param buffer Buffer donde se almacenarán los bytes leídos
+ * @param len Número de bytes a leer
+ *
+ * @return Número de bytes leídos, o -1 en caso de error
+ */
+ssize_t read_full(int fd, BYTE *buffer, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t bytes_read = read(fd, buffer + total, len - total);
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0)
+        {
+            break;
+        }
+        total += bytes_read;
+    }
+
+    return total;
+}
+
+/**
+ * Escribe len bytes en un descriptor, reintentando ante escrituras parciales
+ * o interrupciones
+ *
+ * @param fd Descriptor de archivo
+ * @param buffer Bytes a escribir
+ * @param len Número de bytes a escribir
+ *
+ * @return true si se escribieron todos los bytes, false en caso contrario
+ */
+bool write_full(int fd, const BYTE *buffer, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t bytes_written = write(fd, buffer + total, len - total);
+        if (bytes_written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        total += bytes_written;
+    }
+
+    return true;
+}
+
+/**
+ * Lee hasta len bytes de un descriptor a partir de una posición, sin mover el offset del
+ * descriptor, de modo que varios hilos pueden leer el mismo archivo a la vez
+ *
+ * @param fd Descriptor de archivo
+ * @param buffer Buffer donde se almacenarán los bytes leídos
+ * @param len Número de bytes a leer
+ * @param offset Posición del archivo desde la que se lee
+ *
+ * @return Número de bytes leídos, o -1 en caso de error
+ */
+ssize_t pread_full(int fd, BYTE *buffer, size_t len, off_t offset)
+{
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t bytes_read = pread(fd, buffer + total, len - total, offset + total);
+        if (bytes_read < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (bytes_read == 0)
+        {
+            break;
+        }
+        total += bytes_read;
+    }
+
+    return total;
+}
+
+/**
+ * Escribe len bytes en un descriptor a partir de una posición, sin mover el offset del
+ * descriptor
+ *
+ * @param fd Descriptor de archivo
+ * @param buffer Bytes a escribir
+ * @param len Número de bytes a escribir
+ * @param offset Posición del archivo en la que se escribe
+ *
+ * @return true si se escribieron todos los bytes, false en caso contrario
+ */
+bool pwrite_full(int fd, const BYTE *buffer, size_t len, off_t offset)
+{
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t bytes_written = pwrite(fd, buffer + total, len - total, offset + total);
+        if (bytes_written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        total += bytes_written;
+    }
+
+    return true;
+}
+
+/**
+ * Llena un buffer con bytes aleatorios del generador del sistema operativo
+ *
+ * @param buffer Buffer a llenar
+ * @param len Número de bytes
+ *
+ * @return true si se obtuvieron todos los bytes, false en caso contrario
+ */
+bool fill_random(BYTE *buffer, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t bytes = getrandom(buffer + total, len - total, 0);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        total += bytes;
+    }
+
+    return true;
+}
+
+/**
+ * Reserva un buffer de E/S cuyo tamaño es múltiplo del tamaño de bloque del cifrado,
+ * de modo que el cifrado pueda recorrer el buffer completo sin bloques partidos
+ *
+ * @param size Tamaño solicitado en bytes. Se actualiza con el tamaño realmente reservado
+ * @param block_size Tamaño de bloque del cifrado
+ *
+ * @return Puntero al buffer, o NULL si no se pudo reservar
+ */
+BYTE *allocate_io_buffer(size_t *size, size_t block_size)
+{
+    size_t rounded = *size - (*size % block_size);
+    if (rounded < block_size)
+    {
+        rounded = block_size;
+    }
+
+    *size = rounded;
+    return (BYTE *)malloc(rounded);
+}
+
+/**
+ * Mapea en memoria un archivo de sólo lectura para recorrerlo secuencialmente
+ *
+ * @param fd Descriptor del archivo abierto para lectura
+ * @param size Tamaño del archivo en bytes, debe ser mayor a 0
+ *
+ * @return Puntero al inicio del mapeo, o NULL si el archivo no se puede mapear
+ */
+BYTE *map_input_file(int fd, size_t size)
+{
+    if (size == 0)
+    {
+        return NULL;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    madvise(map, size, MADV_SEQUENTIAL);
+    return (BYTE *)map;
+}
+
+/**
+ * Reserva en disco los primeros size bytes de un archivo de salida y lo extiende hasta
+ * ese tamaño. A diferencia de ftruncate el archivo no queda disperso, así que escribirlo
+ * después no puede fallar a mitad de camino por falta de espacio
+ *
+ * @param fd Descriptor del archivo abierto para escritura
+ * @param size Tamaño final del archivo en bytes
+ *
+ * @return true si se reservó el espacio, false en caso contrario con errno indicando la
+ * causa (ENOSPC si no hay espacio suficiente)
+ */
+bool reserve_output_file(int fd, off_t size)
+{
+    if (size == 0)
+    {
+        return true;
+    }
+
+    int error = posix_fallocate(fd, 0, size);
+    if (error != 0)
+    {
+        errno = error;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reserva el tamaño exacto de un archivo de salida y lo mapea en memoria para escribir
+ * en él directamente. El espacio se reserva con reserve_output_file, porque escribir en
+ * un mapeo de un archivo disperso con el disco lleno termina el proceso con SIGBUS
+ *
+ * @param fd Descriptor del archivo abierto para lectura y escritura
+ * @param size Tamaño final del archivo en bytes, debe ser mayor a 0
+ *
+ * @return Puntero al inicio del mapeo, o NULL si el archivo no se puede mapear o no se
+ * puede reservar su espacio. El archivo conserva entonces su tamaño anterior
+ */
+BYTE *map_output_file(int fd, size_t size)
+{
+    struct stat file_stats;
+    if (size == 0 || fstat(fd, &file_stats) < 0)
+    {
+        return NULL;
+    }
+
+    if (!reserve_output_file(fd, size))
+    {
+        ftruncate(fd, file_stats.st_size);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    madvise(map, size, MADV_SEQUENTIAL);
+    return (BYTE *)map;
+}
+
+/**
+ * Libera un mapeo creado con map_input_file o map_output_file
+ *
+ * @param map Puntero al inicio del mapeo
+ * @param size Tamaño del mapeo en bytes
+ */
+void unmap_file(BYTE *map, size_t size)
+{
+    munmap(map, size);
+}
+
+/**
+ * Borra el archivo de salida pendiente, si lo hay. Se registra con atexit
+ */
+static void remove_pending_output()
+{
+    if (pending_output != NULL)
+    {
+        unlink(pending_output);
+    }
+}
+
+/**
+ * Marca un archivo de salida recién creado como incompleto hasta que se llame a
+ * keep_output_file. Los errores de lectura, de escritura o de integridad terminan el
+ * programa con exit desde cualquier punto, incluso desde los hilos; así el archivo a
+ * medio escribir se borra en lugar de quedar junto al mensaje de error
+ *
+ * @param path Ruta del archivo de salida, debe seguir siendo válida hasta el final
+ */
+void remove_output_on_exit(const char *path)
+{
+    static bool registered = false;
+    if (!registered)
+    {
+        atexit(remove_pending_output);
+        registered = true;
+    }
+    pending_output = path;
+}
+
+/**
+ * Conserva el archivo de salida marcado con remove_output_on_exit, una vez completo
+ */
+void keep_output_file()
+{
+    pending_output = NULL;
+}
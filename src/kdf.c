@@ -0,0 +1,151 @@
+#include <time.h>
+#include "kdf.h"
+#include "container.h"
+
+/**
+ * Devuelve el tiempo actual de un reloj monótono en segundos
+ */
+static double kdf_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Calcula cuántas iteraciones de PBKDF2 tardan el tiempo indicado en esta máquina. Mide
+ * un número de iteraciones que se duplica hasta que la medición dura lo suficiente para
+ * ser fiable, y escala el resultado. El coste de PBKDF2 es lineal en las iteraciones
+ *
+ * @param milliseconds Tiempo objetivo
+ *
+ * @return Iteraciones, entre KDF_MIN_ITERATIONS y KDF_MAX_ITERATIONS
+ */
+unsigned int kdf_calibrate(unsigned int milliseconds)
+{
+    BYTE salt[KDF_SALT_SIZE] = {0};
+    BYTE key[SHA256_BLOCK_SIZE];
+    unsigned long iterations = 1000;
+    double elapsed;
+
+    for (;;)
+    {
+        double start = kdf_now();
+        pbkdf2_sha256(salt, KDF_SALT_SIZE, salt, KDF_SALT_SIZE, iterations, key, sizeof(key));
+        elapsed = kdf_now() - start;
+        if (elapsed >= KDF_CALIBRATION_MIN_SECONDS || iterations >= KDF_MAX_ITERATIONS)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    double target = iterations * (milliseconds / 1000.0) / elapsed;
+    if (target < KDF_MIN_ITERATIONS)
+    {
+        return KDF_MIN_ITERATIONS;
+    }
+    if (target > KDF_MAX_ITERATIONS)
+    {
+        return KDF_MAX_ITERATIONS;
+    }
+    return (unsigned int)target;
+}
+
+/**
+ * Elige los parámetros de PBKDF2 de un archivo nuevo: una sal aleatoria y las
+ * iteraciones que tardan el tiempo indicado en esta máquina
+ *
+ * @param header Cabecera del archivo, donde se guardan los parámetros
+ * @param milliseconds Tiempo objetivo de la derivación de la clave
+ *
+ * @return true si se generó la sal, false en caso contrario
+ */
+bool kdf_setup(FILE_HEADER *header, unsigned int milliseconds)
+{
+    header->header_size = HEADER_SIZE + KDF_PARAMS_SIZE;
+    header->iterations = kdf_calibrate(milliseconds);
+    return fill_random(header->salt, KDF_SALT_SIZE);
+}
+
+/**
+ * Escribe los parámetros de PBKDF2 tal como van en el archivo, después de los
+ * HEADER_SIZE bytes de la cabecera
+ *
+ * @param raw Destino, de KDF_PARAMS_SIZE bytes
+ * @param header Cabecera con las iteraciones, la sal y el valor de comprobación
+ */
+void store_kdf_params(BYTE *raw, const FILE_HEADER *header)
+{
+    store_le(raw, header->iterations, KDF_ITERATIONS_SIZE);
+    memcpy(raw + KDF_ITERATIONS_SIZE, header->salt, KDF_SALT_SIZE);
+    memcpy(raw + KDF_ITERATIONS_SIZE + KDF_SALT_SIZE, header->check, KDF_CHECK_SIZE);
+}
+
+/**
+ * Deriva la clave de un archivo a partir de la frase. Los archivos con los parámetros de
+ * PBKDF2 en la cabecera usan PBKDF2-HMAC-SHA256 con su sal e iteraciones; los anteriores,
+ * el SHA-256 de la frase
+ *
+ * @param passphrase Frase de encriptación
+ * @param header Cabecera del archivo
+ * @param key Clave resultante, de header->bits / 8 bytes
+ */
+void derive_key(const char *passphrase, const FILE_HEADER *header, BYTE *key)
+{
+    if (header->iterations == 0)
+    {
+        generate_key_sha256((char *)passphrase, key, header->bits);
+        return;
+    }
+
+    pbkdf2_sha256((const BYTE *)passphrase, strlen(passphrase), header->salt, KDF_SALT_SIZE, header->iterations, key,
+                  header->bits / 8);
+}
+
+/**
+ * Calcula el valor de comprobación de una clave: los primeros KDF_CHECK_SIZE bytes del
+ * HMAC-SHA256 de una etiqueta fija con la clave. Sólo cuesta un HMAC, y revela tan poco
+ * de la clave como cualquier bloque cifrado con ella
+ *
+ * @param key Clave derivada, de bits / 8 bytes
+ * @param bits Número de bits de la clave
+ * @param check Valor resultante, de KDF_CHECK_SIZE bytes
+ */
+void key_check_value(const BYTE *key, int bits, BYTE *check)
+{
+    HMAC_SHA256_KEY hmac;
+    BYTE mac[SHA256_BLOCK_SIZE];
+
+    hmac_sha256_init(&hmac, key, bits / 8);
+    hmac_sha256(&hmac, (const BYTE *)KDF_CHECK_LABEL, strlen(KDF_CHECK_LABEL), mac);
+    memcpy(check, mac, KDF_CHECK_SIZE);
+}
+
+/**
+ * Comprueba que la clave derivada de la frase es la del archivo, comparando su valor de
+ * comprobación con el de la cabecera. Los archivos sin parámetros de PBKDF2 no tienen
+ * valor de comprobación y se aceptan siempre
+ *
+ * @param header Cabecera del archivo
+ * @param key Clave derivada con derive_key
+ *
+ * @return true si la clave es la correcta o no se puede comprobar, false en caso contrario
+ */
+bool check_key(const FILE_HEADER *header, const BYTE *key)
+{
+    BYTE check[KDF_CHECK_SIZE];
+    BYTE diff = 0;
+
+    if (header->iterations == 0)
+    {
+        return true;
+    }
+
+    key_check_value(key, header->bits, check);
+    for (int i = 0; i < KDF_CHECK_SIZE; i++)
+    {
+        diff |= check[i] ^ header->check[i];
+    }
+    return diff == 0;
+}
@@ -4,6 +4,31 @@
 #include <string.h>
 #include "errors.h"
 #include "encrypter.h"
+#include "benchmark.h"
+#include "workers.h"
+#include "container.h"
+#include "range.h"
+#include "kdf.h"
+
+#define OPT_MMAP 256
+#define OPT_BENCHMARK 257
+#define OPT_CHUNKED 258
+#define OPT_RANGE 259
+#define OPT_SHA256 260
+#define OPT_KDF_MS 261
+
+/**
+ * Opciones largas del programa
+ */
+static struct option long_options[] = {
+    {"mmap", no_argument, NULL, OPT_MMAP},
+    {"benchmark", no_argument, NULL, OPT_BENCHMARK},
+    {"chunked", optional_argument, NULL, OPT_CHUNKED},
+    {"range", required_argument, NULL, OPT_RANGE},
+    {"sha256", no_argument, NULL, OPT_SHA256},
+    {"kdf-ms", required_argument, NULL, OPT_KDF_MS},
+    {NULL, 0, NULL, 0},
+};
 
 /**
  * Imprime la ayuda del programa
@@ -15,14 +40,26 @@ void print_help(char *executable)
 {
     printf("%s encripta o desencripta un archivo usando los algoritmos AES o BLOWFISH.\n", executable);
     printf("uso:\n");
-    printf(" ./encrypter [-d] [-a <algo>] [-b <bits>] -k <passphrase> <nombre_archivo>\n");
+    printf(" ./encrypter [-d] [-a <algo>] [-m <modo>] [-b <bits>] [-s <MiB>] [-j <hilos>] [--chunked[=<KiB>]] [--mmap] [--sha256] [--kdf-ms <ms>] -k <passphrase> <nombre_archivo>\n");
+    printf(" ./encrypter -d --range <offset>:<bytes> [-o <archivo>] -k <passphrase> <nombre_archivo>\n");
     printf(" ./encrypter -h\n");
+    printf(" ./encrypter --benchmark\n");
     printf("Opciones:\n");
     printf(" -h\t\t\tAyuda, muestra este mensaje\n");
+    printf(" --benchmark\t\tMide el rendimiento de cada implementación de AES disponible.\n");
     printf(" -d\t\t\tDesencripta el archivo en lugar de encriptarlo.\n");
     printf(" -k <passphrase>\tEspecifica la frase de encriptación.\n");
     printf(" -a <algo>\t\tEspecifica el algoritmo de encriptación, opciones: aes, blowfish. [default: aes]\n");
+    printf(" --range <offset>:<bytes>\tDesencripta sólo ese rango del archivo original y lo escribe en la salida estándar.\n");
+    printf(" -o <archivo>\t\tEscribe el rango desencriptado en un archivo en lugar de la salida estándar.\n");
+    printf(" -m <modo>\t\tEspecifica el modo de encriptación, opciones: ecb, ctr, cbc, gcm, ccm. cbc, gcm y ccm sólo están disponibles con aes. gcm y ccm autentican el archivo. [default: ecb]\n");
     printf(" -b <bits>\t\tEspecifica los bits de encriptación, opciones: 128, 192, 256. [default: 128]\n");
+    printf(" -s <MiB>\t\tEspecifica el tamaño de los buffers de lectura y escritura en MiB. [default: 4]\n");
+    printf(" -j <hilos>\t\tEspecifica el número de hilos que procesan el archivo en modo ctr y gcm y al desencriptar en modo cbc. [default: núcleos disponibles]\n");
+    printf(" --chunked[=<KiB>]\tUsa el contenedor por fragmentos: cada fragmento se encripta por separado con su propio IV y se guarda un índice. Requiere el modo ctr, cbc o gcm. Con gcm cada fragmento lleva su propia etiqueta y se verifican en paralelo. [default: 1024]\n");
+    printf(" --mmap\t\t\tMapea los archivos en memoria en lugar de usar buffers. Si no es posible, se usan buffers.\n");
+    printf(" --sha256\t\tCalcula el hash SHA-256 del archivo mientras se encripta y lo guarda en <nombre_archivo>.sha256, en el formato de sha256sum.\n");
+    printf(" --kdf-ms <ms>\t\tMilisegundos que debe tardar la derivación de la clave con PBKDF2 en esta máquina; el número de iteraciones se calibra y se guarda en la cabecera. [default: %d]\n", KDF_DEFAULT_MS);
 }
 
 int main(int argc, char *argv[])
@@ -32,11 +69,25 @@ int main(int argc, char *argv[])
     int arguments = 1;
     bool decrypt = false;
     char *algorithm = "aes";
+    char *mode = "ecb";
+    bool has_range = false;
+    unsigned long long range_offset = 0;
+    unsigned long long range_length = 0;
+    char *output_name = NULL;
     int bits = 128;
-    char *passphrase;
+    char *passphrase = NULL;
     bool has_passphrase = false;
+    FILE_DIGEST digest;
+    ENCRYPT_OPTIONS options = {
+        .buffer_size = DEFAULT_BUFFER_SIZE,
+        .use_mmap = false,
+        .threads = default_thread_count(),
+        .chunk_size = 0,
+        .digest = NULL,
+        .kdf_ms = KDF_DEFAULT_MS,
+    };
 
-    while ((opt = getopt(argc, argv, "hda:b:k:")) != -1)
+    while ((opt = getopt_long(argc, argv, "hda:m:b:k:s:j:o:", long_options, NULL)) != -1)
     {
         switch (opt)
         {
@@ -51,6 +102,10 @@ int main(int argc, char *argv[])
             algorithm = optarg;
             arguments += 2;
             break;
+        case 'm':
+            mode = optarg;
+            arguments += 2;
+            break;
         case 'b':
             bits = atoi(optarg);
             arguments += 2;
@@ -60,6 +115,71 @@ int main(int argc, char *argv[])
             arguments += 2;
             has_passphrase = true;
             break;
+        case 's':
+            if (atoi(optarg) <= 0)
+            {
+                fprintf(stderr, "Tamaño de buffer no válido: %s\n", optarg);
+                return 1;
+            }
+            options.buffer_size = (size_t)atoi(optarg) * MIB;
+            arguments += 2;
+            break;
+        case 'j':
+            if (atoi(optarg) <= 0)
+            {
+                fprintf(stderr, "Número de hilos no válido: %s\n", optarg);
+                return 1;
+            }
+            options.threads = atoi(optarg);
+            arguments += 2;
+            break;
+        case OPT_BENCHMARK:
+            run_benchmark();
+            return 0;
+        case OPT_CHUNKED:
+            options.chunk_size = DEFAULT_CHUNK_SIZE;
+            if (optarg != NULL)
+            {
+                long kib = atol(optarg);
+                if (kib <= 0 || kib > 1024 * 1024)
+                {
+                    fprintf(stderr, "Tamaño de fragmento no válido: %s\n", optarg);
+                    return 1;
+                }
+                options.chunk_size = (size_t)kib * 1024;
+            }
+            arguments += 1;
+            break;
+        case OPT_RANGE:
+            if (!parse_range(optarg, &range_offset, &range_length))
+            {
+                fprintf(stderr, "Rango no válido: %s, usar <offset>:<bytes>\n", optarg);
+                return 1;
+            }
+            has_range = true;
+            arguments += argv[optind - 1] == optarg ? 2 : 1;
+            break;
+        case 'o':
+            output_name = optarg;
+            arguments += 2;
+            break;
+        case OPT_SHA256:
+            options.digest = &digest;
+            arguments += 1;
+            break;
+        case OPT_KDF_MS:
+            if (atoi(optarg) <= 0)
+            {
+                fprintf(stderr, "Tiempo de derivación no válido: %s\n", optarg);
+                return 1;
+            }
+            options.kdf_ms = atoi(optarg);
+            arguments += argv[optind - 1] == optarg ? 2 : 1;
+            break;
+        case OPT_MMAP:
+            options.use_mmap = true;
+            arguments += 1;
+            break;
         default:
             print_error("Opción inválida\n");
             print_help(executable);
@@ -74,6 +194,31 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (!is_valid_mode(mode))
+    {
+        fprintf(stderr, "Modo de encriptación no soportado: %s\n", mode);
+        printf("Modos soportados: ecb, ctr, cbc, gcm, ccm");
+        return 1;
+    }
+
+    if (strcmp(mode, "ecb") != 0 && strcmp(mode, "ctr") != 0 && strcmp(algorithm, "aes") != 0)
+    {
+        print_error("Los modos cbc, gcm y ccm sólo están disponibles con aes\n");
+        return 1;
+    }
+
+    if (options.chunk_size > 0 && strcmp(algorithm, "aes") != 0)
+    {
+        print_error("El modo por fragmentos sólo está disponible con aes\n");
+        return 1;
+    }
+
+    if (options.chunk_size > 0 && strcmp(mode, "ctr") != 0 && strcmp(mode, "cbc") != 0 && strcmp(mode, "gcm") != 0)
+    {
+        print_error("El modo por fragmentos requiere el modo ctr, cbc o gcm\n");
+        return 1;
+    }
+
     if (!is_valid_bit(bits))
     {
         fprintf(stderr, "Número de bits de encriptación no soportado: %d", bits);
@@ -103,14 +248,39 @@ int main(int argc, char *argv[])
         file_name = argv[i];
     }
 
-    if (decrypt)
+    if (has_range && !decrypt)
+    {
+        print_error("--range sólo se puede usar al desencriptar (-d)\n");
+        return 1;
+    }
+
+    if (options.digest != NULL && decrypt)
     {
-        decrypt_file(passphrase, file_name);
+        print_error("--sha256 sólo se puede usar al encriptar\n");
+        return 1;
+    }
+
+    if (has_range)
+    {
+        decrypt_range(passphrase, file_name, range_offset, range_length, output_name, &options);
+    }
+    else if (decrypt)
+    {
+        decrypt_file(passphrase, file_name, &options);
     }
     else
     {
         printf("Usando %s con clave de %d bits\n", algorithm, bits);
-        encrypt_file(algorithm, bits, passphrase, file_name);
+        if (options.digest != NULL)
+        {
+            digest_init(options.digest);
+        }
+        encrypt_file(algorithm, mode, bits, passphrase, file_name, &options);
+        if (options.digest != NULL && !write_digest_file(file_name, options.digest))
+        {
+            print_error("Error al escribir el hash del archivo\n");
+            return 1;
+        }
     }
 
     return 0;
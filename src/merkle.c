@@ -0,0 +1,164 @@
+#include "merkle.h"
+#include "container.h"
+#include "workers.h"
+
+/**
+ * Datos compartidos por los hilos que calculan las hojas del árbol de un archivo
+ */
+typedef struct
+{
+    int fd;
+    off_t offset;            // Posición del primer byte cubierto por el árbol
+    unsigned long long size; // Bytes cubiertos por el árbol
+    unsigned long long leaves;
+    const BYTE *header;      // Cabecera sin la raíz, que forma parte del contexto de cada hoja
+    size_t header_len;
+    BYTE *hashes;            // Hoja calculada de cada parte
+} MERKLE_FILE_JOB;
+
+/**
+ * Calcula el hash de una hoja del árbol: SHA-256 del prefijo MERKLE_LEAF seguido del
+ * contexto y de los datos de la hoja. El contexto liga la hoja a su posición, para que no
+ * se pueda mover a otra sin cambiar su hash
+ *
+ * @param context Contexto de la hoja
+ * @param context_len Bytes del contexto
+ * @param data Datos de la hoja
+ * @param len Número de bytes
+ * @param hash Hash resultante, de MERKLE_HASH_SIZE bytes
+ */
+void merkle_leaf(const BYTE *context, size_t context_len, const BYTE *data, size_t len, BYTE *hash)
+{
+    BYTE prefix = MERKLE_LEAF;
+    SHA256_CTX ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, &prefix, 1);
+    sha256_update(&ctx, context, context_len);
+    sha256_update(&ctx, data, len);
+    sha256_final(&ctx, hash);
+}
+
+/**
+ * Calcula la raíz del árbol de hashes a partir de las hojas. Cada nodo interno es el
+ * SHA-256 del prefijo MERKLE_NODE y de sus dos hijos; si un nivel tiene un número impar
+ * de nodos, el último sube sin cambios al siguiente. Los nodos de cada nivel son mensajes
+ * independientes y se calculan juntos con sha256_multi. La raíz de un árbol sin hojas es
+ * el SHA-256 de un mensaje vacío
+ *
+ * @param hashes Hashes de las hojas, count * MERKLE_HASH_SIZE bytes, que se sobrescriben
+ * @param count Número de hojas
+ * @param root Raíz resultante, de MERKLE_HASH_SIZE bytes
+ */
+void merkle_root(BYTE *hashes, unsigned long long count, BYTE *root)
+{
+    size_t node_size = 1 + 2 * MERKLE_HASH_SIZE;
+    size_t pairs = count / 2;
+
+    if (count == 0)
+    {
+        SHA256_CTX ctx;
+        sha256_init(&ctx);
+        sha256_final(&ctx, root);
+        return;
+    }
+
+    BYTE *nodes = (BYTE *)malloc(pairs * node_size + 1);
+    const BYTE **messages = (const BYTE **)malloc((pairs + 1) * sizeof(BYTE *));
+    size_t *lens = (size_t *)malloc((pairs + 1) * sizeof(size_t));
+    if (nodes == NULL || messages == NULL || lens == NULL)
+    {
+        print_error("Error al reservar el árbol de hashes\n");
+        exit(1);
+    }
+
+    // Los hijos se copian junto a su prefijo antes de sobrescribir el nivel con sus padres
+    while (count > 1)
+    {
+        pairs = count / 2;
+        for (size_t i = 0; i < pairs; i++)
+        {
+            nodes[i * node_size] = MERKLE_NODE;
+            memcpy(nodes + i * node_size + 1, hashes + 2 * i * MERKLE_HASH_SIZE, 2 * MERKLE_HASH_SIZE);
+            messages[i] = nodes + i * node_size;
+            lens[i] = node_size;
+        }
+
+        sha256_multi(messages, lens, (BYTE(*)[SHA256_BLOCK_SIZE])hashes, pairs);
+
+        if (count % 2 == 1)
+        {
+            memmove(hashes + pairs * MERKLE_HASH_SIZE, hashes + (count - 1) * MERKLE_HASH_SIZE, MERKLE_HASH_SIZE);
+        }
+        count = pairs + count % 2;
+    }
+
+    memcpy(root, hashes, MERKLE_HASH_SIZE);
+    free(nodes);
+    free(messages);
+    free(lens);
+}
+
+/**
+ * Lee una parte de MERKLE_FILE_LEAF_SIZE bytes del archivo y calcula su hoja. El contexto
+ * de la hoja es la cabecera, la posición de la parte y si es la última
+ *
+ * @param context Trabajo del árbol
+ * @param leaf Índice de la parte
+ * @param buffer Buffer del hilo, de MERKLE_FILE_LEAF_SIZE bytes
+ */
+static void merkle_file_task(void *context, unsigned long long leaf, BYTE *buffer)
+{
+    MERKLE_FILE_JOB *job = (MERKLE_FILE_JOB *)context;
+    BYTE leaf_context[MAX_HEADER_SIZE + 8 + 1];
+    unsigned long long offset = leaf * MERKLE_FILE_LEAF_SIZE;
+    size_t len = job->size - offset < MERKLE_FILE_LEAF_SIZE ? (size_t)(job->size - offset) : MERKLE_FILE_LEAF_SIZE;
+
+    if (pread_full(job->fd, buffer, len, job->offset + offset) != (ssize_t)len)
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    memcpy(leaf_context, job->header, job->header_len);
+    store_le(leaf_context + job->header_len, leaf, 8);
+    leaf_context[job->header_len + 8] = leaf == job->leaves - 1;
+    merkle_leaf(leaf_context, job->header_len + 9, buffer, len, job->hashes + leaf * MERKLE_HASH_SIZE);
+}
+
+/**
+ * Calcula la raíz del árbol de hashes de los bytes de un archivo, divididos en hojas de
+ * MERKLE_FILE_LEAF_SIZE bytes que se reparten entre varios hilos. Siempre hay al menos
+ * una hoja, de modo que la cabecera queda cubierta aunque no haya datos
+ *
+ * @param fd Descriptor del archivo
+ * @param header Cabecera del archivo sin la raíz
+ * @param header_len Bytes de la cabecera, como mucho MAX_HEADER_SIZE
+ * @param offset Posición del primer byte cubierto
+ * @param size Bytes cubiertos
+ * @param threads Número de hilos
+ * @param root Raíz resultante, de MERKLE_HASH_SIZE bytes
+ */
+void merkle_file_root(int fd, const BYTE *header, size_t header_len, off_t offset, unsigned long long size, int threads,
+                      BYTE *root)
+{
+    unsigned long long leaves = size > 0 ? (size + MERKLE_FILE_LEAF_SIZE - 1) / MERKLE_FILE_LEAF_SIZE : 1;
+    MERKLE_FILE_JOB job = {
+        .fd = fd,
+        .offset = offset,
+        .size = size,
+        .leaves = leaves,
+        .header = header,
+        .header_len = header_len,
+        .hashes = (BYTE *)malloc(leaves * MERKLE_HASH_SIZE),
+    };
+    if (job.hashes == NULL)
+    {
+        print_error("Error al reservar el árbol de hashes\n");
+        exit(1);
+    }
+
+    run_workers(threads, leaves, MERKLE_FILE_LEAF_SIZE, merkle_file_task, &job);
+    merkle_root(job.hashes, leaves, root);
+    free(job.hashes);
+}
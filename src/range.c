@@ -0,0 +1,298 @@
+#include <errno.h>
+#include "range.h"
+#include "container.h"
+#include "stream.h"
+#include "kdf.h"
+
+/**
+ * Interpreta un rango con el formato OFFSET:LENGTH
+ *
+ * @param text Rango a interpretar
+ * @param offset Posición del primer byte del rango
+ * @param length Número de bytes del rango
+ *
+ * @return true si el rango es válido, false en caso contrario
+ */
+bool parse_range(const char *text, unsigned long long *offset, unsigned long long *length)
+{
+    char *end;
+
+    if (*text < '0' || *text > '9')
+    {
+        return false;
+    }
+    errno = 0;
+    *offset = strtoull(text, &end, 10);
+    if (errno != 0 || *end != ':' || end[1] < '0' || end[1] > '9')
+    {
+        return false;
+    }
+    *length = strtoull(end + 1, &end, 10);
+    return errno == 0 && *end == '\0';
+}
+
+/**
+ * Escribe la parte de un fragmento desencriptado que cae dentro del rango pedido
+ *
+ * @param fd Descriptor de salida
+ * @param buffer Texto plano desencriptado
+ * @param position Posición del buffer dentro del archivo original
+ * @param len Bytes del buffer
+ * @param offset Inicio del rango
+ * @param end Fin del rango, sin incluir
+ */
+static void write_range_slice(int fd, const BYTE *buffer, unsigned long long position, size_t len, unsigned long long offset,
+                              unsigned long long end)
+{
+    unsigned long long from = offset > position ? offset : position;
+    unsigned long long to = end < position + len ? end : position + len;
+
+    if (from < to && !write_full(fd, buffer + (from - position), to - from))
+    {
+        print_error("Error al escribir el rango desencriptado\n");
+        exit(1);
+    }
+}
+
+/**
+ * Desencripta sólo los fragmentos del contenedor que cubren el rango, leyendo del índice
+ * únicamente sus entradas, y verifica cada uno con la hoja guardada en su entrada
+ */
+static void decrypt_range_chunked(int fd, int out_fd, const FILE_HEADER *header, const CIPHER *cipher,
+                                  unsigned long long offset, unsigned long long end)
+{
+    CONTAINER_HEADER container;
+    CHUNK_ENTRY entry;
+
+    read_container_header(fd, header->header_size, header->size, &container);
+
+    BYTE *buffer = (BYTE *)malloc(container.chunk_size);
+    if (buffer == NULL)
+    {
+        print_error("Error al reservar el buffer de E/S\n");
+        exit(1);
+    }
+
+    for (unsigned long long chunk = offset / container.chunk_size; chunk * container.chunk_size < end; chunk++)
+    {
+        read_chunk_entry(fd, header->mask, header->size, &container, chunk, &entry);
+
+        size_t stored = chunk_stored_length(header->mask, entry.length);
+        if (pread_full(fd, buffer, stored, entry.offset) != (ssize_t)stored)
+        {
+            print_error("Archivo encriptado truncado o corrupto\n");
+            exit(1);
+        }
+
+        // El fragmento se verifica antes de escribir nada de él
+        if (!container_decrypt_chunk(cipher, header->mask, &container, chunk, &entry, buffer, NULL))
+        {
+            print_error("Verificación fallida: un fragmento no coincide con el árbol de hashes, el archivo fue "
+                        "modificado o la frase de encriptación es incorrecta\n");
+            exit(1);
+        }
+        write_range_slice(out_fd, buffer, chunk * container.chunk_size, entry.length, offset, end);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Desencripta sólo los fragmentos autenticados que cubren el rango en los archivos gcm
+ * por fragmentos. La posición de cada fragmento se calcula sin índice, y su etiqueta se
+ * verifica antes de escribir nada de él
+ */
+static void decrypt_range_stream(int fd, int out_fd, const FILE_HEADER *header, const CIPHER *cipher,
+                                 unsigned long long offset, unsigned long long end)
+{
+    STREAM_FILE stream;
+
+    const char *error = stream_read_prefix(fd, header->header_size, header->size, cipher, &stream);
+    if (error != NULL)
+    {
+        print_error((char *)error);
+        exit(1);
+    }
+
+    BYTE *buffer = (BYTE *)malloc(stream.chunk_size + GCM_TAG_SIZE);
+    if (buffer == NULL)
+    {
+        print_error("Error al reservar el buffer de E/S\n");
+        exit(1);
+    }
+
+    for (unsigned long long chunk = offset / stream.chunk_size; chunk * stream.chunk_size < end; chunk++)
+    {
+        size_t len = stream_chunk_length(&stream, chunk);
+        if (pread_full(fd, buffer, len + GCM_TAG_SIZE, stream_chunk_offset(&stream, chunk)) !=
+            (ssize_t)(len + GCM_TAG_SIZE))
+        {
+            print_error("Archivo encriptado truncado o corrupto\n");
+            exit(1);
+        }
+
+        if (!stream_decrypt_chunk(&stream, chunk, buffer))
+        {
+            print_error("Autenticación fallida: el archivo fue modificado o la frase de encriptación es incorrecta\n");
+            exit(1);
+        }
+        write_range_slice(out_fd, buffer, chunk * stream.chunk_size, len, offset, end);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Desencripta sólo los bloques que cubren el rango en los formatos sin fragmentos. El
+ * bloque k está en data_offset + k * block_size; en ECB y CTR se puede desencriptar
+ * directamente y en CBC se lee además el bloque cifrado anterior como IV
+ */
+static void decrypt_range_blocks(int fd, int out_fd, const FILE_HEADER *header, const CIPHER *cipher,
+                                 unsigned long long offset, unsigned long long end, const ENCRYPT_OPTIONS *options)
+{
+    bool ctr = (header->mask & MODE_MASK) == CTR;
+    bool cbc = (header->mask & MODE_MASK) == CBC;
+    size_t block_size = cipher->block_size;
+    // El nonce de CTR ocupa un bloque del cifrado
+    off_t data_offset = header->header_size + (ctr ? block_size : 0) + (cbc ? CBC_IV_SIZE : 0);
+    BYTE iv[AES_BLOCK_SIZE];
+
+    unsigned long long start = offset - offset % block_size;
+    // Sólo CTR guarda el último bloque sin relleno
+    unsigned long long stored_end = ctr ? end : (end + block_size - 1) / block_size * block_size;
+
+    if (ctr || cbc)
+    {
+        off_t iv_offset = start == 0 || ctr ? (off_t)header->header_size : (off_t)(data_offset + start - block_size);
+        if (pread_full(fd, iv, block_size, iv_offset) != (ssize_t)block_size)
+        {
+            print_error("Archivo encriptado truncado o corrupto\n");
+            exit(1);
+        }
+    }
+
+    size_t buffer_size = options->buffer_size;
+    BYTE *buffer = allocate_io_buffer(&buffer_size, block_size);
+    if (buffer == NULL)
+    {
+        print_error("Error al reservar el buffer de E/S\n");
+        exit(1);
+    }
+
+    for (unsigned long long position = start; position < stored_end; position += buffer_size)
+    {
+        size_t len = stored_end - position < buffer_size ? (size_t)(stored_end - position) : buffer_size;
+        if (pread_full(fd, buffer, len, data_offset + position) != (ssize_t)len)
+        {
+            print_error("Archivo encriptado truncado o corrupto\n");
+            exit(1);
+        }
+
+        if (ctr)
+        {
+            cipher_ctr_buffer(cipher, iv, position, buffer, buffer, len);
+        }
+        else if (cbc)
+        {
+            cipher_cbc_decrypt_buffer(cipher, iv, buffer, buffer, len);
+        }
+        else
+        {
+            cipher_decrypt_buffer(cipher, buffer, buffer, len);
+        }
+
+        write_range_slice(out_fd, buffer, position, len, offset, end);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Desencripta sólo un rango de bytes del archivo original. Se leen y desencriptan
+ * únicamente los bloques o fragmentos que lo cubren, así que el tiempo depende del
+ * tamaño del rango y no del tamaño del archivo
+ *
+ * @param passphrase Frase de encriptación
+ * @param file_name Nombre del archivo encriptado
+ * @param offset Posición del primer byte del rango en el archivo original
+ * @param length Número de bytes del rango. Se recorta al final del archivo
+ * @param output_name Archivo donde se escribe el rango, o NULL para la salida estándar
+ * @param options Opciones de desencriptación
+ */
+void decrypt_range(char *passphrase, char *file_name, unsigned long long offset, unsigned long long length,
+                   char *output_name, const ENCRYPT_OPTIONS *options)
+{
+    int fd = open(file_name, O_RDONLY, S_IRUSR);
+    if (fd < 0)
+    {
+        print_error("Error al leer el archivo a desencriptar\n");
+        exit(1);
+    }
+
+    FILE_HEADER header;
+    read_header(fd, &header);
+
+    // Sin fragmentos, la única etiqueta de gcm y ccm cubre el archivo completo, así que un
+    // rango no se puede verificar; en gcm por fragmentos cada uno lleva su etiqueta
+    if ((header.mask & MODE_MASK) == AEAD && (header.mask & CHUNKED) != CHUNKED)
+    {
+        print_error("Los archivos en modo gcm o ccm sin --chunked no admiten rangos: su etiqueta cubre el archivo "
+                    "completo y sólo se pueden desencriptar completos\n");
+        exit(1);
+    }
+
+    if (offset > header.size)
+    {
+        print_error("El rango comienza después del final del archivo\n");
+        exit(1);
+    }
+
+    unsigned long long end = header.size - offset < length ? header.size : offset + length;
+
+    BYTE *encrypt_key = (BYTE *)malloc(sizeof(BYTE) * header.bits);
+    derive_key(passphrase, &header, encrypt_key);
+    if (!check_key(&header, encrypt_key))
+    {
+        print_error("Frase de encriptación incorrecta\n");
+        exit(1);
+    }
+
+    int out_fd = STDOUT_FILENO;
+    if (output_name != NULL)
+    {
+        out_fd = open(output_name, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+        if (out_fd < 0)
+        {
+            print_error("Error al crear el archivo de salida\n");
+            exit(1);
+        }
+        remove_output_on_exit(output_name);
+    }
+
+    CIPHER cipher;
+    cipher_setup(&cipher, header.algorithm, encrypt_key, header.bits);
+
+    if (offset < end)
+    {
+        if ((header.mask & (CHUNKED | MODE_MASK)) == (CHUNKED | AEAD))
+        {
+            decrypt_range_stream(fd, out_fd, &header, &cipher, offset, end);
+        }
+        else if ((header.mask & CHUNKED) == CHUNKED)
+        {
+            decrypt_range_chunked(fd, out_fd, &header, &cipher, offset, end);
+        }
+        else
+        {
+            decrypt_range_blocks(fd, out_fd, &header, &cipher, offset, end, options);
+        }
+    }
+
+    keep_output_file();
+    close(fd);
+    if (output_name != NULL)
+    {
+        close(out_fd);
+    }
+    free(encrypt_key);
+}
@@ -0,0 +1,418 @@
+#include <errno.h>
+#include <pthread.h>
+#include "encrypter.h"
+#include "container.h"
+#include "stream.h"
+#include "kdf.h"
+#include "reader.h"
+
+#define READER_EMPTY ((unsigned long long)-1)
+
+/**
+ * Fragmento desencriptado guardado en la caché
+ */
+typedef struct
+{
+    unsigned long long chunk;     // Índice del fragmento, o READER_EMPTY si está libre
+    unsigned long long last_used; // Momento del último uso, para desalojar el menos usado
+    size_t length;                // Bytes de texto plano del fragmento
+    BYTE *data;
+} READER_SLOT;
+
+struct ENC_READER
+{
+    int fd;
+    FILE_HEADER header;
+    CIPHER cipher;
+    CONTAINER_HEADER container; // Sólo en archivos con CHUNKED en modo ctr o cbc
+    STREAM_FILE stream;         // Sólo en archivos gcm por fragmentos
+    off_t data_offset;          // Posición del primer bloque cifrado en archivos sin CHUNKED
+    BYTE iv[AES_BLOCK_SIZE];    // Nonce de CTR o IV de CBC en archivos sin CHUNKED
+    size_t chunk_size;          // Bytes de texto plano por fragmento
+    READER_SLOT *slots;
+    int slot_count;
+    unsigned long long clock;
+    pthread_mutex_t lock;
+};
+
+/**
+ * Libera el lector y borra de la memoria la clave expandida
+ *
+ * @param reader Lector, puede estar a medio inicializar
+ */
+static void reader_free(ENC_READER *reader)
+{
+    if (reader->slots != NULL)
+    {
+        for (int i = 0; i < reader->slot_count; i++)
+        {
+            free(reader->slots[i].data);
+        }
+        free(reader->slots);
+    }
+    if (reader->fd >= 0)
+    {
+        close(reader->fd);
+    }
+    memset(&reader->cipher, 0, sizeof(reader->cipher));
+    memset(&reader->stream, 0, sizeof(reader->stream));
+    free(reader);
+}
+
+/**
+ * Lee la cabecera y comprueba que el archivo contenga todos los datos cifrados
+ *
+ * @return true si el archivo es válido, false en caso contrario
+ */
+static bool reader_read_header(ENC_READER *reader)
+{
+    BYTE raw[MAX_HEADER_SIZE + CONTAINER_HEADER_SIZE];
+    struct stat file_stats;
+
+    if (pread_full(reader->fd, raw, HEADER_SIZE, 0) != HEADER_SIZE || fstat(reader->fd, &file_stats) < 0 ||
+        parse_header(raw, &reader->header) != NULL)
+    {
+        return false;
+    }
+
+    // La raíz del árbol de hashes cubre el archivo completo, así que el lector sólo la salta
+    size_t header_size = reader->header.header_size;
+    if (header_size > HEADER_SIZE &&
+        (pread_full(reader->fd, raw + HEADER_SIZE, header_size - HEADER_SIZE, HEADER_SIZE) !=
+             (ssize_t)(header_size - HEADER_SIZE) ||
+         parse_header_params(raw + HEADER_SIZE, &reader->header) != NULL))
+    {
+        return false;
+    }
+
+    unsigned long long file_size = file_stats.st_size;
+    BYTE mask = reader->header.mask;
+
+    // Sin fragmentos, la etiqueta de gcm y ccm cubre el archivo completo y un fragmento
+    // suelto no se puede verificar. En gcm por fragmentos cada uno lleva su etiqueta, pero
+    // leer el prefijo requiere el cifrado, así que se hace en enc_reader_open
+    if ((mask & MODE_MASK) == AEAD)
+    {
+        return (mask & CHUNKED) == CHUNKED;
+    }
+
+    if ((mask & CHUNKED) == CHUNKED)
+    {
+        reader->chunk_size = 0;
+        if (pread_full(reader->fd, raw + header_size, CONTAINER_HEADER_SIZE, header_size) != CONTAINER_HEADER_SIZE ||
+            parse_container_header(raw + header_size, reader->header.size, file_size, &reader->container) != NULL)
+        {
+            return false;
+        }
+        reader->chunk_size = reader->container.chunk_size;
+        return true;
+    }
+
+    size_t block_size = reader->header.algorithm == AES ? AES_BLOCK_SIZE : BLOWFISH_BLOCK_SIZE;
+
+    // El nonce de CTR y el IV de CBC ocupan un bloque del cifrado
+    reader->chunk_size = READER_CHUNK_SIZE;
+    reader->data_offset = header_size;
+    if ((mask & MODE_MASK) != 0)
+    {
+        if (pread_full(reader->fd, reader->iv, block_size, header_size) != (ssize_t)block_size)
+        {
+            return false;
+        }
+        reader->data_offset += block_size;
+    }
+
+    unsigned long long stored = (mask & MODE_MASK) == CTR ? reader->header.size
+                                                    : (reader->header.size + block_size - 1) / block_size * block_size;
+    return file_size >= reader->data_offset + stored;
+}
+
+/**
+ * Abre un archivo encriptado para leerlo con enc_pread. La cabecera indica el formato,
+ * el algoritmo y el número de bits, y la clave se expande una sola vez
+ *
+ * @param path Ruta del archivo encriptado
+ * @param passphrase Frase de encriptación
+ *
+ * @return Lector, o NULL en caso de error con errno indicando la causa (EINVAL si el
+ * archivo no es un archivo encriptado válido o está en modo gcm o ccm sin fragmentos,
+ * EACCES si la frase no es la correcta)
+ */
+ENC_READER *enc_reader_open(const char *path, const char *passphrase)
+{
+    ENC_READER *reader = (ENC_READER *)calloc(1, sizeof(ENC_READER));
+    if (reader == NULL)
+    {
+        return NULL;
+    }
+
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0)
+    {
+        int error = errno;
+        reader_free(reader);
+        errno = error;
+        return NULL;
+    }
+
+    if (!reader_read_header(reader))
+    {
+        reader_free(reader);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    BYTE key[32];
+    derive_key(passphrase, &reader->header, key);
+    if (!check_key(&reader->header, key))
+    {
+        memset(key, 0, sizeof(key));
+        reader_free(reader);
+        errno = EACCES;
+        return NULL;
+    }
+    cipher_setup(&reader->cipher, reader->header.algorithm, key, reader->header.bits);
+    memset(key, 0, sizeof(key));
+
+    BYTE mask = reader->header.mask;
+    if ((mask & (CHUNKED | MODE_MASK)) == (CHUNKED | AEAD))
+    {
+        if (stream_read_prefix(reader->fd, reader->header.header_size, reader->header.size, &reader->cipher,
+                               &reader->stream) != NULL)
+        {
+            reader_free(reader);
+            errno = EINVAL;
+            return NULL;
+        }
+        reader->chunk_size = reader->stream.chunk_size;
+    }
+
+    reader->slot_count = READER_CACHE_SIZE / reader->chunk_size;
+    if (reader->slot_count < 2)
+    {
+        reader->slot_count = 2;
+    }
+
+    reader->slots = (READER_SLOT *)calloc(reader->slot_count, sizeof(READER_SLOT));
+    if (reader->slots == NULL)
+    {
+        reader_free(reader);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (int i = 0; i < reader->slot_count; i++)
+    {
+        reader->slots[i].chunk = READER_EMPTY;
+    }
+
+    pthread_mutex_init(&reader->lock, NULL);
+    return reader;
+}
+
+/**
+ * Lee y desencripta un fragmento en un espacio de la caché
+ *
+ * @return true si se desencriptó el fragmento, false ante un error de lectura, un índice
+ * corrupto o un fragmento que no coincide con su hoja del árbol de hashes o su etiqueta
+ */
+static bool reader_load_chunk(ENC_READER *reader, unsigned long long chunk, READER_SLOT *slot)
+{
+    BYTE mask = reader->header.mask;
+    unsigned long long position = chunk * reader->chunk_size;
+    size_t length = reader->header.size - position < reader->chunk_size ? (size_t)(reader->header.size - position)
+                                                                          : reader->chunk_size;
+
+    if ((mask & (CHUNKED | MODE_MASK)) == (CHUNKED | AEAD))
+    {
+        if (pread_full(reader->fd, slot->data, length + GCM_TAG_SIZE, stream_chunk_offset(&reader->stream, chunk)) !=
+            (ssize_t)(length + GCM_TAG_SIZE))
+        {
+            return false;
+        }
+        if (!stream_decrypt_chunk(&reader->stream, chunk, slot->data))
+        {
+            errno = EBADMSG;
+            return false;
+        }
+        slot->length = length;
+        return true;
+    }
+
+    if ((mask & CHUNKED) == CHUNKED)
+    {
+        BYTE raw[CHUNK_ENTRY_SIZE];
+        CHUNK_ENTRY entry;
+        struct stat file_stats;
+
+        if (pread_full(reader->fd, raw, CHUNK_ENTRY_SIZE, reader->container.index_offset + chunk * CHUNK_ENTRY_SIZE) !=
+                CHUNK_ENTRY_SIZE ||
+            fstat(reader->fd, &file_stats) < 0 ||
+            !decode_chunk_entry(raw, mask, reader->header.size, &reader->container, file_stats.st_size, chunk, &entry))
+        {
+            return false;
+        }
+
+        size_t stored = chunk_stored_length(mask, entry.length);
+        if (pread_full(reader->fd, slot->data, stored, entry.offset) != (ssize_t)stored)
+        {
+            return false;
+        }
+        if (!container_decrypt_chunk(&reader->cipher, mask, &reader->container, chunk, &entry, slot->data, NULL))
+        {
+            errno = EBADMSG;
+            return false;
+        }
+        slot->length = entry.length;
+        return true;
+    }
+
+    // En ECB y CBC el último bloque se guarda rellenado; en CTR no hay relleno
+    size_t block_size = reader->cipher.block_size;
+    size_t stored = (mask & MODE_MASK) == CTR ? length : (length + block_size - 1) / block_size * block_size;
+    if (pread_full(reader->fd, slot->data, stored, reader->data_offset + position) != (ssize_t)stored)
+    {
+        return false;
+    }
+
+    if ((mask & MODE_MASK) == CTR)
+    {
+        cipher_ctr_buffer(&reader->cipher, reader->iv, position, slot->data, slot->data, length);
+    }
+    else if ((mask & MODE_MASK) == CBC)
+    {
+        BYTE iv[AES_BLOCK_SIZE];
+        if (position == 0)
+        {
+            memcpy(iv, reader->iv, AES_BLOCK_SIZE);
+        }
+        else if (pread_full(reader->fd, iv, AES_BLOCK_SIZE, reader->data_offset + position - AES_BLOCK_SIZE) !=
+                 AES_BLOCK_SIZE)
+        {
+            return false;
+        }
+        cipher_cbc_decrypt_buffer(&reader->cipher, iv, slot->data, slot->data, stored);
+    }
+    else
+    {
+        cipher_decrypt_buffer(&reader->cipher, slot->data, slot->data, stored);
+    }
+
+    slot->length = length;
+    return true;
+}
+
+/**
+ * Devuelve el fragmento desencriptado desde la caché, desencriptándolo en el espacio
+ * menos usado recientemente si no está
+ *
+ * @return Espacio de la caché con el fragmento, o NULL en caso de error
+ */
+static READER_SLOT *reader_get_chunk(ENC_READER *reader, unsigned long long chunk)
+{
+    READER_SLOT *victim = &reader->slots[0];
+
+    reader->clock++;
+    for (int i = 0; i < reader->slot_count; i++)
+    {
+        READER_SLOT *slot = &reader->slots[i];
+        if (slot->chunk == chunk)
+        {
+            slot->last_used = reader->clock;
+            return slot;
+        }
+        if (slot->last_used < victim->last_used)
+        {
+            victim = slot;
+        }
+    }
+
+    if (victim->data == NULL)
+    {
+        // Con espacio para la etiqueta de los archivos gcm por fragmentos
+        victim->data = (BYTE *)malloc(reader->chunk_size + GCM_TAG_SIZE);
+        if (victim->data == NULL)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    // reader_load_chunk cambia errno a EBADMSG si el fragmento no supera la verificación
+    victim->chunk = READER_EMPTY;
+    errno = EIO;
+    if (!reader_load_chunk(reader, chunk, victim))
+    {
+        return NULL;
+    }
+
+    victim->chunk = chunk;
+    victim->last_used = reader->clock;
+    return victim;
+}
+
+/**
+ * Lee hasta len bytes del archivo original a partir de offset, como pread(2)
+ *
+ * @param reader Lector abierto con enc_reader_open
+ * @param buf Buffer donde se almacenarán los bytes leídos
+ * @param len Número de bytes a leer
+ * @param offset Posición en el archivo original
+ *
+ * @return Número de bytes leídos, menor a len sólo al llegar al final del archivo, o -1
+ * en caso de error con errno indicando la causa (EBADMSG si un fragmento fue modificado)
+ */
+ssize_t enc_pread(ENC_READER *reader, void *buf, size_t len, unsigned long long offset)
+{
+    BYTE *out = (BYTE *)buf;
+    size_t total = 0;
+
+    if (offset >= reader->header.size)
+    {
+        return 0;
+    }
+    if (len > reader->header.size - offset)
+    {
+        len = reader->header.size - offset;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    while (total < len)
+    {
+        unsigned long long position = offset + total;
+        READER_SLOT *slot = reader_get_chunk(reader, position / reader->chunk_size);
+        if (slot == NULL)
+        {
+            pthread_mutex_unlock(&reader->lock);
+            return total > 0 ? (ssize_t)total : -1;
+        }
+
+        size_t start = position % reader->chunk_size;
+        size_t count = slot->length - start < len - total ? slot->length - start : len - total;
+        memcpy(out + total, slot->data + start, count);
+        total += count;
+    }
+    pthread_mutex_unlock(&reader->lock);
+
+    return total;
+}
+
+/**
+ * Devuelve el tamaño del archivo original
+ *
+ * @param reader Lector abierto con enc_reader_open
+ */
+unsigned long long enc_reader_size(const ENC_READER *reader)
+{
+    return reader->header.size;
+}
+
+/**
+ * Cierra el lector y libera la caché
+ *
+ * @param reader Lector abierto con enc_reader_open
+ */
+void enc_reader_close(ENC_READER *reader)
+{
+    pthread_mutex_destroy(&reader->lock);
+    reader_free(reader);
+}
@@ -0,0 +1,309 @@
+#include "stream.h"
+#include "container.h"
+#include "workers.h"
+
+/**
+ * Datos compartidos por los hilos que procesan un archivo autenticado por fragmentos
+ */
+typedef struct
+{
+    STREAM_FILE stream;
+    bool encrypt;
+    int in_fd;
+    int out_fd;
+    bool failed;         // Algún fragmento no superó la verificación
+    FILE_DIGEST *digest; // Hash del texto plano al encriptar, o NULL
+} STREAM_JOB;
+
+/**
+ * Calcula el IV de un fragmento: el prefijo aleatorio del nonce, el índice del fragmento
+ * en big endian y un byte que vale 1 sólo en el último. Así cada etiqueta queda ligada a
+ * la posición del fragmento y a si el archivo termina en él, y reordenar, duplicar o
+ * truncar fragmentos hace fallar la verificación
+ *
+ * @param stream Parámetros del archivo
+ * @param chunk Índice del fragmento
+ * @param iv IV resultante, de GCM_IV_SIZE bytes
+ */
+static void stream_chunk_iv(const STREAM_FILE *stream, unsigned long long chunk, BYTE *iv)
+{
+    memcpy(iv, stream->prefix + stream->prefix_size - STREAM_NONCE_PREFIX_SIZE, STREAM_NONCE_PREFIX_SIZE);
+    for (int i = 0; i < 4; i++)
+    {
+        iv[STREAM_NONCE_PREFIX_SIZE + i] = (chunk >> 8 * (3 - i)) & 0xFF;
+    }
+    iv[GCM_IV_SIZE - 1] = chunk + 1 == stream->chunks;
+}
+
+/**
+ * Devuelve los bytes de texto plano de un fragmento: chunk_size salvo en el último
+ *
+ * @param stream Parámetros del archivo
+ * @param chunk Índice del fragmento
+ */
+size_t stream_chunk_length(const STREAM_FILE *stream, unsigned long long chunk)
+{
+    unsigned long long offset = chunk * stream->chunk_size;
+    return stream->size - offset < stream->chunk_size ? (size_t)(stream->size - offset) : stream->chunk_size;
+}
+
+/**
+ * Devuelve la posición de un fragmento cifrado dentro del archivo. Cada fragmento ocupa
+ * su texto plano más la etiqueta, así que la posición se calcula sin índice
+ *
+ * @param stream Parámetros del archivo
+ * @param chunk Índice del fragmento
+ */
+off_t stream_chunk_offset(const STREAM_FILE *stream, unsigned long long chunk)
+{
+    return stream->prefix_size + chunk * (stream->chunk_size + GCM_TAG_SIZE);
+}
+
+/**
+ * Desencripta un fragmento en su lugar si su etiqueta es correcta
+ *
+ * @param stream Parámetros del archivo leídos con stream_read_prefix
+ * @param chunk Índice del fragmento
+ * @param buffer Fragmento cifrado seguido de su etiqueta, stream_chunk_length() +
+ *        GCM_TAG_SIZE bytes leídos desde stream_chunk_offset()
+ *
+ * @return true si el fragmento es auténtico, false si fue modificado o la clave no es la
+ *         correcta
+ */
+bool stream_decrypt_chunk(const STREAM_FILE *stream, unsigned long long chunk, BYTE *buffer)
+{
+    size_t len = stream_chunk_length(stream, chunk);
+    BYTE iv[GCM_IV_SIZE];
+
+    stream_chunk_iv(stream, chunk, iv);
+    return aes_decrypt_gcm(buffer, len, buffer, stream->prefix, stream->prefix_size, iv, buffer + len, &stream->gcm);
+}
+
+/**
+ * Encripta o desencripta un fragmento con su propia etiqueta GCM. Al desencriptar, un
+ * fragmento que no supera la verificación no se escribe y marca el trabajo como fallido;
+ * los fragmentos que quedan se descartan sin procesarlos
+ *
+ * @param context Trabajo del archivo
+ * @param chunk Índice del fragmento
+ * @param buffer Buffer del hilo, de chunk_size + GCM_TAG_SIZE bytes
+ */
+static void stream_task(void *context, unsigned long long chunk, BYTE *buffer)
+{
+    STREAM_JOB *job = (STREAM_JOB *)context;
+    const STREAM_FILE *stream = &job->stream;
+    unsigned long long offset = chunk * stream->chunk_size;
+    size_t len = stream_chunk_length(stream, chunk);
+    off_t stored_offset = stream_chunk_offset(stream, chunk);
+
+    if (__atomic_load_n(&job->failed, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+
+    if (job->encrypt)
+    {
+        BYTE iv[GCM_IV_SIZE];
+
+        if (pread_full(job->in_fd, buffer, len, offset) != (ssize_t)len)
+        {
+            print_error("Error al leer el archivo a encriptar\n");
+            exit(1);
+        }
+
+        stream_chunk_iv(stream, chunk, iv);
+        digest_chunk(job->digest, chunk, buffer, len);
+        aes_encrypt_gcm(buffer, len, buffer, stream->prefix, stream->prefix_size, iv, buffer + len, &stream->gcm);
+
+        if (!pwrite_full(job->out_fd, buffer, len + GCM_TAG_SIZE, stored_offset))
+        {
+            print_error("Error al escribir el archivo encriptado\n");
+            exit(1);
+        }
+        return;
+    }
+
+    if (pread_full(job->in_fd, buffer, len + GCM_TAG_SIZE, stored_offset) != (ssize_t)(len + GCM_TAG_SIZE))
+    {
+        print_error("Archivo encriptado truncado o corrupto\n");
+        exit(1);
+    }
+
+    if (!stream_decrypt_chunk(stream, chunk, buffer))
+    {
+        __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if (!pwrite_full(job->out_fd, buffer, len, offset))
+    {
+        print_error("Error al escribir el archivo desencriptado\n");
+        exit(1);
+    }
+}
+
+/**
+ * Prepara el contexto GCM y el número de fragmentos. Un archivo vacío tiene un único
+ * fragmento vacío, de modo que siempre hay una etiqueta con la marca de final
+ *
+ * @param stream Parámetros del archivo, con size y chunk_size
+ * @param cipher Cifrado AES inicializado
+ *
+ * @return true si el número de fragmentos cabe en el IV, false en caso contrario
+ */
+static bool stream_setup(STREAM_FILE *stream, const CIPHER *cipher)
+{
+    stream->chunks = stream->size == 0 ? 1 : (stream->size + stream->chunk_size - 1) / stream->chunk_size;
+    stream->gcm.aes = cipher->aes_ctx;
+    aes_ghash_init(&stream->gcm.ghash, &stream->gcm.aes);
+    return stream->chunks <= STREAM_MAX_CHUNKS;
+}
+
+/**
+ * Lee y valida el prefijo de un archivo autenticado por fragmentos y prepara sus
+ * parámetros para desencriptar cualquiera de sus fragmentos
+ *
+ * @param fd Descriptor del archivo encriptado
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo original según la cabecera
+ * @param cipher Cifrado AES inicializado
+ * @param stream Parámetros leídos
+ *
+ * @return NULL si el prefijo es válido y el archivo tiene el tamaño esperado, o el
+ *         mensaje de error en caso contrario
+ */
+const char *stream_read_prefix(int fd, size_t header_size, unsigned long long size, const CIPHER *cipher,
+                               STREAM_FILE *stream)
+{
+    struct stat file_stats;
+
+    stream->prefix_size = STREAM_PREFIX_SIZE(header_size);
+    stream->size = size;
+    if (pread_full(fd, stream->prefix, stream->prefix_size, 0) != (ssize_t)stream->prefix_size)
+    {
+        return "Archivo encriptado truncado o corrupto\n";
+    }
+
+    // Por fragmentos sólo existe gcm
+    if (stream->prefix[header_size] != AEAD_GCM)
+    {
+        return "Cabecera no especifica el modo autenticado correctamente\n";
+    }
+
+    stream->chunk_size = load_le(stream->prefix + header_size + AEAD_ID_SIZE, STREAM_CHUNK_SIZE_SIZE);
+    if (stream->chunk_size == 0 || stream->chunk_size > 1024 * MIB || !stream_setup(stream, cipher))
+    {
+        return "Cabecera no especifica el tamaño de fragmento correctamente\n";
+    }
+
+    if (fstat(fd, &file_stats) < 0 ||
+        (unsigned long long)file_stats.st_size != stream->prefix_size + size + stream->chunks * GCM_TAG_SIZE)
+    {
+        return "Archivo encriptado truncado o corrupto\n";
+    }
+
+    return NULL;
+}
+
+/**
+ * Encripta un archivo en fragmentos autenticados por separado (construcción STREAM). A la
+ * cabecera le siguen el modo, el tamaño de fragmento y un prefijo de nonce aleatorio, que
+ * se autentican como datos asociados de cada fragmento, y luego cada fragmento cifrado
+ * seguido de su etiqueta. Los fragmentos se reparten entre options->threads hilos
+ *
+ * @param in_fd Descriptor del archivo a encriptar
+ * @param out_fd Descriptor del archivo encriptado
+ * @param header Cabecera del archivo, con CHUNKED y AEAD en la máscara
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo original
+ * @param cipher Cifrado AES inicializado
+ * @param chunk_size Bytes de texto plano por fragmento
+ * @param options Opciones de encriptación
+ */
+void stream_encrypt_file(int in_fd, int out_fd, const BYTE *header, size_t header_size, unsigned long long size,
+                         const CIPHER *cipher, size_t chunk_size, const ENCRYPT_OPTIONS *options)
+{
+    STREAM_JOB job = {
+        .stream = {
+            .prefix_size = STREAM_PREFIX_SIZE(header_size),
+            .size = size,
+            .chunk_size = chunk_size,
+        },
+        .encrypt = true,
+        .in_fd = in_fd,
+        .out_fd = out_fd,
+        .digest = options->digest,
+    };
+    STREAM_FILE *stream = &job.stream;
+
+    memcpy(stream->prefix, header, header_size);
+    stream->prefix[header_size] = AEAD_GCM;
+    store_le(stream->prefix + header_size + AEAD_ID_SIZE, chunk_size, STREAM_CHUNK_SIZE_SIZE);
+    if (!fill_random(stream->prefix + stream->prefix_size - STREAM_NONCE_PREFIX_SIZE, STREAM_NONCE_PREFIX_SIZE))
+    {
+        print_error("Error al generar el nonce\n");
+        exit(1);
+    }
+
+    if (!stream_setup(stream, cipher))
+    {
+        print_error("El archivo tiene demasiados fragmentos para el modo gcm\n");
+        exit(1);
+    }
+
+    if (!pwrite_full(out_fd, stream->prefix, stream->prefix_size, 0))
+    {
+        print_error("Error al escribir la cabecera\n");
+        exit(1);
+    }
+
+    if (!reserve_output_file(out_fd, stream->prefix_size + size + stream->chunks * GCM_TAG_SIZE))
+    {
+        print_error("Error al reservar espacio para el archivo encriptado\n");
+        exit(1);
+    }
+
+    run_workers(options->threads, stream->chunks, chunk_size + GCM_TAG_SIZE, stream_task, &job);
+}
+
+/**
+ * Desencripta un archivo autenticado por fragmentos. Cada hilo verifica la etiqueta de
+ * sus fragmentos antes de escribirlos, en cualquier orden; si alguno falla el resto se
+ * descarta y quien llama debe borrar el archivo de salida
+ *
+ * @param in_fd Descriptor del archivo encriptado
+ * @param out_fd Descriptor del archivo desencriptado
+ * @param header_size Bytes de la cabecera
+ * @param size Tamaño del archivo original según la cabecera
+ * @param cipher Cifrado AES inicializado
+ * @param options Opciones de desencriptación
+ *
+ * @return true si todos los fragmentos son auténticos, false si el archivo fue
+ *         modificado o la clave no es la correcta
+ */
+bool stream_decrypt_file(int in_fd, int out_fd, size_t header_size, unsigned long long size, const CIPHER *cipher,
+                         const ENCRYPT_OPTIONS *options)
+{
+    STREAM_JOB job = {
+        .encrypt = false,
+        .in_fd = in_fd,
+        .out_fd = out_fd,
+    };
+
+    const char *error = stream_read_prefix(in_fd, header_size, size, cipher, &job.stream);
+    if (error != NULL)
+    {
+        print_error((char *)error);
+        exit(1);
+    }
+
+    if (!reserve_output_file(out_fd, size))
+    {
+        print_error("Error al reservar espacio para el archivo desencriptado\n");
+        exit(1);
+    }
+
+    run_workers(options->threads, job.stream.chunks, job.stream.chunk_size + GCM_TAG_SIZE, stream_task, &job);
+
+    return !job.failed;
+}
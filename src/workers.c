@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "errors.h"
+#include "workers.h"
+
+typedef struct
+{
+    unsigned long long next_chunk; // Siguiente fragmento sin asignar, compartido entre hilos
+    unsigned long long chunks;
+    size_t buffer_size;
+    WORKER_TASK task;
+    void *context;
+} WORKER_POOL;
+
+/**
+ * Devuelve el número de hilos a usar por defecto: uno por cada núcleo disponible
+ */
+int default_thread_count()
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+/**
+ * Cuerpo de cada hilo. Toma fragmentos del contador compartido hasta agotarlos, de modo
+ * que los hilos más rápidos procesan más fragmentos
+ *
+ * @param arg Pool de hilos
+ */
+static void *worker_main(void *arg)
+{
+    WORKER_POOL *pool = (WORKER_POOL *)arg;
+    BYTE *buffer = NULL;
+
+    if (pool->buffer_size > 0)
+    {
+        buffer = (BYTE *)malloc(pool->buffer_size);
+        if (buffer == NULL)
+        {
+            print_error("Error al reservar el buffer de E/S\n");
+            exit(1);
+        }
+    }
+
+    unsigned long long chunk;
+    while ((chunk = __atomic_fetch_add(&pool->next_chunk, 1, __ATOMIC_RELAXED)) < pool->chunks)
+    {
+        pool->task(pool->context, chunk, buffer);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/**
+ * Procesa los fragmentos [0, chunks) repartiéndolos entre varios hilos y espera a que
+ * terminen todos. Con un solo hilo los fragmentos se procesan en el hilo actual
+ *
+ * @param threads Número de hilos
+ * @param chunks Número de fragmentos
+ * @param buffer_size Tamaño del buffer propio de cada hilo, 0 si la tarea no lo necesita
+ * @param task Tarea a ejecutar sobre cada fragmento
+ * @param context Datos compartidos pasados a la tarea
+ */
+void run_workers(int threads, unsigned long long chunks, size_t buffer_size, WORKER_TASK task, void *context)
+{
+    WORKER_POOL pool = {
+        .next_chunk = 0,
+        .chunks = chunks,
+        .buffer_size = buffer_size,
+        .task = task,
+        .context = context,
+    };
+
+    if ((unsigned long long)threads > chunks)
+    {
+        threads = (int)chunks;
+    }
+
+    if (threads <= 1)
+    {
+        worker_main(&pool);
+        return;
+    }
+
+    pthread_t *ids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    if (ids == NULL)
+    {
+        print_error("Error al crear los hilos\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (pthread_create(&ids[i], NULL, worker_main, &pool) != 0)
+        {
+            print_error("Error al crear los hilos\n");
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+
+    free(ids);
+}
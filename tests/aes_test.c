@@ -0,0 +1,334 @@
+/*********************************************************************
+* Filename:   aes_test.c
+* Author:     Brad Conte (brad AT bradconte.com)
+* Copyright:
+* Disclaimer: This code is presented "as is" without any guarantees.
+* Details:    Performs known-answer tests on every AES implementation
+              available on this machine, and on the CBC, CTR, CCM and
+              GCM modes built on them. The vectors come from FIPS-197
+              appendix C, SP 800-38A appendix F, SP 800-38C appendix C
+              and the test cases of the original GCM specification.
+*********************************************************************/
+
+/*************************** HEADER FILES ***************************/
+#include <stdio.h>
+#include <memory.h>
+#include "aes.h"
+
+/**************************** VARIABLES *****************************/
+// FIPS-197 C.1 to C.3, the same plaintext under 128, 192 and 256 bit keys.
+static const BYTE fips_key[32] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f,
+	0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17,0x18,0x19,0x1a,0x1b,0x1c,0x1d,0x1e,0x1f
+};
+static const BYTE fips_plaintext[16] = {
+	0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xaa,0xbb,0xcc,0xdd,0xee,0xff
+};
+static const BYTE fips_ciphertext[3][16] = {
+	{0x69,0xc4,0xe0,0xd8,0x6a,0x7b,0x04,0x30,0xd8,0xcd,0xb7,0x80,0x70,0xb4,0xc5,0x5a},
+	{0xdd,0xa9,0x7c,0xa4,0x86,0x4c,0xdf,0xe0,0x6e,0xaf,0x70,0xa0,0xec,0x0d,0x71,0x91},
+	{0x8e,0xa2,0xb7,0xca,0x51,0x67,0x45,0xbf,0xea,0xfc,0x49,0x90,0x4b,0x49,0x60,0x89}
+};
+
+// SP 800-38A F.2.1 and F.5.1, AES-128.
+static const BYTE sp_key[16] = {
+	0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c
+};
+static const BYTE sp_plaintext[64] = {
+	0x6b,0xc1,0xbe,0xe2,0x2e,0x40,0x9f,0x96,0xe9,0x3d,0x7e,0x11,0x73,0x93,0x17,0x2a,
+	0xae,0x2d,0x8a,0x57,0x1e,0x03,0xac,0x9c,0x9e,0xb7,0x6f,0xac,0x45,0xaf,0x8e,0x51,
+	0x30,0xc8,0x1c,0x46,0xa3,0x5c,0xe4,0x11,0xe5,0xfb,0xc1,0x19,0x1a,0x0a,0x52,0xef,
+	0xf6,0x9f,0x24,0x45,0xdf,0x4f,0x9b,0x17,0xad,0x2b,0x41,0x7b,0xe6,0x6c,0x37,0x10
+};
+static const BYTE sp_cbc_iv[16] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f
+};
+static const BYTE sp_cbc_ciphertext[64] = {
+	0x76,0x49,0xab,0xac,0x81,0x19,0xb2,0x46,0xce,0xe9,0x8e,0x9b,0x12,0xe9,0x19,0x7d,
+	0x50,0x86,0xcb,0x9b,0x50,0x72,0x19,0xee,0x95,0xdb,0x11,0x3a,0x91,0x76,0x78,0xb2,
+	0x73,0xbe,0xd6,0xb8,0xe3,0xc1,0x74,0x3b,0x71,0x16,0xe6,0x9e,0x22,0x22,0x95,0x16,
+	0x3f,0xf1,0xca,0xa1,0x68,0x1f,0xac,0x09,0x12,0x0e,0xca,0x30,0x75,0x86,0xe1,0xa7
+};
+static const BYTE sp_ctr[16] = {
+	0xf0,0xf1,0xf2,0xf3,0xf4,0xf5,0xf6,0xf7,0xf8,0xf9,0xfa,0xfb,0xfc,0xfd,0xfe,0xff
+};
+static const BYTE sp_ctr_ciphertext[64] = {
+	0x87,0x4d,0x61,0x91,0xb6,0x20,0xe3,0x26,0x1b,0xef,0x68,0x64,0x99,0x0d,0xb6,0xce,
+	0x98,0x06,0xf6,0x6b,0x79,0x70,0xfd,0xff,0x86,0x17,0x18,0x7b,0xb9,0xff,0xfd,0xff,
+	0x5a,0xe4,0xdf,0x3e,0xdb,0xd5,0xd3,0x5e,0x5b,0x4f,0x09,0x02,0x0d,0xb0,0x3e,0xab,
+	0x1e,0x03,0x1d,0xda,0x2f,0xbe,0x03,0xd1,0x79,0x21,0x70,0xa0,0xf3,0x00,0x9c,0xee
+};
+
+// SP 800-38C C.1 and C.2.
+static const BYTE ccm_key[16] = {
+	0x40,0x41,0x42,0x43,0x44,0x45,0x46,0x47,0x48,0x49,0x4a,0x4b,0x4c,0x4d,0x4e,0x4f
+};
+static const BYTE ccm_nonce[8] = {0x10,0x11,0x12,0x13,0x14,0x15,0x16,0x17};
+static const BYTE ccm_assoc[16] = {
+	0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f
+};
+static const BYTE ccm_plaintext[16] = {
+	0x20,0x21,0x22,0x23,0x24,0x25,0x26,0x27,0x28,0x29,0x2a,0x2b,0x2c,0x2d,0x2e,0x2f
+};
+static const BYTE ccm_ciphertext1[8] = {0x71,0x62,0x01,0x5b,0x4d,0xac,0x25,0x5d};
+static const BYTE ccm_ciphertext2[22] = {
+	0xd2,0xa1,0xf0,0xe0,0x51,0xea,0x5f,0x62,0x08,0x1a,0x77,0x92,0x07,0x3d,0x59,0x3d,
+	0x1f,0xc6,0x4f,0xbf,0xac,0xcd
+};
+
+// GCM specification test cases 3 and 4.
+static const BYTE gcm_key[16] = {
+	0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08
+};
+static const BYTE gcm_iv[12] = {0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,0xde,0xca,0xf8,0x88};
+static const BYTE gcm_plaintext[64] = {
+	0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,0xa5,0x59,0x09,0xc5,0xaf,0xf5,0x26,0x9a,
+	0x86,0xa7,0xa9,0x53,0x15,0x34,0xf7,0xda,0x2e,0x4c,0x30,0x3d,0x8a,0x31,0x8a,0x72,
+	0x1c,0x3c,0x0c,0x95,0x95,0x68,0x09,0x53,0x2f,0xcf,0x0e,0x24,0x49,0xa6,0xb5,0x25,
+	0xb1,0x6a,0xed,0xf5,0xaa,0x0d,0xe6,0x57,0xba,0x63,0x7b,0x39,0x1a,0xaf,0xd2,0x55
+};
+static const BYTE gcm_ciphertext[64] = {
+	0x42,0x83,0x1e,0xc2,0x21,0x77,0x74,0x24,0x4b,0x72,0x21,0xb7,0x84,0xd0,0xd4,0x9c,
+	0xe3,0xaa,0x21,0x2f,0x2c,0x02,0xa4,0xe0,0x35,0xc1,0x7e,0x23,0x29,0xac,0xa1,0x2e,
+	0x21,0xd5,0x14,0xb2,0x54,0x66,0x93,0x1c,0x7d,0x8f,0x6a,0x5a,0xac,0x84,0xaa,0x05,
+	0x1b,0xa3,0x0b,0x39,0x6a,0x0a,0xac,0x97,0x3d,0x58,0xe0,0x91,0x47,0x3f,0x59,0x85
+};
+static const BYTE gcm_aad[20] = {
+	0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,0xfe,0xed,0xfa,0xce,0xde,0xad,0xbe,0xef,
+	0xab,0xad,0xda,0xd2
+};
+static const BYTE gcm_tag3[16] = {
+	0x4d,0x5c,0x2a,0xf3,0x27,0xcd,0x64,0xa6,0x2c,0xf3,0x5a,0xbd,0x2b,0xa6,0xfa,0xb4
+};
+static const BYTE gcm_tag4[16] = {
+	0x5b,0xc9,0x4f,0xbc,0x32,0x21,0xa5,0xdb,0x94,0xfa,0xe9,0x5a,0xe7,0x12,0x1a,0x47
+};
+
+/*********************** FUNCTION DEFINITIONS ***********************/
+// Block functions, with a raw schedule and with a context, and the bulk ECB functions
+// over enough blocks to go through the multi-block kernel and its tail.
+int aes_ecb_test()
+{
+	BYTE buf[37 * AES_BLOCK_SIZE];
+	WORD key_schedule[60];
+	AES_CTX ctx;
+	BYTE out[AES_BLOCK_SIZE];
+	int pass = 1;
+	int idx, blk;
+
+	for (idx = 0; idx < 3; idx++) {
+		int keysize = 128 + 64 * idx;
+
+		aes_key_setup(fips_key, key_schedule, keysize);
+		aes_encrypt(fips_plaintext, out, key_schedule, keysize);
+		pass = pass && !memcmp(out, fips_ciphertext[idx], AES_BLOCK_SIZE);
+		aes_decrypt(fips_ciphertext[idx], out, key_schedule, keysize);
+		pass = pass && !memcmp(out, fips_plaintext, AES_BLOCK_SIZE);
+
+		aes_ctx_init(&ctx, fips_key, keysize);
+		aes_encrypt_ctx(fips_plaintext, out, &ctx);
+		pass = pass && !memcmp(out, fips_ciphertext[idx], AES_BLOCK_SIZE);
+		aes_decrypt_ctx(fips_ciphertext[idx], out, &ctx);
+		pass = pass && !memcmp(out, fips_plaintext, AES_BLOCK_SIZE);
+
+		for (blk = 0; blk < 37; blk++)
+			memcpy(buf + blk * AES_BLOCK_SIZE, fips_plaintext, AES_BLOCK_SIZE);
+		aes_ecb_encrypt_blocks(buf, buf, 37, &ctx);
+		for (blk = 0; blk < 37; blk++)
+			pass = pass && !memcmp(buf + blk * AES_BLOCK_SIZE, fips_ciphertext[idx], AES_BLOCK_SIZE);
+		aes_ecb_decrypt_blocks(buf, buf, 37, &ctx);
+		for (blk = 0; blk < 37; blk++)
+			pass = pass && !memcmp(buf + blk * AES_BLOCK_SIZE, fips_plaintext, AES_BLOCK_SIZE);
+	}
+
+	return(pass);
+}
+
+// The four blocks of SP 800-38A, once in a single call and once a block per call to
+// check that the IV and the counter carry over between calls. CBC decryption is also
+// run through aes_decrypt_cbc, which only takes the key schedule.
+int aes_cbc_ctr_test()
+{
+	WORD key_schedule[60];
+	AES_CTX ctx;
+	BYTE buf[64];
+	BYTE iv[AES_BLOCK_SIZE];
+	int pass = 1;
+	int blk;
+
+	aes_ctx_init(&ctx, sp_key, 128);
+
+	memcpy(iv, sp_cbc_iv, AES_BLOCK_SIZE);
+	aes_cbc_encrypt_blocks(sp_plaintext, buf, 4, &ctx, iv);
+	pass = pass && !memcmp(buf, sp_cbc_ciphertext, 64);
+	memcpy(iv, sp_cbc_iv, AES_BLOCK_SIZE);
+	aes_cbc_decrypt_blocks(sp_cbc_ciphertext, buf, 4, &ctx, iv);
+	pass = pass && !memcmp(buf, sp_plaintext, 64);
+	memcpy(iv, sp_cbc_iv, AES_BLOCK_SIZE);
+	for (blk = 0; blk < 4; blk++)
+		aes_cbc_decrypt_blocks(sp_cbc_ciphertext + blk * 16, buf + blk * 16, 1, &ctx, iv);
+	pass = pass && !memcmp(buf, sp_plaintext, 64);
+	aes_key_setup(sp_key, key_schedule, 128);
+	aes_decrypt_cbc(sp_cbc_ciphertext, 64, buf, key_schedule, 128, sp_cbc_iv);
+	pass = pass && !memcmp(buf, sp_plaintext, 64);
+
+	memcpy(iv, sp_ctr, AES_BLOCK_SIZE);
+	aes_ctr_blocks(sp_plaintext, buf, 4, &ctx, iv);
+	pass = pass && !memcmp(buf, sp_ctr_ciphertext, 64);
+	memcpy(iv, sp_ctr, AES_BLOCK_SIZE);
+	for (blk = 0; blk < 4; blk++)
+		aes_ctr_blocks(sp_ctr_ciphertext + blk * 16, buf + blk * 16, 1, &ctx, iv);
+	pass = pass && !memcmp(buf, sp_plaintext, 64);
+
+	return(pass);
+}
+
+// Distinct blocks under every key size. The bulk decryption functions, which use the
+// equivalent inverse schedule cached in the context, must undo aes_encrypt block by
+// block.
+int aes_decrypt_test()
+{
+	BYTE plain[37 * AES_BLOCK_SIZE];
+	BYTE buf[37 * AES_BLOCK_SIZE];
+	BYTE iv[AES_BLOCK_SIZE];
+	WORD key_schedule[60];
+	AES_CTX ctx;
+	int pass = 1;
+	int idx, blk;
+
+	for (idx = 0; idx < (int)sizeof(plain); idx++)
+		plain[idx] = (BYTE)(idx * 131 + 17);
+
+	for (idx = 0; idx < 3; idx++) {
+		int keysize = 128 + 64 * idx;
+
+		aes_key_setup(fips_key, key_schedule, keysize);
+		aes_ctx_init(&ctx, fips_key, keysize);
+		for (blk = 0; blk < 37; blk++)
+			aes_encrypt(plain + blk * AES_BLOCK_SIZE, buf + blk * AES_BLOCK_SIZE, key_schedule, keysize);
+		aes_ecb_decrypt_blocks(buf, buf, 37, &ctx);
+		pass = pass && !memcmp(buf, plain, sizeof(plain));
+
+		memcpy(iv, fips_plaintext, AES_BLOCK_SIZE);
+		aes_cbc_encrypt_blocks(plain, buf, 37, &ctx, iv);
+		memcpy(iv, fips_plaintext, AES_BLOCK_SIZE);
+		aes_cbc_decrypt_blocks(buf, buf, 37, &ctx, iv);
+		pass = pass && !memcmp(buf, plain, sizeof(plain));
+	}
+
+	return(pass);
+}
+
+int aes_ccm_test()
+{
+	BYTE buf[32];
+	WORD len;
+	int mac_auth;
+	int pass = 1;
+
+	aes_encrypt_ccm(ccm_plaintext, 4, ccm_assoc, 8, ccm_nonce, 7, buf, &len, 4, ccm_key, 128);
+	pass = pass && len == sizeof(ccm_ciphertext1) && !memcmp(buf, ccm_ciphertext1, len);
+	aes_encrypt_ccm(ccm_plaintext, 16, ccm_assoc, 16, ccm_nonce, 8, buf, &len, 6, ccm_key, 128);
+	pass = pass && len == sizeof(ccm_ciphertext2) && !memcmp(buf, ccm_ciphertext2, len);
+
+	aes_decrypt_ccm(ccm_ciphertext2, 22, ccm_assoc, 16, ccm_nonce, 8, buf, &len, 6, &mac_auth, ccm_key, 128);
+	pass = pass && mac_auth && len == 16 && !memcmp(buf, ccm_plaintext, 16);
+
+	// A flipped bit in the MAC must be rejected
+	memcpy(buf, ccm_ciphertext2, 22);
+	buf[21] ^= 0x01;
+	aes_decrypt_ccm(buf, 22, ccm_assoc, 16, ccm_nonce, 8, buf, &len, 6, &mac_auth, ccm_key, 128);
+	pass = pass && !mac_auth;
+
+	return(pass);
+}
+
+int aes_gcm_test()
+{
+	AES_GCM_CTX ctx;
+	BYTE buf[64];
+	BYTE tag[AES_GCM_TAG_SIZE];
+	int pass = 1;
+
+	aes_gcm_init(&ctx, gcm_key, 128);
+
+	aes_encrypt_gcm(gcm_plaintext, 64, buf, NULL, 0, gcm_iv, tag, &ctx);
+	pass = pass && !memcmp(buf, gcm_ciphertext, 64) && !memcmp(tag, gcm_tag3, AES_GCM_TAG_SIZE);
+
+	aes_encrypt_gcm(gcm_plaintext, 60, buf, gcm_aad, sizeof(gcm_aad), gcm_iv, tag, &ctx);
+	pass = pass && !memcmp(buf, gcm_ciphertext, 60) && !memcmp(tag, gcm_tag4, AES_GCM_TAG_SIZE);
+
+	pass = pass && aes_decrypt_gcm(gcm_ciphertext, 60, buf, gcm_aad, sizeof(gcm_aad), gcm_iv, gcm_tag4, &ctx);
+	pass = pass && !memcmp(buf, gcm_plaintext, 60);
+
+	// A flipped bit in the associated data must be rejected
+	memcpy(buf, gcm_aad, sizeof(gcm_aad));
+	buf[0] ^= 0x01;
+	pass = pass && !aes_decrypt_gcm(gcm_ciphertext, 60, buf + 32, buf, sizeof(gcm_aad), gcm_iv, gcm_tag4, &ctx);
+
+	return(pass);
+}
+
+// The key schedule has the same layout under every implementation, so a schedule
+// expanded by one can be used by another.
+int aes_schedule_test()
+{
+	WORD key_schedule[60];
+	WORD reference[60];
+	int impl = aes_get_impl();
+	int pass = 1;
+	int idx;
+
+	for (idx = 0; idx < 3; idx++) {
+		int keysize = 128 + 64 * idx;
+
+		aes_key_setup(fips_key, key_schedule, keysize);
+		aes_set_impl(AES_IMPL_REFERENCE);
+		aes_key_setup(fips_key, reference, keysize);
+		aes_set_impl(impl);
+		pass = pass && !memcmp(key_schedule, reference, 4 * (keysize / 32 + 7) * sizeof(WORD));
+	}
+
+	return(pass);
+}
+
+// GCM runs once with each GHASH implementation available.
+int aes_impl_test()
+{
+	int pass = 1;
+
+	pass = pass && aes_ecb_test();
+	pass = pass && aes_schedule_test();
+	pass = pass && aes_cbc_ctr_test();
+	pass = pass && aes_decrypt_test();
+	pass = pass && aes_ccm_test();
+	pass = pass && aes_gcm_test();
+	if (aes_ghash_uses_pclmul()) {
+		aes_ghash_use_pclmul(0);
+		pass = pass && aes_gcm_test();
+		aes_ghash_use_pclmul(1);
+	}
+
+	return(pass);
+}
+
+int main()
+{
+	int initial = aes_get_impl();
+	int pass = 1;
+	int impl;
+
+	for (impl = AES_IMPL_REFERENCE; aes_impl_name(impl) != NULL; impl++) {
+		if (!aes_set_impl(impl)) {
+			printf("AES %s: not available\n", aes_impl_name(impl));
+			continue;
+		}
+		int impl_pass = aes_impl_test();
+		printf("AES %s: %s\n", aes_impl_name(impl), impl_pass ? "SUCCEEDED" : "FAILED");
+		pass = pass && impl_pass;
+	}
+	aes_set_impl(initial);
+
+	printf("AES Tests: %s\n", pass ? "SUCCEEDED" : "FAILED");
+	return(pass ? 0 : 1);
+}
@@ -0,0 +1,168 @@
+/*********************************************************************
+* Filename:   blowfish_test.c
+* Author:     Brad Conte (brad AT bradconte.com)
+* Copyright:
+* Disclaimer: This code is presented "as is" without any guarantees.
+* Details:    Performs known-answer tests on the Blowfish block
+              functions and checks the multi-block ECB and CTR
+              functions of every implementation available on this
+              machine against them. The vectors are from Eric Young's
+              set, published by Bruce Schneier. The batched key setup
+              is compared with the one-key setup.
+*********************************************************************/
+
+/*************************** HEADER FILES ***************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "blowfish.h"
+
+/****************************** MACROS ******************************/
+#define BLOCKS 19                       // Two passes of the widest kernel and a tail
+#define KEYS 13                         // One batch of 8, one of 4 and a single key
+
+/**************************** VARIABLES *****************************/
+static const BYTE key[3][8] = {
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+	{0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff},
+	{0x30,0x00,0x00,0x00,0x00,0x00,0x00,0x00}
+};
+static const BYTE plaintext[3][8] = {
+	{0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00},
+	{0xff,0xff,0xff,0xff,0xff,0xff,0xff,0xff},
+	{0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x01}
+};
+static const BYTE ciphertext[3][8] = {
+	{0x4e,0xf9,0x97,0x45,0x61,0x98,0xdd,0x78},
+	{0x51,0x86,0x6f,0xd5,0xb8,0x5e,0xcb,0x8a},
+	{0x7d,0x85,0x6f,0x9a,0x61,0x30,0x63,0xf2}
+};
+
+/*********************** FUNCTION DEFINITIONS ***********************/
+int blowfish_block_test()
+{
+	BLOWFISH_KEY keystruct;
+	BYTE out[BLOWFISH_BLOCK_SIZE];
+	int pass = 1;
+	int idx;
+
+	for (idx = 0; idx < 3; idx++) {
+		blowfish_key_setup(key[idx], &keystruct, 8);
+		blowfish_encrypt(plaintext[idx], out, &keystruct);
+		pass = pass && !memcmp(out, ciphertext[idx], BLOWFISH_BLOCK_SIZE);
+		blowfish_decrypt(ciphertext[idx], out, &keystruct);
+		pass = pass && !memcmp(out, plaintext[idx], BLOWFISH_BLOCK_SIZE);
+	}
+
+	return(pass);
+}
+
+// Distinct random blocks, so a kernel that mixes up its lanes or its tail does not
+// go unnoticed. Each block must match blowfish_encrypt/blowfish_decrypt on its own.
+int blowfish_ecb_test()
+{
+	BLOWFISH_KEY keystruct;
+	BYTE plain[BLOCKS * BLOWFISH_BLOCK_SIZE];
+	BYTE buf[BLOCKS * BLOWFISH_BLOCK_SIZE];
+	BYTE out[BLOWFISH_BLOCK_SIZE];
+	int pass = 1;
+	int idx, blk;
+
+	for (idx = 0; idx < (int)sizeof(plain); idx++)
+		plain[idx] = (BYTE)rand();
+
+	for (idx = 0; idx < 3; idx++) {
+		blowfish_key_setup(key[idx], &keystruct, 8);
+
+		blowfish_ecb_encrypt_blocks(plain, buf, BLOCKS, &keystruct);
+		for (blk = 0; blk < BLOCKS; blk++) {
+			blowfish_encrypt(plain + blk * BLOWFISH_BLOCK_SIZE, out, &keystruct);
+			pass = pass && !memcmp(buf + blk * BLOWFISH_BLOCK_SIZE, out, BLOWFISH_BLOCK_SIZE);
+		}
+		blowfish_ecb_decrypt_blocks(buf, buf, BLOCKS, &keystruct);
+		for (blk = 0; blk < BLOCKS; blk++) {
+			blowfish_encrypt(plain + blk * BLOWFISH_BLOCK_SIZE, out, &keystruct);
+			blowfish_decrypt(out, out, &keystruct);
+			pass = pass && !memcmp(buf + blk * BLOWFISH_BLOCK_SIZE, out, BLOWFISH_BLOCK_SIZE);
+		}
+	}
+
+	return(pass);
+}
+
+// The keystream of block i is the encryption of ctr + i, so the multi-block result is
+// checked against blowfish_encrypt on each counter, including a carry out of the low byte.
+int blowfish_ctr_test()
+{
+	BLOWFISH_KEY keystruct;
+	BYTE ctr[BLOWFISH_BLOCK_SIZE] = {0x01,0x02,0x03,0x04,0x05,0x06,0x07,0xf8};
+	BYTE counter[BLOWFISH_BLOCK_SIZE];
+	BYTE buf[BLOCKS * BLOWFISH_BLOCK_SIZE] = {0};
+	BYTE out[BLOWFISH_BLOCK_SIZE];
+	int pass = 1;
+	int blk, i;
+
+	blowfish_key_setup(key[2], &keystruct, 8);
+	memcpy(counter, ctr, BLOWFISH_BLOCK_SIZE);
+	blowfish_ctr_blocks(buf, buf, BLOCKS, &keystruct, counter);
+
+	for (blk = 0; blk < BLOCKS; blk++) {
+		blowfish_encrypt(ctr, out, &keystruct);
+		pass = pass && !memcmp(buf + blk * BLOWFISH_BLOCK_SIZE, out, BLOWFISH_BLOCK_SIZE);
+		for (i = BLOWFISH_BLOCK_SIZE - 1; i >= 0 && ++ctr[i] == 0; i--)
+			;
+	}
+	pass = pass && !memcmp(counter, ctr, BLOWFISH_BLOCK_SIZE);
+
+	return(pass);
+}
+
+// Keys of mixed lengths from 1 to 56 bytes, enough of them to fill the 8-lane and the
+// 4-lane batches and leave a key over. Each schedule must match blowfish_key_setup.
+int blowfish_key_batch_test()
+{
+	static const size_t lens[KEYS] = {1, 56, 8, 4, 16, 33, 7, 24, 56, 2, 13, 40, 5};
+	BYTE key_bytes[KEYS][56];
+	const BYTE *keys[KEYS];
+	BLOWFISH_KEY batch[KEYS];
+	BLOWFISH_KEY keystruct;
+	int pass = 1;
+	int idx, i;
+
+	for (idx = 0; idx < KEYS; idx++) {
+		for (i = 0; i < 56; i++)
+			key_bytes[idx][i] = (BYTE)rand();
+		keys[idx] = key_bytes[idx];
+	}
+
+	blowfish_key_setup_batch(keys, lens, batch, KEYS);
+	for (idx = 0; idx < KEYS; idx++) {
+		blowfish_key_setup(keys[idx], &keystruct, lens[idx]);
+		pass = pass && !memcmp(&keystruct, &batch[idx], sizeof(BLOWFISH_KEY));
+	}
+
+	return(pass);
+}
+
+int main()
+{
+	int initial = blowfish_get_impl();
+	int pass;
+	int impl;
+
+	srand(1);
+	pass = blowfish_block_test();
+	for (impl = BLOWFISH_IMPL_SCALAR; blowfish_impl_name(impl) != NULL; impl++) {
+		if (!blowfish_set_impl(impl)) {
+			printf("Blowfish %s: not available\n", blowfish_impl_name(impl));
+			continue;
+		}
+		int impl_pass = blowfish_ecb_test() && blowfish_ctr_test() && blowfish_key_batch_test();
+		printf("Blowfish %s: %s\n", blowfish_impl_name(impl), impl_pass ? "SUCCEEDED" : "FAILED");
+		pass = pass && impl_pass;
+	}
+	blowfish_set_impl(initial);
+
+	printf("Blowfish Tests: %s\n", pass ? "SUCCEEDED" : "FAILED");
+	return(pass ? 0 : 1);
+}
@@ -0,0 +1,214 @@
+#!/bin/sh
+# Pruebas de extremo a extremo del programa: encripta y desencripta archivos con cada
+# combinación de opciones, desencripta rangos, lee con enc_reader_open y compara el
+# resultado con el archivo original. Comprueba también que una frase incorrecta o un
+# archivo modificado hacen fallar la desencriptación sin dejar el archivo de salida.
+#
+# Uso: cli_test.sh <encrypter> <reader_test>
+
+ENCRYPTER=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+READER=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+PASSPHRASE="frase de prueba"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+failures=0
+
+fail()
+{
+    echo "FALLO: $*"
+    failures=$((failures + 1))
+}
+
+# Invierte el bit más bajo del byte en la posición indicada
+flip()
+{
+    byte=$(od -An -tu1 -j "$2" -N1 "$1" | tr -d ' ')
+    printf "\\$(printf %03o $((byte ^ 1)))" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+encrypt()
+{
+    "$ENCRYPTER" --kdf-ms 1 -k "$PASSPHRASE" "$@" > /dev/null
+}
+
+decrypt()
+{
+    "$ENCRYPTER" -d -k "$PASSPHRASE" "$@" > /dev/null 2>&1
+}
+
+# Compara un rango desencriptado con el mismo rango del original
+check_range()
+{
+    file=$1
+    offset=$2
+    length=$3
+    shift 3
+    "$ENCRYPTER" -d -k "$PASSPHRASE" --range "$offset:$length" -o range.out "$file.enc" 2> /dev/null ||
+        { fail "--range $offset:$length $*"; return; }
+    tail -c +$((offset + 1)) "$file.orig" | head -c "$length" > range.expected
+    cmp -s range.out range.expected || fail "--range $offset:$length no coincide $*"
+}
+
+# Encripta y desencripta cada tamaño con las opciones dadas y compara el resultado
+round_trip()
+{
+    for size in 0 1 17 4096 300000; do
+        head -c $size /dev/urandom > data
+        cp data data.orig
+        encrypt "$@" data || { fail "encriptar $size $*"; continue; }
+        rm data
+        decrypt $DECRYPT_ARGS data.enc || { fail "desencriptar $size $*"; continue; }
+        cmp -s data data.orig || fail "el archivo desencriptado no coincide $size $*"
+        rm -f data.enc
+    done
+}
+
+# Modifica un byte del archivo encriptado y comprueba que se rechace sin dejar la salida
+tamper()
+{
+    position=$1
+    shift
+    head -c 300000 /dev/urandom > data
+    cp data data.orig
+    encrypt "$@" data || { fail "encriptar $*"; return; }
+    rm data
+    flip data.enc "$position"
+    decrypt data.enc && fail "se aceptó un archivo modificado en $position $*"
+    [ -e data ] && fail "quedó el archivo de salida tras fallar $*"
+    rm -f data data.enc
+}
+
+for bits in 128 256; do
+    for mode in ecb ctr cbc gcm ccm; do
+        round_trip -b $bits -m $mode
+    done
+    for mode in ctr cbc gcm; do
+        round_trip -b $bits -m $mode --chunked=64
+    done
+    for mode in ecb ctr; do
+        round_trip -a blowfish -b $bits -m $mode
+    done
+done
+DECRYPT_ARGS="--mmap" round_trip --mmap
+DECRYPT_ARGS="-j 3" round_trip -m ctr -j 3
+DECRYPT_ARGS="--mmap -j 3" round_trip -m ctr
+DECRYPT_ARGS="-j 3" round_trip -m cbc
+DECRYPT_ARGS="-j 3" round_trip -m ctr --chunked=64 -j 3
+DECRYPT_ARGS="-j 3" round_trip -m gcm --chunked=64 -j 3
+DECRYPT_ARGS="-j 3" round_trip -a blowfish -m ctr -j 3
+
+# Un archivo mayor que los búferes de lectura y escritura se procesa en varias vueltas
+head -c 2500000 /dev/urandom > data.orig
+for mode in ecb ctr cbc gcm ccm; do
+    cp data.orig data
+    encrypt -s 1 -m $mode data
+    rm data
+    decrypt -s 1 data.enc
+    cmp -s data data.orig || fail "el archivo desencriptado no coincide con -s 1 -m $mode"
+    rm -f data data.enc
+done
+
+# Una frase incorrecta se rechaza antes de crear la salida, también en un rango y en
+# el lector
+head -c 1000 /dev/urandom > data
+cp data data.orig
+encrypt -m ctr data
+rm data
+"$ENCRYPTER" -d -k "otra frase" data.enc > /dev/null 2>&1 && fail "se aceptó una frase incorrecta"
+[ -e data ] && fail "quedó el archivo de salida con una frase incorrecta"
+"$ENCRYPTER" -d -k "otra frase" --range 0:10 -o range.out data.enc > /dev/null 2>&1 &&
+    fail "se aceptó una frase incorrecta en un rango"
+[ -e range.out ] && fail "quedó la salida de un rango con una frase incorrecta"
+"$READER" data.enc "otra frase" data.orig 2> /dev/null && fail "el lector aceptó una frase incorrecta"
+rm -f data data.orig data.enc range.out
+
+# --sha256 escribe el hash del archivo original en formato de sha256sum
+for options in "-m ecb" "-m ctr -j 3" "-m cbc --mmap" "-m gcm" "-m ccm" "-m gcm --chunked=64 -j 3"; do
+    head -c 300000 /dev/urandom > data
+    encrypt --sha256 $options data || { fail "encriptar --sha256 $options"; continue; }
+    sha256sum -c --status data.sha256 || fail "--sha256 no coincide $options"
+    rm -f data data.enc data.sha256
+done
+
+# Los modos autenticados y los contenedores, por su árbol de hashes, detectan un byte
+# modificado en los datos y, en los contenedores, en las banderas (byte 38) y en los
+# bytes reservados (byte 40) de la cabecera extendida, que sigue a los 37 bytes de la
+# cabecera
+for mode in gcm ccm; do
+    tamper 150000 -m $mode
+done
+for mode in ctr cbc gcm; do
+    tamper 150000 -m $mode --chunked=64
+done
+for mode in ctr cbc; do
+    tamper 38 -m $mode --chunked=64
+    tamper 40 -m $mode --chunked=64
+done
+
+# En ecb, ctr y cbc sin fragmentos el árbol de hashes cubre el texto cifrado y la
+# cabecera, y su raíz ocupa los bytes 37 a 68: se rechaza un byte modificado en los
+# datos, en la raíz o en el tamaño (byte 0), y también un byte añadido al final
+for options in "-m ecb" "-m ctr" "-m cbc" "-a blowfish" "-a blowfish -m ctr"; do
+    tamper 150000 $options
+    tamper 50 $options
+    tamper 0 $options
+done
+head -c 1000 /dev/urandom > data
+encrypt -m ctr data
+rm data
+printf x >> data.enc
+decrypt data.enc && fail "se aceptó un archivo con un byte añadido"
+[ -e data ] && fail "quedó el archivo de salida tras un byte añadido"
+rm -f data data.enc
+
+# Un tamaño de fragmento mayor que 1 GiB (0x40010000, el byte alto está en la posición 44)
+# se rechaza antes de reservar los búferes
+head -c 300000 /dev/urandom > data
+encrypt -m ctr --chunked=64 data
+printf '\100' | dd of=data.enc bs=1 seek=44 conv=notrunc 2>/dev/null
+"$ENCRYPTER" -d -k "$PASSPHRASE" data.enc 2>&1 | grep -q "tamaño de fragmento" ||
+    fail "se aceptó un tamaño de fragmento mayor que 1 GiB"
+rm -f data data.enc
+
+# Rangos y lector de acceso aleatorio
+for options in "-m ecb" "-m ctr" "-m cbc" "-a blowfish" "-a blowfish -m ctr" "-m ctr --chunked=64" \
+    "-m cbc --chunked=64" "-m gcm --chunked=64"; do
+    head -c 300000 /dev/urandom > data
+    cp data data.orig
+    encrypt $options data || { fail "encriptar $options"; continue; }
+    check_range data 0 1 $options
+    check_range data 65530 20 $options
+    check_range data 100 200000 $options
+    check_range data 299990 100 $options
+    "$READER" data.enc "$PASSPHRASE" data.orig || fail "lector $options"
+    rm -f data data.enc
+done
+
+# Los archivos gcm y ccm sin fragmentos no admiten rangos
+head -c 1000 /dev/urandom > data
+encrypt -m gcm data
+"$ENCRYPTER" -d -k "$PASSPHRASE" --range 0:10 data.enc > /dev/null 2>&1 && fail "se aceptó un rango en gcm"
+rm -f data data.enc
+
+# Un rango o una lectura que toca un fragmento modificado falla, y los demás se leen
+for options in "-m ctr --chunked=64" "-m cbc --chunked=64" "-m gcm --chunked=64"; do
+    head -c 300000 /dev/urandom > data
+    cp data data.orig
+    encrypt $options data
+    flip data.enc 150000
+    "$ENCRYPTER" -d -k "$PASSPHRASE" --range 131072:65536 -o range.out data.enc 2> /dev/null &&
+        fail "se aceptó un rango modificado $options"
+    [ -e range.out ] && fail "quedó la salida de un rango modificado $options"
+    check_range data 0 1000 $options
+    "$READER" data.enc "$PASSPHRASE" data.orig 2> reader.err && fail "el lector aceptó un fragmento modificado $options"
+    grep -q EBADMSG reader.err || fail "el lector no devolvió EBADMSG $options"
+    rm -f data data.enc range.out
+done
+
+if [ $failures -gt 0 ]; then
+    echo "Pruebas del programa: $failures fallos"
+    exit 1
+fi
+echo "Pruebas del programa: SUCCEEDED"
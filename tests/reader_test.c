@@ -0,0 +1,112 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reader.h"
+
+#define READS 2000
+#define MAX_READ (200 * 1024)
+
+/**
+ * Lee el archivo original completo
+ *
+ * @param path Ruta del archivo
+ * @param size Tamaño leído
+ *
+ * @return Contenido del archivo, que se debe liberar con free, o NULL en caso de error
+ */
+static unsigned char *read_original(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char *data = (unsigned char *)malloc(*size + 1);
+    if (data != NULL && fread(data, 1, *size, file) != *size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+/**
+ * Compara lecturas de enc_pread en posiciones y tamaños aleatorios con el archivo
+ * original. Uso: reader_test <archivo.enc> <passphrase> <original>
+ *
+ * @return 0 si todas las lecturas coinciden, 1 en caso contrario. Si enc_pread falla,
+ * escribe EBADMSG cuando un fragmento no supera la verificación
+ */
+int main(int argc, char *argv[])
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "uso: %s <archivo.enc> <passphrase> <original>\n", argv[0]);
+        return 1;
+    }
+
+    size_t size;
+    unsigned char *original = read_original(argv[3], &size);
+    unsigned char *buffer = (unsigned char *)malloc(MAX_READ);
+    if (original == NULL || buffer == NULL)
+    {
+        fprintf(stderr, "Error al leer el archivo original\n");
+        return 1;
+    }
+
+    ENC_READER *reader = enc_reader_open(argv[1], argv[2]);
+    if (reader == NULL)
+    {
+        fprintf(stderr, "enc_reader_open: %s\n", strerror(errno));
+        return 1;
+    }
+
+    int failures = enc_reader_size(reader) != size;
+    srand(1);
+    for (int i = 0; i < READS && failures == 0; i++)
+    {
+        unsigned long long offset = (unsigned long long)rand() % (size + 16);
+        size_t len = rand() % MAX_READ;
+        size_t expected = offset >= size ? 0 : (size - offset < len ? size - offset : len);
+
+        // Como pread, enc_pread devuelve una lectura parcial si falla después de leer
+        // algo, y el error se obtiene al seguir leyendo desde ahí
+        size_t got = 0;
+        while (got < len)
+        {
+            ssize_t count = enc_pread(reader, buffer + got, len - got, offset + got);
+            if (count < 0)
+            {
+                fprintf(stderr, "enc_pread: %s\n", errno == EBADMSG ? "EBADMSG" : strerror(errno));
+                enc_reader_close(reader);
+                return 1;
+            }
+            if (count == 0)
+            {
+                break;
+            }
+            got += count;
+        }
+        if (got != expected || (expected > 0 && memcmp(buffer, original + offset, expected) != 0))
+        {
+            failures++;
+        }
+    }
+
+    enc_reader_close(reader);
+    free(buffer);
+    free(original);
+    if (failures > 0)
+    {
+        fprintf(stderr, "enc_pread no coincide con el archivo original\n");
+        return 1;
+    }
+    return 0;
+}
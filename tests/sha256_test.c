@@ -0,0 +1,214 @@
+/*********************************************************************
+* Filename:   sha256_test.c
+* Author:     Brad Conte (brad AT bradconte.com)
+* Copyright:
+* Disclaimer: This code is presented "as is" without any guarantees.
+* Details:    Performs known-answer tests on the SHA-256 compression
+              functions available on this machine, HMAC-SHA256
+              (RFC 4231) and PBKDF2-HMAC-SHA256 (RFC 7914 section 11),
+              and checks that splitting the input across updates or
+              hashing it with the multi-buffer functions does not
+              change the hash.
+*********************************************************************/
+
+/*************************** HEADER FILES ***************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "sha256.h"
+
+/**************************** VARIABLES *****************************/
+static const char *text[3] = {
+	"",
+	"abc",
+	"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+};
+static const BYTE hash[4][SHA256_BLOCK_SIZE] = {
+	{0xe3,0xb0,0xc4,0x42,0x98,0xfc,0x1c,0x14,0x9a,0xfb,0xf4,0xc8,0x99,0x6f,0xb9,0x24,
+	 0x27,0xae,0x41,0xe4,0x64,0x9b,0x93,0x4c,0xa4,0x95,0x99,0x1b,0x78,0x52,0xb8,0x55},
+	{0xba,0x78,0x16,0xbf,0x8f,0x01,0xcf,0xea,0x41,0x41,0x40,0xde,0x5d,0xae,0x22,0x23,
+	 0xb0,0x03,0x61,0xa3,0x96,0x17,0x7a,0x9c,0xb4,0x10,0xff,0x61,0xf2,0x00,0x15,0xad},
+	{0x24,0x8d,0x6a,0x61,0xd2,0x06,0x38,0xb8,0xe5,0xc0,0x26,0x93,0x0c,0x3e,0x60,0x39,
+	 0xa3,0x3c,0xe4,0x59,0x64,0xff,0x21,0x67,0xf6,0xec,0xed,0xd4,0x19,0xdb,0x06,0xc1},
+	// One million times 'a'
+	{0xcd,0xc7,0x6e,0x5c,0x99,0x14,0xfb,0x92,0x81,0xa1,0xc7,0xe2,0x84,0xd7,0x3e,0x67,
+	 0xf1,0x80,0x9a,0x48,0xa4,0x97,0x20,0x0e,0x04,0x6d,0x39,0xcc,0xc7,0x11,0x2c,0xd0}
+};
+
+static const BYTE hmac_mac[SHA256_BLOCK_SIZE] = {
+	0xb0,0x34,0x4c,0x61,0xd8,0xdb,0x38,0x53,0x5c,0xa8,0xaf,0xce,0xaf,0x0b,0xf1,0x2b,
+	0x88,0x1d,0xc2,0x00,0xc9,0x83,0x3d,0xa7,0x26,0xe9,0x37,0x6c,0x2e,0x32,0xcf,0xf7
+};
+
+static const BYTE pbkdf2_out[2][64] = {
+	{0x55,0xac,0x04,0x6e,0x56,0xe3,0x08,0x9f,0xec,0x16,0x91,0xc2,0x25,0x44,0xb6,0x05,
+	 0xf9,0x41,0x85,0x21,0x6d,0xde,0x04,0x65,0xe6,0x8b,0x9d,0x57,0xc2,0x0d,0xac,0xbc,
+	 0x49,0xca,0x9c,0xcc,0xf1,0x79,0xb6,0x45,0x99,0x16,0x64,0xb3,0x9d,0x77,0xef,0x31,
+	 0x7c,0x71,0xb8,0x45,0xb1,0xe3,0x0b,0xd5,0x09,0x11,0x20,0x41,0xd3,0xa1,0x97,0x83},
+	{0x4d,0xdc,0xd8,0xf6,0x0b,0x98,0xbe,0x21,0x83,0x0c,0xee,0x5e,0xf2,0x27,0x01,0xf9,
+	 0x64,0x1a,0x44,0x18,0xd0,0x4c,0x04,0x14,0xae,0xff,0x08,0x87,0x6b,0x34,0xab,0x56,
+	 0xa1,0xd4,0x25,0xa1,0x22,0x58,0x33,0x54,0x9a,0xdb,0x84,0x1b,0x51,0xc9,0xb3,0x17,
+	 0x6a,0x27,0x2b,0xde,0xbb,0xa1,0xd0,0x78,0x47,0x8f,0x62,0xb3,0x97,0xf3,0x3c,0x8d}
+};
+
+/*********************** FUNCTION DEFINITIONS ***********************/
+int sha256_test()
+{
+	BYTE buf[SHA256_BLOCK_SIZE];
+	BYTE a[1000];
+	SHA256_CTX ctx;
+	int pass = 1;
+	int idx;
+
+	for (idx = 0; idx < 3; idx++) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, (const BYTE *)text[idx], strlen(text[idx]));
+		sha256_final(&ctx, buf);
+		pass = pass && !memcmp(hash[idx], buf, SHA256_BLOCK_SIZE);
+	}
+
+	memset(a, 'a', sizeof(a));
+	sha256_init(&ctx);
+	for (idx = 0; idx < 1000; idx++)
+		sha256_update(&ctx, a, sizeof(a));
+	sha256_final(&ctx, buf);
+	pass = pass && !memcmp(hash[3], buf, SHA256_BLOCK_SIZE);
+
+	return(pass);
+}
+
+// Whole blocks go straight to the compression function and the rest through the
+// buffer, so every split of a message must give the hash of the whole message.
+int sha256_split_test()
+{
+	static const size_t steps[4] = {1, 63, 64, 65};
+	BYTE message[300];
+	BYTE buf[SHA256_BLOCK_SIZE];
+	BYTE whole[SHA256_BLOCK_SIZE];
+	SHA256_CTX ctx;
+	size_t len, pos, step;
+	int pass = 1;
+	int idx;
+
+	for (idx = 0; idx < (int)sizeof(message); idx++)
+		message[idx] = (BYTE)(idx * 29 + 3);
+
+	for (len = 0; len <= sizeof(message); len += 7) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, message, len);
+		sha256_final(&ctx, whole);
+		for (idx = 0; idx < 4; idx++) {
+			sha256_init(&ctx);
+			for (pos = 0; pos < len; pos += step) {
+				step = len - pos < steps[idx] ? len - pos : steps[idx];
+				sha256_update(&ctx, message + pos, step);
+			}
+			sha256_final(&ctx, buf);
+			pass = pass && !memcmp(whole, buf, SHA256_BLOCK_SIZE);
+		}
+	}
+
+	return(pass);
+}
+
+// More messages than lanes, with lengths around the block and padding boundaries, so
+// lanes finish at different times and take new messages. Each result must match
+// sha256_update on the same message.
+int sha256_multi_test()
+{
+	enum { COUNT = 3 * SHA256_LANES + 5 };
+	const BYTE *data[COUNT];
+	size_t lens[COUNT];
+	BYTE (*hashes)[SHA256_BLOCK_SIZE] = malloc(COUNT * SHA256_BLOCK_SIZE);
+	BYTE *message = malloc(COUNT * 200);
+	BYTE buf[SHA256_BLOCK_SIZE];
+	SHA256_CTX ctx;
+	int pass = 1;
+	int idx;
+
+	for (idx = 0; idx < COUNT * 200; idx++)
+		message[idx] = (BYTE)(idx * 31 + 7);
+	for (idx = 0; idx < COUNT; idx++) {
+		data[idx] = message + idx * 200;
+		lens[idx] = (idx * 23) % 200;
+	}
+
+	sha256_multi(data, lens, hashes, COUNT);
+	for (idx = 0; idx < COUNT; idx++) {
+		sha256_init(&ctx);
+		sha256_update(&ctx, data[idx], lens[idx]);
+		sha256_final(&ctx, buf);
+		pass = pass && !memcmp(hashes[idx], buf, SHA256_BLOCK_SIZE);
+	}
+
+	free(hashes);
+	free(message);
+	return(pass);
+}
+
+int hmac_pbkdf2_test()
+{
+	HMAC_SHA256_KEY key;
+	BYTE secret[20];
+	BYTE buf[64];
+	int pass = 1;
+
+	memset(secret, 0x0b, sizeof(secret));
+	hmac_sha256_init(&key, secret, sizeof(secret));
+	hmac_sha256(&key, (const BYTE *)"Hi There", 8, buf);
+	pass = pass && !memcmp(buf, hmac_mac, SHA256_BLOCK_SIZE);
+
+	pbkdf2_sha256((const BYTE *)"passwd", 6, (const BYTE *)"salt", 4, 1, buf, 64);
+	pass = pass && !memcmp(buf, pbkdf2_out[0], 64);
+	pbkdf2_sha256((const BYTE *)"Password", 8, (const BYTE *)"NaCl", 4, 80000, buf, 64);
+	pass = pass && !memcmp(buf, pbkdf2_out[1], 64);
+
+	return(pass);
+}
+
+int sha256_all_test()
+{
+	int pass = 1;
+
+	pass = pass && sha256_test();
+	pass = pass && sha256_split_test();
+	pass = pass && sha256_multi_test();
+	pass = pass && hmac_pbkdf2_test();
+	return(pass);
+}
+
+int main()
+{
+	int shani = sha256_uses_shani();
+	int avx2 = sha256_multi_uses_avx2();
+	int pass, variant_pass;
+
+	// Portable compression with each multi-buffer implementation, then the SHA extensions
+	sha256_use_shani(0);
+	sha256_multi_use_avx2(0);
+	pass = sha256_all_test();
+	printf("SHA-256 portable: %s\n", pass ? "SUCCEEDED" : "FAILED");
+
+	if (sha256_multi_use_avx2(1)) {
+		variant_pass = sha256_all_test();
+		printf("SHA-256 portable, multi-buffer avx2: %s\n", variant_pass ? "SUCCEEDED" : "FAILED");
+		pass = pass && variant_pass;
+		sha256_multi_use_avx2(0);
+	}
+	else
+		printf("SHA-256 multi-buffer avx2: not available\n");
+
+	if (sha256_use_shani(1)) {
+		variant_pass = sha256_all_test();
+		printf("SHA-256 sha-ni: %s\n", variant_pass ? "SUCCEEDED" : "FAILED");
+		pass = pass && variant_pass;
+	}
+	else
+		printf("SHA-256 sha-ni: not available\n");
+
+	sha256_use_shani(shani);
+	sha256_multi_use_avx2(avx2);
+
+	printf("SHA-256 Tests: %s\n", pass ? "SUCCEEDED" : "FAILED");
+	return(pass ? 0 : 1);
+}